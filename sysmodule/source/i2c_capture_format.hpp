@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+
+/* Binary i2c capture format, shared between the sysmodule and the host tools */
+namespace ams::mitm::i2c::capture {
+
+    constexpr inline const char CaptureFilePath[] = "sdmc:/atmosphere/logs/i2c-mitm.cap";
+
+    /*
+     * A capture is split into files of at most MaxFileSize bytes, each with its own FileHeader. Records never span two files.
+     * CaptureFilePath is the file being written, the older ones are i2c-mitm.1.cap (newest) to i2c-mitm.<NumFiles - 1>.cap.
+     */
+    constexpr inline size_t NumFiles    = 4;
+    constexpr inline s64    MaxFileSize = 0x400000;
+
+    constexpr inline u32 FileMagic     = 0x50433249; /* "I2CP" */
+    /* Version 2 added the repeated and rate limited records, version 3 the session records and session ids. Older files decode unchanged. */
+    constexpr inline u16 FormatVersion = 3;
+
+    /* Written once at the start of every capture file */
+    struct FileHeader {
+        u32 magic;
+        u16 version;
+        u16 header_size;
+        u64 tick_frequency;
+    };
+    static_assert(sizeof(FileHeader) == 0x10);
+
+    enum Op : u8 {
+        Op_Send               = 0,
+        Op_Receive            = 1,
+        Op_ExecuteCommandList = 2,
+        Op_SetRetryPolicy     = 3,
+        Op_Repeated           = 4,
+        Op_RateLimited        = 5,
+        Op_OpenSession        = 6,
+        Op_CloseSession       = 7,
+    };
+
+    /* Set in the option of a Send the mitm issued itself, such as a rule's on open write, rather than forwarded for the client */
+    constexpr inline u8 OptionFlag_Injected = 0x80;
+
+    /*
+     * Every record is a RecordHeader followed by size bytes of data and aux_size bytes of auxiliary data.
+     * Send/Receive:       data is the transferred payload, no aux data.
+     * ExecuteCommandList: data is the encoded command list, aux is the receive buffer.
+     * SetRetryPolicy:     data is max_retry_count and retry_interval_us as two s32.
+     * Repeated:           a record was repeated and left out, option is its op, data is a RepeatedData.
+     *                     program_id, device_code and result are those of the repeated record.
+     * RateLimited:        data is a RateLimitedData, records of device_code the rate limit left out.
+     * OpenSession:        a session was opened, no data. Every later record of it carries its session_id.
+     * CloseSession:       the session was closed, no data.
+     */
+    struct RecordHeader {
+        u64 tick;
+        u64 program_id;
+        u32 device_code;
+        u32 result;
+        u8  op;
+        u8  option;
+        u16 size;
+        u16 aux_size;
+        u16 session_id; /* Unique among the open sessions, 0 before version 3 and for RateLimited */
+    };
+    static_assert(sizeof(RecordHeader) == 0x20);
+
+    struct RepeatedData {
+        u32 count;
+        u32 payload_hash;
+    };
+
+    struct RateLimitedData {
+        u32 count;
+        u32 reserved;
+    };
+
+    constexpr inline size_t GetRecordSize(const RecordHeader &header) {
+        return sizeof(RecordHeader) + header.size + header.aux_size;
+    }
+
+    /* The sysmodule grows the file in zeroed extents and only truncates it on a clean shutdown. No record has a zero tick, the records end there. */
+    constexpr inline bool IsPreallocatedTail(const RecordHeader &header) {
+        return header.tick == 0;
+    }
+
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+
+/* Decoder for the command lists of ExecuteCommandList, shared between the sysmodule and the host tools */
+namespace ams::mitm::i2c::cmdlist {
+
+    /* nn::i2c builds command lists in a 256 byte buffer */
+    constexpr size_t MaxCommandListSize = 0x100;
+
+    enum CommandId {
+        CommandId_Send      = 0,
+        CommandId_Receive   = 1,
+        CommandId_Extension = 2,
+        CommandId_Count     = 3,
+    };
+
+    enum SubCommandId {
+        SubCommandId_Sleep = 0,
+    };
+
+    struct CommonCommandFormat {
+        using CommandId    = util::BitPack8::Field<0, 2>;
+        using SubCommandId = util::BitPack8::Field<2, 6>;
+    };
+
+    struct ReceiveCommandFormat {
+        using StartCondition = util::BitPack8::Field<6, 1, bool>;
+        using StopCondition  = util::BitPack8::Field<7, 1, bool>;
+        using Size           = util::BitPack8::Field<0, 8>;
+    };
+
+    struct SendCommandFormat {
+        using StartCondition = util::BitPack8::Field<6, 1, bool>;
+        using StopCondition  = util::BitPack8::Field<7, 1, bool>;
+        using Size           = util::BitPack8::Field<0, 8>;
+    };
+
+    struct SleepCommandFormat {
+        using MicroSeconds = util::BitPack8::Field<0, 8>;
+    };
+
+    enum CommandKind {
+        CommandKind_Send,
+        CommandKind_Receive,
+        CommandKind_Sleep,
+    };
+
+    /* One decoded command, data points into the command list */
+    struct Command {
+        CommandKind kind;
+        bool start_condition;
+        bool stop_condition;
+        const u8 *data;        /* Send: the bytes to send */
+        size_t size;           /* Send and Receive: number of bytes */
+        size_t receive_offset; /* Receive: where the bytes land in the receive buffer */
+        u32 sleep_us;          /* Sleep */
+    };
+
+    enum ParseError {
+        ParseError_None,
+        ParseError_Truncated,       /* A command or its send data runs past the end of the list */
+        ParseError_ReceiveOverflow, /* The receives need more than the receive buffer holds */
+        ParseError_InvalidCommand,  /* Unknown command or extension */
+    };
+
+    /* Walks a command list one command at a time, without copying it. Stops at the first malformed command. */
+    class CommandListReader {
+        private:
+            const ::ams::i2c::I2cCommand *m_commands;
+            size_t m_num_commands;
+            size_t m_rcv_size;
+            size_t m_offset;
+            size_t m_rcv_offset;
+            ParseError m_error;
+        public:
+            constexpr CommandListReader(const ::ams::i2c::I2cCommand *commands, size_t num_commands, size_t rcv_size)
+                : m_commands(commands), m_num_commands(num_commands), m_rcv_size(rcv_size), m_offset(0), m_rcv_offset(0), m_error(ParseError_None) { /* ... */ }
+
+            /* Returns false at the end of the list or at a malformed command, GetError tells them apart */
+            constexpr bool Next(Command *out) {
+                if (m_error != ParseError_None || m_offset >= m_num_commands) {
+                    return false;
+                }
+
+                /* Every command is a header followed by one argument byte */
+                if (m_num_commands - m_offset < 2) {
+                    return this->Fail(ParseError_Truncated);
+                }
+
+                const util::BitPack8 header = { m_commands[m_offset] };
+                const util::BitPack8 arg    = { m_commands[m_offset + 1] };
+
+                switch (header.Get<CommonCommandFormat::CommandId>()) {
+                    case CommandId_Send:
+                        {
+                            const size_t size = arg.Get<SendCommandFormat::Size>();
+                            if (m_num_commands - m_offset - 2 < size) {
+                                return this->Fail(ParseError_Truncated);
+                            }
+
+                            *out = {
+                                .kind            = CommandKind_Send,
+                                .start_condition = header.Get<SendCommandFormat::StartCondition>(),
+                                .stop_condition  = header.Get<SendCommandFormat::StopCondition>(),
+                                .data            = m_commands + m_offset + 2,
+                                .size            = size,
+                                .receive_offset  = 0,
+                                .sleep_us        = 0,
+                            };
+                            m_offset += 2 + size;
+                        } break;
+                    case CommandId_Receive:
+                        {
+                            const size_t size = arg.Get<ReceiveCommandFormat::Size>();
+                            if (m_rcv_size - m_rcv_offset < size) {
+                                return this->Fail(ParseError_ReceiveOverflow);
+                            }
+
+                            *out = {
+                                .kind            = CommandKind_Receive,
+                                .start_condition = header.Get<ReceiveCommandFormat::StartCondition>(),
+                                .stop_condition  = header.Get<ReceiveCommandFormat::StopCondition>(),
+                                .data            = nullptr,
+                                .size            = size,
+                                .receive_offset  = m_rcv_offset,
+                                .sleep_us        = 0,
+                            };
+                            m_rcv_offset += size;
+                            m_offset += 2;
+                        } break;
+                    case CommandId_Extension:
+                        if (header.Get<CommonCommandFormat::SubCommandId>() != SubCommandId_Sleep) {
+                            return this->Fail(ParseError_InvalidCommand);
+                        }
+
+                        *out = {
+                            .kind            = CommandKind_Sleep,
+                            .start_condition = false,
+                            .stop_condition  = false,
+                            .data            = nullptr,
+                            .size            = 0,
+                            .receive_offset  = 0,
+                            .sleep_us        = arg.Get<SleepCommandFormat::MicroSeconds>(),
+                        };
+                        m_offset += 2;
+                        break;
+                    default:
+                        return this->Fail(ParseError_InvalidCommand);
+                }
+
+                return true;
+            }
+
+            constexpr ParseError GetError() const { return m_error; }
+
+            /* Offset of the next command, or of the malformed one */
+            constexpr size_t GetOffset() const { return m_offset; }
+
+            /* Bytes received by the commands read so far */
+            constexpr size_t GetReceiveSize() const { return m_rcv_offset; }
+        private:
+            constexpr bool Fail(ParseError error) {
+                m_error = error;
+                return false;
+            }
+    };
+
+    /* Calls f(command) for every command, returns whether the whole list was well formed */
+    template<typename F>
+    constexpr bool ForEachCommand(const ::ams::i2c::I2cCommand *commands, size_t num_commands, size_t rcv_size, F f) {
+        CommandListReader reader(commands, num_commands, rcv_size);
+
+        Command command = {};
+        while (reader.Next(std::addressof(command))) {
+            f(command);
+        }
+
+        return reader.GetError() == ParseError_None;
+    }
+
+    constexpr bool IsValid(const ::ams::i2c::I2cCommand *commands, size_t num_commands, size_t rcv_size) {
+        return ForEachCommand(commands, num_commands, rcv_size, [](const Command &) { /* ... */ });
+    }
+
+    static_assert([] { constexpr ::ams::i2c::I2cCommand List[] = { 0x40, 0x01, 0x08, 0x02, 0x64, 0xC1, 0x02 }; return IsValid(List, sizeof(List), 2); }());
+    static_assert([] { constexpr ::ams::i2c::I2cCommand List[] = { 0xC0, 0x03, 0x04, 0xB2 }; return !IsValid(List, sizeof(List), 0); }());
+    static_assert([] { constexpr ::ams::i2c::I2cCommand List[] = { 0x40, 0x01, 0x08, 0xC1, 0x02 }; return !IsValid(List, sizeof(List), 1); }());
+
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+
+/* Text log ring file, shared between the sysmodule and the host tools */
+namespace ams::mitm::i2c::logfile {
+
+    constexpr inline const char LogFilePath[] = "sdmc:/atmosphere/logs/i2c-mitm.log";
+
+    constexpr inline u32 FileMagic     = 0x4C433249; /* "I2CL" */
+    constexpr inline u16 FormatVersion = 1;
+
+    /* Size of the data area of a new log, the file never grows past it */
+    constexpr inline u64 DefaultDataSize = 0x100000;
+
+    /*
+     * The file is a FileHeader followed by data_size bytes of log text, written as a circular buffer.
+     * The header is rewritten every time the log is flushed. The oldest byte is at write_position % data_size
+     * once the log has wrapped, data written after the last flush of a crashed process may follow the header's position.
+     */
+    struct FileHeader {
+        u32 magic;
+        u16 version;
+        u16 header_size;
+        u64 data_size;
+        u64 write_position; /* Bytes written since the file was created, the next one goes to header_size + write_position % data_size */
+    };
+    static_assert(sizeof(FileHeader) == 0x18);
+
+    constexpr inline bool IsValidHeader(const FileHeader &header, s64 file_size) {
+        return header.magic == FileMagic && header.version == FormatVersion && header.header_size == sizeof(FileHeader) &&
+               header.data_size != 0 && file_size >= static_cast<s64>(header.header_size + header.data_size);
+    }
+
+}
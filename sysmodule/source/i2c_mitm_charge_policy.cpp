@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "i2c_mitm_charge_policy.hpp"
+#include "i2c_mitm_devices.hpp"
+#include "logging.hpp"
+
+namespace ams::mitm::i2c::charge {
+
+    namespace {
+
+        /* bq24193 REG04, VREG in bits 7:2 in 16mV steps from 3504mV */
+        constexpr u8 ChargeVoltageRegister = 0x04;
+        constexpr u8 ChargeVoltageMask     = 0xFC;
+        /* BATLOWV 3000mV and VRECHG 100mV, as written by chrg_voltage */
+        constexpr u8 ChargeVoltageLowBits  = 0x02;
+
+        /* max17050, little endian */
+        constexpr u8 Max17050SocRepRegister      = 0x06; /* 1/256 % */
+        constexpr u8 Max17050TemperatureRegister = 0x08; /* 1/256 C, signed */
+
+        /* tmp451 in its default range, whole degrees */
+        constexpr u8 Tmp451LocalTempRegister  = 0x00;
+        constexpr u8 Tmp451RemoteTempRegister = 0x01;
+
+        constexpr u8 EncodeVoltage(u32 voltage_mv) {
+            return static_cast<u8>(((voltage_mv - MinVoltageMv) / 16) << 2);
+        }
+
+        constexpr u32 DecodeVoltage(u8 value) {
+            return MinVoltageMv + ((value & ChargeVoltageMask) >> 2) * 16;
+        }
+
+        static_assert(EncodeVoltage(4208) == 0xB0 && DecodeVoltage(0xB2) == 4208);
+
+        /* Latest readings and the state of the table, only touched with g_state_mutex held */
+        struct PolicyState {
+            s32 soc;          /* 1/256 % */
+            s32 battery_temp; /* 1/256 C */
+            s32 local_temp;
+            s32 remote_temp;
+            bool has_soc;
+            bool has_battery_temp;
+            bool has_local_temp;
+            bool has_remote_temp;
+            u64 hold_since_ms[MaxPolicyRows]; /* When the row's state of charge condition started to hold, 0 while it does not */
+            s32 active_row;                   /* -1 for the default voltage */
+        };
+
+        constinit os::SdkMutex g_state_mutex;
+        constinit PolicyState g_state = {
+            .soc              = 0,
+            .battery_temp     = 0,
+            .local_temp       = 0,
+            .remote_temp      = 0,
+            .has_soc          = false,
+            .has_battery_temp = false,
+            .has_local_temp   = false,
+            .has_remote_temp  = false,
+            .hold_since_ms    = {},
+            .active_row       = -1,
+        };
+
+        /* Target VREG bits with TargetValid set, bumped generation on every change. A session that wrote the target stores its generation as applied. */
+        constexpr u32 TargetValid = 1u << 8;
+        constinit std::atomic<u32> g_target = 0;
+        constinit std::atomic<u32> g_target_generation = 0;
+        constinit std::atomic<u32> g_applied_generation = 0;
+
+        Result ParseS32(const char *value, s32 &out, s32 min, s32 max) {
+            char *end;
+            const long tmp = std::strtol(value, std::addressof(end), 0);
+            R_UNLESS(end != value && *end == '\0' && tmp >= min && tmp <= max, ::ams::settings::ResultInvalidArgument());
+            out = tmp;
+            R_SUCCEED();
+        }
+
+        Result ParseU32(const char *value, u32 &out, u32 min, u32 max) {
+            s32 tmp;
+            R_TRY(ParseS32(value, tmp, static_cast<s32>(min), static_cast<s32>(max)));
+            out = tmp;
+            R_SUCCEED();
+        }
+
+        PolicyRow *FindOrCreateRow(PolicyConfig *config, const char *row_name) {
+            for (size_t i = 0; i < config->num_rows; i++) {
+                if (strncmp(config->rows[i].name, row_name, MaxPolicyNameLength - 1) == 0) {
+                    return std::addressof(config->rows[i]);
+                }
+            }
+
+            if (config->num_rows >= MaxPolicyRows) {
+                return nullptr;
+            }
+
+            PolicyRow *row = std::addressof(config->rows[config->num_rows++]);
+            *row = {
+                .name           = {},
+                .battery_temp_c = NoThreshold,
+                .board_temp_c   = NoThreshold,
+                .soc_pct        = NoThreshold,
+                .hold_minutes   = 0,
+                .voltage_mv     = 0,
+            };
+            util::Strlcpy(row->name, row_name, sizeof(row->name));
+            return row;
+        }
+
+        /* A threshold of an active row is lowered by the hysteresis, so a reading hovering around it does not flip the voltage back and forth */
+        bool Holds(s32 threshold, bool has_value, s32 value, s32 scale, s32 hysteresis) {
+            return threshold == NoThreshold || (has_value && value >= (threshold - hysteresis) * scale);
+        }
+
+        s32 Evaluate(const PolicyConfig &config, PolicyState &state, u64 now_ms) {
+            const bool has_board_temp = state.has_local_temp || state.has_remote_temp;
+            const s32 board_temp = std::max(state.has_local_temp  ? state.local_temp  : std::numeric_limits<s32>::min(),
+                                            state.has_remote_temp ? state.remote_temp : std::numeric_limits<s32>::min());
+
+            s32 match = -1;
+            for (size_t i = 0; i < config.num_rows; i++) {
+                const PolicyRow &row = config.rows[i];
+                const bool active = static_cast<s32>(i) == state.active_row;
+
+                /* Every row's hold timer is kept up to date, not only the ones before the match */
+                const bool soc_holds = Holds(row.soc_pct, state.has_soc, state.soc, 256, active ? config.soc_hysteresis_pct : 0);
+                if (!soc_holds) {
+                    state.hold_since_ms[i] = 0;
+                } else if (state.hold_since_ms[i] == 0) {
+                    state.hold_since_ms[i] = now_ms;
+                }
+
+                if (match >= 0 || !soc_holds || now_ms - state.hold_since_ms[i] < static_cast<u64>(row.hold_minutes) * 60'000) {
+                    continue;
+                }
+
+                const s32 temp_hysteresis = active ? config.temp_hysteresis_c : 0;
+                if (Holds(row.battery_temp_c, state.has_battery_temp, state.battery_temp, 256, temp_hysteresis) &&
+                    Holds(row.board_temp_c, has_board_temp, board_temp, 1, temp_hysteresis)) {
+                    match = static_cast<s32>(i);
+                }
+            }
+
+            return match;
+        }
+
+        void SetTarget(const PolicyConfig &config, s32 row) {
+            const u32 voltage_mv = row >= 0 ? config.rows[row].voltage_mv : config.default_voltage_mv;
+            const u32 target = TargetValid | EncodeVoltage(voltage_mv);
+            if (g_target.load() == target) {
+                return;
+            }
+
+            log::DebugLog("Charge policy: %s, charge voltage %" PRIu32 "mV\n", row >= 0 ? config.rows[row].name : "default", DecodeVoltage(static_cast<u8>(target)));
+            g_target.store(target);
+            g_target_generation.fetch_add(1);
+        }
+
+    }
+
+    Result ParseIniEntry(PolicyConfig *config, const char *name, const char *value) {
+        if (strcasecmp(name, "default_voltage") == 0) {
+            R_TRY(ParseU32(value, config->default_voltage_mv, MinVoltageMv, MaxVoltageMv));
+        } else if (strcasecmp(name, "temp_hysteresis_c") == 0) {
+            R_TRY(ParseS32(value, config->temp_hysteresis_c, 0, 50));
+        } else if (strcasecmp(name, "soc_hysteresis_pct") == 0) {
+            R_TRY(ParseS32(value, config->soc_hysteresis_pct, 0, 100));
+        }
+
+        R_SUCCEED();
+    }
+
+    Result ParseRowIniEntry(PolicyConfig *config, const char *row_name, const char *name, const char *value) {
+        PolicyRow *row = FindOrCreateRow(config, row_name);
+        if (row == nullptr) {
+            log::DebugLog("Too many charge policy rows, ignoring row %s\n", row_name);
+            R_SUCCEED();
+        }
+
+        if (strcasecmp(name, "battery_temp_c") == 0) {
+            R_TRY(ParseS32(value, row->battery_temp_c, -40, 125));
+        } else if (strcasecmp(name, "board_temp_c") == 0) {
+            R_TRY(ParseS32(value, row->board_temp_c, -40, 125));
+        } else if (strcasecmp(name, "soc") == 0) {
+            R_TRY(ParseS32(value, row->soc_pct, 0, 100));
+        } else if (strcasecmp(name, "hold_minutes") == 0) {
+            R_TRY(ParseU32(value, row->hold_minutes, 0, 60 * 24 * 30));
+        } else if (strcasecmp(name, "voltage") == 0) {
+            R_TRY(ParseU32(value, row->voltage_mv, MinVoltageMv, MaxVoltageMv));
+        }
+
+        R_SUCCEED();
+    }
+
+    void Commit(PolicyConfig *config, int chrg_voltage_mv) {
+        size_t num_rows = 0;
+        for (size_t i = 0; i < config->num_rows; i++) {
+            if (config->rows[i].voltage_mv == 0) {
+                log::DebugLog("Charge policy row %s has no voltage, ignoring it\n", config->rows[i].name);
+                continue;
+            }
+            config->rows[num_rows++] = config->rows[i];
+        }
+        config->num_rows = num_rows;
+
+        if (config->default_voltage_mv == 0) {
+            config->default_voltage_mv = chrg_voltage_mv != 0 ? chrg_voltage_mv : DefaultVoltageMv;
+        }
+    }
+
+    void Publish(const PolicyConfig &config) {
+        std::scoped_lock lk(g_state_mutex);
+
+        /* The active row and the hold timers are indexed by row, they mean nothing in the new table. The readings stay valid. */
+        g_state.active_row = -1;
+        std::fill(std::begin(g_state.hold_since_ms), std::end(g_state.hold_since_ms), 0);
+
+        /* Without a table the target is dropped, so enabling the policy again writes the charger even for the same voltage */
+        if (!IsEnabled(config)) {
+            g_target.store(0);
+            return;
+        }
+
+        /* Target the new table with the readings so far instead of waiting for the next one */
+        g_state.active_row = Evaluate(config, g_state, os::GetSystemTick().ToTimeSpan().GetMilliSeconds());
+        SetTarget(config, g_state.active_row);
+    }
+
+    void LogConfig(const PolicyConfig &config) {
+        if (!IsEnabled(config)) {
+            return;
+        }
+
+        log::DebugLog("i2c mitm charge policy: default %" PRIu32 "mV, hysteresis %" PRIi32 "C, %" PRIi32 "%%\n", config.default_voltage_mv, config.temp_hysteresis_c, config.soc_hysteresis_pct);
+        for (size_t i = 0; i < config.num_rows; i++) {
+            const PolicyRow &row = config.rows[i];
+
+            /* Only the conditions the row sets */
+            char conditions[0x60] = "always";
+            size_t len = 0;
+            if (row.battery_temp_c != NoThreshold) {
+                len += util::TSNPrintf(conditions + len, sizeof(conditions) - len, "battery >= %" PRIi32 "C ", row.battery_temp_c);
+            }
+            if (row.board_temp_c != NoThreshold) {
+                len += util::TSNPrintf(conditions + len, sizeof(conditions) - len, "board >= %" PRIi32 "C ", row.board_temp_c);
+            }
+            if (row.soc_pct != NoThreshold) {
+                len += util::TSNPrintf(conditions + len, sizeof(conditions) - len, "soc >= %" PRIi32 "%% for %" PRIu32 "min ", row.soc_pct, row.hold_minutes);
+            }
+            if (len != 0) {
+                conditions[len - 1] = '\0';
+            }
+
+            log::DebugLog("i2c mitm charge policy %s: %s -> %" PRIu32 "mV\n", row.name, conditions, DecodeVoltage(EncodeVoltage(row.voltage_mv)));
+        }
+    }
+
+    bool IsChargerDevice(DeviceCode device_code) {
+        return device_code.GetInternalValue() == ChargerDeviceCode;
+    }
+
+    bool IsObservedDevice(const PolicyConfig &config, DeviceCode device_code) {
+        const u32 value = device_code.GetInternalValue();
+        return IsEnabled(config) && (value == FuelGaugeDeviceCode || value == TempSensorDeviceCode);
+    }
+
+    void ObserveRegister(const PolicyConfig &config, DeviceCode device_code, u8 reg, const u8 *values, size_t size) {
+        if (!IsEnabled(config) || size == 0) {
+            return;
+        }
+
+        std::scoped_lock lk(g_state_mutex);
+
+        /* Only the first register of a read is looked at. The table is evaluated on every reading, hold times run out between them. */
+        s32 *reading;
+        bool *has_reading;
+        s32 value;
+        switch (device_code.GetInternalValue()) {
+            case FuelGaugeDeviceCode:
+                if (size < sizeof(u16)) {
+                    return;
+                }
+                value = static_cast<s16>(values[0] | (values[1] << BITSIZEOF(u8)));
+                if (reg == Max17050SocRepRegister) {
+                    reading     = std::addressof(g_state.soc);
+                    has_reading = std::addressof(g_state.has_soc);
+                    value       = static_cast<u16>(value);
+                } else if (reg == Max17050TemperatureRegister) {
+                    reading     = std::addressof(g_state.battery_temp);
+                    has_reading = std::addressof(g_state.has_battery_temp);
+                } else {
+                    return;
+                }
+                break;
+            case TempSensorDeviceCode:
+                value = values[0];
+                if (reg == Tmp451LocalTempRegister) {
+                    reading     = std::addressof(g_state.local_temp);
+                    has_reading = std::addressof(g_state.has_local_temp);
+                } else if (reg == Tmp451RemoteTempRegister) {
+                    reading     = std::addressof(g_state.remote_temp);
+                    has_reading = std::addressof(g_state.has_remote_temp);
+                } else {
+                    return;
+                }
+                break;
+            default:
+                return;
+        }
+
+        *reading     = value;
+        *has_reading = true;
+
+        g_state.active_row = Evaluate(config, g_state, os::GetSystemTick().ToTimeSpan().GetMilliSeconds());
+        SetTarget(config, g_state.active_row);
+    }
+
+    bool ApplyToWrite(const PolicyConfig &config, DeviceCode device_code, u8 *data, size_t size) {
+        if (!IsEnabled(config) || !IsChargerDevice(device_code) || size < 2 || data[0] > ChargeVoltageRegister || ChargeVoltageRegister - data[0] + 1u >= size) {
+            return false;
+        }
+
+        const u32 target = g_target.load();
+        if (!(target & TargetValid)) {
+            return false;
+        }
+
+        u8 &value = data[ChargeVoltageRegister - data[0] + 1];
+        const u8 patched = (value & ~ChargeVoltageMask) | static_cast<u8>(target);
+        if (patched == value) {
+            return false;
+        }
+
+        value = patched;
+        return true;
+    }
+
+    bool TakePendingWrite(const PolicyConfig &config, DeviceCode device_code, PendingWrite *out) {
+        if (!IsEnabled(config) || !IsChargerDevice(device_code)) {
+            return false;
+        }
+
+        const u32 generation = g_target_generation.load();
+        u32 applied = g_applied_generation.load();
+        if (applied == generation) {
+            return false;
+        }
+
+        const u32 target = g_target.load();
+        if (!(target & TargetValid) || !g_applied_generation.compare_exchange_strong(applied, generation)) {
+            return false;
+        }
+
+        *out = {
+            .reg             = ChargeVoltageRegister,
+            .value           = static_cast<u8>(static_cast<u8>(target) | ChargeVoltageLowBits),
+            .generation      = generation,
+            .prev_generation = applied,
+        };
+        return true;
+    }
+
+    void RestorePendingWrite(const PendingWrite &write) {
+        /* Unless a newer target was handed out or written in the meantime */
+        u32 expected = write.generation;
+        g_applied_generation.compare_exchange_strong(expected, write.prev_generation);
+    }
+
+}
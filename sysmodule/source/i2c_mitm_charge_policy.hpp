@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+
+/* Picks the bq24193 charge voltage from the fuel gauge and temperature sensor reads passing through the mitm */
+namespace ams::mitm::i2c::charge {
+
+    constexpr size_t MaxPolicyRows       = 8;
+    constexpr size_t MaxPolicyNameLength = 0x18;
+
+    constexpr u32 MinVoltageMv     = 3504;
+    constexpr u32 MaxVoltageMv     = 4400;
+    constexpr u32 DefaultVoltageMv = 4208;
+
+    constexpr s32 DefaultTempHysteresisC  = 2;
+    constexpr s32 DefaultSocHysteresisPct = 5;
+
+    /* The bq24193 charger the policy writes to, and the max17050 fuel gauge and tmp451 sensor whose reads it follows */
+    constexpr u32 ChargerDeviceCode    = 0x39000001;
+    constexpr u32 FuelGaugeDeviceCode  = 0x39000033;
+    constexpr u32 TempSensorDeviceCode = 0x3E000001;
+    constexpr u32 PolicyDeviceCodes[] = { ChargerDeviceCode, FuelGaugeDeviceCode, TempSensorDeviceCode };
+
+    /* Conditions left at NoThreshold always hold */
+    constexpr s32 NoThreshold = std::numeric_limits<s32>::min();
+
+    struct PolicyRow {
+        char name[MaxPolicyNameLength];
+        s32 battery_temp_c; /* max17050 temperature at or above */
+        s32 board_temp_c;   /* Hotter of the tmp451 local and remote temperature at or above */
+        s32 soc_pct;        /* max17050 reported state of charge at or above... */
+        u32 hold_minutes;   /* ...for at least this long */
+        u32 voltage_mv;
+    };
+
+    /* Charge voltage table, part of the config snapshot. The first row whose conditions all hold sets the voltage. No rows disables the policy. */
+    struct PolicyConfig {
+        PolicyRow rows[MaxPolicyRows];
+        size_t num_rows;
+        u32 default_voltage_mv; /* When no row holds, 0 until Commit */
+        s32 temp_hysteresis_c;
+        s32 soc_hysteresis_pct;
+    };
+
+    /* Handles the keys of the charge_policy section and of the charge_policy.<name> row sections */
+    Result ParseIniEntry(PolicyConfig *config, const char *name, const char *value);
+    Result ParseRowIniEntry(PolicyConfig *config, const char *row_name, const char *name, const char *value);
+
+    /* Drops rows without a voltage, the default voltage falls back to chrg_voltage (0 if unset) and then the bq24193 default */
+    void Commit(PolicyConfig *config, int chrg_voltage_mv);
+    /* Restarts the row evaluation and re-targets the charger, once the snapshot holding config is the current one */
+    void Publish(const PolicyConfig &config);
+    void LogConfig(const PolicyConfig &config);
+
+    constexpr bool IsEnabled(const PolicyConfig &config) {
+        return config.num_rows != 0;
+    }
+
+    bool IsChargerDevice(DeviceCode device_code);
+    bool IsObservedDevice(const PolicyConfig &config, DeviceCode device_code);
+
+    /* Feeds a register read of an observed device and re-evaluates the table */
+    void ObserveRegister(const PolicyConfig &config, DeviceCode device_code, u8 reg, const u8 *values, size_t size);
+
+    /* Patches the charge voltage bits of a charger write that covers the charge voltage register, returns whether the data changed */
+    bool ApplyToWrite(const PolicyConfig &config, DeviceCode device_code, u8 *data, size_t size);
+
+    /* A register write the charger still needs after the target changed, handed out to one session only */
+    struct PendingWrite {
+        u8 reg;
+        u8 value;
+        u32 generation;
+        u32 prev_generation;
+    };
+
+    bool TakePendingWrite(const PolicyConfig &config, DeviceCode device_code, PendingWrite *out);
+    /* Hands a write that failed out again */
+    void RestorePendingWrite(const PendingWrite &write);
+
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "i2c_mitm_control_service.hpp"
+#include "i2c_mitm_stats.hpp"
+#include "i2c_mitm_settings.hpp"
+#include "i2c_mitm_register_cache.hpp"
+#include "i2c_mitm_session_pool.hpp"
+#include "i2c_mitm_telemetry.hpp"
+#include "i2c_mitm_trace.hpp"
+#include "logging.hpp"
+
+namespace ams::mitm::i2c {
+
+    namespace {
+
+        constexpr const char TelemetryCsvPath[] = "sdmc:/atmosphere/logs/i2c-mitm-telemetry.csv";
+
+        /* Only the control thread dumps, one rail of buckets at a time */
+        constinit telemetry::RailBucket g_dump_buckets[telemetry::NumBuckets];
+        constinit char g_dump_line[telemetry::MaxCsvLineLength];
+
+    }
+
+    Result I2cMitmControlService::GetLatencyStats(const sf::OutBuffer &out_stats, sf::Out<u32> out_count) {
+        const size_t max_count = out_stats.GetSize() / sizeof(stats::DeviceLatencyStats);
+        out_count.SetValue(stats::GetLatencyStats(reinterpret_cast<stats::DeviceLatencyStats *>(out_stats.GetPointer()), max_count));
+        R_SUCCEED();
+    }
+
+    Result I2cMitmControlService::GetErrorCounts(const sf::OutBuffer &out_errors, sf::Out<u32> out_count) {
+        const size_t max_count = out_errors.GetSize() / sizeof(stats::ErrorCount);
+        out_count.SetValue(stats::GetErrorCounts(reinterpret_cast<stats::ErrorCount *>(out_errors.GetPointer()), max_count));
+        R_SUCCEED();
+    }
+
+    Result I2cMitmControlService::ResetStats() {
+        stats::Reset();
+        telemetry::Reset();
+        R_SUCCEED();
+    }
+
+    Result I2cMitmControlService::ReloadConfig() {
+        R_RETURN(::ams::mitm::i2c::ReloadConfig());
+    }
+
+    Result I2cMitmControlService::GetCachedRegisters(const sf::OutBuffer &out_registers, sf::Out<u32> out_count, u32 device_code) {
+        const size_t max_count = out_registers.GetSize() / sizeof(cache::CachedRegister);
+        out_count.SetValue(cache::GetSnapshot(device_code, reinterpret_cast<cache::CachedRegister *>(out_registers.GetPointer()), max_count));
+        R_SUCCEED();
+    }
+
+    Result I2cMitmControlService::GetPoolStats(const sf::OutBuffer &out_stats, sf::Out<u32> out_count) {
+        const size_t max_count = out_stats.GetSize() / sizeof(pool::PoolStats);
+        out_count.SetValue(pool::GetStats(reinterpret_cast<pool::PoolStats *>(out_stats.GetPointer()), max_count));
+        R_SUCCEED();
+    }
+
+    Result I2cMitmControlService::GetTelemetry(const sf::OutBuffer &out_buckets, sf::Out<u32> out_count) {
+        const size_t max_count = out_buckets.GetSize() / sizeof(telemetry::RailBucket);
+        out_count.SetValue(telemetry::GetSamples(reinterpret_cast<telemetry::RailBucket *>(out_buckets.GetPointer()), max_count));
+        R_SUCCEED();
+    }
+
+    Result I2cMitmControlService::DumpTelemetry() {
+        /* Replaces the previous dump */
+        bool has_file;
+        R_TRY(fs::HasFile(std::addressof(has_file), TelemetryCsvPath));
+        if (has_file) {
+            R_TRY(fs::DeleteFile(TelemetryCsvPath));
+        }
+        R_TRY(fs::CreateFile(TelemetryCsvPath, 0));
+
+        fs::FileHandle file;
+        R_TRY(fs::OpenFile(std::addressof(file), TelemetryCsvPath, fs::OpenMode_Write | fs::OpenMode_AllowAppend));
+        ON_SCOPE_EXIT { fs::CloseFile(file); };
+
+        s64 offset = 0;
+        R_TRY(fs::WriteFile(file, offset, telemetry::CsvHeader, sizeof(telemetry::CsvHeader) - 1, fs::WriteOption::None));
+        offset += sizeof(telemetry::CsvHeader) - 1;
+
+        for (size_t rail = 0; rail < telemetry::MaxRails; rail++) {
+            const size_t count = telemetry::GetRailSamples(rail, g_dump_buckets, std::size(g_dump_buckets));
+            for (size_t i = 0; i < count; i++) {
+                const int len = telemetry::FormatCsvLine(g_dump_line, sizeof(g_dump_line), g_dump_buckets[i]);
+                R_TRY(fs::WriteFile(file, offset, g_dump_line, len, fs::WriteOption::None));
+                offset += len;
+            }
+        }
+
+        R_RETURN(fs::FlushFile(file));
+    }
+
+    Result I2cMitmControlService::FlushLog() {
+        R_UNLESS(log::Flush(), os::ResultBusy());
+        R_SUCCEED();
+    }
+
+    Result I2cMitmControlService::SetTraceMask(u32 device_code, u32 mask) {
+        R_RETURN(trace::SetMask(device_code, mask));
+    }
+
+    Result I2cMitmControlService::SetLogLevel(u32 level) {
+        R_UNLESS(level <= log::Level_Debug, ::ams::settings::ResultInvalidArgument());
+        log::SetLevel(static_cast<log::Level>(level));
+        R_SUCCEED();
+    }
+
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+#define AMS_I2C_MITM_CONTROL_INTERFACE_INFO(C, H)                                                                                                          \
+    AMS_SF_METHOD_INFO(C, H,  0, Result, GetLatencyStats, (const sf::OutBuffer &out_stats, sf::Out<u32> out_count), (out_stats, out_count)) \
+    AMS_SF_METHOD_INFO(C, H,  1, Result, GetErrorCounts,  (const sf::OutBuffer &out_errors, sf::Out<u32> out_count), (out_errors, out_count)) \
+    AMS_SF_METHOD_INFO(C, H,  2, Result, ResetStats,      (),                                                          ()                     ) \
+    AMS_SF_METHOD_INFO(C, H,  3, Result, ReloadConfig,    (),                                                          ()                     ) \
+    AMS_SF_METHOD_INFO(C, H,  4, Result, GetCachedRegisters, (const sf::OutBuffer &out_registers, sf::Out<u32> out_count, u32 device_code), (out_registers, out_count, device_code)) \
+    AMS_SF_METHOD_INFO(C, H,  5, Result, GetPoolStats,    (const sf::OutBuffer &out_stats, sf::Out<u32> out_count),  (out_stats, out_count)) \
+    AMS_SF_METHOD_INFO(C, H,  6, Result, GetTelemetry,    (const sf::OutBuffer &out_buckets, sf::Out<u32> out_count), (out_buckets, out_count)) \
+    AMS_SF_METHOD_INFO(C, H,  7, Result, DumpTelemetry,   (),                                                          ()                     ) \
+    AMS_SF_METHOD_INFO(C, H,  8, Result, FlushLog,        (),                                                          ()                     ) \
+    AMS_SF_METHOD_INFO(C, H,  9, Result, SetTraceMask,    (u32 device_code, u32 mask),                                 (device_code, mask)    ) \
+    AMS_SF_METHOD_INFO(C, H, 10, Result, SetLogLevel,     (u32 level),                                                 (level)                )
+
+AMS_SF_DEFINE_INTERFACE(ams::mitm::i2c, II2cMitmControlInterface, AMS_I2C_MITM_CONTROL_INTERFACE_INFO, 0x7A2C1D35)
+
+namespace ams::mitm::i2c {
+
+    /* Custom "i2cmitm" service, lets homebrew tools query the state of the mitm */
+    class I2cMitmControlService {
+    public:
+        Result GetLatencyStats(const sf::OutBuffer &out_stats, sf::Out<u32> out_count);
+        Result GetErrorCounts(const sf::OutBuffer &out_errors, sf::Out<u32> out_count);
+        Result ResetStats();
+        Result ReloadConfig();
+        Result GetCachedRegisters(const sf::OutBuffer &out_registers, sf::Out<u32> out_count, u32 device_code);
+        Result GetPoolStats(const sf::OutBuffer &out_stats, sf::Out<u32> out_count);
+        Result GetTelemetry(const sf::OutBuffer &out_buckets, sf::Out<u32> out_count);
+        Result DumpTelemetry();
+        Result FlushLog();
+        Result SetTraceMask(u32 device_code, u32 mask);
+        Result SetLogLevel(u32 level);
+    };
+    static_assert(IsII2cMitmControlInterface<I2cMitmControlService>);
+
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+#include "i2c_register_maps.hpp"
+
+namespace ams::mitm::i2c {
+
+    enum ChipFamily : u8 {
+        ChipFamily_Unknown,
+        ChipFamily_Bq24193,
+        ChipFamily_Max17050,
+        ChipFamily_Max77620,
+        ChipFamily_Max77621,
+        ChipFamily_Max77812,
+        ChipFamily_Max77801,
+        ChipFamily_Fan53528,
+        ChipFamily_Tmp451,
+        ChipFamily_Ina226,
+        ChipFamily_Alc5639,
+        ChipFamily_Bm92t30mwv,
+        ChipFamily_Bh1730,
+        ChipFamily_Ftm3bd56,
+        ChipFamily_Hdmi,
+        ChipFamily_Nfc,
+        ChipFamily_ClassicController,
+    };
+
+    constexpr s8 UnknownBusIndex = -1;
+
+    /* What the mitm knows about an i2c device. name is what the config accepts in place of the device code. */
+    struct DeviceInfo {
+        u32 device_code;
+        const char *name;
+        const char *description;
+        s8 bus_idx;                          /* As passed to OpenSessionForDev, UnknownBusIndex if not known */
+        u8 slave_address;
+        ChipFamily family;
+        const regmap::RegisterMap *register_map; /* nullptr if the registers have no names */
+    };
+
+    /* Sorted by device code */
+    constexpr inline DeviceInfo DeviceInfos[] = {
+        { 0x040000C9, "Bm92t30mwv",        "Bm92t30mwv",                                          0,               0x18, ChipFamily_Bm92t30mwv,        nullptr                                },
+        { 0x33000001, "Alc5639",           "Alc5639",                                             0,               0x1C, ChipFamily_Alc5639,           nullptr                                },
+        { 0x34000001, "HdmiDdc",           "HdmiDdc",                                             3,               0x50, ChipFamily_Hdmi,              nullptr                                },
+        { 0x34000002, "HdmiScdc",          "HdmiScdc",                                            3,               0x54, ChipFamily_Hdmi,              nullptr                                },
+        { 0x34000003, "HdmiHdcp",          "HdmiHdcp",                                            3,               0x3A, ChipFamily_Hdmi,              nullptr                                },
+        { 0x35000033, "Ftm3bd56",          "Ftm3bd56",                                            2,               0x49, ChipFamily_Ftm3bd56,          nullptr                                },
+        { 0x35000047, "Bh1730",            "Bh1730",                                              1,               0x29, ChipFamily_Bh1730,            nullptr                                },
+        { 0x350000C9, "ClassicController", "ClassicController",                                   0,               0x52, ChipFamily_ClassicController, nullptr                                },
+        { 0x36000001, "MillauNfc",         "MillauNfc",                                           UnknownBusIndex, 0x00, ChipFamily_Nfc,               nullptr                                },
+        { 0x39000001, "Bq24193",           "Bq24193",                                             0,               0x6B, ChipFamily_Bq24193,           std::addressof(regmap::Bq24193RegisterMap)  },
+        { 0x39000033, "Max17050",          "Max17050",                                            0,               0x36, ChipFamily_Max17050,          std::addressof(regmap::Max17050RegisterMap) },
+        { 0x3A000001, "Max77620Pmic",      "Max77620Pmic",                                        4,               0x3C, ChipFamily_Max77620,          std::addressof(regmap::Max77620RegisterMap) },
+        { 0x3A000002, "Max77812Pmic3",     "Max77812Pmic",                                        4,               0x31, ChipFamily_Max77812,          nullptr                                },
+        { 0x3A000003, "Max77621Cpu",       "Max77621Cpu",                                         4,               0x1B, ChipFamily_Max77621,          nullptr                                },
+        { 0x3A000004, "Max77621Gpu",       "Max77621Gpu",                                         4,               0x1C, ChipFamily_Max77621,          nullptr                                },
+        { 0x3A000005, "Fan53528",          "Fan53528",                                            4,               0x52, ChipFamily_Fan53528,          nullptr                                },
+        { 0x3A000006, "Max77812Pmic2",     "Max77812Pmic",                                        4,               0x31, ChipFamily_Max77812,          nullptr                                },
+        { 0x3A000007, "Max77801",          "Max77801",                                            UnknownBusIndex, 0x00, ChipFamily_Max77801,          nullptr                                },
+        { 0x3B000001, "Max77620Rtc",       "Max77620Rtc",                                         4,               0x68, ChipFamily_Max77620,          nullptr                                },
+        { 0x3E000001, "Tmp451",            "Tmp451 or Nct72",                                     0,               0x4C, ChipFamily_Tmp451,            nullptr                                },
+        { 0x3F000001, "Ina226VsysCpuDs",   "Ina226VsysCpuDs or Ina226VddCpuAp (SdevMariko)",      1,               0x41, ChipFamily_Ina226,            std::addressof(regmap::Ina226RegisterMap)   },
+        { 0x3F000002, "Ina226VsysGpuDs",   "Ina226VsysGpuDs or Ina226VddGpuAp (SdevMariko)",      1,               0x44, ChipFamily_Ina226,            std::addressof(regmap::Ina226RegisterMap)   },
+        { 0x3F000003, "Ina226VsysDdrDs",   "Ina226VsysDdrDs or Ina226VddDdr1V1Pmic (SdevMariko)", 1,               0x45, ChipFamily_Ina226,            std::addressof(regmap::Ina226RegisterMap)   },
+        { 0x3F000401, "Ina226Vdd15v0Hb",   "Ina226Vdd15v0Hb",                                     1,               0x40, ChipFamily_Ina226,            std::addressof(regmap::Ina226RegisterMap)   },
+        { 0x3F000402, "Ina226VsysAp",      "Ina226VsysAp",                                        1,               0x46, ChipFamily_Ina226,            std::addressof(regmap::Ina226RegisterMap)   },
+        { 0x3F000403, "Ina226VsysBlDs",    "Ina226VsysBlDs",                                      1,               0x47, ChipFamily_Ina226,            std::addressof(regmap::Ina226RegisterMap)   },
+        { 0x3F000404, "Ina226VsysCore",    "Ina226VsysCore or Ina226VddCoreAp (SdevMariko)",      1,               0x48, ChipFamily_Ina226,            std::addressof(regmap::Ina226RegisterMap)   },
+        { 0x3F000405, "Ina226Soc1V8",      "Ina226Soc1V8 or Ina226VddSoc1V8 (SdevMariko)",        1,               0x49, ChipFamily_Ina226,            std::addressof(regmap::Ina226RegisterMap)   },
+        { 0x3F000406, "Ina226Lpddr1V8",    "Ina226Lpddr1V8 or Ina226Vdd1V8 (SdevMariko)",         1,               0x4A, ChipFamily_Ina226,            std::addressof(regmap::Ina226RegisterMap)   },
+        { 0x3F000407, "Ina226Reg1V32",     "Ina226Reg1V32",                                       1,               0x4B, ChipFamily_Ina226,            std::addressof(regmap::Ina226RegisterMap)   },
+        { 0x3F000408, "Ina226Vdd3V3Sys",   "Ina226Vdd3V3Sys",                                     1,               0x4D, ChipFamily_Ina226,            std::addressof(regmap::Ina226RegisterMap)   },
+        { 0x3F000409, "Ina226VddDdr0V6",   "Ina226VddDdr0V6 (SdevMariko)",                        1,               0x4E, ChipFamily_Ina226,            std::addressof(regmap::Ina226RegisterMap)   },
+    };
+
+    static_assert([] {
+        for (size_t i = 1; i < std::size(DeviceInfos); i++) {
+            if (DeviceInfos[i - 1].device_code >= DeviceInfos[i].device_code) {
+                return false;
+            }
+        }
+        return true;
+    }());
+
+    /* Returns nullptr for devices missing from the table */
+    constexpr const DeviceInfo *GetDeviceInfo(DeviceCode device_code) {
+        const u32 value = device_code.GetInternalValue();
+        const DeviceInfo *end = DeviceInfos + std::size(DeviceInfos);
+        const DeviceInfo *it = std::lower_bound(DeviceInfos, end, value, [](const DeviceInfo &info, u32 value) { return info.device_code < value; });
+        return it != end && it->device_code == value ? it : nullptr;
+    }
+
+    /* Looks up the device behind a session opened by bus index and slave address, nullptr when several devices share the address (the max77812 variants) */
+    constexpr const DeviceInfo *GetDeviceInfo(s32 bus_idx, u16 slave_address) {
+        const DeviceInfo *found = nullptr;
+        for (const auto &info : DeviceInfos) {
+            if (info.bus_idx == bus_idx && info.slave_address == slave_address) {
+                if (found != nullptr) {
+                    return nullptr;
+                }
+                found = std::addressof(info);
+            }
+        }
+        return found;
+    }
+
+    /* Case insensitive, name is not required to be null terminated */
+    constexpr const DeviceInfo *GetDeviceInfo(std::string_view name) {
+        const auto to_lower = [](char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c; };
+        for (const auto &info : DeviceInfos) {
+            const std::string_view info_name = info.name;
+            if (info_name.size() == name.size() && std::equal(name.begin(), name.end(), info_name.begin(), [&](char a, char b) { return to_lower(a) == to_lower(b); })) {
+                return std::addressof(info);
+            }
+        }
+        return nullptr;
+    }
+
+    constexpr const char *GetDeviceName(DeviceCode device_code) {
+        const DeviceInfo *info = GetDeviceInfo(device_code);
+        return info != nullptr ? info->description : "Unknown";
+    }
+
+    /* Returns nullptr if the device or the register has no name */
+    constexpr const char *GetRegisterName(DeviceCode device_code, u8 reg) {
+        const DeviceInfo *info = GetDeviceInfo(device_code);
+        return info != nullptr && info->register_map != nullptr ? regmap::GetRegisterName(*info->register_map, reg) : nullptr;
+    }
+
+    /* Parses a device code or a device name from the table, end is set past the parsed characters */
+    inline Result ParseDeviceCode(const char *value, char **end, u32 &out) {
+        if (value[0] >= '0' && value[0] <= '9') {
+            const unsigned long long tmp = std::strtoull(value, end, 0);
+            R_UNLESS(*end != value && tmp <= std::numeric_limits<u32>::max(), ::ams::settings::ResultInvalidArgument());
+            out = tmp;
+            R_SUCCEED();
+        }
+
+        const char *cur = value;
+        while ((*cur >= 'a' && *cur <= 'z') || (*cur >= 'A' && *cur <= 'Z') || (*cur >= '0' && *cur <= '9') || *cur == '_') {
+            cur++;
+        }
+
+        const DeviceInfo *info = GetDeviceInfo(std::string_view(value, cur - value));
+        R_UNLESS(info != nullptr, ::ams::settings::ResultInvalidArgument());
+
+        *end = const_cast<char *>(cur);
+        out = info->device_code;
+        R_SUCCEED();
+    }
+
+    static_assert(GetDeviceInfo(DeviceCode(0x39000001))->family == ChipFamily_Bq24193);
+    static_assert(GetDeviceInfo(0, 0x36)->device_code == 0x39000033);
+    static_assert(GetDeviceInfo(1, 0x40)->device_code == 0x3F000401);
+    static_assert(GetDeviceInfo(4, 0x31) == nullptr);
+    static_assert(GetDeviceInfo(std::string_view("max77620pmic"))->device_code == 0x3A000001);
+    static_assert(GetDeviceInfo(DeviceCode(0x39000002)) == nullptr);
+
+}
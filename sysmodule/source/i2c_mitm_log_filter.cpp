@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "i2c_mitm_log_filter.hpp"
+#include "i2c_mitm_settings.hpp"
+#include "logging.hpp"
+
+namespace ams::mitm::i2c::logfilter {
+
+    namespace {
+
+        /* Everything that makes two records identical, except for the tick */
+        struct RecordKey {
+            u64 program_id;
+            u32 device_code;
+            u32 result;
+            u32 payload_hash;
+            u16 size;
+            u16 aux_size;
+            u16 session_id;
+            u8 op;
+            u8 option;
+
+            constexpr bool operator==(const RecordKey &) const = default;
+        };
+
+        struct DedupEntry {
+            RecordKey key;
+            s64 window_start;
+            u32 repeats;
+            bool valid;
+        };
+
+        /*
+         * Token bucket per device, kept as the tick the bucket is full again (GCRA).
+         * Every record adds one emission interval, records are only let through while that stays within the burst.
+         */
+        struct RateBucket {
+            u32 device_code;
+            s64 full_tick;
+            u32 limited;
+            u64 limited_program_id; /* Of the last record left out */
+            bool is_claimed;        /* Device code 0 is the unknown device, not a free bucket */
+        };
+
+        struct FilterConfig {
+            s64 dedup_window;
+            s64 emission_interval;
+            s64 burst;
+        };
+
+        /* A summary record owed for records that were left out */
+        struct Summary {
+            capture::RecordHeader header;
+            u32 data[2];
+        };
+
+        constinit os::SdkMutex g_filter_mutex;
+        constinit DedupEntry g_dedup_entries[NumDedupEntries] = {};
+        constinit RateBucket g_rate_buckets[MaxRateLimitedDevices] = {};
+
+        constexpr u32 HashBytes(u32 hash, const void *data, size_t size) {
+            /* FNV-1a */
+            const u8 *bytes = static_cast<const u8 *>(data);
+            for (size_t i = 0; i < size; i++) {
+                hash = (hash ^ bytes[i]) * 0x01000193;
+            }
+            return hash;
+        }
+
+        constexpr size_t GetDedupIndex(const RecordKey &key) {
+            return (key.payload_hash ^ key.device_code ^ (static_cast<u32>(key.op) << 24)) % NumDedupEntries;
+        }
+
+        Summary MakeRepeatedSummary(const DedupEntry &entry, s64 tick) {
+            return {
+                .header = {
+                    .tick        = static_cast<u64>(tick),
+                    .program_id  = entry.key.program_id,
+                    .device_code = entry.key.device_code,
+                    .result      = entry.key.result,
+                    .op          = capture::Op_Repeated,
+                    .option      = entry.key.op,
+                    .size        = sizeof(capture::RepeatedData),
+                    .aux_size    = 0,
+                    .session_id  = entry.key.session_id,
+                },
+                .data = { entry.repeats, entry.key.payload_hash },
+            };
+        }
+
+        Summary MakeRateLimitedSummary(const RateBucket &bucket, s64 tick) {
+            return {
+                .header = {
+                    .tick        = static_cast<u64>(tick),
+                    .program_id  = bucket.limited_program_id,
+                    .device_code = bucket.device_code,
+                    .result      = 0,
+                    .op          = capture::Op_RateLimited,
+                    .option      = 0,
+                    .size        = sizeof(capture::RateLimitedData),
+                    .aux_size    = 0,
+                    .session_id  = 0,
+                },
+                .data = { bucket.limited, 0 },
+            };
+        }
+
+        FilterConfig GetFilterConfig() {
+            const ScopedConfig config;
+            const I2CMitmConfig &cfg = config.GetConfig();
+            return {
+                .dedup_window      = os::ConvertToTick(TimeSpan::FromMilliSeconds(cfg.log_dedup_window_ms)).GetInt64Value(),
+                .emission_interval = cfg.log_rate_limit > 0 ? os::GetSystemTickFrequency() / cfg.log_rate_limit : 0,
+                .burst             = std::max(cfg.log_rate_burst, 1),
+            };
+        }
+
+        void WriteSummaries(const Summary *summaries, size_t num_summaries) {
+            for (size_t i = 0; i < num_summaries; i++) {
+                log::WriteCapture(summaries[i].header, summaries[i].data, nullptr);
+            }
+        }
+
+        /* Caller holds g_filter_mutex. A Repeated record for the entry if it counted any, the entry starts over. */
+        bool SettleDedupEntry(DedupEntry &entry, s64 now, Summary *out) {
+            if (!entry.valid || entry.repeats == 0) {
+                return false;
+            }
+
+            *out = MakeRepeatedSummary(entry, now);
+            entry.repeats = 0;
+            return true;
+        }
+
+        /* Caller holds g_filter_mutex */
+        bool SettleRateBucket(RateBucket &bucket, s64 now, Summary *out) {
+            if (bucket.limited == 0) {
+                return false;
+            }
+
+            *out = MakeRateLimitedSummary(bucket, now);
+            bucket.limited = 0;
+            return true;
+        }
+
+        /* Flushes the summaries owed for a closed session, the device's rate limited count included. Not a hot path, the summaries are written under the lock. */
+        void SettleSession(const capture::RecordHeader &header) {
+            std::scoped_lock lk(g_filter_mutex);
+
+            const s64 now = static_cast<s64>(header.tick);
+            Summary summary;
+            for (auto &entry : g_dedup_entries) {
+                if (entry.key.session_id == header.session_id && SettleDedupEntry(entry, now, std::addressof(summary))) {
+                    WriteSummaries(std::addressof(summary), 1);
+                }
+            }
+            for (auto &bucket : g_rate_buckets) {
+                if (bucket.is_claimed && bucket.device_code == header.device_code && SettleRateBucket(bucket, now, std::addressof(summary))) {
+                    WriteSummaries(std::addressof(summary), 1);
+                }
+            }
+        }
+
+        RateBucket *GetRateBucket(u32 device_code) {
+            for (auto &bucket : g_rate_buckets) {
+                if (!bucket.is_claimed) {
+                    bucket.device_code = device_code;
+                    bucket.is_claimed  = true;
+                    return std::addressof(bucket);
+                }
+                if (bucket.device_code == device_code) {
+                    return std::addressof(bucket);
+                }
+            }
+
+            /* Devices past the table are not limited */
+            return nullptr;
+        }
+
+    }
+
+    bool ShouldWrite(const capture::RecordHeader &header, const void *data, const void *aux) {
+        /* A replay needs every session record to know which session the others belong to */
+        if (header.op == capture::Op_CloseSession) {
+            SettleSession(header);
+            return true;
+        }
+        if (header.op == capture::Op_OpenSession) {
+            return true;
+        }
+
+        const auto [dedup_window, emission_interval, burst] = GetFilterConfig();
+
+        const RecordKey key = {
+            .program_id   = header.program_id,
+            .device_code  = header.device_code,
+            .result       = header.result,
+            .payload_hash = HashBytes(HashBytes(0x811C9DC5, data, header.size), aux, header.aux_size),
+            .size         = header.size,
+            .aux_size     = header.aux_size,
+            .session_id   = header.session_id,
+            .op           = header.op,
+            .option       = header.option,
+        };
+        const s64 now = static_cast<s64>(header.tick);
+
+        Summary summaries[2];
+        size_t num_summaries = 0;
+        bool write = true;
+        {
+            std::scoped_lock lk(g_filter_mutex);
+
+            if (dedup_window > 0) {
+                DedupEntry &entry = g_dedup_entries[GetDedupIndex(key)];
+                if (entry.valid && entry.key == key && now - entry.window_start < dedup_window) {
+                    entry.repeats++;
+                    return false;
+                }
+
+                /* The slot's window is over or it is taken over by another record, settle its repeats first */
+                if (SettleDedupEntry(entry, now, std::addressof(summaries[num_summaries]))) {
+                    num_summaries++;
+                }
+                entry = { .key = key, .window_start = now, .repeats = 0, .valid = true };
+            }
+
+            if (emission_interval > 0) {
+                if (RateBucket *bucket = GetRateBucket(header.device_code); bucket != nullptr) {
+                    const s64 full_tick = std::max(bucket->full_tick, now) + emission_interval;
+                    if (full_tick - now > burst * emission_interval) {
+                        bucket->limited++;
+                        bucket->limited_program_id = header.program_id;
+                        write = false;
+                    } else {
+                        bucket->full_tick = full_tick;
+                        if (SettleRateBucket(*bucket, now, std::addressof(summaries[num_summaries]))) {
+                            num_summaries++;
+                        }
+                    }
+                }
+            }
+        }
+
+        WriteSummaries(summaries, num_summaries);
+
+        return write;
+    }
+
+    void SettleExpired(s64 now) {
+        const auto [dedup_window, emission_interval, burst] = GetFilterConfig();
+
+        /* Not a hot path either, see SettleSession */
+        std::scoped_lock lk(g_filter_mutex);
+
+        Summary summary;
+        for (auto &entry : g_dedup_entries) {
+            if (now - entry.window_start >= dedup_window && SettleDedupEntry(entry, now, std::addressof(summary))) {
+                WriteSummaries(std::addressof(summary), 1);
+            }
+        }
+
+        /* A bucket with room for a record again means the device's records stopped being left out */
+        for (auto &bucket : g_rate_buckets) {
+            if (bucket.is_claimed && std::max(bucket.full_tick, now) + emission_interval - now <= burst * emission_interval && SettleRateBucket(bucket, now, std::addressof(summary))) {
+                WriteSummaries(std::addressof(summary), 1);
+            }
+        }
+    }
+
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+#include "i2c_capture_format.hpp"
+
+namespace ams::mitm::i2c::logfilter {
+
+    constexpr size_t NumDedupEntries = 64;
+    constexpr size_t MaxRateLimitedDevices = 32;
+
+    /*
+     * Decides whether a capture record is written. A record identical to one written less than dedup_window_ms before is left out
+     * and counted, the count is written as a Repeated record once the window is over. Records over a device's rate limit are
+     * left out the same way and summed up in a RateLimited record. Writes the summary records it owes itself.
+     * Session open and close records are always written, a close first settles the counts of its session and device.
+     */
+    bool ShouldWrite(const capture::RecordHeader &header, const void *data, const void *aux);
+
+    /* Writes the summaries of windows that are over and of devices back under their rate limit, for pollers that stopped. Called by the log writer. */
+    void SettleExpired(s64 now);
+
+}
@@ -15,6 +15,8 @@
  */
 #include "i2c_mitm_module.hpp"
 #include "i2c_mitm_service.hpp"
+#include "i2c_mitm_control_service.hpp"
+#include "i2c_mitm_settings.hpp"
 #include "logging.hpp"
 #include <stratosphere.hpp>
 
@@ -27,6 +29,7 @@ namespace ams::mitm::i2c {
             PortIndex_I2cPcvMitm,
             PortIndex_Count,
         };
+        static_assert(PortIndex_Count == NumMitmPorts);
 
         constexpr sm::ServiceName g_i2c_mitm_service_name     = sm::ServiceName::Encode("i2c");
         constexpr sm::ServiceName g_i2c_pcv_mitm_service_name = sm::ServiceName::Encode("i2c:pcv");
@@ -40,60 +43,135 @@ namespace ams::mitm::i2c {
             static constexpr bool CanManageMitmServers  = true;
         };
 
-        constexpr size_t MaxSessions = 0x10;
+        constexpr size_t MaxServers  = 1;
+        constexpr size_t MaxSessions = MaxSessionsPerPort;
 
-        class ServerManager final : public sf::hipc::ServerManager<PortIndex_Count, ServerOptions, MaxSessions> {
+        /* Every port gets its own server manager, so slow pcv transactions never block psm and vice versa */
+        class ServerManager final : public sf::hipc::ServerManager<MaxServers, ServerOptions, MaxSessions> {
+            private:
+                const char *m_port_name;
+            public:
+                ServerManager(const char *port_name) : m_port_name(port_name) { /* ... */ }
             private:
                 virtual Result OnNeedsToAccept(int port_index, Server *server) override;
         };
 
-        ServerManager g_server_manager;
-
         Result ServerManager::OnNeedsToAccept(int port_index, Server *server) {
+            AMS_UNUSED(port_index);
+
             /* Acknowledge the mitm session. */
             std::shared_ptr<::Service> fsrv;
             sm::MitmProcessInfo client_info;
             server->AcknowledgeMitmSession(std::addressof(fsrv), std::addressof(client_info));
 
-            switch (port_index) {
-                case PortIndex_I2cMitm:
-                    DEBUG_LOG("i2c mitm accept");
-                    return this->AcceptMitmImpl(server, sf::CreateSharedObjectEmplaced<II2cMitmInterface, I2cMitmService>(decltype(fsrv)(fsrv), client_info), fsrv);
-                case PortIndex_I2cPcvMitm:
-                    DEBUG_LOG("i2c:pcv mitm accept");
-                    return this->AcceptMitmImpl(server, sf::CreateSharedObjectEmplaced<II2cMitmInterface, I2cMitmService>(decltype(fsrv)(fsrv), client_info), fsrv);
-                AMS_UNREACHABLE_DEFAULT_CASE();
-            }
+            DEBUG_LOG("%s mitm accept", m_port_name);
+            return this->AcceptMitmImpl(server, sf::CreateSharedObjectEmplaced<II2cMitmInterface, I2cMitmService>(decltype(fsrv)(fsrv), client_info), fsrv);
         }
 
-        constexpr s32 ThreadPriority = 9;
         constexpr size_t ThreadStackSize = 0x2000;
-        alignas(os::ThreadStackAlignment) constinit u8 g_thread_stack[ThreadStackSize];
-        constinit os::ThreadType g_thread;
-        
-        void I2cMitmThreadFunction(void *) {
-            R_ABORT_UNLESS((g_server_manager.RegisterMitmServer<I2cMitmService>(PortIndex_I2cMitm, g_i2c_mitm_service_name)));
-            R_ABORT_UNLESS((g_server_manager.RegisterMitmServer<I2cMitmService>(PortIndex_I2cPcvMitm, g_i2c_pcv_mitm_service_name)));
-            g_server_manager.LoopProcess();
+
+        struct MitmPort {
+            ServerManager server_manager;
+            sm::ServiceName service_name;
+            const char *thread_name;
+            s32 thread_priority;
+            int thread_count;
+            os::ThreadType threads[MaxThreadsPerPort];
+            alignas(os::ThreadStackAlignment) u8 thread_stacks[MaxThreadsPerPort][ThreadStackSize];
+        };
+
+        /* pcv handles latency critical DVFS requests, so its threads run at a higher priority than those of psm and friends */
+        MitmPort g_ports[PortIndex_Count] = {
+            /* PortIndex_I2cMitm */
+            {
+                .server_manager  = ServerManager("i2c"),
+                .service_name    = g_i2c_mitm_service_name,
+                .thread_name     = "I2cMitmThread",
+                .thread_priority = 9,
+            },
+            /* PortIndex_I2cPcvMitm */
+            {
+                .server_manager  = ServerManager("i2c:pcv"),
+                .service_name    = g_i2c_pcv_mitm_service_name,
+                .thread_name     = "I2cPcvMitmThread",
+                .thread_priority = 8,
+            },
+        };
+
+        void I2cMitmThreadFunction(void *arg) {
+            static_cast<MitmPort *>(arg)->server_manager.LoopProcess();
+        }
+
+        constexpr sm::ServiceName g_control_service_name = sm::ServiceName::Encode("i2cmitm");
+        constexpr size_t MaxControlSessions = 2;
+
+        struct ControlServerOptions {
+            static constexpr size_t PointerBufferSize   = 0;
+            static constexpr size_t MaxDomains          = 0;
+            static constexpr size_t MaxDomainObjects    = 0;
+            static constexpr bool CanDeferInvokeRequest = false;
+            static constexpr bool CanManageMitmServers  = false;
+        };
+
+        sf::hipc::ServerManager<1, ControlServerOptions, MaxControlSessions> g_control_server_manager;
+        constinit sf::UnmanagedServiceObject<II2cMitmControlInterface, I2cMitmControlService> g_control_service_object;
+
+        /* The control service is only used by diagnostic tools, so it runs below the mitm threads */
+        constexpr s32 ControlThreadPriority = 20;
+        alignas(os::ThreadStackAlignment) constinit u8 g_control_thread_stack[ThreadStackSize];
+        constinit os::ThreadType g_control_thread;
+
+        void I2cMitmControlThreadFunction(void *) {
+            g_control_server_manager.LoopProcess();
         }
 
     }
 
     void Launch() {
-        R_ABORT_UNLESS(os::CreateThread(&g_thread,
-            I2cMitmThreadFunction,
+        /* The thread counts are only read at boot */
+        const ScopedConfig scoped_config;
+        const I2CMitmConfig &config = scoped_config.GetConfig();
+        g_ports[PortIndex_I2cMitm].thread_count    = config.i2c_thread_count;
+        g_ports[PortIndex_I2cPcvMitm].thread_count = config.pcv_thread_count;
+
+        for (auto &port : g_ports) {
+            R_ABORT_UNLESS((port.server_manager.RegisterMitmServer<I2cMitmService>(0, port.service_name)));
+
+            for (int i = 0; i < port.thread_count; i++) {
+                R_ABORT_UNLESS(os::CreateThread(&port.threads[i],
+                    I2cMitmThreadFunction,
+                    &port,
+                    port.thread_stacks[i],
+                    ThreadStackSize,
+                    port.thread_priority
+                ));
+
+                os::SetThreadNamePointer(&port.threads[i], port.thread_name);
+                os::StartThread(&port.threads[i]);
+            }
+        }
+
+        R_ABORT_UNLESS(g_control_server_manager.RegisterObjectForServer(g_control_service_object.GetShared(), g_control_service_name, MaxControlSessions));
+        R_ABORT_UNLESS(os::CreateThread(&g_control_thread,
+            I2cMitmControlThreadFunction,
             nullptr,
-            g_thread_stack,
+            g_control_thread_stack,
             ThreadStackSize,
-            ThreadPriority
+            ControlThreadPriority
         ));
 
-        os::SetThreadNamePointer(&g_thread, "I2cMitmThread");
-        os::StartThread(&g_thread);
+        os::SetThreadNamePointer(&g_control_thread, "I2cMitmCtrl");
+        os::StartThread(&g_control_thread);
     }
 
     void WaitFinished() {
-        os::WaitThread(&g_thread);
+        for (auto &port : g_ports) {
+            for (int i = 0; i < port.thread_count; i++) {
+                os::WaitThread(&port.threads[i]);
+            }
+        }
+
+        os::WaitThread(&g_control_thread);
     }
 
-}
\ No newline at end of file
+}
@@ -18,6 +18,10 @@
 
 namespace ams::mitm::i2c {
 
+    /* Sessions each mitm port serves, every i2c session opened through a port counts against it */
+    constexpr size_t MaxSessionsPerPort = 0x10;
+    constexpr size_t NumMitmPorts       = 2;
+
     void Launch();
     void WaitFinished();
 
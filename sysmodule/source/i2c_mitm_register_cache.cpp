@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "i2c_mitm_register_cache.hpp"
+#include "i2c_mitm_devices.hpp"
+#include "logging.hpp"
+
+namespace ams::mitm::i2c::cache {
+
+    /* Entries pack the tick of the read above the value, 0 marks an empty entry */
+    class RegisterCache {
+        public:
+            std::atomic<u32> device_code;
+            std::atomic<u32> generation;
+            std::atomic<u64> entries[NumRegisters];
+        public:
+            constexpr RegisterCache() : device_code(0), generation(0), entries() { /* ... */ }
+
+            static constexpr u64 MakeEntry(os::Tick tick, u8 value) {
+                return (static_cast<u64>(tick.GetInt64Value()) << BITSIZEOF(u8)) | value;
+            }
+
+            static constexpr os::Tick GetEntryTick(u64 entry) {
+                return os::Tick(static_cast<s64>(entry >> BITSIZEOF(u8)));
+            }
+
+            static constexpr u8 GetEntryValue(u64 entry) {
+                return static_cast<u8>(entry);
+            }
+    };
+
+    namespace {
+
+        constinit RegisterCache g_register_caches[MaxCachedDevices];
+
+        Result ParseU32(const char *value, char **end, u32 &out, u32 max = std::numeric_limits<u32>::max()) {
+            const unsigned long tmp = std::strtoul(value, end, 0);
+            if (*end != value && tmp <= max) {
+                out = tmp;
+                R_SUCCEED();
+            }
+            R_THROW(::ams::settings::ResultInvalidArgument());
+        }
+
+        /* Comma separated list of registers and register ranges, e.g. "0x00-0x07,0x0A" */
+        Result ParseRegisterList(const char *value, u64 *out_bitmap) {
+            std::memset(out_bitmap, 0, NumRegisters / BITSIZEOF(u8));
+
+            const char *cur = value;
+            while (*cur != '\0') {
+                char *end;
+                u32 first, last;
+                R_TRY(ParseU32(cur, std::addressof(end), first, NumRegisters - 1));
+                last = first;
+                if (*end == '-') {
+                    cur = end + 1;
+                    R_TRY(ParseU32(cur, std::addressof(end), last, NumRegisters - 1));
+                }
+                R_UNLESS(first <= last, ::ams::settings::ResultInvalidArgument());
+
+                for (u32 r = first; r <= last; r++) {
+                    out_bitmap[r / BITSIZEOF(u64)] |= u64(1) << (r % BITSIZEOF(u64));
+                }
+
+                while (*end == ' ') {
+                    end++;
+                }
+                if (*end == ',') {
+                    end++;
+                } else {
+                    R_UNLESS(*end == '\0', ::ams::settings::ResultInvalidArgument());
+                }
+                while (*end == ' ') {
+                    end++;
+                }
+                cur = end;
+            }
+
+            R_SUCCEED();
+        }
+
+        DeviceCacheConfig *FindOrCreateDeviceConfig(CacheConfig *config, const char *cache_name) {
+            for (size_t i = 0; i < config->num_devices; i++) {
+                if (strncmp(config->devices[i].name, cache_name, MaxCacheNameLength - 1) == 0) {
+                    return std::addressof(config->devices[i]);
+                }
+            }
+
+            if (config->num_devices >= MaxCachedDevices) {
+                return nullptr;
+            }
+
+            DeviceCacheConfig *device = std::addressof(config->devices[config->num_devices++]);
+            *device = {
+                .name        = {},
+                .device_code = 0,
+                .ttl_ms      = 1000,
+                .cacheable   = {},
+            };
+            util::Strlcpy(device->name, cache_name, sizeof(device->name));
+            return device;
+        }
+
+    }
+
+    Result ParseIniEntry(CacheConfig *config, const char *cache_name, const char *name, const char *value) {
+        DeviceCacheConfig *device = FindOrCreateDeviceConfig(config, cache_name);
+        if (device == nullptr) {
+            log::DebugLog("Too many cached devices, ignoring cache %s\n", cache_name);
+            R_SUCCEED();
+        }
+
+        char *end;
+        if (strcasecmp(name, "device") == 0) {
+            R_TRY(ParseDeviceCode(value, std::addressof(end), device->device_code));
+            R_UNLESS(*end == '\0', ::ams::settings::ResultInvalidArgument());
+        } else if (strcasecmp(name, "registers") == 0) {
+            R_TRY(ParseRegisterList(value, device->cacheable));
+        } else if (strcasecmp(name, "ttl_ms") == 0) {
+            R_TRY(ParseU32(value, std::addressof(end), device->ttl_ms));
+        }
+
+        R_SUCCEED();
+    }
+
+    void LogConfig(const CacheConfig &config) {
+        for (size_t i = 0; i < config.num_devices; i++) {
+            const DeviceCacheConfig &device = config.devices[i];
+            log::DebugLog("i2c mitm cache %s: dev 0x%08" PRIx32 " (%s), ttl %" PRIu32 "ms, registers %016" PRIx64 "%016" PRIx64 "%016" PRIx64 "%016" PRIx64 "\n",
+                          device.name, device.device_code, GetDeviceName(device.device_code), device.ttl_ms, device.cacheable[3], device.cacheable[2], device.cacheable[1], device.cacheable[0]);
+        }
+    }
+
+    const DeviceCacheConfig *GetDeviceCacheConfig(const CacheConfig &config, DeviceCode device_code) {
+        for (size_t i = 0; i < config.num_devices; i++) {
+            if (config.devices[i].device_code == device_code.GetInternalValue()) {
+                return std::addressof(config.devices[i]);
+            }
+        }
+        return nullptr;
+    }
+
+    RegisterCache *GetRegisterCache(DeviceCode device_code) {
+        const u32 value = device_code.GetInternalValue();
+
+        for (auto &cache : g_register_caches) {
+            u32 expected = 0;
+            if (cache.device_code.compare_exchange_strong(expected, value) || expected == value) {
+                return std::addressof(cache);
+            }
+        }
+
+        return nullptr;
+    }
+
+    u32 GetGeneration(const RegisterCache *cache) {
+        return cache->generation.load();
+    }
+
+    bool Lookup(RegisterCache *cache, const DeviceCacheConfig &config, u8 reg, u8 *out_values, size_t count) {
+        if (!IsCacheable(config, reg, count)) {
+            return false;
+        }
+
+        const os::Tick now = os::GetSystemTick();
+        const os::Tick ttl = os::ConvertToTick(TimeSpan::FromMilliSeconds(config.ttl_ms));
+
+        for (size_t i = 0; i < count; i++) {
+            const u64 entry = cache->entries[reg + i].load(std::memory_order_acquire);
+            if (entry == 0 || (now - RegisterCache::GetEntryTick(entry)) > ttl) {
+                return false;
+            }
+            out_values[i] = RegisterCache::GetEntryValue(entry);
+        }
+
+        return true;
+    }
+
+    void Update(RegisterCache *cache, u32 generation, u8 reg, const u8 *values, size_t count) {
+        count = std::min<size_t>(count, NumRegisters - reg);
+
+        const os::Tick now = os::GetSystemTick();
+        for (size_t i = 0; i < count; i++) {
+            cache->entries[reg + i].store(RegisterCache::MakeEntry(now, values[i]), std::memory_order_release);
+        }
+
+        /* A write may have landed while the read was in flight, drop what we stored rather than serve a stale value */
+        if (cache->generation.load() != generation) {
+            Invalidate(cache, reg, count);
+        }
+    }
+
+    void Invalidate(RegisterCache *cache, u8 reg, size_t count) {
+        count = std::min<size_t>(count, NumRegisters - reg);
+
+        cache->generation.fetch_add(1);
+        for (size_t i = 0; i < count; i++) {
+            cache->entries[reg + i].store(0, std::memory_order_release);
+        }
+    }
+
+    size_t GetSnapshot(DeviceCode device_code, CachedRegister *out, size_t max_count) {
+        for (const auto &cache : g_register_caches) {
+            if (cache.device_code.load() != device_code.GetInternalValue()) {
+                continue;
+            }
+
+            const os::Tick now = os::GetSystemTick();
+
+            size_t count = 0;
+            for (size_t r = 0; r < NumRegisters && count < max_count; r++) {
+                const u64 entry = cache.entries[r].load(std::memory_order_acquire);
+                if (entry == 0) {
+                    continue;
+                }
+
+                out[count++] = {
+                    .reg      = static_cast<u8>(r),
+                    .value    = RegisterCache::GetEntryValue(entry),
+                    .reserved = 0,
+                    .age_ms   = static_cast<u32>((now - RegisterCache::GetEntryTick(entry)).ToTimeSpan().GetMilliSeconds()),
+                };
+            }
+            return count;
+        }
+
+        return 0;
+    }
+
+}
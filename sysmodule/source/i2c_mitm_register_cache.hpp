@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+
+namespace ams::mitm::i2c::cache {
+
+    constexpr size_t MaxCachedDevices   = 8;
+    constexpr size_t MaxCacheNameLength = 0x18;
+    constexpr size_t NumRegisters       = 0x100;
+
+    /* Which registers of a device may be answered from the cache, part of the config snapshot */
+    struct DeviceCacheConfig {
+        char name[MaxCacheNameLength];
+        u32 device_code;
+        u32 ttl_ms;
+        u64 cacheable[NumRegisters / BITSIZEOF(u64)];
+    };
+
+    struct CacheConfig {
+        DeviceCacheConfig devices[MaxCachedDevices];
+        size_t num_devices;
+    };
+
+    /* Layout of the register snapshot returned by the i2cmitm service */
+    struct CachedRegister {
+        u8 reg;
+        u8 value;
+        u16 reserved;
+        u32 age_ms;
+    };
+
+    Result ParseIniEntry(CacheConfig *config, const char *cache_name, const char *name, const char *value);
+    void LogConfig(const CacheConfig &config);
+
+    /* Returns nullptr if caching is not enabled for the device */
+    const DeviceCacheConfig *GetDeviceCacheConfig(const CacheConfig &config, DeviceCode device_code);
+
+    constexpr bool IsCacheable(const DeviceCacheConfig &config, u8 reg, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            const size_t r = reg + i;
+            if (r >= NumRegisters || !(config.cacheable[r / BITSIZEOF(u64)] & (u64(1) << (r % BITSIZEOF(u64))))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    class RegisterCache;
+
+    /* Returns the cache of a device, nullptr if all slots are taken. The cache stays valid for the process lifetime. */
+    RegisterCache *GetRegisterCache(DeviceCode device_code);
+
+    /* Generation to pass to Update, taken before the read is sent to the device */
+    u32 GetGeneration(const RegisterCache *cache);
+
+    /* Fills out_values if all count registers from reg on are cacheable and younger than the ttl */
+    bool Lookup(RegisterCache *cache, const DeviceCacheConfig &config, u8 reg, u8 *out_values, size_t count);
+
+    /* Records values read from the device, dropped if a write invalidated the cache since generation was taken */
+    void Update(RegisterCache *cache, u32 generation, u8 reg, const u8 *values, size_t count);
+    void Invalidate(RegisterCache *cache, u8 reg, size_t count);
+
+    /* Copies the valid entries of a device's cache */
+    size_t GetSnapshot(DeviceCode device_code, CachedRegister *out, size_t max_count);
+
+}
@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "i2c_mitm_rules.hpp"
+#include "i2c_mitm_devices.hpp"
+#include "logging.hpp"
+
+namespace ams::mitm::i2c::rules {
+
+    namespace {
+
+        struct PendingRule {
+            Rule rule;
+            bool has_device;
+            bool has_register;
+            bool has_max;
+            bool has_set;
+        };
+
+        constinit PendingRule g_pending_rules[MaxRules] = {};
+        constinit size_t g_num_pending_rules = 0;
+
+        constexpr const char *ActionToName(Action action) {
+            switch (action) {
+            case Action_Rewrite:
+                return "rewrite";
+            case Action_Clamp:
+                return "clamp";
+            case Action_Drop:
+                return "drop";
+            case Action_Log:
+                return "log";
+            default:
+                return "unknown";
+            }
+        }
+
+        Result ParseU32(const char *value, u32 &out, u32 max = std::numeric_limits<u32>::max()) {
+            char *end;
+            const unsigned long tmp = std::strtoul(value, std::addressof(end), 0);
+            if (end != value && *end == '\0' && tmp <= max) {
+                out = tmp;
+                R_SUCCEED();
+            }
+            R_THROW(::ams::settings::ResultInvalidArgument());
+        }
+
+        Result ParseDevice(const char *value, u32 &out) {
+            char *end;
+            R_TRY(ParseDeviceCode(value, std::addressof(end), out));
+            R_UNLESS(*end == '\0', ::ams::settings::ResultInvalidArgument());
+            R_SUCCEED();
+        }
+
+        Result ParseU8(const char *value, u8 &out) {
+            u32 tmp;
+            R_TRY(ParseU32(value, tmp, std::numeric_limits<u8>::max()));
+            out = tmp;
+            R_SUCCEED();
+        }
+
+        Result ParseBool(const char *value, bool &out) {
+            if (strcasecmp(value, "true") == 0 || strcmp(value, "1") == 0) {
+                out = true;
+                R_SUCCEED();
+            } else if (strcasecmp(value, "false") == 0 || strcmp(value, "0") == 0) {
+                out = false;
+                R_SUCCEED();
+            }
+            R_THROW(::ams::settings::ResultInvalidArgument());
+        }
+
+        Result ParseAction(const char *value, Action &out) {
+            for (const auto action : {Action_Rewrite, Action_Clamp, Action_Drop, Action_Log}) {
+                if (strcasecmp(value, ActionToName(action)) == 0) {
+                    out = action;
+                    R_SUCCEED();
+                }
+            }
+            R_THROW(::ams::settings::ResultInvalidArgument());
+        }
+
+        PendingRule *FindOrCreatePendingRule(const char *rule_name) {
+            for (size_t i = 0; i < g_num_pending_rules; i++) {
+                if (strncmp(g_pending_rules[i].rule.name, rule_name, MaxRuleNameLength - 1) == 0) {
+                    return std::addressof(g_pending_rules[i]);
+                }
+            }
+
+            if (g_num_pending_rules >= MaxRules) {
+                return nullptr;
+            }
+
+            PendingRule *pending = std::addressof(g_pending_rules[g_num_pending_rules++]);
+            *pending = {
+                .rule = {
+                    .name        = {},
+                    .device_code = 0,
+                    .reg         = 0,
+                    .mask        = 0xFF,
+                    .min         = 0x00,
+                    .max         = 0xFF,
+                    .set         = 0x00,
+                    .set_mask    = 0xFF,
+                    .action      = Action_Log,
+                    .on_open     = false,
+                    .next        = InvalidRuleIndex,
+                },
+                .has_device   = false,
+                .has_register = false,
+                .has_max      = false,
+                .has_set      = false,
+            };
+            util::Strlcpy(pending->rule.name, rule_name, sizeof(pending->rule.name));
+            return pending;
+        }
+
+        bool ValidateRule(const PendingRule &pending) {
+            const Rule &rule = pending.rule;
+
+            const char *error = nullptr;
+            if (!pending.has_device || !pending.has_register) {
+                error = "device and register are required";
+            } else if (rule.mask == 0 || rule.min > rule.max || (rule.min & ~rule.mask) || (rule.max & ~rule.mask)) {
+                error = "min and max must be within mask";
+            } else if (rule.action == Action_Rewrite && !pending.has_set) {
+                error = "rewrite needs a set value";
+            } else if (rule.on_open && (!pending.has_set || rule.set_mask != 0xFF)) {
+                error = "on_open needs a set value for the whole register";
+            }
+
+            if (error != nullptr) {
+                log::DebugLog("Ignoring rule %s: %s\n", rule.name, error);
+                return false;
+            }
+
+            return true;
+        }
+
+        DeviceRules *FindOrCreateDeviceRules(RuleSet *rules, u32 device_code) {
+            for (size_t i = 0; i < rules->num_devices; i++) {
+                if (rules->devices[i].device_code == device_code) {
+                    return std::addressof(rules->devices[i]);
+                }
+            }
+
+            if (rules->num_devices >= MaxRuleDevices) {
+                return nullptr;
+            }
+
+            DeviceRules *device = std::addressof(rules->devices[rules->num_devices++]);
+            device->device_code = device_code;
+            device->num_rules   = 0;
+            std::memset(device->first_rule, InvalidRuleIndex, sizeof(device->first_rule));
+            for (auto &done : device->open_write_done) {
+                done.store(false);
+            }
+            return device;
+        }
+
+        void CompileRule(RuleSet *rules, const Rule &rule) {
+            DeviceRules *device = FindOrCreateDeviceRules(rules, rule.device_code);
+            if (device == nullptr || device->num_rules >= MaxRulesPerDevice) {
+                log::DebugLog("Ignoring rule %s: too many rules\n", rule.name);
+                return;
+            }
+
+            const u8 index = device->num_rules++;
+            device->rules[index]      = rule;
+            device->rules[index].next = InvalidRuleIndex;
+
+            /* Append to the end of the register's chain, rules apply in config order */
+            u8 *link = std::addressof(device->first_rule[rule.reg]);
+            while (*link != InvalidRuleIndex) {
+                link = std::addressof(device->rules[*link].next);
+            }
+            *link = index;
+        }
+
+    }
+
+    Result ParseIniEntry(const char *rule_name, const char *name, const char *value) {
+        PendingRule *pending = FindOrCreatePendingRule(rule_name);
+        if (pending == nullptr) {
+            log::DebugLog("Too many rules, ignoring rule %s\n", rule_name);
+            R_SUCCEED();
+        }
+
+        Rule &rule = pending->rule;
+        if (strcasecmp(name, "device") == 0) {
+            R_TRY(ParseDevice(value, rule.device_code));
+            pending->has_device = true;
+        } else if (strcasecmp(name, "register") == 0) {
+            R_TRY(ParseU8(value, rule.reg));
+            pending->has_register = true;
+        } else if (strcasecmp(name, "mask") == 0) {
+            R_TRY(ParseU8(value, rule.mask));
+            /* Without an explicit max the rule matches up to the top of the field */
+            if (!pending->has_max) {
+                rule.max = rule.mask;
+            }
+        } else if (strcasecmp(name, "value") == 0) {
+            R_TRY(ParseU8(value, rule.min));
+            rule.max = rule.min;
+            pending->has_max = true;
+        } else if (strcasecmp(name, "min") == 0) {
+            R_TRY(ParseU8(value, rule.min));
+        } else if (strcasecmp(name, "max") == 0) {
+            R_TRY(ParseU8(value, rule.max));
+            pending->has_max = true;
+        } else if (strcasecmp(name, "action") == 0) {
+            R_TRY(ParseAction(value, rule.action));
+        } else if (strcasecmp(name, "set") == 0) {
+            R_TRY(ParseU8(value, rule.set));
+            pending->has_set = true;
+        } else if (strcasecmp(name, "set_mask") == 0) {
+            R_TRY(ParseU8(value, rule.set_mask));
+        } else if (strcasecmp(name, "on_open") == 0) {
+            R_TRY(ParseBool(value, rule.on_open));
+        }
+
+        R_SUCCEED();
+    }
+
+    Result AddRule(const Rule &rule) {
+        PendingRule *pending = FindOrCreatePendingRule(rule.name);
+        R_UNLESS(pending != nullptr, ::ams::settings::ResultInvalidArgument());
+
+        *pending = {
+            .rule         = rule,
+            .has_device   = true,
+            .has_register = true,
+            .has_max      = true,
+            .has_set      = true,
+        };
+        R_SUCCEED();
+    }
+
+    void Commit(RuleSet *out_rules) {
+        out_rules->num_devices = 0;
+        for (size_t i = 0; i < g_num_pending_rules; i++) {
+            if (ValidateRule(g_pending_rules[i])) {
+                CompileRule(out_rules, g_pending_rules[i].rule);
+            }
+        }
+        g_num_pending_rules = 0;
+    }
+
+    void Discard() {
+        g_num_pending_rules = 0;
+    }
+
+    void LogRules(const RuleSet &rules) {
+        for (size_t i = 0; i < rules.num_devices; i++) {
+            const DeviceRules &device = rules.devices[i];
+            for (size_t j = 0; j < device.num_rules; j++) {
+                const Rule &rule = device.rules[j];
+                const char *reg_name = GetRegisterName(rule.device_code, rule.reg);
+                log::DebugLog("i2c mitm rule %s: dev 0x%08" PRIx32 " (%s), reg 0x%02" PRIx8 " (%s), mask 0x%02" PRIx8 ", range 0x%02" PRIx8 "-0x%02" PRIx8 ", %s 0x%02" PRIx8 "/0x%02" PRIx8 "%s\n",
+                              rule.name, rule.device_code, GetDeviceName(rule.device_code), rule.reg, reg_name != nullptr ? reg_name : "?", rule.mask, rule.min, rule.max, ActionToName(rule.action), rule.set, rule.set_mask, rule.on_open ? ", on open" : "");
+            }
+        }
+    }
+
+    const DeviceRules *GetDeviceRules(const RuleSet &rules, DeviceCode device_code) {
+        for (size_t i = 0; i < rules.num_devices; i++) {
+            if (rules.devices[i].device_code == device_code.GetInternalValue()) {
+                return std::addressof(rules.devices[i]);
+            }
+        }
+        return nullptr;
+    }
+
+    Verdict ApplyToWrite(const DeviceRules &rules, u8 *data, size_t size) {
+        Verdict verdict = Verdict_Forward;
+
+        for (size_t i = 1; i < size; i++) {
+            const u8 reg = static_cast<u8>(data[0] + i - 1);
+
+            for (u8 index = rules.first_rule[reg]; index != InvalidRuleIndex; index = rules.rules[index].next) {
+                const Rule &rule = rules.rules[index];
+                const u8 value = data[i];
+                const u8 field = value & rule.mask;
+                const bool in_range = field >= rule.min && field <= rule.max;
+
+                switch (rule.action) {
+                case Action_Rewrite:
+                    if (in_range) {
+                        data[i] = (value & ~rule.set_mask) | (rule.set & rule.set_mask);
+                    }
+                    break;
+                case Action_Clamp:
+                    if (field < rule.min) {
+                        data[i] = (value & ~rule.mask) | rule.min;
+                    } else if (field > rule.max) {
+                        data[i] = (value & ~rule.mask) | rule.max;
+                    }
+                    break;
+                case Action_Drop:
+                    if (in_range) {
+                        log::DebugLog("Rule %s: dropping write of 0x%02" PRIx8 " to reg 0x%02" PRIx8 " of dev 0x%08" PRIx32 "\n", rule.name, value, reg, rules.device_code);
+                        return Verdict_Drop;
+                    }
+                    break;
+                case Action_Log:
+                    if (in_range) {
+                        log::DebugLog("Rule %s: write of 0x%02" PRIx8 " to reg 0x%02" PRIx8 " of dev 0x%08" PRIx32 "\n", rule.name, value, reg, rules.device_code);
+                    }
+                    break;
+                }
+
+                if (data[i] != value) {
+                    DEBUG_LOG("Rule %s: rewriting reg 0x%02" PRIx8 " of dev 0x%08" PRIx32 " from 0x%02" PRIx8 " to 0x%02" PRIx8, rule.name, reg, rules.device_code, value, data[i]);
+                    verdict = Verdict_Modified;
+                }
+            }
+        }
+
+        return verdict;
+    }
+
+    size_t TakeOpenWrites(const DeviceRules &rules, RegisterWrite *out_writes, size_t max_writes) {
+        size_t count = 0;
+        for (size_t i = 0; i < rules.num_rules && count < max_writes; i++) {
+            const Rule &rule = rules.rules[i];
+            if (rule.on_open && !rules.open_write_done[i].exchange(true)) {
+                out_writes[count++] = { rule.reg, rule.set };
+            }
+        }
+        return count;
+    }
+
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+
+namespace ams::mitm::i2c::rules {
+
+    constexpr size_t MaxRules          = 32;
+    constexpr size_t MaxRuleDevices    = 8;
+    constexpr size_t MaxRulesPerDevice = 16;
+    constexpr size_t MaxRuleNameLength = 0x18;
+
+    constexpr u8 InvalidRuleIndex = 0xFF;
+
+    enum Action : u8 {
+        Action_Rewrite = 0, /* Replace the bits in set_mask with set */
+        Action_Clamp   = 1, /* Clamp the masked field into [min, max] */
+        Action_Drop    = 2, /* Complete the write without sending it to the device */
+        Action_Log     = 3, /* Only log the write */
+    };
+
+    /* A register rule, matches writes of (value & mask) in [min, max] to reg of a device */
+    struct Rule {
+        char name[MaxRuleNameLength];
+        u32 device_code;
+        u8 reg;
+        u8 mask;
+        u8 min;
+        u8 max;
+        u8 set;
+        u8 set_mask;
+        Action action;
+        bool on_open; /* Write set to reg once when the first session for the device is opened */
+        u8 next;      /* Next rule for the same register, InvalidRuleIndex ends the chain */
+    };
+
+    /* Compiled rules of one device, first_rule is indexed by register so a write only looks at the rules for its register */
+    struct DeviceRules {
+        u32 device_code;
+        u8 num_rules;
+        u8 first_rule[0x100];
+        Rule rules[MaxRulesPerDevice];
+        mutable std::atomic<bool> open_write_done[MaxRulesPerDevice];
+    };
+
+    struct RuleSet {
+        DeviceRules devices[MaxRuleDevices];
+        size_t num_devices;
+    };
+
+    enum Verdict {
+        Verdict_Forward  = 0, /* Nothing changed, forward the original data */
+        Verdict_Modified = 1, /* The data was rewritten in place */
+        Verdict_Drop     = 2, /* Do not send the write */
+    };
+
+    struct RegisterWrite {
+        u8 reg;
+        u8 value;
+    };
+
+    /* Rules are collected while the config is parsed and compiled into a rule set on Commit, the caller serializes config loads */
+    Result ParseIniEntry(const char *rule_name, const char *name, const char *value);
+    Result AddRule(const Rule &rule);
+    void Commit(RuleSet *out_rules);
+    /* Drops the rules collected since the last Commit, for a config that failed to parse */
+    void Discard();
+    void LogRules(const RuleSet &rules);
+
+    /* Returns nullptr if there are no rules for the device */
+    const DeviceRules *GetDeviceRules(const RuleSet &rules, DeviceCode device_code);
+
+    /* data is a register write, the start register followed by the values for consecutive registers */
+    Verdict ApplyToWrite(const DeviceRules &rules, u8 *data, size_t size);
+
+    /* Returns the on_open writes that were not done yet, each one is only handed out once per rule set */
+    size_t TakeOpenWrites(const DeviceRules &rules, RegisterWrite *out_writes, size_t max_writes);
+
+}
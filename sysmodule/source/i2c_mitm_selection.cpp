@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "i2c_mitm_selection.hpp"
+#include "i2c_mitm_devices.hpp"
+#include "logging.hpp"
+
+namespace ams::mitm::i2c::selection {
+
+    namespace {
+
+        /* bq24193, mitm'd for the chrg_voltage override unless the config names its own device list */
+        constexpr u32 DefaultDeviceCode = 0x39000001;
+
+        constexpr u32 MakeBusAddress(s32 bus_idx, u16 slave_address) {
+            return (static_cast<u32>(bus_idx) << BITSIZEOF(u16)) | slave_address;
+        }
+
+        template<typename T>
+        bool Add(T *values, size_t *count, size_t max_count, T value) {
+            if (*count >= max_count) {
+                return false;
+            }
+            values[(*count)++] = value;
+            return true;
+        }
+
+        template<typename T>
+        void SortUnique(T *values, size_t *count) {
+            std::sort(values, values + *count);
+            *count = std::unique(values, values + *count) - values;
+        }
+
+        template<typename T>
+        bool Contains(const T *values, size_t count, T value) {
+            return std::binary_search(values, values + count, value);
+        }
+
+        Result ParseU64(const char *value, char **end, u64 &out, u64 max = std::numeric_limits<u64>::max()) {
+            const unsigned long long tmp = std::strtoull(value, end, 0);
+            if (*end != value && tmp <= max) {
+                out = tmp;
+                R_SUCCEED();
+            }
+            R_THROW(::ams::settings::ResultInvalidArgument());
+        }
+
+        Result ParseDevices(Selection *selection, const char *value) {
+            selection->has_device_list = true;
+            R_RETURN(ForEachListItem(value, [&](const char *item, char **end) -> Result {
+                u32 device_code;
+                R_TRY(ParseDeviceCode(item, end, device_code));
+                if (!Add(selection->device_codes, std::addressof(selection->num_device_codes), MaxSelectedDevices, device_code)) {
+                    log::DebugLog("Too many selected devices, ignoring 0x%08" PRIx32 "\n", device_code);
+                }
+                R_SUCCEED();
+            }));
+        }
+
+        /* Bus index and slave address pairs, e.g. "0:0x6B,0:0x36" */
+        Result ParseBusDevices(Selection *selection, const char *value) {
+            R_RETURN(ForEachListItem(value, [&](const char *item, char **end) -> Result {
+                u64 bus_idx, slave_address;
+                R_TRY(ParseU64(item, end, bus_idx, std::numeric_limits<u16>::max()));
+                R_UNLESS(**end == ':', ::ams::settings::ResultInvalidArgument());
+                R_TRY(ParseU64(*end + 1, end, slave_address, std::numeric_limits<u16>::max()));
+
+                const u32 bus_address = MakeBusAddress(static_cast<s32>(bus_idx), static_cast<u16>(slave_address));
+                if (!Add(selection->bus_addresses, std::addressof(selection->num_bus_addresses), MaxSelectedBusAddresses, bus_address)) {
+                    log::DebugLog("Too many selected bus devices, ignoring %" PRIu64 ":0x%02" PRIx64 "\n", bus_idx, slave_address);
+                }
+                R_SUCCEED();
+            }));
+        }
+
+        Result ParsePrograms(Selection *selection, const char *value) {
+            R_RETURN(ForEachListItem(value, [&](const char *item, char **end) -> Result {
+                u64 program_id;
+                R_TRY(ParseU64(item, end, program_id));
+                if (!Add(selection->program_ids, std::addressof(selection->num_program_ids), MaxSelectedPrograms, program_id)) {
+                    log::DebugLog("Too many selected programs, ignoring 0x%016" PRIx64 "\n", program_id);
+                }
+                R_SUCCEED();
+            }));
+        }
+
+    }
+
+    bool IsIniEntry(const char *name) {
+        return strcasecmp(name, "devices") == 0 || strcasecmp(name, "bus_devices") == 0 || strcasecmp(name, "programs") == 0;
+    }
+
+    Result ParseIniEntry(Selection *selection, const char *name, const char *value) {
+        /* A malformed list is dropped as a whole */
+        const Selection prev = *selection;
+
+        Result result = ResultSuccess();
+        if (strcasecmp(name, "devices") == 0) {
+            result = ParseDevices(selection, value);
+        } else if (strcasecmp(name, "bus_devices") == 0) {
+            result = ParseBusDevices(selection, value);
+        } else if (strcasecmp(name, "programs") == 0) {
+            result = ParsePrograms(selection, value);
+        }
+
+        if (R_FAILED(result)) {
+            *selection = prev;
+        }
+        R_RETURN(result);
+    }
+
+    void Commit(Selection *selection, const rules::RuleSet &rules, const cache::CacheConfig &cache, const telemetry::TelemetryConfig &telemetry, const charge::PolicyConfig &charge_policy) {
+        /* Rules, caches, the telemetry sampler and the charge policy only see mitm'd sessions, their devices are always selected */
+        bool added_all = true;
+        if (!selection->has_device_list) {
+            added_all &= Add(selection->device_codes, std::addressof(selection->num_device_codes), MaxSelectedDevices, DefaultDeviceCode);
+        }
+        for (size_t i = 0; i < rules.num_devices; i++) {
+            added_all &= Add(selection->device_codes, std::addressof(selection->num_device_codes), MaxSelectedDevices, rules.devices[i].device_code);
+        }
+        for (size_t i = 0; i < cache.num_devices; i++) {
+            added_all &= Add(selection->device_codes, std::addressof(selection->num_device_codes), MaxSelectedDevices, cache.devices[i].device_code);
+        }
+        for (size_t i = 0; i < telemetry.num_rails; i++) {
+            added_all &= Add(selection->device_codes, std::addressof(selection->num_device_codes), MaxSelectedDevices, telemetry.device_codes[i]);
+        }
+        if (charge::IsEnabled(charge_policy)) {
+            for (const u32 device_code : charge::PolicyDeviceCodes) {
+                added_all &= Add(selection->device_codes, std::addressof(selection->num_device_codes), MaxSelectedDevices, device_code);
+            }
+        }
+        if (!added_all) {
+            log::DebugLog("Too many selected devices, some rule, cache, telemetry or charge policy devices are not mitm'd\n");
+        }
+
+        SortUnique(selection->device_codes, std::addressof(selection->num_device_codes));
+        SortUnique(selection->bus_addresses, std::addressof(selection->num_bus_addresses));
+        SortUnique(selection->program_ids, std::addressof(selection->num_program_ids));
+    }
+
+    void LogSelection(const Selection &selection) {
+        for (size_t i = 0; i < selection.num_device_codes; i++) {
+            log::DebugLog("i2c mitm selected dev 0x%08" PRIx32 " (%s)\n", selection.device_codes[i], GetDeviceName(selection.device_codes[i]));
+        }
+        for (size_t i = 0; i < selection.num_bus_addresses; i++) {
+            log::DebugLog("i2c mitm selected bus %" PRIu32 ", addr 0x%02" PRIx32 "\n", selection.bus_addresses[i] >> BITSIZEOF(u16), selection.bus_addresses[i] & 0xFFFF);
+        }
+        if (selection.num_program_ids == 0) {
+            log::DebugLog("i2c mitm selected programs: all\n");
+        }
+        for (size_t i = 0; i < selection.num_program_ids; i++) {
+            log::DebugLog("i2c mitm selected program 0x%016" PRIx64 "\n", selection.program_ids[i]);
+        }
+    }
+
+    bool IsDeviceSelected(const Selection &selection, DeviceCode device_code) {
+        return Contains(selection.device_codes, selection.num_device_codes, device_code.GetInternalValue());
+    }
+
+    bool IsBusAddressSelected(const Selection &selection, s32 bus_idx, u16 slave_address) {
+        return Contains(selection.bus_addresses, selection.num_bus_addresses, MakeBusAddress(bus_idx, slave_address));
+    }
+
+    bool IsProgramSelected(const Selection &selection, ncm::ProgramId program_id) {
+        return selection.num_program_ids == 0 || Contains(selection.program_ids, selection.num_program_ids, program_id.value);
+    }
+
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+#include "i2c_mitm_rules.hpp"
+#include "i2c_mitm_register_cache.hpp"
+#include "i2c_mitm_telemetry.hpp"
+#include "i2c_mitm_charge_policy.hpp"
+
+namespace ams::mitm::i2c::selection {
+
+    constexpr size_t MaxSelectedDevices      = 32;
+    constexpr size_t MaxSelectedBusAddresses = 16;
+    constexpr size_t MaxSelectedPrograms     = 16;
+
+    /* Which sessions and clients are mitm'd, part of the config snapshot. The arrays are sorted once Commit ran. */
+    struct Selection {
+        u32 device_codes[MaxSelectedDevices];
+        u32 bus_addresses[MaxSelectedBusAddresses]; /* Bus index in the upper half, slave address in the lower half */
+        u64 program_ids[MaxSelectedPrograms];
+        size_t num_device_codes;
+        size_t num_bus_addresses;
+        size_t num_program_ids;
+        bool has_device_list; /* devices= was given, the default device is not added */
+    };
+
+    /* Calls f(item, item_end) for every item of a comma separated list, stops at the first failure */
+    template<typename F>
+    Result ForEachListItem(const char *value, F f) {
+        const char *cur = value;
+        while (true) {
+            while (*cur == ' ') {
+                cur++;
+            }
+            if (*cur == '\0') {
+                break;
+            }
+
+            char *end;
+            R_TRY(f(cur, std::addressof(end)));
+
+            while (*end == ' ') {
+                end++;
+            }
+            if (*end == ',') {
+                end++;
+            } else {
+                R_UNLESS(*end == '\0', ::ams::settings::ResultInvalidArgument());
+            }
+            cur = end;
+        }
+
+        R_SUCCEED();
+    }
+
+    /* Handles the devices, bus_devices and programs keys of the mitm section */
+    bool IsIniEntry(const char *name);
+    Result ParseIniEntry(Selection *selection, const char *name, const char *value);
+
+    /* Adds the devices that have rules, a register cache, sampled rails or the charge policy and sorts the lists, the caller serializes config loads */
+    void Commit(Selection *selection, const rules::RuleSet &rules, const cache::CacheConfig &cache, const telemetry::TelemetryConfig &telemetry, const charge::PolicyConfig &charge_policy);
+    void LogSelection(const Selection &selection);
+
+    bool IsDeviceSelected(const Selection &selection, DeviceCode device_code);
+    bool IsBusAddressSelected(const Selection &selection, s32 bus_idx, u16 slave_address);
+
+    /* An empty program list selects every client */
+    bool IsProgramSelected(const Selection &selection, ncm::ProgramId program_id);
+
+}
@@ -16,163 +16,83 @@
 #include "i2c_mitm_settings.hpp"
 #include "logging.hpp"
 #include "i2c_mitm_service.hpp"
+#include "i2c_mitm_rules.hpp"
+#include "i2c_mitm_register_cache.hpp"
+#include "i2c_mitm_selection.hpp"
+#include "i2c_mitm_telemetry.hpp"
+#include "i2c_mitm_charge_policy.hpp"
+#include "i2c_mitm_devices.hpp"
+#include "i2c_mitm_session_pool.hpp"
 #include <switch/services/i2c.h>
 
 
 
 namespace ams::mitm::i2c {
 
-    enum CommandId {
-        CommandId_Send      = 0,
-        CommandId_Receive   = 1,
-        CommandId_Extension = 2,
-        CommandId_Count     = 3,
-    };
-
-    enum SubCommandId {
-        SubCommandId_Sleep = 0,
-    };
-
-    struct CommonCommandFormat {
-        using CommandId    = util::BitPack8::Field<0, 2>;
-        using SubCommandId = util::BitPack8::Field<2, 6>;
-    };
-
-    struct ReceiveCommandFormat {
-        using StartCondition = util::BitPack8::Field<6, 1, bool>;
-        using StopCondition  = util::BitPack8::Field<7, 1, bool>;
-        using Size           = util::BitPack8::Field<0, 8>;
-    };
-
-    struct SendCommandFormat {
-        using StartCondition = util::BitPack8::Field<6, 1, bool>;
-        using StopCondition  = util::BitPack8::Field<7, 1, bool>;
-        using Size           = util::BitPack8::Field<0, 8>;
-    };
-
-    struct SleepCommandFormat {
-        using MicroSeconds = util::BitPack8::Field<0, 8>;
-    };
-
-
-    constexpr std::string DeviceCodeToName(DeviceCode device_code) {
-        switch(device_code.GetInternalValue()) {
-        case 0x350000C9:
-            return "ClassicController";
-        case 0x35000033:
-            return "Ftm3bd56";
-        case 0x3E000001:
-            return "Tmp451 or Nct72";
-        case 0x33000001:
-            return "Alc5639";
-        case 0x3B000001:
-            return "Max77620Rtc";
-        case 0x3A000001:
-            return "Max77620Pmic";
-        case 0x3A000003:
-            return "Max77621Cpu";
-        case 0x3A000004:
-            return "Max77621Gpu";
-        case 0x39000001:
-            return "Bq24193";
-        case 0x39000033:
-            return "Max17050";
-        case 0x040000C9:
-            return "Bm92t30mwv";
-        case 0x3F000401:
-            return "Ina226Vdd15v0Hb";
-        case 0x3F000001:
-            return "Ina226VsysCpuDs or Ina226VddCpuAp (SdevMariko)";
-        case 0x3F000002:
-            return "Ina226VsysGpuDs or Ina226VddGpuAp (SdevMariko)";
-        case 0x3F000003:
-            return "Ina226VsysDdrDs or Ina226VddDdr1V1Pmic (SdevMariko)";
-        case 0x3F000402:
-            return "Ina226VsysAp";
-        case 0x3F000403:
-            return "Ina226VsysBlDs";
-        case 0x35000047:
-            return "Bh1730";
-        case 0x3F000404:
-            return "Ina226VsysCore or Ina226VddCoreAp (SdevMariko)";
-        case 0x3F000405:
-            return "Ina226Soc1V8 or Ina226VddSoc1V8 (SdevMariko)";
-        case 0x3F000406:
-            return "Ina226Lpddr1V8 or Ina226Vdd1V8 (SdevMariko)";
-        case 0x3F000407:
-            return "Ina226Reg1V32";
-        case 0x3F000408:
-            return "Ina226Vdd3V3Sys";
-        case 0x34000001:
-            return "HdmiDdc";
-        case 0x34000002:
-            return "HdmiScdc";
-        case 0x34000003:
-            return "HdmiHdcp";
-        case 0x3A000005:
-            return "Fan53528";
-        case 0x3A000002:
-            return "Max77812Pmic";
-        case 0x3A000006:
-            return "Max77812Pmic";
-        case 0x3F000409:
-            return "Ina226VddDdr0V6 (SdevMariko)";
-        case 0x36000001:
-            return "MillauNfc";
-        case 0x3A000007:
-            return "Max77801";
-        default:
-            return "Unknown";
-        }
-    }
-
     bool I2cMitmService::ShouldMitmSession(DeviceCode device_code) {
-        /* Only mitm i2c sessions for bq24193 */
-        return device_code.GetInternalValue() == 0x39000001;
+        /* Devices named in the config and devices with rules or a register cache, everything else is forwarded untouched */
+        const ScopedConfig config;
+        return selection::IsDeviceSelected(config.GetSelection(), device_code);
     }
 
     bool I2cMitmService::ShouldMitmSession(s32 bus_idx, u16 slave_address) {
-        AMS_UNUSED(bus_idx);
-        AMS_UNUSED(slave_address);
-        return false;
+        const ScopedConfig config;
+        return selection::IsBusAddressSelected(config.GetSelection(), bus_idx, slave_address);
     }
 
     bool I2cMitmService::ShouldMitm(const sm::MitmProcessInfo &process_info) {
-        AMS_UNUSED(process_info);
-        return true;
+        /* Decided once per client connection, a reload only applies to clients connecting after it */
+        const ScopedConfig config;
+        return selection::IsProgramSelected(config.GetSelection(), process_info.program_id);
     }
 
-    int GetVoltage(u8 val) {
-        int voltage = 3504;
-
-        for (u32 i = 2; i < 8; i++) {
-            if (val & (1 << i)) {
-                voltage += 4 << i;
-            }
-        }
+    template<typename Impl>
+    sf::SharedPointer<II2cSession> I2cMitmService::CreateI2cSession(::I2cSession session, DeviceCode device_code) {
+        static_assert(pool::FitsSessionObjectUnit<Impl>);
 
-        return voltage;
+        /* The session object comes from a fixed size pool, opening a session never touches the heap fs allocates from */
+        return pool::SessionObjectFactory::CreateSharedEmplaced<II2cSession, Impl>(pool::GetSessionObjectMemoryResource(),
+                                                                                 session,
+                                                                                 device_code,
+                                                                                 this->m_client_info.program_id);
     }
 
     sf::SharedPointer<II2cSession> I2cMitmService::GetI2cSessionForDevice(::I2cSession session, s32 bus_idx, s32 addr) {
-        AMS_UNUSED(bus_idx, addr);
+        /* Label the session with the device at that address, so its capture records can be told apart */
+        const DeviceInfo *info = GetDeviceInfo(bus_idx, addr);
+        const DeviceCode device_code = info != nullptr ? info->device_code : 0;
 
-        return sf::CreateSharedObjectEmplaced<II2cSession, I2cSessionService>(std::make_unique<::I2cSession>(session), 
-                                                                              0, 
-                                                                              this->m_client_info.program_id);
+        /* A monitor session checks the trace mask on every call, so SetTraceMask reaches sessions that are already open */
+        return this->CreateI2cSession<MonitorI2cSessionService>(session, device_code);
     }
 
     sf::SharedPointer<II2cSession> I2cMitmService::GetI2cSessionForDevice(::I2cSession session, DeviceCode device_code) {
-        switch (device_code.GetInternalValue()) {
-        case 0x39000001:
-            return sf::CreateSharedObjectEmplaced<II2cSession, Bq24193I2cSessionService>(std::make_unique<::I2cSession>(session),
-                                                                                         device_code,
-                                                                                         this->m_client_info.program_id);
-        default:
-            return sf::CreateSharedObjectEmplaced<II2cSession, I2cSessionService>(std::make_unique<::I2cSession>(session),
-                                                                                  device_code,
-                                                                                  this->m_client_info.program_id);
+        /* The session type is picked from the config at open, a reload applies to sessions opened after it */
+        bool use_cache, use_telemetry, use_rules;
+        {
+            const ScopedConfig config;
+            const charge::PolicyConfig &charge_policy = config.GetChargePolicy();
+            use_cache     = cache::GetDeviceCacheConfig(config.GetCache(), device_code) != nullptr;
+            use_telemetry = telemetry::IsRailSelected(config.GetTelemetry(), device_code) || charge::IsObservedDevice(charge_policy, device_code);
+            use_rules     = rules::GetDeviceRules(config.GetRules(), device_code) != nullptr ||
+                            (charge::IsEnabled(charge_policy) && charge::IsChargerDevice(device_code)) ||
+                            config.GetConfig().coalesce_reads;
+        }
+        if (use_cache) {
+            return this->CreateI2cSession<CachingI2cSessionService>(session, device_code);
+        }
+
+        /* Reads answered from the cache never reach the bus, so cached rails and charge policy sensors are not sampled */
+        if (use_telemetry) {
+            return this->CreateI2cSession<TelemetryI2cSessionService>(session, device_code);
+        }
+
+        if (use_rules) {
+            return this->CreateI2cSession<RuleI2cSessionService>(session, device_code);
         }
+
+        /* Nothing to apply, the session only forwards. Monitor keeps it traceable when SetTraceMask enables it later. */
+        return this->CreateI2cSession<MonitorI2cSessionService>(session, device_code);
     }
 
     Result I2cMitmService::OpenSessionForDev(sf::Out<sf::SharedPointer<II2cSession>> out, s32 bus_idx, u16 slave_address, ::ams::i2c::AddressingMode addressing_mode, ::ams::i2c::SpeedMode speed_mode) {
@@ -209,7 +129,7 @@ namespace ams::mitm::i2c {
 
     Result I2cMitmService::OpenSession2(sf::Out<sf::SharedPointer<II2cSession>> out, DeviceCode device_code) {
         if (ShouldMitmSession(device_code)) {
-            DEBUG_LOG("OpenSession2 dev: %s (0x%" PRIx32 "), ProgID: 0x016%" PRIx64 ", i2c session mitm enabled", DeviceCodeToName(device_code).c_str(), device_code, this->m_client_info.program_id.value);
+            DEBUG_LOG("OpenSession2 dev: %s (0x%" PRIx32 "), ProgID: 0x016%" PRIx64 ", i2c session mitm enabled", GetDeviceName(device_code), device_code, this->m_client_info.program_id.value);
             ::I2cSession session;
             const u32 in = device_code.GetInternalValue();
             R_TRY(serviceDispatchIn(this->m_forward_service.get(),
@@ -225,359 +145,9 @@ namespace ams::mitm::i2c {
 
             R_SUCCEED();
         } else {
-            DEBUG_LOG("OpenSession2 dev: %s (0x%" PRIx32 "), ProgID: 0x016%" PRIx64, DeviceCodeToName(device_code).c_str(), device_code, this->m_client_info.program_id.value);
+            DEBUG_LOG("OpenSession2 dev: %s (0x%" PRIx32 "), ProgID: 0x016%" PRIx64, GetDeviceName(device_code), device_code, this->m_client_info.program_id.value);
             R_RETURN(sm::mitm::ResultShouldForwardToSession());
         }
     }
 
-    int I2cSessionService::LogPrintHeader(char *buf, size_t buf_size) {
-        const u32 dev_id = this->m_device_code.GetInternalValue();
-        return util::TSNPrintf(buf, buf_size, "ProgID: 0x016%" PRIx64 ", I2C dev: 0x%08" PRIx32 " (%s): ", this->m_program_id.value, dev_id, DeviceCodeToName(dev_id).c_str());
-    }
-
-    void I2cSessionService::LogSendReceive(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool is_send, Result result) {
-        AMS_UNUSED(option);
-        
-        if (!this->ShouldLog()) {
-            return;
-        }
-
-        static constexpr size_t buf_size = 0x400;
-        char buf[buf_size];
-        int idx = 0;
-
-        idx += this->LogPrintHeader(buf + idx, buf_size - idx);
-        idx += util::TSNPrintf(buf + idx, buf_size - idx, "result: 0x%08" PRIx32 ", %-4s, data: [", result.GetValue(), is_send ? "send" : "recv");
-
-        for (size_t i = 0; i < size; i++) {
-            idx += util::TSNPrintf(buf + idx, buf_size - idx, "0x%02" PRIx8 "%s", data[i], i + 1 < size ? ", " : "");
-        }
-
-        idx += util::TSNPrintf(buf + idx, buf_size - idx, "]");
-
-        DEBUG_LOG("%s", buf);
-    }
-
-    void I2cSessionService::LogSend(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, Result result) {
-        return this->LogSendReceive(data, size, option, true, result);
-    }
-
-    void I2cSessionService::LogReceive(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, Result result) {
-        return this->LogSendReceive(data, size, option, false, result);
-    }
-
-    int I2cSessionService::LogPrintCommand(char *buf, size_t buf_size, const ::ams::i2c::I2cCommand *commands, size_t &num_commands) {
-        int buf_idx = 0;
-        size_t idx = 0;
-        const util::BitPack8 command = static_cast<util::BitPack8>(commands[idx]);
-
-        switch(command.Get<CommonCommandFormat::CommandId>()) {
-        case CommandId_Send:
-            {
-                idx++;
-                const u8 send_size = commands[idx];
-                idx++;
-                const u8 *send_data = commands + idx;
-                idx += send_size - 1;
-
-                buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, "[send, len: 0x%02" PRIx8 ", data: [", send_size);
-
-                for(size_t i = 0; i < send_size; i++) {
-                    buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, "0x%02" PRIx8 "%s", send_data[i], i + 1 < send_size ? ", " : "");
-                }
-
-                buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, "]]");
-            } break;
-        case CommandId_Receive:
-            {
-                idx++;
-                const u8 recv_size = commands[idx];
-
-                buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, "[recv, len: 0x%02" PRIx8 "]", recv_size);
-            } break;
-        case CommandId_Extension:
-            {
-                idx++;
-                const u8 ms = commands[idx];
-
-                buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, "[sleep, ms: 0x%02" PRIx8 "]", ms);
-            } break;
-        }
-
-        idx++;
-
-        num_commands -= idx;
-
-        return buf_idx;
-    }
-
-    void I2cSessionService::LogCommandList(const u8 *recv_data, size_t recv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, Result result) {
-        AMS_UNUSED(recv_data, recv_size, commands, num_commands, result);
-        if (!this->ShouldLog()) {
-            return;
-        }
-
-        static constexpr size_t buf_size = 0x400;
-        char buf[buf_size];
-        int buf_idx = 0;
-
-        buf_idx += this->LogPrintHeader(buf, buf_size);
-        buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, "result: 0x%08" PRIx32 ", commands: [", result.GetValue());
-
-        size_t commands_left = num_commands;
-
-        while(commands_left) {
-            buf_idx += this->LogPrintCommand(buf + buf_idx, buf_size - buf_idx, commands + num_commands - commands_left, commands_left);
-            buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, "%s", commands_left ? ", " : "");
-        }
-
-        buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, "]");
-
-        if (recv_data && recv_size) {
-            buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, ", recv data: [");
-            for(size_t i = 0; i < recv_size; i++) {
-                buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, "0x%02" PRIx8 "%s", recv_data[i], i + 1 < recv_size ? ", " : "");
-            }
-            buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, "]");
-        }
-        
-        DEBUG_LOG("%s", buf);
-    }
-
-    void I2cSessionService::LogRetryPolicy(s32 max_retry_count, s32 retry_interval_us, Result result) {
-        if (!this->ShouldLog()) {
-            return;
-        }
-
-        static constexpr size_t buf_size = 0x400;
-        char buf[buf_size];
-        int buf_idx = 0;
-
-        buf_idx += this->LogPrintHeader(buf, buf_size);
-        buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, "result: 0x%08" PRIx32 ", max retry count: %" PRIi32 ", retry interval us: %" PRIi32, result.GetValue(), max_retry_count, retry_interval_us);
-        
-        DEBUG_LOG("%s", buf);
-    }
-
-    I2cSessionService::I2cSessionService(std::unique_ptr<::I2cSession> session, DeviceCode device_code, ncm::ProgramId program_id) : m_session(std::move(session)), m_device_code(device_code), m_program_id(program_id) { }
-
-    I2cSessionService::~I2cSessionService() {
-        serviceClose(&this->m_session.get()->s);
-    }
-
-
-
-    Result I2cSessionService::SendOld(const sf::InBuffer &in_data, ::ams::i2c::TransactionOption option){
-        Result result = SendOldCb(in_data, option);
-        R_SUCCEED_IF(R_SUCCEEDED(result));
-        if (!::ams::i2c::ResultNoOverride::Includes(result)) {
-            R_THROW(result);
-        }
-
-        result = serviceDispatchIn(&this->m_session.get()->s,
-                                   0,
-                                   option,
-                                   .buffer_attrs = {SfBufferAttr_In | SfBufferAttr_HipcMapAlias},
-                                   .buffers = {{in_data.GetPointer(), in_data.GetSize()}});
-
-        this->LogSend(in_data.GetPointer(), in_data.GetSize(), option, result);
-
-        R_RETURN(result);
-    }
-
-    Result I2cSessionService::ReceiveOld(const sf::OutBuffer &out_data, ::ams::i2c::TransactionOption option){
-        Result result = ReceiveOldCb(out_data, option);
-        R_SUCCEED_IF(R_SUCCEEDED(result));
-        if (!::ams::i2c::ResultNoOverride::Includes(result)) {
-            R_THROW(result);
-        }
-
-        result = serviceDispatchIn(&this->m_session.get()->s, 
-                                          1, 
-                                          option,
-                                          .buffer_attrs = {SfBufferAttr_Out | SfBufferAttr_HipcMapAlias},
-                                          .buffers = {{out_data.GetPointer(), out_data.GetSize()}});
-       
-        this->LogReceive(out_data.GetPointer(), out_data.GetSize(), option, result);
-
-        R_RETURN(result);
-    }
-
-    Result I2cSessionService::ExecuteCommandListOld(const sf::OutBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list){
-        Result result = ExecuteCommandListOldCb(rcv_buf, command_list);
-        R_SUCCEED_IF(R_SUCCEEDED(result));
-        if (!::ams::i2c::ResultNoOverride::Includes(result)) {
-            R_THROW(result);
-        }
-
-        result = serviceDispatch(&this->m_session.get()->s,
-                                        2,
-                                        .buffer_attrs= {SfBufferAttr_Out | SfBufferAttr_HipcMapAlias, SfBufferAttr_In | SfBufferAttr_HipcPointer},
-                                        .buffers = {{rcv_buf.GetPointer(), rcv_buf.GetSize()}, {command_list.GetPointer(), command_list.GetSize()}});
-
-        this->LogCommandList(rcv_buf.GetPointer(), rcv_buf.GetSize(), command_list.GetPointer(), command_list.GetSize(), result);
-
-        R_RETURN(result);
-    }
-
-    Result I2cSessionService::Send(const sf::InAutoSelectBuffer &in_data, ::ams::i2c::TransactionOption option){
-        Result result = SendCb(in_data, option);
-        R_SUCCEED_IF(R_SUCCEEDED(result));
-        if (!::ams::i2c::ResultNoOverride::Includes(result)) {
-            R_THROW(result);
-        }
-
-        result = serviceDispatchIn(&this->m_session.get()->s,
-                                   10,
-                                   option,
-                                   .buffer_attrs = {SfBufferAttr_In | SfBufferAttr_HipcAutoSelect},
-                                   .buffers = {{in_data.GetPointer(), in_data.GetSize()}});
-
-        this->LogSend(in_data.GetPointer(), in_data.GetSize(), option, result);
-
-        R_RETURN(result);
-    }
-
-    Result I2cSessionService::Receive(const sf::OutAutoSelectBuffer &out_data, ::ams::i2c::TransactionOption option){
-        Result result = ReceiveCb(out_data, option);
-        R_SUCCEED_IF(R_SUCCEEDED(result));
-        if (!::ams::i2c::ResultNoOverride::Includes(result)) {
-            R_THROW(result);
-        }
-
-        result = serviceDispatchIn(&this->m_session.get()->s, 
-                                          11, 
-                                          option,
-                                          .buffer_attrs = {SfBufferAttr_Out | SfBufferAttr_HipcAutoSelect},
-                                          .buffers = {{out_data.GetPointer(), out_data.GetSize()}});
-
-        this->LogReceive(out_data.GetPointer(), out_data.GetSize(), option, result);
-
-        R_RETURN(result);
-    }
-
-    Result I2cSessionService::ExecuteCommandList(const sf::OutAutoSelectBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list){
-        Result result = ExecuteCommandListCb(rcv_buf, command_list);
-        R_SUCCEED_IF(R_SUCCEEDED(result));
-        if (!::ams::i2c::ResultNoOverride::Includes(result)) {
-            R_THROW(result);
-        }
-
-        result = serviceDispatch(&this->m_session.get()->s,
-                                        12,
-                                        .buffer_attrs= {SfBufferAttr_Out | SfBufferAttr_HipcAutoSelect, SfBufferAttr_In | SfBufferAttr_HipcPointer},
-                                        .buffers = {{rcv_buf.GetPointer(), rcv_buf.GetSize()}, {command_list.GetPointer(), command_list.GetSize()}});
-
-        this->LogCommandList(rcv_buf.GetPointer(), rcv_buf.GetSize(), command_list.GetPointer(), command_list.GetSize(), result);
-
-        R_RETURN(result);
-    }
-
-    Result I2cSessionService::SetRetryPolicy(s32 max_retry_count, s32 retry_interval_us){
-        Result result = SetRetryPolicyCb(max_retry_count, retry_interval_us);
-        R_SUCCEED_IF(R_SUCCEEDED(result));
-        if (!::ams::i2c::ResultNoOverride::Includes(result)) {
-            R_THROW(result);
-        }
-
-        const u32 in[] = {static_cast<u32>(max_retry_count), static_cast<u32>(retry_interval_us)};
-        result = serviceDispatchIn(&this->m_session.get()->s, 
-                                   13, 
-                                   in);
-
-        this->LogRetryPolicy(max_retry_count, retry_interval_us, result);
-
-        R_RETURN(result);
-    }
-
-    constinit util::Atomic<bool> Bq24193I2cSessionService::first_init_done = false;
-
-    Bq24193I2cSessionService::Bq24193I2cSessionService(std::unique_ptr<::I2cSession> session, DeviceCode device_code, ncm::ProgramId program_id) : I2cSessionService(std::move(session), device_code, program_id) {
-        if (!this->first_init_done.Exchange(true)) {
-            constexpr size_t buf_size = 0x100;
-            char buf[buf_size];
-            int buf_idx = 0;
-            buf_idx += this->LogPrintHeader(buf, buf_size);
-            buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, "First bq24193 session, set initial voltage");
-            DEBUG_LOG("%s", buf);
-            this->SetVoltage(0xae);
-        }
-    }
-
-    Result Bq24193I2cSessionService::SetVoltage(u8 voltage_config) {
-        u8 cmd[2] = {0x04, voltage_config};
-
-        ::ams::i2c::TransactionOption option= static_cast<::ams::i2c::TransactionOption>(::ams::i2c::TransactionOption_StartCondition | ::ams::i2c::TransactionOption_StopCondition);
-
-        Result result = serviceDispatchIn(&this->m_session.get()->s,
-                                          10,
-                                          option,
-                                          .buffer_attrs = {SfBufferAttr_In | SfBufferAttr_HipcAutoSelect},
-                                          .buffers = {{cmd, sizeof(cmd)}});
-
-        this->LogSend(cmd, sizeof(cmd), option, result);
-
-        R_RETURN(result);
-    }
-
-    Result Bq24193I2cSessionService::SendCb(const sf::InAutoSelectBuffer &in_data, ::ams::i2c::TransactionOption option) {
-        AMS_UNUSED(option);
-
-        const u8 *data = in_data.GetPointer();
-        size_t size = in_data.GetSize();
-
-        static constexpr size_t buf_size = 0x100;
-        char buf[buf_size];
-        int buf_idx = 0;
-
-        /* first, check if target device is bq24193 and send data size is 2 */
-        if (this->m_device_code != 0x39000001 ||
-            size != 2) {
-            R_RETURN(::ams::i2c::ResultNoOverride());
-        }
-
-        const I2CMitmConfig &config = GetConfig();
-
-        /* handle set charge voltage command */
-        if (data[0] == 0x04 && GetVoltage(data[1]) >= 4192 ) {
-            if (!config.voltage_config) {
-                R_RETURN(::ams::i2c::ResultNoOverride());
-            }
-
-            /* 0x04: charge voltage control register, 0xb2: 4.2V */
-            buf_idx += this->LogPrintHeader(buf, buf_size);
-            buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, "Overriding set voltage command, setting 0x%02" PRIx8 " (%" PRIi32 "mV) instead of 0x%02" PRIx8 " (%" PRIi32 "mV)", 
-                                       config.voltage_config, GetVoltage(config.voltage_config), 
-                                       data[1], GetVoltage(data[1]));
-            DEBUG_LOG("%s", buf);
-
-            R_RETURN(this->SetVoltage(config.voltage_config));
-        }
-        /* Also override voltage when charging is enabled */
-        // } else if(data[0] == 0x01 && ((data[1] >> 4) & 0x3) == 1) {
-        //     if (!config.voltage_config) {
-        //         R_RETURN(::ams::i2c::ResultNoOverride());
-        //     }
-
-        //     /* 0x01: Power On Config Register, Bit 4:5 = 1: Battery Charge Enabled */
-        //     buf_idx += this->LogPrintHeader(buf, buf_size);
-        //     buf_idx += util::TSNPrintf(buf + buf_idx, buf_size - buf_idx, "Charging is being enabled, also set voltage to 0x%02" PRIx8 " (%" PRIi32 "mV)", config.voltage_config, GetVoltage(config.voltage_config));
-        //     DEBUG_LOG("%s", buf);
-
-        //     Result result = serviceDispatchIn(&this->m_session.get()->s,
-        //                                       10,
-        //                                       option,
-        //                                       .buffer_attrs = {SfBufferAttr_In | SfBufferAttr_HipcAutoSelect},
-        //                                       .buffers = {{override_voltage_cmd, sizeof(override_voltage_cmd)}});
-
-        //     this->LogSend(override_voltage_cmd, sizeof(override_voltage_cmd), option, result);
-
-        //     /* Still need to send the original command */
-        //     R_TRY(result);
-        //     R_RETURN(::ams::i2c::ResultNoOverride());
-        // }
-
-        R_RETURN(::ams::i2c::ResultNoOverride());
-    }
-
 }
\ No newline at end of file
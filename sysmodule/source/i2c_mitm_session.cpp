@@ -0,0 +1,801 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "i2c_mitm_session.hpp"
+#include "i2c_command_list.hpp"
+#include "i2c_mitm_devices.hpp"
+#include "i2c_mitm_settings.hpp"
+#include "i2c_mitm_stats.hpp"
+#include "i2c_mitm_rules.hpp"
+#include "i2c_mitm_register_cache.hpp"
+#include "i2c_mitm_telemetry.hpp"
+#include "i2c_mitm_charge_policy.hpp"
+#include "i2c_mitm_log_filter.hpp"
+#include "logging.hpp"
+
+namespace ams::mitm::i2c {
+
+    /* Writes are the start register followed by at least one value. A longer burst wraps around and writes every register. */
+    constexpr size_t MaxRuleWriteSize = 0x100;
+    static_assert(MaxRuleWriteSize >= cmdlist::MaxCommandListSize);
+
+    namespace {
+
+        constinit std::atomic<u16> g_next_session_id = 1;
+
+        /* Wraps around after 65535 sessions, skipping 0 */
+        u16 AllocateSessionId() {
+            u16 id = g_next_session_id.fetch_add(1);
+            while (id == 0) {
+                id = g_next_session_id.fetch_add(1);
+            }
+            return id;
+        }
+
+    }
+
+    /* Matches the command list nn::i2c builds to read registers: Send(reg) followed by Receive(count) */
+    bool GetRegisterRead(const ::ams::i2c::I2cCommand *commands, size_t num_commands, size_t rcv_size, u8 *out_reg, size_t *out_count) {
+        cmdlist::CommandListReader reader(commands, num_commands, rcv_size);
+
+        cmdlist::Command send, receive, extra;
+        if (!reader.Next(std::addressof(send)) || send.kind != cmdlist::CommandKind_Send || send.size != 1 ||
+            !reader.Next(std::addressof(receive)) || receive.kind != cmdlist::CommandKind_Receive || receive.size == 0 ||
+            reader.Next(std::addressof(extra)) || reader.GetError() != cmdlist::ParseError_None) {
+            return false;
+        }
+
+        *out_reg   = send.data[0];
+        *out_count = receive.size;
+        return true;
+    }
+
+    /* Calls on_write(reg, count) for every Send of a register followed by data, up to the first malformed command */
+    template<typename F>
+    void ForEachRegisterWrite(const ::ams::i2c::I2cCommand *commands, size_t num_commands, size_t rcv_size, F on_write) {
+        cmdlist::ForEachCommand(commands, num_commands, rcv_size, [&](const cmdlist::Command &command) {
+            if (command.kind == cmdlist::CommandKind_Send && command.size >= 2) {
+                on_write(command.data[0], command.size - 1);
+            }
+        });
+    }
+
+    int I2cSessionServiceBase::LogPrintHeader(char *buf, size_t buf_size) {
+        const u32 dev_id = this->m_device_code.GetInternalValue();
+        return util::TSNPrintf(buf, buf_size, "ProgID: 0x016%" PRIx64 ", I2C dev: 0x%08" PRIx32 " (%s): ", this->m_program_id.value, dev_id, GetDeviceName(dev_id));
+    }
+
+    void I2cSessionServiceBase::LogCapture(capture::Op op, u8 option, Result result, const void *data, size_t size, const void *aux, size_t aux_size) {
+        const capture::RecordHeader header = {
+            .tick        = static_cast<u64>(os::GetSystemTick().GetInt64Value()),
+            .program_id  = this->m_program_id.value,
+            .device_code = this->m_device_code.GetInternalValue(),
+            .result      = result.GetValue(),
+            .op          = op,
+            .option      = option,
+            .size        = static_cast<u16>(std::min<size_t>(size, std::numeric_limits<u16>::max())),
+            .aux_size    = static_cast<u16>(std::min<size_t>(aux_size, std::numeric_limits<u16>::max())),
+            .session_id  = this->m_session_id,
+        };
+
+        if (logfilter::ShouldWrite(header, data, aux)) {
+            log::WriteCapture(header, data, aux);
+        }
+    }
+
+    void I2cSessionServiceBase::LogSendReceive(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool is_send, Result result) {
+        if (!this->ShouldTrace(is_send ? trace::Op_Send : trace::Op_Receive)) {
+            return;
+        }
+
+        this->LogCapture(is_send ? capture::Op_Send : capture::Op_Receive, option, result, data, size, nullptr, 0);
+    }
+
+    void I2cSessionServiceBase::LogSend(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, Result result) {
+        return this->LogSendReceive(data, size, option, true, result);
+    }
+
+    void I2cSessionServiceBase::LogReceive(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, Result result) {
+        return this->LogSendReceive(data, size, option, false, result);
+    }
+
+    void I2cSessionServiceBase::LogCommandList(const u8 *recv_data, size_t recv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, Result result) {
+        if (!this->ShouldTrace(trace::Op_CommandList)) {
+            return;
+        }
+
+        this->LogCapture(capture::Op_ExecuteCommandList, 0, result, commands, num_commands, recv_data, recv_data ? recv_size : 0);
+    }
+
+    void I2cSessionServiceBase::LogRetryPolicy(s32 max_retry_count, s32 retry_interval_us, Result result) {
+        if (!this->ShouldTrace(trace::Op_RetryPolicy)) {
+            return;
+        }
+
+        const s32 policy[] = {max_retry_count, retry_interval_us};
+        this->LogCapture(capture::Op_SetRetryPolicy, 0, result, policy, sizeof(policy), nullptr, 0);
+    }
+
+    void I2cSessionServiceBase::LogSessionEvent(capture::Op op) {
+        /* Recorded while any op of the device is traced, so the records of the session can be tied to it */
+        if (!this->ShouldTrace(trace::AllOps)) {
+            return;
+        }
+
+        this->LogCapture(op, 0, ResultSuccess(), nullptr, 0, nullptr, 0);
+    }
+
+    I2cSessionServiceBase::I2cSessionServiceBase(I2cSessionTransport::SessionHandle session, DeviceCode device_code, ncm::ProgramId program_id) : m_transport(std::move(session)), m_program_id(program_id), m_stats(stats::GetDeviceStats(device_code)), m_trace_mask(trace::GetMask(device_code)), m_device_code(device_code), m_session_id(AllocateSessionId()) {
+        this->LogSessionEvent(capture::Op_OpenSession);
+    }
+
+    I2cSessionServiceBase::~I2cSessionServiceBase() {
+        this->LogSessionEvent(capture::Op_CloseSession);
+    }
+
+    template<typename Policy>
+    Result I2cSessionServiceImpl<Policy>::SendOld(const sf::InBuffer &in_data, ::ams::i2c::TransactionOption option){
+        if constexpr (Policy::EnableOverrides) {
+            const Result result = this->SendOldCb(in_data, option);
+            R_SUCCEED_IF(R_SUCCEEDED(result));
+            if (!::ams::i2c::ResultNoOverride::Includes(result)) {
+                R_THROW(result);
+            }
+        }
+
+        const os::Tick start = os::GetSystemTick();
+        const Result result = this->m_transport.Send(in_data.GetPointer(), in_data.GetSize(), option, true);
+        stats::RecordLatency(this->m_stats, stats::Command_Send, start, result);
+
+        this->LogSend(in_data.GetPointer(), in_data.GetSize(), option, result);
+
+        R_RETURN(result);
+    }
+
+    template<typename Policy>
+    Result I2cSessionServiceImpl<Policy>::ReceiveOld(const sf::OutBuffer &out_data, ::ams::i2c::TransactionOption option){
+        if constexpr (Policy::EnableOverrides) {
+            const Result result = this->ReceiveOldCb(out_data, option);
+            R_SUCCEED_IF(R_SUCCEEDED(result));
+            if (!::ams::i2c::ResultNoOverride::Includes(result)) {
+                R_THROW(result);
+            }
+        }
+
+        const os::Tick start = os::GetSystemTick();
+        const Result result = this->m_transport.Receive(out_data.GetPointer(), out_data.GetSize(), option, true);
+        stats::RecordLatency(this->m_stats, stats::Command_Receive, start, result);
+
+        this->LogReceive(out_data.GetPointer(), out_data.GetSize(), option, result);
+
+        R_RETURN(result);
+    }
+
+    template<typename Policy>
+    Result I2cSessionServiceImpl<Policy>::ExecuteCommandListOld(const sf::OutBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list){
+        if constexpr (Policy::EnableOverrides) {
+            const Result result = this->ExecuteCommandListOldCb(rcv_buf, command_list);
+            R_SUCCEED_IF(R_SUCCEEDED(result));
+            if (!::ams::i2c::ResultNoOverride::Includes(result)) {
+                R_THROW(result);
+            }
+        }
+
+        const os::Tick start = os::GetSystemTick();
+        const Result result = this->m_transport.ExecuteCommandList(rcv_buf.GetPointer(), rcv_buf.GetSize(), command_list.GetPointer(), command_list.GetSize(), true);
+        stats::RecordLatency(this->m_stats, stats::Command_ExecuteCommandList, start, result);
+
+        this->LogCommandList(rcv_buf.GetPointer(), rcv_buf.GetSize(), command_list.GetPointer(), command_list.GetSize(), result);
+
+        R_RETURN(result);
+    }
+
+    template<typename Policy>
+    Result I2cSessionServiceImpl<Policy>::Send(const sf::InAutoSelectBuffer &in_data, ::ams::i2c::TransactionOption option){
+        if constexpr (Policy::EnableOverrides) {
+            const Result result = this->SendCb(in_data, option);
+            R_SUCCEED_IF(R_SUCCEEDED(result));
+            if (!::ams::i2c::ResultNoOverride::Includes(result)) {
+                R_THROW(result);
+            }
+        }
+
+        const os::Tick start = os::GetSystemTick();
+        const Result result = this->m_transport.Send(in_data.GetPointer(), in_data.GetSize(), option, false);
+        stats::RecordLatency(this->m_stats, stats::Command_Send, start, result);
+
+        this->LogSend(in_data.GetPointer(), in_data.GetSize(), option, result);
+
+        R_RETURN(result);
+    }
+
+    template<typename Policy>
+    Result I2cSessionServiceImpl<Policy>::Receive(const sf::OutAutoSelectBuffer &out_data, ::ams::i2c::TransactionOption option){
+        if constexpr (Policy::EnableOverrides) {
+            const Result result = this->ReceiveCb(out_data, option);
+            R_SUCCEED_IF(R_SUCCEEDED(result));
+            if (!::ams::i2c::ResultNoOverride::Includes(result)) {
+                R_THROW(result);
+            }
+        }
+
+        const os::Tick start = os::GetSystemTick();
+        const Result result = this->m_transport.Receive(out_data.GetPointer(), out_data.GetSize(), option, false);
+        stats::RecordLatency(this->m_stats, stats::Command_Receive, start, result);
+
+        this->LogReceive(out_data.GetPointer(), out_data.GetSize(), option, result);
+
+        R_RETURN(result);
+    }
+
+    template<typename Policy>
+    Result I2cSessionServiceImpl<Policy>::ExecuteCommandList(const sf::OutAutoSelectBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list){
+        if constexpr (Policy::EnableOverrides) {
+            const Result result = this->ExecuteCommandListCb(rcv_buf, command_list);
+            R_SUCCEED_IF(R_SUCCEEDED(result));
+            if (!::ams::i2c::ResultNoOverride::Includes(result)) {
+                R_THROW(result);
+            }
+        }
+
+        const os::Tick start = os::GetSystemTick();
+        const Result result = this->m_transport.ExecuteCommandList(rcv_buf.GetPointer(), rcv_buf.GetSize(), command_list.GetPointer(), command_list.GetSize(), false);
+        stats::RecordLatency(this->m_stats, stats::Command_ExecuteCommandList, start, result);
+
+        this->LogCommandList(rcv_buf.GetPointer(), rcv_buf.GetSize(), command_list.GetPointer(), command_list.GetSize(), result);
+
+        R_RETURN(result);
+    }
+
+    template<typename Policy>
+    Result I2cSessionServiceImpl<Policy>::SetRetryPolicy(s32 max_retry_count, s32 retry_interval_us){
+        if constexpr (Policy::EnableOverrides) {
+            const Result result = this->SetRetryPolicyCb(max_retry_count, retry_interval_us);
+            R_SUCCEED_IF(R_SUCCEEDED(result));
+            if (!::ams::i2c::ResultNoOverride::Includes(result)) {
+                R_THROW(result);
+            }
+        }
+
+        const os::Tick start = os::GetSystemTick();
+        const Result result = this->m_transport.SetRetryPolicy(max_retry_count, retry_interval_us);
+        stats::RecordLatency(this->m_stats, stats::Command_SetRetryPolicy, start, result);
+
+        this->LogRetryPolicy(max_retry_count, retry_interval_us, result);
+
+        R_RETURN(result);
+    }
+
+    template class I2cSessionServiceImpl<MonitorSessionPolicy>;
+    template class I2cSessionServiceImpl<OverrideSessionPolicy>;
+
+    RuleI2cSessionService::RuleI2cSessionService(I2cSessionTransport::SessionHandle session, DeviceCode device_code, ncm::ProgramId program_id) : I2cSessionService(std::move(session), device_code, program_id), m_deferred_reg(-1), m_deferred_option(), m_deferred_use_old_command(false) {
+        /* Do the on_open writes of the first session for the device */
+        rules::RegisterWrite writes[rules::MaxRulesPerDevice];
+        size_t num_writes = 0;
+        {
+            const ScopedConfig config;
+            if (const rules::DeviceRules *device_rules = rules::GetDeviceRules(config.GetRules(), device_code); device_rules != nullptr) {
+                num_writes = rules::TakeOpenWrites(*device_rules, writes, std::size(writes));
+            }
+        }
+
+        for (size_t i = 0; i < num_writes; i++) {
+            DEBUG_LOG("First session for dev 0x%08" PRIx32 ", writing 0x%02" PRIx8 " to reg 0x%02" PRIx8, device_code.GetInternalValue(), writes[i].value, writes[i].reg);
+
+            const u8 cmd[2] = {writes[i].reg, writes[i].value};
+            this->SendInjected(cmd, sizeof(cmd), hos::GetVersion() < hos::Version_6_0_0);
+        }
+    }
+
+    Result RuleI2cSessionService::SendDirect(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+        const os::Tick start = os::GetSystemTick();
+        const Result result = this->m_transport.Send(data, size, option, use_old_command);
+        stats::RecordLatency(this->m_stats, stats::Command_Send, start, result);
+
+        this->LogSend(data, size, option, result);
+
+        R_RETURN(result);
+    }
+
+    Result RuleI2cSessionService::SendInjected(const u8 *data, size_t size, bool use_old_command) {
+        const auto option = static_cast<::ams::i2c::TransactionOption>(::ams::i2c::TransactionOption_StartCondition | ::ams::i2c::TransactionOption_StopCondition);
+
+        const os::Tick start = os::GetSystemTick();
+        const Result result = this->m_transport.Send(data, size, option, use_old_command);
+        stats::RecordLatency(this->m_stats, stats::Command_Send, start, result);
+
+        if (this->ShouldTrace(trace::Op_Send)) {
+            this->LogCapture(capture::Op_Send, option | capture::OptionFlag_Injected, result, data, size, nullptr, 0);
+        }
+
+        R_RETURN(result);
+    }
+
+    Result RuleI2cSessionService::ReceiveDirect(u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+        const os::Tick start = os::GetSystemTick();
+        const Result result = this->m_transport.Receive(data, size, option, use_old_command);
+        stats::RecordLatency(this->m_stats, stats::Command_Receive, start, result);
+
+        this->LogReceive(data, size, option, result);
+
+        R_RETURN(result);
+    }
+
+    Result RuleI2cSessionService::ExecuteCommandListDirect(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, bool use_old_command) {
+        const os::Tick start = os::GetSystemTick();
+        const Result result = this->m_transport.ExecuteCommandList(rcv_data, rcv_size, commands, num_commands, use_old_command);
+        stats::RecordLatency(this->m_stats, stats::Command_ExecuteCommandList, start, result);
+
+        this->LogCommandList(rcv_data, rcv_size, commands, num_commands, result);
+
+        R_RETURN(result);
+    }
+
+    Result RuleI2cSessionService::ApplyWriteRules(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+        if (size < 2) {
+            R_RETURN(::ams::i2c::ResultNoOverride());
+        }
+
+        /* Rules are looked up on every write so a config reload applies to open sessions */
+        u8 buf[MaxRuleWriteSize];
+        rules::Verdict verdict = rules::Verdict_Forward;
+        {
+            const ScopedConfig config;
+            const rules::DeviceRules *device_rules = rules::GetDeviceRules(config.GetRules(), this->m_device_code);
+            const charge::PolicyConfig &charge_policy = config.GetChargePolicy();
+            if (device_rules == nullptr && !(charge::IsEnabled(charge_policy) && charge::IsChargerDevice(this->m_device_code))) {
+                R_RETURN(::ams::i2c::ResultNoOverride());
+            }
+
+            /* Such a burst also writes the ruled registers, fail it like a NACKed write instead of letting it past the rules */
+            if (size > MaxRuleWriteSize) {
+                log::DebugLog("Failing a write of %zu bytes to dev 0x%08" PRIx32 ", too long to apply its rules to\n", size, this->m_device_code.GetInternalValue());
+                R_THROW(::ams::i2c::ResultNoAck());
+            }
+
+            std::memcpy(buf, data, size);
+            if (device_rules != nullptr) {
+                verdict = rules::ApplyToWrite(*device_rules, buf, size);
+            }
+            /* The policy has the last word on the charge voltage, chrg_voltage only sets its default */
+            if (verdict != rules::Verdict_Drop && charge::ApplyToWrite(charge_policy, this->m_device_code, buf, size)) {
+                verdict = rules::Verdict_Modified;
+            }
+        }
+
+        switch (verdict) {
+        case rules::Verdict_Modified:
+            R_RETURN(this->SendDirect(buf, size, option, use_old_command));
+        case rules::Verdict_Drop:
+            R_SUCCEED();
+        case rules::Verdict_Forward:
+        default:
+            R_RETURN(::ams::i2c::ResultNoOverride());
+        }
+    }
+
+    Result RuleI2cSessionService::ApplyCommandListRules(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, bool use_old_command) {
+        if (num_commands > cmdlist::MaxCommandListSize) {
+            R_RETURN(::ams::i2c::ResultNoOverride());
+        }
+
+        /* The list is only copied once a rule changes one of its writes, everything else is forwarded as is */
+        u8 list[cmdlist::MaxCommandListSize];
+        size_t list_size = 0;
+        size_t copied = 0;
+        {
+            const ScopedConfig config;
+            const rules::DeviceRules *device_rules = rules::GetDeviceRules(config.GetRules(), this->m_device_code);
+            const charge::PolicyConfig &charge_policy = config.GetChargePolicy();
+            if (device_rules == nullptr && !(charge::IsEnabled(charge_policy) && charge::IsChargerDevice(this->m_device_code))) {
+                R_RETURN(::ams::i2c::ResultNoOverride());
+            }
+
+            cmdlist::CommandListReader reader(commands, num_commands, rcv_size);
+            cmdlist::Command command;
+            while (reader.Next(std::addressof(command))) {
+                /* A send is part of the list, so it always fits MaxRuleWriteSize */
+                if (command.kind != cmdlist::CommandKind_Send || command.size < 2) {
+                    continue;
+                }
+
+                u8 buf[MaxRuleWriteSize];
+                std::memcpy(buf, command.data, command.size);
+
+                rules::Verdict verdict = device_rules != nullptr ? rules::ApplyToWrite(*device_rules, buf, command.size) : rules::Verdict_Forward;
+                if (verdict != rules::Verdict_Drop && charge::ApplyToWrite(charge_policy, this->m_device_code, buf, command.size)) {
+                    verdict = rules::Verdict_Modified;
+                }
+                /* Only a write that ends the transfer can be left out, the command after any other one continues it */
+                if (verdict == rules::Verdict_Forward || (verdict == rules::Verdict_Drop && !command.stop_condition)) {
+                    continue;
+                }
+
+                /* Copy up to the send's header, then the header with the patched data unless the write is dropped */
+                const size_t header_offset = (command.data - commands) - 2;
+                std::memcpy(list + list_size, commands + copied, header_offset - copied);
+                list_size += header_offset - copied;
+                if (verdict == rules::Verdict_Modified) {
+                    std::memcpy(list + list_size, commands + header_offset, 2);
+                    std::memcpy(list + list_size + 2, buf, command.size);
+                    list_size += 2 + command.size;
+                }
+                copied = header_offset + 2 + command.size;
+            }
+
+            /* Malformed lists are left to the i2c service to reject */
+            if (reader.GetError() != cmdlist::ParseError_None || copied == 0) {
+                R_RETURN(::ams::i2c::ResultNoOverride());
+            }
+        }
+
+        std::memcpy(list + list_size, commands + copied, num_commands - copied);
+        list_size += num_commands - copied;
+
+        /* Every command was a dropped write */
+        R_SUCCEED_IF(list_size == 0);
+
+        R_RETURN(this->ExecuteCommandListDirect(rcv_data, rcv_size, list, list_size, use_old_command));
+    }
+
+    void RuleI2cSessionService::DeferSend(u8 reg, ::ams::i2c::TransactionOption option, bool use_old_command) {
+        this->m_deferred_reg             = reg;
+        this->m_deferred_option          = option;
+        this->m_deferred_use_old_command = use_old_command;
+    }
+
+    Result RuleI2cSessionService::FlushDeferredSend() {
+        R_SUCCEED_IF(this->m_deferred_reg < 0);
+
+        const u8 reg = static_cast<u8>(this->m_deferred_reg);
+        this->m_deferred_reg = -1;
+        R_RETURN(this->SendDirect(std::addressof(reg), sizeof(reg), this->m_deferred_option, this->m_deferred_use_old_command));
+    }
+
+    s32 RuleI2cSessionService::ApplyChargePolicy(bool use_old_command) {
+        if (!charge::IsChargerDevice(this->m_device_code)) {
+            return -1;
+        }
+
+        charge::PendingWrite write;
+        {
+            const ScopedConfig config;
+            if (!charge::TakePendingWrite(config.GetChargePolicy(), this->m_device_code, std::addressof(write))) {
+                return -1;
+            }
+        }
+
+        /* The client's call goes ahead either way, a failed write is tried again before its next one */
+        const u8 cmd[2] = {write.reg, write.value};
+        if (R_FAILED(this->SendInjected(cmd, sizeof(cmd), use_old_command))) {
+            charge::RestorePendingWrite(write);
+        }
+
+        return write.reg;
+    }
+
+    Result RuleI2cSessionService::ReceiveDeferred(u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+        AMS_ASSERT(this->m_deferred_reg >= 0);
+
+        bool coalesce;
+        {
+            const ScopedConfig config;
+            coalesce = config.GetConfig().coalesce_reads;
+        }
+
+        /* A receive command holds at most 255 bytes, and both halves have to go through the same command */
+        if (!coalesce || size > std::numeric_limits<u8>::max() || use_old_command != this->m_deferred_use_old_command) {
+            R_TRY(this->FlushDeferredSend());
+            R_RETURN(this->ReceiveDirect(data, size, option, use_old_command));
+        }
+
+        const auto to_flags = [](::ams::i2c::TransactionOption option) -> u8 {
+            return ((option & ::ams::i2c::TransactionOption_StartCondition) ? (1 << 6) : 0) |
+                   ((option & ::ams::i2c::TransactionOption_StopCondition)  ? (1 << 7) : 0);
+        };
+
+        const ::ams::i2c::I2cCommand commands[] = {
+            static_cast<u8>(cmdlist::CommandId_Send | to_flags(this->m_deferred_option)), 1, static_cast<u8>(this->m_deferred_reg),
+            static_cast<u8>(cmdlist::CommandId_Receive | to_flags(option)), static_cast<u8>(size),
+        };
+        this->m_deferred_reg = -1;
+
+        R_RETURN(this->ExecuteCommandListDirect(data, size, commands, sizeof(commands), use_old_command));
+    }
+
+    Result RuleI2cSessionService::RuleSend(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+        R_TRY(this->FlushDeferredSend());
+        if (option & ::ams::i2c::TransactionOption_StartCondition) {
+            this->ApplyChargePolicy(use_old_command);
+        }
+
+        if (IsRegisterSelect(size, option)) {
+            bool coalesce;
+            {
+                const ScopedConfig config;
+                coalesce = config.GetConfig().coalesce_reads;
+            }
+            if (coalesce) {
+                this->DeferSend(data[0], option, use_old_command);
+                R_SUCCEED();
+            }
+        }
+
+        R_RETURN(this->ApplyWriteRules(data, size, option, use_old_command));
+    }
+
+    Result RuleI2cSessionService::RuleExecuteCommandList(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, bool use_old_command) {
+        R_TRY(this->FlushDeferredSend());
+        this->ApplyChargePolicy(use_old_command);
+        R_RETURN(this->ApplyCommandListRules(rcv_data, rcv_size, commands, num_commands, use_old_command));
+    }
+
+    Result RuleI2cSessionService::SendOldCb(const sf::InBuffer &in_data, ::ams::i2c::TransactionOption option) {
+        R_RETURN(this->RuleSend(in_data.GetPointer(), in_data.GetSize(), option, true));
+    }
+
+    Result RuleI2cSessionService::ReceiveOldCb(const sf::OutBuffer &out_data, ::ams::i2c::TransactionOption option) {
+        R_UNLESS(this->m_deferred_reg >= 0, ::ams::i2c::ResultNoOverride());
+        R_RETURN(this->ReceiveDeferred(out_data.GetPointer(), out_data.GetSize(), option, true));
+    }
+
+    Result RuleI2cSessionService::ExecuteCommandListOldCb(const sf::OutBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list) {
+        R_RETURN(this->RuleExecuteCommandList(rcv_buf.GetPointer(), rcv_buf.GetSize(), command_list.GetPointer(), command_list.GetSize(), true));
+    }
+
+    Result RuleI2cSessionService::SendCb(const sf::InAutoSelectBuffer &in_data, ::ams::i2c::TransactionOption option) {
+        R_RETURN(this->RuleSend(in_data.GetPointer(), in_data.GetSize(), option, false));
+    }
+
+    Result RuleI2cSessionService::ReceiveCb(const sf::OutAutoSelectBuffer &out_data, ::ams::i2c::TransactionOption option) {
+        R_UNLESS(this->m_deferred_reg >= 0, ::ams::i2c::ResultNoOverride());
+        R_RETURN(this->ReceiveDeferred(out_data.GetPointer(), out_data.GetSize(), option, false));
+    }
+
+    Result RuleI2cSessionService::ExecuteCommandListCb(const sf::OutAutoSelectBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list) {
+        R_RETURN(this->RuleExecuteCommandList(rcv_buf.GetPointer(), rcv_buf.GetSize(), command_list.GetPointer(), command_list.GetSize(), false));
+    }
+
+    Result RuleI2cSessionService::SetRetryPolicyCb(s32 max_retry_count, s32 retry_interval_us) {
+        AMS_UNUSED(max_retry_count, retry_interval_us);
+        R_TRY(this->FlushDeferredSend());
+        R_RETURN(::ams::i2c::ResultNoOverride());
+    }
+
+    CachingI2cSessionService::CachingI2cSessionService(I2cSessionTransport::SessionHandle session, DeviceCode device_code, ncm::ProgramId program_id) : RuleI2cSessionService(std::move(session), device_code, program_id), m_cache(cache::GetRegisterCache(device_code)) { }
+
+    Result CachingI2cSessionService::CachedSend(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+        R_TRY(this->FlushDeferredSend());
+        if (option & ::ams::i2c::TransactionOption_StartCondition) {
+            this->InvalidateChargePolicyWrite(this->ApplyChargePolicy(use_old_command));
+        }
+
+        /* A register select for a read, hold it back in case the cache can answer the read or it can be coalesced with it */
+        if (IsRegisterSelect(size, option)) {
+            const ScopedConfig config;
+            const cache::DeviceCacheConfig *cache_config = cache::GetDeviceCacheConfig(config.GetCache(), this->m_device_code);
+            if (config.GetConfig().coalesce_reads || (this->m_cache != nullptr && cache_config != nullptr && cache::IsCacheable(*cache_config, data[0], 1))) {
+                this->DeferSend(data[0], option, use_old_command);
+                R_SUCCEED();
+            }
+        }
+
+        if (size < 2 || this->m_cache == nullptr) {
+            R_RETURN(this->ApplyWriteRules(data, size, option, use_old_command));
+        }
+
+        /* Invalidate around the write, so neither a read racing it nor one before it is served afterwards */
+        cache::Invalidate(this->m_cache, data[0], size - 1);
+
+        Result result = this->ApplyWriteRules(data, size, option, use_old_command);
+        if (::ams::i2c::ResultNoOverride::Includes(result)) {
+            result = this->SendDirect(data, size, option, use_old_command);
+        }
+
+        cache::Invalidate(this->m_cache, data[0], size - 1);
+        R_RETURN(result);
+    }
+
+    void CachingI2cSessionService::InvalidateChargePolicyWrite(s32 reg) {
+        if (reg >= 0 && this->m_cache != nullptr) {
+            cache::Invalidate(this->m_cache, static_cast<u8>(reg), 1);
+        }
+    }
+
+    Result CachingI2cSessionService::CachedReceive(u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+        if (this->m_deferred_reg < 0) {
+            R_RETURN(::ams::i2c::ResultNoOverride());
+        }
+        if (this->m_cache == nullptr) {
+            R_RETURN(this->ReceiveDeferred(data, size, option, use_old_command));
+        }
+
+        const u8 reg = static_cast<u8>(this->m_deferred_reg);
+        {
+            const ScopedConfig config;
+            const cache::DeviceCacheConfig *cache_config = cache::GetDeviceCacheConfig(config.GetCache(), this->m_device_code);
+            if (cache_config != nullptr && cache::Lookup(this->m_cache, *cache_config, reg, data, size)) {
+                this->m_deferred_reg = -1;
+                R_SUCCEED();
+            }
+        }
+
+        /* Miss, select the register and read it from the device */
+        const u32 generation = cache::GetGeneration(this->m_cache);
+        const Result result = this->ReceiveDeferred(data, size, option, use_old_command);
+        if (R_SUCCEEDED(result)) {
+            cache::Update(this->m_cache, generation, reg, data, size);
+        }
+
+        R_RETURN(result);
+    }
+
+    Result CachingI2cSessionService::CachedExecuteCommandList(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, bool use_old_command) {
+        R_TRY(this->FlushDeferredSend());
+        this->InvalidateChargePolicyWrite(this->ApplyChargePolicy(use_old_command));
+        if (this->m_cache == nullptr) {
+            R_RETURN(::ams::i2c::ResultNoOverride());
+        }
+
+        u8 reg;
+        size_t count;
+        if (GetRegisterRead(commands, num_commands, rcv_size, std::addressof(reg), std::addressof(count))) {
+            {
+                const ScopedConfig config;
+                const cache::DeviceCacheConfig *cache_config = cache::GetDeviceCacheConfig(config.GetCache(), this->m_device_code);
+                if (cache_config != nullptr && cache::Lookup(this->m_cache, *cache_config, reg, rcv_data, count)) {
+                    R_SUCCEED();
+                }
+            }
+
+            const u32 generation = cache::GetGeneration(this->m_cache);
+            const Result result = this->ExecuteCommandListDirect(rcv_data, rcv_size, commands, num_commands, use_old_command);
+            if (R_SUCCEEDED(result)) {
+                cache::Update(this->m_cache, generation, reg, rcv_data, count);
+            }
+
+            R_RETURN(result);
+        }
+
+        bool has_writes = false;
+        ForEachRegisterWrite(commands, num_commands, rcv_size, [&](u8 write_reg, size_t write_count) {
+            cache::Invalidate(this->m_cache, write_reg, write_count);
+            has_writes = true;
+        });
+        if (!has_writes) {
+            R_RETURN(::ams::i2c::ResultNoOverride());
+        }
+
+        Result result = this->ApplyCommandListRules(rcv_data, rcv_size, commands, num_commands, use_old_command);
+        if (::ams::i2c::ResultNoOverride::Includes(result)) {
+            result = this->ExecuteCommandListDirect(rcv_data, rcv_size, commands, num_commands, use_old_command);
+        }
+        ForEachRegisterWrite(commands, num_commands, rcv_size, [&](u8 write_reg, size_t write_count) {
+            cache::Invalidate(this->m_cache, write_reg, write_count);
+        });
+
+        R_RETURN(result);
+    }
+
+    Result CachingI2cSessionService::SendOldCb(const sf::InBuffer &in_data, ::ams::i2c::TransactionOption option) {
+        R_RETURN(this->CachedSend(in_data.GetPointer(), in_data.GetSize(), option, true));
+    }
+
+    Result CachingI2cSessionService::ReceiveOldCb(const sf::OutBuffer &out_data, ::ams::i2c::TransactionOption option) {
+        R_RETURN(this->CachedReceive(out_data.GetPointer(), out_data.GetSize(), option, true));
+    }
+
+    Result CachingI2cSessionService::ExecuteCommandListOldCb(const sf::OutBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list) {
+        R_RETURN(this->CachedExecuteCommandList(rcv_buf.GetPointer(), rcv_buf.GetSize(), command_list.GetPointer(), command_list.GetSize(), true));
+    }
+
+    Result CachingI2cSessionService::SendCb(const sf::InAutoSelectBuffer &in_data, ::ams::i2c::TransactionOption option) {
+        R_RETURN(this->CachedSend(in_data.GetPointer(), in_data.GetSize(), option, false));
+    }
+
+    Result CachingI2cSessionService::ReceiveCb(const sf::OutAutoSelectBuffer &out_data, ::ams::i2c::TransactionOption option) {
+        R_RETURN(this->CachedReceive(out_data.GetPointer(), out_data.GetSize(), option, false));
+    }
+
+    Result CachingI2cSessionService::ExecuteCommandListCb(const sf::OutAutoSelectBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list) {
+        R_RETURN(this->CachedExecuteCommandList(rcv_buf.GetPointer(), rcv_buf.GetSize(), command_list.GetPointer(), command_list.GetSize(), false));
+    }
+
+    TelemetryI2cSessionService::TelemetryI2cSessionService(I2cSessionTransport::SessionHandle session, DeviceCode device_code, ncm::ProgramId program_id) : RuleI2cSessionService(std::move(session), device_code, program_id), m_rail(telemetry::GetRail(device_code)), m_pointer(-1) { }
+
+    void TelemetryI2cSessionService::Observe(const ScopedConfig &config, u8 reg, const u8 *values, size_t size) {
+        /* A rail no longer sampled since a config reload gets a bucket length of 0 */
+        const telemetry::TelemetryConfig &telemetry_config = config.GetTelemetry();
+        telemetry::RecordRegister(this->m_rail, telemetry::IsRailSelected(telemetry_config, this->m_device_code) ? telemetry_config.bucket_ms : 0, reg, values, size);
+        charge::ObserveRegister(config.GetChargePolicy(), this->m_device_code, reg, values, size);
+    }
+
+    Result TelemetryI2cSessionService::SampledSend(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+        Result result = this->RuleSend(data, size, option, use_old_command);
+        if (::ams::i2c::ResultNoOverride::Includes(result)) {
+            result = this->SendDirect(data, size, option, use_old_command);
+        }
+        R_TRY(result);
+
+        /* Every write sets the register pointer, the bytes after it are written to that register */
+        if (size >= 1) {
+            this->m_pointer = data[0];
+            this->Observe(ScopedConfig(), data[0], data + 1, size - 1);
+        }
+
+        R_SUCCEED();
+    }
+
+    Result TelemetryI2cSessionService::SampledReceive(u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+        if (this->m_deferred_reg >= 0) {
+            R_TRY(this->ReceiveDeferred(data, size, option, use_old_command));
+        } else {
+            R_TRY(this->ReceiveDirect(data, size, option, use_old_command));
+        }
+
+        if (this->m_pointer >= 0) {
+            this->Observe(ScopedConfig(), static_cast<u8>(this->m_pointer), data, size);
+        }
+
+        R_SUCCEED();
+    }
+
+    Result TelemetryI2cSessionService::SampledExecuteCommandList(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, bool use_old_command) {
+        Result result = this->RuleExecuteCommandList(rcv_data, rcv_size, commands, num_commands, use_old_command);
+        if (::ams::i2c::ResultNoOverride::Includes(result)) {
+            result = this->ExecuteCommandListDirect(rcv_data, rcv_size, commands, num_commands, use_old_command);
+        }
+        R_TRY(result);
+
+        /* Replay the list against the register pointer, every receive reads the register the send before it selected */
+        const ScopedConfig config;
+        cmdlist::ForEachCommand(commands, num_commands, rcv_size, [&](const cmdlist::Command &command) {
+            if (command.kind == cmdlist::CommandKind_Send && command.size >= 1) {
+                this->m_pointer = command.data[0];
+                this->Observe(config, command.data[0], command.data + 1, command.size - 1);
+            } else if (command.kind == cmdlist::CommandKind_Receive && this->m_pointer >= 0) {
+                this->Observe(config, static_cast<u8>(this->m_pointer), rcv_data + command.receive_offset, command.size);
+            }
+        });
+
+        R_SUCCEED();
+    }
+
+    Result TelemetryI2cSessionService::SendOldCb(const sf::InBuffer &in_data, ::ams::i2c::TransactionOption option) {
+        R_RETURN(this->SampledSend(in_data.GetPointer(), in_data.GetSize(), option, true));
+    }
+
+    Result TelemetryI2cSessionService::ReceiveOldCb(const sf::OutBuffer &out_data, ::ams::i2c::TransactionOption option) {
+        R_RETURN(this->SampledReceive(out_data.GetPointer(), out_data.GetSize(), option, true));
+    }
+
+    Result TelemetryI2cSessionService::ExecuteCommandListOldCb(const sf::OutBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list) {
+        R_RETURN(this->SampledExecuteCommandList(rcv_buf.GetPointer(), rcv_buf.GetSize(), command_list.GetPointer(), command_list.GetSize(), true));
+    }
+
+    Result TelemetryI2cSessionService::SendCb(const sf::InAutoSelectBuffer &in_data, ::ams::i2c::TransactionOption option) {
+        R_RETURN(this->SampledSend(in_data.GetPointer(), in_data.GetSize(), option, false));
+    }
+
+    Result TelemetryI2cSessionService::ReceiveCb(const sf::OutAutoSelectBuffer &out_data, ::ams::i2c::TransactionOption option) {
+        R_RETURN(this->SampledReceive(out_data.GetPointer(), out_data.GetSize(), option, false));
+    }
+
+    Result TelemetryI2cSessionService::ExecuteCommandListCb(const sf::OutAutoSelectBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list) {
+        R_RETURN(this->SampledExecuteCommandList(rcv_buf.GetPointer(), rcv_buf.GetSize(), command_list.GetPointer(), command_list.GetSize(), false));
+    }
+
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+#include "i2c_capture_format.hpp"
+#include "i2c_mitm_transport.hpp"
+#include "i2c_mitm_trace.hpp"
+
+namespace ams::i2c {
+    R_DEFINE_ERROR_RESULT(NoOverride, 4);
+}
+
+namespace ams::mitm::i2c {
+
+    namespace stats {
+        class DeviceStats;
+    }
+
+    namespace cache {
+        class RegisterCache;
+    }
+
+    namespace telemetry {
+        class Rail;
+    }
+
+    class ScopedConfig;
+
+    constexpr size_t SessionCacheLineSize = 0x40;
+
+    /* Session state and logging helpers shared by all session types. Every forwarded call reads all of it, keep it to one cache line. */
+    class I2cSessionServiceBase {
+    protected:
+        I2cSessionTransport m_transport;
+        ncm::ProgramId m_program_id;
+        stats::DeviceStats *m_stats;
+        /* Ops of the device that are captured, checked before every record */
+        const trace::Mask *m_trace_mask;
+        DeviceCode m_device_code;
+        /* Ties the capture records of the session together */
+        u16 m_session_id;
+    public:
+        I2cSessionServiceBase(I2cSessionTransport::SessionHandle session, DeviceCode device_code, ncm::ProgramId program_id);
+        ~I2cSessionServiceBase();
+
+    protected:
+        bool ShouldTrace(u32 ops) const {
+            return trace::IsEnabled(m_trace_mask, ops);
+        }
+        int LogPrintHeader(char *buf, size_t buf_size);
+        void LogCapture(capture::Op op, u8 option, Result result, const void *data, size_t size, const void *aux, size_t aux_size);
+        void LogSendReceive(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool is_send, Result result);
+        void LogSend(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, Result result);
+        void LogReceive(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, Result result);
+        void LogCommandList(const u8 *recv_data, size_t recv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, Result result);
+        void LogRetryPolicy(s32 max_retry_count, s32 retry_interval_us, Result result);
+        void LogSessionEvent(capture::Op op);
+    };
+
+    /* Override callbacks, only sessions with overrides pay for the virtual calls */
+    class I2cSessionOverrideHooks {
+    public:
+        virtual ~I2cSessionOverrideHooks() = default;
+
+    private:
+        virtual Result SendOldCb(const sf::InBuffer &in_data, ::ams::i2c::TransactionOption option) { AMS_UNUSED(in_data, option); R_RETURN(::ams::i2c::ResultNoOverride()); }
+        virtual Result ReceiveOldCb(const sf::OutBuffer &out_data, ::ams::i2c::TransactionOption option) { AMS_UNUSED(out_data, option); R_RETURN(::ams::i2c::ResultNoOverride()); }
+        virtual Result ExecuteCommandListOldCb(const sf::OutBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list) { AMS_UNUSED(rcv_buf, command_list); R_RETURN(::ams::i2c::ResultNoOverride()); }
+        virtual Result SendCb(const sf::InAutoSelectBuffer &in_data, ::ams::i2c::TransactionOption option) { AMS_UNUSED(in_data, option); R_RETURN(::ams::i2c::ResultNoOverride()); }
+        virtual Result ReceiveCb(const sf::OutAutoSelectBuffer &out_data, ::ams::i2c::TransactionOption option) { AMS_UNUSED(out_data, option); R_RETURN(::ams::i2c::ResultNoOverride()); }
+        virtual Result ExecuteCommandListCb(const sf::OutAutoSelectBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list) { AMS_UNUSED(rcv_buf, command_list); R_RETURN(::ams::i2c::ResultNoOverride()); }
+        virtual Result SetRetryPolicyCb(s32 max_retry_count, s32 retry_interval_us) { AMS_UNUSED(max_retry_count, retry_interval_us); R_RETURN(::ams::i2c::ResultNoOverride()); }
+
+        template<typename Policy>
+        friend class I2cSessionServiceImpl;
+    };
+
+    class I2cSessionNoHooks { };
+
+    /* Session policies, selected per session when it is opened */
+    struct MonitorSessionPolicy {
+        static constexpr bool EnableOverrides = false;
+    };
+
+    struct OverrideSessionPolicy {
+        static constexpr bool EnableOverrides = true;
+    };
+
+    template<typename Policy>
+    class I2cSessionServiceImpl : public I2cSessionServiceBase, public std::conditional_t<Policy::EnableOverrides, I2cSessionOverrideHooks, I2cSessionNoHooks> {
+    public:
+        using I2cSessionServiceBase::I2cSessionServiceBase;
+
+        Result SendOld(const sf::InBuffer &in_data, ::ams::i2c::TransactionOption option);
+        Result ReceiveOld(const sf::OutBuffer &out_data, ::ams::i2c::TransactionOption option);
+        Result ExecuteCommandListOld(const sf::OutBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list);
+        Result Send(const sf::InAutoSelectBuffer &in_data, ::ams::i2c::TransactionOption option);
+        Result Receive(const sf::OutAutoSelectBuffer &out_data, ::ams::i2c::TransactionOption option);
+        Result ExecuteCommandList(const sf::OutAutoSelectBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list);
+        Result SetRetryPolicy(s32 max_retry_count, s32 retry_interval_us);
+    };
+
+    /* Including the vtable pointer of the sessions with override hooks */
+    static_assert(sizeof(I2cSessionServiceBase) + sizeof(void *) <= SessionCacheLineSize);
+
+    /* Forwards everything and logs the transactions */
+    using MonitorI2cSessionService = I2cSessionServiceImpl<MonitorSessionPolicy>;
+    /* Gives the override callbacks a chance to handle each call before forwarding it */
+    using I2cSessionService = I2cSessionServiceImpl<OverrideSessionPolicy>;
+
+
+    /* Applies the register rules and the charge policy from the config to writes, and coalesces register reads when enabled */
+    class RuleI2cSessionService : public I2cSessionService {
+    protected:
+        /* A one byte register Send is held back until the Receive shows how the read can be done */
+        s32 m_deferred_reg;
+        ::ams::i2c::TransactionOption m_deferred_option;
+        bool m_deferred_use_old_command;
+    public:
+        RuleI2cSessionService(I2cSessionTransport::SessionHandle session, DeviceCode device_code, ncm::ProgramId program_id);
+
+    private:
+        virtual Result SendOldCb(const sf::InBuffer &in_data, ::ams::i2c::TransactionOption option) override;
+        virtual Result ReceiveOldCb(const sf::OutBuffer &out_data, ::ams::i2c::TransactionOption option) override;
+        virtual Result ExecuteCommandListOldCb(const sf::OutBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list) override;
+        virtual Result SendCb(const sf::InAutoSelectBuffer &in_data, ::ams::i2c::TransactionOption option) override;
+        virtual Result ReceiveCb(const sf::OutAutoSelectBuffer &out_data, ::ams::i2c::TransactionOption option) override;
+        virtual Result ExecuteCommandListCb(const sf::OutAutoSelectBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list) override;
+        virtual Result SetRetryPolicyCb(s32 max_retry_count, s32 retry_interval_us) override;
+
+    protected:
+        Result RuleSend(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command);
+        Result RuleExecuteCommandList(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, bool use_old_command);
+
+        static bool IsRegisterSelect(size_t size, ::ams::i2c::TransactionOption option) {
+            return size == 1 && !(option & ::ams::i2c::TransactionOption_StopCondition);
+        }
+        void DeferSend(u8 reg, ::ams::i2c::TransactionOption option, bool use_old_command);
+        Result FlushDeferredSend();
+        /* Receive following a deferred register select, as one command list when coalescing is enabled */
+        Result ReceiveDeferred(u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command);
+
+        Result ApplyCommandListRules(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, bool use_old_command);
+        Result ApplyWriteRules(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command);
+        Result SendDirect(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command);
+        /* A complete write the mitm does on its own, captured as injected */
+        Result SendInjected(const u8 *data, size_t size, bool use_old_command);
+        Result ReceiveDirect(u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command);
+        Result ExecuteCommandListDirect(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, bool use_old_command);
+
+        /* Writes a charge voltage the charger has not been sent yet, before a transaction starts. Returns the register written or -1. */
+        s32 ApplyChargePolicy(bool use_old_command);
+    };
+
+    /* Rule session that also answers reads of cacheable registers from the device's shadow register cache */
+    class CachingI2cSessionService : public RuleI2cSessionService {
+    private:
+        cache::RegisterCache *m_cache;
+    public:
+        CachingI2cSessionService(I2cSessionTransport::SessionHandle session, DeviceCode device_code, ncm::ProgramId program_id);
+
+    private:
+        virtual Result SendOldCb(const sf::InBuffer &in_data, ::ams::i2c::TransactionOption option) override;
+        virtual Result ReceiveOldCb(const sf::OutBuffer &out_data, ::ams::i2c::TransactionOption option) override;
+        virtual Result ExecuteCommandListOldCb(const sf::OutBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list) override;
+        virtual Result SendCb(const sf::InAutoSelectBuffer &in_data, ::ams::i2c::TransactionOption option) override;
+        virtual Result ReceiveCb(const sf::OutAutoSelectBuffer &out_data, ::ams::i2c::TransactionOption option) override;
+        virtual Result ExecuteCommandListCb(const sf::OutAutoSelectBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list) override;
+
+        Result CachedSend(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command);
+        Result CachedReceive(u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command);
+        Result CachedExecuteCommandList(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, bool use_old_command);
+
+        void InvalidateChargePolicyWrite(s32 reg);
+    };
+
+    /* Rule session of an ina226 or a charge policy sensor that feeds the register values its client reads into the rail's telemetry and the charge policy */
+    class TelemetryI2cSessionService : public RuleI2cSessionService {
+    private:
+        telemetry::Rail *m_rail;
+        /* Register pointer of the device as set by this session's writes, -1 until the first one */
+        s32 m_pointer;
+    public:
+        TelemetryI2cSessionService(I2cSessionTransport::SessionHandle session, DeviceCode device_code, ncm::ProgramId program_id);
+
+    private:
+        virtual Result SendOldCb(const sf::InBuffer &in_data, ::ams::i2c::TransactionOption option) override;
+        virtual Result ReceiveOldCb(const sf::OutBuffer &out_data, ::ams::i2c::TransactionOption option) override;
+        virtual Result ExecuteCommandListOldCb(const sf::OutBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list) override;
+        virtual Result SendCb(const sf::InAutoSelectBuffer &in_data, ::ams::i2c::TransactionOption option) override;
+        virtual Result ReceiveCb(const sf::OutAutoSelectBuffer &out_data, ::ams::i2c::TransactionOption option) override;
+        virtual Result ExecuteCommandListCb(const sf::OutAutoSelectBuffer &rcv_buf, const sf::InPointerArray<::ams::i2c::I2cCommand> &command_list) override;
+
+        Result SampledSend(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command);
+        Result SampledReceive(u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command);
+        Result SampledExecuteCommandList(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, bool use_old_command);
+
+        void Observe(const ScopedConfig &config, u8 reg, const u8 *values, size_t size);
+    };
+
+}
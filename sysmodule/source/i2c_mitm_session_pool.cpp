@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "i2c_mitm_session_pool.hpp"
+#include "i2c_mitm_module.hpp"
+#include "i2c_mitm_session.hpp"
+
+namespace ams::mitm::i2c::pool {
+
+    namespace {
+
+        /*
+         * Fixed size units on a lock-free free list. The head packs a tag above the index of the first free unit,
+         * the tag changes on every update so a pop racing with a pop and push of the same unit fails its compare exchange.
+         * Links are stored xor'd with the index of the following unit, so the zero initialized pool is already one free list.
+         * Allocations the pool can not serve go to the heap, Free tells them apart by address.
+         */
+        template<size_t UnitSize, size_t NumUnits, size_t UnitAlignment = alignof(std::max_align_t)>
+        class SlabPool {
+            private:
+                static constexpr u32 InvalidIndex = NumUnits;
+
+                struct Unit {
+                    alignas(UnitAlignment) u8 storage[util::AlignUp(UnitSize, UnitAlignment)];
+                };
+            private:
+                Unit m_units[NumUnits];
+                std::atomic<u32> m_next[NumUnits];
+                std::atomic<u64> m_head;
+                std::atomic<u32> m_in_use;
+                std::atomic<u32> m_high_water_mark;
+                std::atomic<u64> m_total_allocations;
+                std::atomic<u64> m_heap_fallbacks;
+            public:
+                constexpr SlabPool() : m_units(), m_next(), m_head(0), m_in_use(0), m_high_water_mark(0), m_total_allocations(0), m_heap_fallbacks(0) { /* ... */ }
+
+                void *Allocate(size_t size, size_t alignment) {
+                    m_total_allocations.fetch_add(1, std::memory_order_relaxed);
+
+                    if (size <= sizeof(Unit) && alignment <= UnitAlignment) {
+                        if (void *p = this->Pop(); p != nullptr) {
+                            this->UpdateHighWaterMark(m_in_use.fetch_add(1, std::memory_order_relaxed) + 1);
+                            return p;
+                        }
+                    }
+
+                    m_heap_fallbacks.fetch_add(1, std::memory_order_relaxed);
+                    return ::operator new(size, std::nothrow);
+                }
+
+                void Free(void *p) {
+                    if (!this->Contains(p)) {
+                        ::operator delete(p);
+                        return;
+                    }
+
+                    m_in_use.fetch_sub(1, std::memory_order_relaxed);
+                    this->Push(static_cast<Unit *>(p) - m_units);
+                }
+
+                void GetStats(PoolStats *out) const {
+                    out->unit_size         = sizeof(Unit);
+                    out->num_units         = NumUnits;
+                    out->in_use            = m_in_use.load(std::memory_order_relaxed);
+                    out->high_water_mark   = m_high_water_mark.load(std::memory_order_relaxed);
+                    out->reserved          = 0;
+                    out->total_allocations = m_total_allocations.load(std::memory_order_relaxed);
+                    out->heap_fallbacks    = m_heap_fallbacks.load(std::memory_order_relaxed);
+                }
+            private:
+                static constexpr u64 MakeHead(u64 tag, u32 index) {
+                    return (tag << BITSIZEOF(u32)) | index;
+                }
+
+                bool Contains(const void *p) const {
+                    const uintptr_t address = reinterpret_cast<uintptr_t>(p);
+                    return address >= reinterpret_cast<uintptr_t>(m_units) && address < reinterpret_cast<uintptr_t>(m_units + NumUnits);
+                }
+
+                void *Pop() {
+                    u64 head = m_head.load(std::memory_order_acquire);
+                    while (true) {
+                        const u32 index = static_cast<u32>(head);
+                        if (index == InvalidIndex) {
+                            return nullptr;
+                        }
+
+                        const u32 next = m_next[index].load(std::memory_order_relaxed) ^ (index + 1);
+                        const u64 new_head = MakeHead((head >> BITSIZEOF(u32)) + 1, next);
+                        if (m_head.compare_exchange_weak(head, new_head, std::memory_order_acquire, std::memory_order_acquire)) {
+                            return m_units[index].storage;
+                        }
+                    }
+                }
+
+                void Push(u32 index) {
+                    u64 head = m_head.load(std::memory_order_relaxed);
+                    do {
+                        m_next[index].store(static_cast<u32>(head) ^ (index + 1), std::memory_order_relaxed);
+                    } while (!m_head.compare_exchange_weak(head, MakeHead((head >> BITSIZEOF(u32)) + 1, index), std::memory_order_release, std::memory_order_relaxed));
+                }
+
+                void UpdateHighWaterMark(u32 in_use) {
+                    u32 high_water_mark = m_high_water_mark.load(std::memory_order_relaxed);
+                    while (in_use > high_water_mark && !m_high_water_mark.compare_exchange_weak(high_water_mark, in_use, std::memory_order_relaxed)) {
+                        /* ... */
+                    }
+                }
+        };
+
+        /* Every session opened through the mitm is a session of one of its ports, so the ports' session limits bound the pools */
+        constexpr size_t MaxSessionObjects = MaxSessionsPerPort * NumMitmPorts;
+
+        /* Cache line aligned units, so the hot fields at the start of a session never straddle a line by chance */
+        using SessionObjectPool = SlabPool<SessionObjectUnitSize, MaxSessionObjects, SessionCacheLineSize>;
+
+        constinit SessionObjectPool g_session_object_pool;
+
+        class SessionObjectMemoryResource : public MemoryResource {
+            private:
+                virtual void *AllocateImpl(size_t size, size_t alignment) override {
+                    return g_session_object_pool.Allocate(size, alignment);
+                }
+
+                virtual void DeallocateImpl(void *buffer, size_t size, size_t alignment) override {
+                    AMS_UNUSED(size, alignment);
+                    g_session_object_pool.Free(buffer);
+                }
+
+                virtual bool IsEqualImpl(const MemoryResource &resource) const override {
+                    return this == std::addressof(resource);
+                }
+        };
+
+        SessionObjectMemoryResource g_session_object_memory_resource;
+
+    }
+
+    MemoryResource *GetSessionObjectMemoryResource() {
+        return std::addressof(g_session_object_memory_resource);
+    }
+
+    size_t GetStats(PoolStats *out, size_t max_count) {
+        size_t count = 0;
+        if (count < max_count) {
+            out[count].pool = Pool_SessionObject;
+            g_session_object_pool.GetStats(std::addressof(out[count++]));
+        }
+        return count;
+    }
+
+}
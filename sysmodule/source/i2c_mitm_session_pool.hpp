@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+#include "i2c_mitm_session.hpp"
+
+namespace ams::mitm::i2c::pool {
+
+    enum Pool {
+        Pool_SessionObject = 0, /* The session services handed out by OpenSession*, with their forward session inline */
+        Pool_Count         = 1,
+    };
+
+    /* Layout of the pool usage returned by the i2cmitm service */
+    struct PoolStats {
+        u32 pool;
+        u32 unit_size;
+        u32 num_units;
+        u32 in_use;
+        u32 high_water_mark;
+        u32 reserved;
+        u64 total_allocations;
+        u64 heap_fallbacks; /* Allocations the pool could not serve, too large or with every unit taken */
+    };
+
+    /* Room for the largest session service plus what the object factory wraps around it */
+    constexpr size_t SessionObjectOverhead = 0x40;
+    constexpr size_t SessionObjectUnitSize = std::max({sizeof(MonitorI2cSessionService), sizeof(RuleI2cSessionService), sizeof(CachingI2cSessionService), sizeof(TelemetryI2cSessionService)}) + SessionObjectOverhead;
+
+    /* Session services that do not fit a unit would silently come from the heap */
+    template<typename Impl>
+    constexpr inline bool FitsSessionObjectUnit = sizeof(Impl) + SessionObjectOverhead <= SessionObjectUnitSize;
+
+    /* Session services are created through this, see SessionObjectFactory */
+    MemoryResource *GetSessionObjectMemoryResource();
+    using SessionObjectFactory = sf::ObjectFactory<sf::MemoryResourceAllocationPolicy>;
+
+    size_t GetStats(PoolStats *out, size_t max_count);
+
+}
@@ -1,15 +1,75 @@
 #include "i2c_mitm_settings.hpp"
+#include "i2c_mitm_rules.hpp"
 #include "logging.hpp"
-#include <stratosphere.hpp>
 
 namespace ams::mitm::i2c {
 
 	namespace {
 		constexpr const char config_file_path[] = "sdmc:/config/i2c_mitm/i2c_mitm.ini";
+		constexpr const char rule_section_prefix[] = "rule.";
+		constexpr const char cache_section_prefix[] = "cache.";
+		constexpr const char charge_policy_section_prefix[] = "charge_policy.";
 
-		constinit I2CMitmConfig g_i2c_config = {
-			.voltage        = 0x0,
-			.voltage_config = 0x0,
+		constexpr I2CMitmConfig DefaultConfig = {
+			.voltage          = 0x0,
+			.voltage_config   = 0x0,
+			.i2c_thread_count = 1,
+			.pcv_thread_count = 1,
+			.coalesce_reads   = false,
+			.log_dedup_window_ms = 5000,
+			.log_rate_limit      = 50,
+			.log_rate_burst      = 200,
+			.log_flush_interval_ms  = log::DefaultFlushIntervalMs,
+			.log_flush_threshold_kb = log::DefaultFlushThresholdKb,
+			.log_level              = log::DefaultLevel,
+		};
+
+		constexpr charge::PolicyConfig DefaultChargePolicy = {
+			.rows               = {},
+			.num_rows           = 0,
+			.default_voltage_mv = 0,
+			.temp_hysteresis_c  = charge::DefaultTempHysteresisC,
+			.soc_hysteresis_pct = charge::DefaultSocHysteresisPct,
+		};
+
+		constexpr telemetry::TelemetryConfig DefaultTelemetry = {
+			.device_codes = {},
+			.num_rails    = 0,
+			.bucket_ms    = telemetry::DefaultBucketMs,
+		};
+
+		constexpr trace::TraceConfig DefaultTrace = {
+			.devices      = {},
+			.num_devices  = 0,
+			.default_mask = trace::DefaultMask,
+		};
+
+		/*
+		 * Two snapshot slots, readers pin the published one with a reader count.
+		 * A reload only writes the other slot once its last reader is gone, then publishes it by swapping the slot index.
+		 */
+		constexpr int NumConfigSlots = 2;
+
+		constinit ConfigSnapshot g_config_snapshots[NumConfigSlots] = {
+			{ .config = DefaultConfig, .rules = {}, .cache = {}, .selection = {}, .telemetry = DefaultTelemetry, .charge_policy = DefaultChargePolicy, .trace = DefaultTrace },
+			{ .config = DefaultConfig, .rules = {}, .cache = {}, .selection = {}, .telemetry = DefaultTelemetry, .charge_policy = DefaultChargePolicy, .trace = DefaultTrace },
+		};
+		constinit std::atomic<int> g_current_config_slot = 0;
+		constinit std::atomic<u32> g_config_reader_counts[NumConfigSlots] = {};
+
+		/* Serializes reloads, never taken by readers */
+		constinit os::SdkMutex g_reload_mutex;
+
+		constexpr TimeSpan ConfigMonitorInterval = TimeSpan::FromSeconds(5);
+		constexpr size_t ConfigMonitorThreadStackSize = 0x2000;
+		constexpr s32 ConfigMonitorThreadPriority = 40;
+
+		os::ThreadType g_config_monitor_thread;
+		alignas(os::ThreadStackAlignment) constinit u8 g_config_monitor_thread_stack[ConfigMonitorThreadStackSize];
+
+		struct ParseContext {
+			Result result;
+			ConfigSnapshot *snapshot;
 		};
 
 		Result ParseInt(const char *value, int &out, int min = INT_MIN, int max = INT_MAX) {
@@ -21,6 +81,28 @@ namespace ams::mitm::i2c {
 			R_THROW(::ams::settings::ResultInvalidArgument());
 		}
 
+		Result ParseBool(const char *value, bool &out) {
+			if (strcasecmp(value, "true") == 0 || strcmp(value, "1") == 0) {
+				out = true;
+				R_SUCCEED();
+			} else if (strcasecmp(value, "false") == 0 || strcmp(value, "0") == 0) {
+				out = false;
+				R_SUCCEED();
+			}
+			R_THROW(::ams::settings::ResultInvalidArgument());
+		}
+
+		Result ParseLogLevel(const char *value, log::Level &out) {
+			if (strcasecmp(value, "info") == 0) {
+				out = log::Level_Info;
+				R_SUCCEED();
+			} else if (strcasecmp(value, "debug") == 0) {
+				out = log::Level_Debug;
+				R_SUCCEED();
+			}
+			R_THROW(::ams::settings::ResultInvalidArgument());
+		}
+
 		Result ParseVoltage(const char *value, int &out_voltage, u8 &out_voltage_config) {
 			int tmp;
 			Result result = ParseInt(value, tmp, 3504, 4400);
@@ -46,12 +128,50 @@ namespace ams::mitm::i2c {
 		}
 
 		int ConfigIniHandler(void *user, const char *section, const char *name, const char *value) {
-			Result &result = *static_cast<Result*>(user);
+			ParseContext &context = *static_cast<ParseContext*>(user);
+			Result &result = context.result;
+			I2CMitmConfig &config = context.snapshot->config;
 
 			if (strcasecmp(section, "battery") == 0) {
 				if (strcasecmp(name, "chrg_voltage") == 0) {
-					result = ParseVoltage(value, g_i2c_config.voltage, g_i2c_config.voltage_config);
+					result = ParseVoltage(value, config.voltage, config.voltage_config);
+				}
+			} else if (strcasecmp(section, "mitm") == 0) {
+				if (strcasecmp(name, "i2c_threads") == 0) {
+					result = ParseInt(value, config.i2c_thread_count, 1, MaxThreadsPerPort);
+				} else if (strcasecmp(name, "pcv_threads") == 0) {
+					result = ParseInt(value, config.pcv_thread_count, 1, MaxThreadsPerPort);
+				} else if (strcasecmp(name, "coalesce_reads") == 0) {
+					result = ParseBool(value, config.coalesce_reads);
+				} else if (selection::IsIniEntry(name)) {
+					result = selection::ParseIniEntry(std::addressof(context.snapshot->selection), name, value);
 				}
+			} else if (strcasecmp(section, "log") == 0) {
+				if (strcasecmp(name, "dedup_window_ms") == 0) {
+					result = ParseInt(value, config.log_dedup_window_ms, 0, 3600000);
+				} else if (strcasecmp(name, "rate_limit") == 0) {
+					result = ParseInt(value, config.log_rate_limit, 0, 100000);
+				} else if (strcasecmp(name, "rate_burst") == 0) {
+					result = ParseInt(value, config.log_rate_burst, 1, 100000);
+				} else if (strcasecmp(name, "flush_interval_ms") == 0) {
+					result = ParseInt(value, config.log_flush_interval_ms, 0, 3600000);
+				} else if (strcasecmp(name, "flush_threshold_kb") == 0) {
+					result = ParseInt(value, config.log_flush_threshold_kb, 1, 4096);
+				} else if (strcasecmp(name, "level") == 0) {
+					result = ParseLogLevel(value, config.log_level);
+				}
+			} else if (strcasecmp(section, "telemetry") == 0) {
+				result = telemetry::ParseIniEntry(std::addressof(context.snapshot->telemetry), name, value);
+			} else if (strcasecmp(section, "trace") == 0) {
+				result = trace::ParseIniEntry(std::addressof(context.snapshot->trace), name, value);
+			} else if (strcasecmp(section, "charge_policy") == 0) {
+				result = charge::ParseIniEntry(std::addressof(context.snapshot->charge_policy), name, value);
+			} else if (strncasecmp(section, charge_policy_section_prefix, sizeof(charge_policy_section_prefix) - 1) == 0) {
+				result = charge::ParseRowIniEntry(std::addressof(context.snapshot->charge_policy), section + sizeof(charge_policy_section_prefix) - 1, name, value);
+			} else if (strncasecmp(section, rule_section_prefix, sizeof(rule_section_prefix) - 1) == 0) {
+				result = rules::ParseIniEntry(section + sizeof(rule_section_prefix) - 1, name, value);
+			} else if (strncasecmp(section, cache_section_prefix, sizeof(cache_section_prefix) - 1) == 0) {
+				result = cache::ParseIniEntry(std::addressof(context.snapshot->cache), section + sizeof(cache_section_prefix) - 1, name, value);
 			}
 
 			if (R_FAILED(result)) {
@@ -61,28 +181,164 @@ namespace ams::mitm::i2c {
 			return R_SUCCEEDED(result) ? 1 : 0;
 		}
 
-		Result LoadFromSD() {
+		Result LoadFromSD(ConfigSnapshot *out_snapshot) {
 			fs::FileHandle f;
 			R_SUCCEED_IF(R_FAILED(fs::OpenFile(std::addressof(f), config_file_path, fs::OpenMode_Read)));
 			ON_SCOPE_EXIT{fs::CloseFile(f);};
 
-			Result result = ResultSuccess();
-			util::ini::ParseFile(f, std::addressof(result), ConfigIniHandler);
+			ParseContext context = { ResultSuccess(), out_snapshot };
+			util::ini::ParseFile(f, std::addressof(context), ConfigIniHandler);
 
-			R_TRY(result);
+			R_TRY(context.result);
 			R_SUCCEED();
 		}
+
+		/* chrg_voltage is a shorthand for a rule rewriting bq24193 charge voltage writes of 4192mV and above */
+		void AddChargeVoltageRule(u8 voltage_config) {
+			const rules::Rule rule = {
+				.name        = "chrg_voltage",
+				.device_code = 0x39000001,
+				.reg         = 0x04,
+				.mask        = 0xFC,
+				.min         = 0xAC,
+				.max         = 0xFC,
+				.set         = voltage_config,
+				.set_mask    = 0xFF,
+				.action      = rules::Action_Rewrite,
+				.on_open     = true,
+				.next        = rules::InvalidRuleIndex,
+			};
+			rules::AddRule(rule);
+		}
+
+		/* A config that fails to parse is only published at boot, a reload keeps the current one */
+		Result LoadAndPublishConfig(bool is_reload) {
+			std::scoped_lock lk(g_reload_mutex);
+
+			/* Wait for the readers of the snapshot before the current one to let go of it */
+			const int slot = (g_current_config_slot.load() + 1) % NumConfigSlots;
+			while (g_config_reader_counts[slot].load() != 0) {
+				os::SleepThread(TimeSpan::FromMilliSeconds(1));
+			}
+
+			ConfigSnapshot &snapshot = g_config_snapshots[slot];
+			snapshot.config = DefaultConfig;
+			snapshot.cache.num_devices = 0;
+			snapshot.selection = {};
+			snapshot.telemetry = DefaultTelemetry;
+			snapshot.charge_policy = DefaultChargePolicy;
+			snapshot.trace = DefaultTrace;
+			const Result result = LoadFromSD(std::addressof(snapshot));
+			if (R_FAILED(result) && is_reload) {
+				rules::Discard();
+				log::DebugLog("Failed to parse the config (0x%" PRIx32 "), keeping the current one\n", result.GetValue());
+				R_RETURN(result);
+			}
+
+			if (snapshot.config.voltage_config) {
+				AddChargeVoltageRule(snapshot.config.voltage_config);
+			}
+			rules::Commit(std::addressof(snapshot.rules));
+			charge::Commit(std::addressof(snapshot.charge_policy), snapshot.config.voltage);
+			selection::Commit(std::addressof(snapshot.selection), snapshot.rules, snapshot.cache, snapshot.telemetry, snapshot.charge_policy);
+
+			g_current_config_slot.store(slot);
+			charge::Publish(snapshot.charge_policy);
+			log::SetFlushPolicy(snapshot.config.log_flush_interval_ms, snapshot.config.log_flush_threshold_kb);
+			log::SetLevel(snapshot.config.log_level);
+			trace::Commit(snapshot.trace);
+
+			R_RETURN(result);
+		}
+
+		bool GetConfigTimeStamp(fs::FileTimeStampRaw *out) {
+			return R_SUCCEEDED(fs::GetFileTimeStampRawForDebug(out, config_file_path));
+		}
+
+		bool IsSameTimeStamp(const fs::FileTimeStampRaw &lhs, const fs::FileTimeStampRaw &rhs) {
+			return lhs.create == rhs.create && lhs.modify == rhs.modify;
+		}
+
+		void ConfigMonitorThreadFunc(void *) {
+			fs::FileTimeStampRaw last_stamp = {};
+			bool had_file = GetConfigTimeStamp(std::addressof(last_stamp));
+
+			while (true) {
+				os::SleepThread(ConfigMonitorInterval);
+
+				fs::FileTimeStampRaw stamp = {};
+				const bool has_file = GetConfigTimeStamp(std::addressof(stamp));
+				if (has_file == had_file && (!has_file || IsSameTimeStamp(stamp, last_stamp))) {
+					continue;
+				}
+
+				had_file   = has_file;
+				last_stamp = stamp;
+
+				log::DebugLog("Config file changed, reloading\n");
+				ReloadConfig();
+			}
+		}
+	}
+
+	ScopedConfig::ScopedConfig() {
+		while (true) {
+			const int slot = g_current_config_slot.load();
+			g_config_reader_counts[slot].fetch_add(1);
+
+			/* A reload may have started on this slot before the count was taken, retry with the new one */
+			if (g_current_config_slot.load() == slot) {
+				m_slot = slot;
+				return;
+			}
+
+			g_config_reader_counts[slot].fetch_sub(1);
+		}
+	}
+
+	ScopedConfig::~ScopedConfig() {
+		g_config_reader_counts[m_slot].fetch_sub(1);
+	}
+
+	const ConfigSnapshot &ScopedConfig::Get() const {
+		return g_config_snapshots[m_slot];
 	}
 
 	Result InitializeConfig() {
-		R_RETURN(LoadFromSD());
+		R_RETURN(LoadAndPublishConfig(false));
 	}
 
-	const I2CMitmConfig &GetConfig() {
-		return g_i2c_config;
+	Result ReloadConfig() {
+		const Result result = LoadAndPublishConfig(true);
+		LogConfig();
+		R_RETURN(result);
 	}
 
 	void LogConfig() {
-		log::DebugLog("i2c mitm config: voltage: %" PRIi32 ", voltage config: 0x%" PRIx8 "\n", GetConfig().voltage, GetConfig().voltage_config);
+		const ScopedConfig scoped_config;
+		const I2CMitmConfig &config = scoped_config.GetConfig();
+
+		log::DebugLog("i2c mitm config: voltage: %" PRIi32 ", voltage config: 0x%" PRIx8 ", i2c threads: %d, pcv threads: %d, coalesce reads: %d\n", config.voltage, config.voltage_config, config.i2c_thread_count, config.pcv_thread_count, config.coalesce_reads);
+		log::DebugLog("i2c mitm log filter: dedup window: %dms, rate limit: %d/s, burst: %d\n", config.log_dedup_window_ms, config.log_rate_limit, config.log_rate_burst);
+		log::DebugLog("i2c mitm log flush: interval: %dms, threshold: %dKB, level: %s\n", config.log_flush_interval_ms, config.log_flush_threshold_kb, config.log_level == log::Level_Debug ? "debug" : "info");
+		rules::LogRules(scoped_config.GetRules());
+		cache::LogConfig(scoped_config.GetCache());
+		selection::LogSelection(scoped_config.GetSelection());
+		telemetry::LogConfig(scoped_config.GetTelemetry());
+		charge::LogConfig(scoped_config.GetChargePolicy());
+		trace::LogConfig(scoped_config.GetTrace());
+	}
+
+	void StartConfigMonitor() {
+		R_ABORT_UNLESS(os::CreateThread(std::addressof(g_config_monitor_thread),
+			ConfigMonitorThreadFunc,
+			nullptr,
+			g_config_monitor_thread_stack,
+			ConfigMonitorThreadStackSize,
+			ConfigMonitorThreadPriority
+		));
+
+		os::SetThreadNamePointer(std::addressof(g_config_monitor_thread), "I2cMitmConfig");
+		os::StartThread(std::addressof(g_config_monitor_thread));
 	}
 }
\ No newline at end of file
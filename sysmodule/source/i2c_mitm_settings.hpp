@@ -1,15 +1,75 @@
 #pragma once
 
+#if defined(ATMOSPHERE_OS_HORIZON)
 #include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+#include "i2c_mitm_rules.hpp"
+#include "i2c_mitm_register_cache.hpp"
+#include "i2c_mitm_selection.hpp"
+#include "i2c_mitm_telemetry.hpp"
+#include "i2c_mitm_charge_policy.hpp"
+#include "i2c_mitm_trace.hpp"
+#include "logging.hpp"
 
 namespace ams::mitm::i2c {
+	/* Upper limit for the number of threads serving one mitm port */
+	constexpr int MaxThreadsPerPort = 3;
+
 	struct I2CMitmConfig {
 		int voltage;
 		u8 voltage_config;
+		int i2c_thread_count;
+		int pcv_thread_count;
+		/* Forward a register select Send and the Receive after it as one command list */
+		bool coalesce_reads;
+		/* Capture log filter, 0 disables dedup or the rate limit */
+		int log_dedup_window_ms;
+		int log_rate_limit;
+		int log_rate_burst;
+		/* How often buffered log and capture data is flushed to SD */
+		int log_flush_interval_ms;
+		int log_flush_threshold_kb;
+		log::Level log_level;
+	};
+
+	/* Never modified once published, a reload builds a new snapshot and swaps it in */
+	struct ConfigSnapshot {
+		I2CMitmConfig config;
+		rules::RuleSet rules;
+		cache::CacheConfig cache;
+		selection::Selection selection;
+		telemetry::TelemetryConfig telemetry;
+		charge::PolicyConfig charge_policy;
+		trace::TraceConfig trace;
+	};
+
+	/* Keeps the current snapshot alive for its lifetime, taking one never blocks */
+	class ScopedConfig {
+		NON_COPYABLE(ScopedConfig);
+		NON_MOVEABLE(ScopedConfig);
+		private:
+			int m_slot;
+		public:
+			ScopedConfig();
+			~ScopedConfig();
+
+			const ConfigSnapshot &Get() const;
+			const I2CMitmConfig &GetConfig() const { return this->Get().config; }
+			const rules::RuleSet &GetRules() const { return this->Get().rules; }
+			const cache::CacheConfig &GetCache() const { return this->Get().cache; }
+			const selection::Selection &GetSelection() const { return this->Get().selection; }
+			const telemetry::TelemetryConfig &GetTelemetry() const { return this->Get().telemetry; }
+			const charge::PolicyConfig &GetChargePolicy() const { return this->Get().charge_policy; }
+			const trace::TraceConfig &GetTrace() const { return this->Get().trace; }
 	};
 
 	Result InitializeConfig();
-	const I2CMitmConfig &GetConfig();
+	Result ReloadConfig();
 	void LogConfig();
 
-}
\ No newline at end of file
+	/* Reloads the config whenever the ini on SD changes */
+	void StartConfigMonitor();
+
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "i2c_mitm_stats.hpp"
+
+namespace ams::mitm::i2c::stats {
+
+    class AtomicHistogram {
+        private:
+            std::atomic<u64> m_count;
+            std::atomic<u64> m_total_us;
+            std::atomic<u64> m_max_us;
+            std::atomic<u32> m_buckets[NumLatencyBuckets];
+        public:
+            constexpr AtomicHistogram() : m_count(0), m_total_us(0), m_max_us(0), m_buckets() { /* ... */ }
+
+            void Add(u64 us) {
+                const size_t bucket = std::min<size_t>(std::bit_width(us), NumLatencyBuckets - 1);
+
+                m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+                m_count.fetch_add(1, std::memory_order_relaxed);
+                m_total_us.fetch_add(us, std::memory_order_relaxed);
+
+                u64 max_us = m_max_us.load(std::memory_order_relaxed);
+                while (us > max_us && !m_max_us.compare_exchange_weak(max_us, us, std::memory_order_relaxed)) { /* ... */ }
+            }
+
+            void Get(LatencyHistogram *out) const {
+                out->count    = m_count.load(std::memory_order_relaxed);
+                out->total_us = m_total_us.load(std::memory_order_relaxed);
+                out->max_us   = m_max_us.load(std::memory_order_relaxed);
+                for (size_t i = 0; i < NumLatencyBuckets; i++) {
+                    out->buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+                }
+            }
+
+            void Reset() {
+                m_count.store(0, std::memory_order_relaxed);
+                m_total_us.store(0, std::memory_order_relaxed);
+                m_max_us.store(0, std::memory_order_relaxed);
+                for (auto &bucket : m_buckets) {
+                    bucket.store(0, std::memory_order_relaxed);
+                }
+            }
+    };
+
+    /* Device code 0 is what sessions of unknown devices are labelled with, so it cannot mark a free slot */
+    constexpr inline u32 FreeSlotDeviceCode = std::numeric_limits<u32>::max();
+
+    class DeviceStats {
+        public:
+            std::atomic<u32> device_code;
+            AtomicHistogram commands[Command_Count];
+        public:
+            constexpr DeviceStats() : device_code(FreeSlotDeviceCode), commands() { /* ... */ }
+    };
+
+    namespace {
+
+        struct ErrorSlot {
+            std::atomic<u64> key;
+            std::atomic<u64> count;
+        };
+
+        constexpr u64 MakeErrorKey(u32 device_code, Result result) {
+            return (static_cast<u64>(device_code) << 32) | result.GetValue();
+        }
+
+        constinit DeviceStats g_device_stats[MaxDevices];
+        constinit ErrorSlot g_error_slots[MaxErrorCounts] = {};
+
+        void RecordError(u32 device_code, Result result) {
+            const u64 key = MakeErrorKey(device_code, result);
+
+            /* Lock-free open addressing, slots are claimed once and never released. Errors are dropped when the table is full. */
+            for (size_t i = 0; i < MaxErrorCounts; i++) {
+                ErrorSlot &slot = g_error_slots[(key + i) % MaxErrorCounts];
+
+                u64 expected = 0;
+                if (slot.key.compare_exchange_strong(expected, key) || expected == key) {
+                    slot.count.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+            }
+        }
+
+    }
+
+    DeviceStats *GetDeviceStats(DeviceCode device_code) {
+        const u32 value = device_code.GetInternalValue();
+
+        for (auto &stats : g_device_stats) {
+            u32 expected = FreeSlotDeviceCode;
+            if (stats.device_code.compare_exchange_strong(expected, value) || expected == value) {
+                return std::addressof(stats);
+            }
+        }
+
+        return nullptr;
+    }
+
+    void RecordLatency(DeviceStats *stats, Command command, os::Tick start, Result result) {
+        if (stats == nullptr) {
+            return;
+        }
+
+        const u64 us = (os::GetSystemTick() - start).ToTimeSpan().GetMicroSeconds();
+        stats->commands[command].Add(us);
+
+        if (R_FAILED(result)) {
+            RecordError(stats->device_code.load(std::memory_order_relaxed), result);
+        }
+    }
+
+    size_t GetLatencyStats(DeviceLatencyStats *out, size_t max_count) {
+        size_t count = 0;
+
+        for (const auto &stats : g_device_stats) {
+            const u32 device_code = stats.device_code.load();
+            if (device_code == FreeSlotDeviceCode) {
+                continue;
+            }
+            if (count >= max_count) {
+                break;
+            }
+
+            out[count].device_code = device_code;
+            out[count].reserved    = 0;
+            for (size_t i = 0; i < Command_Count; i++) {
+                stats.commands[i].Get(std::addressof(out[count].commands[i]));
+            }
+            count++;
+        }
+
+        return count;
+    }
+
+    size_t GetErrorCounts(ErrorCount *out, size_t max_count) {
+        size_t count = 0;
+
+        for (const auto &slot : g_error_slots) {
+            const u64 key = slot.key.load();
+            if (key == 0) {
+                continue;
+            }
+            if (count >= max_count) {
+                break;
+            }
+
+            out[count].device_code = static_cast<u32>(key >> 32);
+            out[count].result      = static_cast<u32>(key);
+            out[count].count       = slot.count.load(std::memory_order_relaxed);
+            count++;
+        }
+
+        return count;
+    }
+
+    void Reset() {
+        /* Device and error slots stay claimed, only the counters are cleared */
+        for (auto &stats : g_device_stats) {
+            for (auto &histogram : stats.commands) {
+                histogram.Reset();
+            }
+        }
+
+        for (auto &slot : g_error_slots) {
+            slot.count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+}
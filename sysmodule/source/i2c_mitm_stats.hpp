@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+
+namespace ams::mitm::i2c::stats {
+
+    enum Command {
+        Command_Send               = 0,
+        Command_Receive            = 1,
+        Command_ExecuteCommandList = 2,
+        Command_SetRetryPolicy     = 3,
+        Command_Count              = 4,
+    };
+
+    /* Bucket i counts forwarded calls that took [2^(i-1), 2^i) us, bucket 0 counts calls below 1us */
+    constexpr size_t NumLatencyBuckets = 24;
+
+    constexpr size_t MaxDevices     = 32;
+    constexpr size_t MaxErrorCounts = 32;
+
+    /* Layout of the stats returned by the i2cmitm service */
+    struct LatencyHistogram {
+        u64 count;
+        u64 total_us;
+        u64 max_us;
+        u32 buckets[NumLatencyBuckets];
+    };
+    static_assert(sizeof(LatencyHistogram) == 0x78);
+
+    struct DeviceLatencyStats {
+        u32 device_code;
+        u32 reserved;
+        LatencyHistogram commands[Command_Count];
+    };
+
+    struct ErrorCount {
+        u32 device_code;
+        u32 result;
+        u64 count;
+    };
+
+    class DeviceStats;
+
+    /* Returns the stats slot for a device, nullptr if all slots are taken. The slot stays valid for the process lifetime. */
+    DeviceStats *GetDeviceStats(DeviceCode device_code);
+
+    void RecordLatency(DeviceStats *stats, Command command, os::Tick start, Result result);
+
+    size_t GetLatencyStats(DeviceLatencyStats *out, size_t max_count);
+    size_t GetErrorCounts(ErrorCount *out, size_t max_count);
+    void Reset();
+
+}
@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "i2c_mitm_telemetry.hpp"
+#include "i2c_mitm_selection.hpp"
+#include "i2c_mitm_devices.hpp"
+#include "logging.hpp"
+
+namespace ams::mitm::i2c::telemetry {
+
+    namespace {
+
+        enum Register : u8 {
+            Register_ShuntVoltage = 0x01,
+            Register_BusVoltage   = 0x02,
+            Register_Current      = 0x04,
+            Register_Calibration  = 0x05,
+        };
+
+        /* Every channel is a 16 bit register, the bus voltage never sets the top bit */
+        struct Summary {
+            s16 min;
+            s16 max;
+            u32 count;
+            s64 sum;
+        };
+
+        struct Bucket {
+            u64 start_ms;
+            u16 calibration;
+            Summary channels[Channel_Count];
+        };
+
+        bool AddRail(TelemetryConfig *config, u32 device_code) {
+            if (IsRailSelected(*config, device_code)) {
+                return true;
+            }
+            if (config->num_rails >= MaxRails) {
+                return false;
+            }
+            config->device_codes[config->num_rails++] = device_code;
+            return true;
+        }
+
+        bool IsPowerMonitor(u32 device_code) {
+            const DeviceInfo *info = GetDeviceInfo(device_code);
+            return info != nullptr && info->family == ChipFamily_Ina226;
+        }
+
+        /* "all" or a list of ina226 device codes or names */
+        Result ParseRails(TelemetryConfig *config, const char *value) {
+            config->num_rails = 0;
+
+            if (strcasecmp(value, "all") == 0) {
+                for (const auto &info : DeviceInfos) {
+                    if (info.family == ChipFamily_Ina226) {
+                        AddRail(config, info.device_code);
+                    }
+                }
+                R_SUCCEED();
+            }
+
+            R_RETURN(selection::ForEachListItem(value, [&](const char *item, char **end) -> Result {
+                u32 device_code;
+                R_TRY(ParseDeviceCode(item, end, device_code));
+                R_UNLESS(IsPowerMonitor(device_code), ::ams::settings::ResultInvalidArgument());
+                if (!AddRail(config, device_code)) {
+                    log::DebugLog("Too many telemetry rails, ignoring 0x%08" PRIx32 "\n", device_code);
+                }
+                R_SUCCEED();
+            }));
+        }
+
+        Result ParseBucketMs(TelemetryConfig *config, const char *value) {
+            char *end;
+            const unsigned long tmp = std::strtoul(value, std::addressof(end), 0);
+            R_UNLESS(end != value && *end == '\0' && tmp >= MinBucketMs && tmp <= MaxBucketMs, ::ams::settings::ResultInvalidArgument());
+            config->bucket_ms = tmp;
+            R_SUCCEED();
+        }
+
+    }
+
+    class Rail {
+        public:
+            std::atomic<u32> device_code;
+            os::SdkMutex mutex;
+            u32 bucket_ms;
+            u16 calibration;
+            size_t head; /* Newest bucket */
+            size_t num_buckets;
+            Bucket buckets[NumBuckets];
+        public:
+            constexpr Rail() : device_code(0), mutex(), bucket_ms(0), calibration(0), head(0), num_buckets(0), buckets() { /* ... */ }
+
+            /* Returns the bucket starting at start_ms, the oldest one is dropped when a new one is started */
+            Bucket *GetBucket(u64 start_ms) {
+                if (this->num_buckets != 0 && this->buckets[this->head].start_ms == start_ms) {
+                    return std::addressof(this->buckets[this->head]);
+                }
+
+                this->head = (this->head + 1) % NumBuckets;
+                this->num_buckets = std::min(this->num_buckets + 1, NumBuckets);
+
+                Bucket &bucket = this->buckets[this->head];
+                bucket.start_ms    = start_ms;
+                bucket.calibration = this->calibration;
+                for (auto &summary : bucket.channels) {
+                    summary = { std::numeric_limits<s16>::max(), std::numeric_limits<s16>::min(), 0, 0 };
+                }
+                return std::addressof(bucket);
+            }
+    };
+
+    namespace {
+
+        constinit Rail g_rails[MaxRails];
+
+    }
+
+    Result ParseIniEntry(TelemetryConfig *config, const char *name, const char *value) {
+        /* A malformed rail list is dropped as a whole */
+        const TelemetryConfig prev = *config;
+
+        Result result = ResultSuccess();
+        if (strcasecmp(name, "rails") == 0) {
+            result = ParseRails(config, value);
+        } else if (strcasecmp(name, "bucket_ms") == 0) {
+            result = ParseBucketMs(config, value);
+        }
+
+        if (R_FAILED(result)) {
+            *config = prev;
+        }
+        R_RETURN(result);
+    }
+
+    void LogConfig(const TelemetryConfig &config) {
+        for (size_t i = 0; i < config.num_rails; i++) {
+            log::DebugLog("i2c mitm telemetry rail 0x%08" PRIx32 " (%s), %" PRIu32 "ms buckets\n", config.device_codes[i], GetDeviceName(config.device_codes[i]), config.bucket_ms);
+        }
+    }
+
+    bool IsRailSelected(const TelemetryConfig &config, DeviceCode device_code) {
+        const u32 value = device_code.GetInternalValue();
+        return std::find(config.device_codes, config.device_codes + config.num_rails, value) != config.device_codes + config.num_rails;
+    }
+
+    Rail *GetRail(DeviceCode device_code) {
+        const u32 value = device_code.GetInternalValue();
+        if (!IsPowerMonitor(value)) {
+            return nullptr;
+        }
+
+        for (auto &rail : g_rails) {
+            u32 expected = 0;
+            if (rail.device_code.compare_exchange_strong(expected, value) || expected == value) {
+                return std::addressof(rail);
+            }
+        }
+
+        return nullptr;
+    }
+
+    void RecordRegister(Rail *rail, u32 bucket_ms, u8 reg, const u8 *values, size_t size) {
+        /* The ina226 does not advance its register pointer, bytes past the first two repeat the register */
+        if (rail == nullptr || bucket_ms == 0 || size < sizeof(u16)) {
+            return;
+        }
+
+        const u32 value = regmap::GetRegisterValue(regmap::Ina226RegisterMap, values);
+
+        Channel channel;
+        switch (reg) {
+            case Register_ShuntVoltage: channel = Channel_ShuntVoltage; break;
+            case Register_BusVoltage:   channel = Channel_BusVoltage;   break;
+            case Register_Current:      channel = Channel_Current;      break;
+            case Register_Calibration:
+                {
+                    std::scoped_lock lk(rail->mutex);
+                    rail->calibration = value & 0x7FFF;
+                }
+                return;
+            default:
+                return;
+        }
+
+        const u64 now_ms   = os::GetSystemTick().ToTimeSpan().GetMilliSeconds();
+        const u64 start_ms = now_ms - now_ms % bucket_ms;
+        const s16 sample   = static_cast<s16>(value);
+
+        std::scoped_lock lk(rail->mutex);
+
+        /* Buckets of different lengths do not mix, a reload changing it starts the series over */
+        if (rail->bucket_ms != bucket_ms) {
+            rail->bucket_ms   = bucket_ms;
+            rail->num_buckets = 0;
+        }
+
+        Bucket *bucket = rail->GetBucket(start_ms);
+        bucket->calibration = rail->calibration;
+
+        Summary &summary = bucket->channels[channel];
+        summary.min  = std::min(summary.min, sample);
+        summary.max  = std::max(summary.max, sample);
+        summary.sum += sample;
+        summary.count++;
+    }
+
+    size_t GetRailSamples(size_t rail_index, RailBucket *out, size_t max_count) {
+        if (rail_index >= MaxRails) {
+            return 0;
+        }
+
+        Rail &rail = g_rails[rail_index];
+        const u32 device_code = rail.device_code.load();
+        if (device_code == 0) {
+            return 0;
+        }
+
+        std::scoped_lock lk(rail.mutex);
+
+        const size_t count = std::min(rail.num_buckets, max_count);
+        const size_t oldest = (rail.head + NumBuckets + 1 - rail.num_buckets) % NumBuckets;
+        for (size_t i = 0; i < count; i++) {
+            const Bucket &bucket = rail.buckets[(oldest + i) % NumBuckets];
+
+            out[i] = {
+                .device_code = device_code,
+                .calibration = bucket.calibration,
+                .reserved    = 0,
+                .start_ms    = bucket.start_ms,
+                .duration_ms = rail.bucket_ms,
+                .reserved2   = 0,
+                .channels    = {},
+            };
+            for (size_t c = 0; c < Channel_Count; c++) {
+                const Summary &summary = bucket.channels[c];
+                out[i].channels[c] = {
+                    .min      = summary.count != 0 ? summary.min : 0,
+                    .max      = summary.count != 0 ? summary.max : 0,
+                    .sum      = summary.sum,
+                    .count    = summary.count,
+                    .reserved = 0,
+                };
+            }
+        }
+
+        return count;
+    }
+
+    size_t GetSamples(RailBucket *out, size_t max_count) {
+        size_t count = 0;
+        for (size_t i = 0; i < MaxRails && count < max_count; i++) {
+            count += GetRailSamples(i, out + count, max_count - count);
+        }
+        return count;
+    }
+
+    void Reset() {
+        /* Rail slots stay claimed and keep the calibration they saw */
+        for (auto &rail : g_rails) {
+            std::scoped_lock lk(rail.mutex);
+            rail.num_buckets = 0;
+        }
+    }
+
+    int FormatCsvLine(char *buf, size_t buf_size, const RailBucket &bucket) {
+        /* Bus voltage in uV, shunt voltage in nV, current raw */
+        constexpr s64 Scales[Channel_Count] = { 1250, 2500, 1 };
+
+        const DeviceInfo *info = GetDeviceInfo(bucket.device_code);
+        size_t len = util::TSNPrintf(buf, buf_size, "0x%08" PRIx32 ",%s,%" PRIu64 ",%" PRIu32,
+                                     bucket.device_code, info != nullptr ? info->name : "Unknown", bucket.start_ms, bucket.duration_ms);
+
+        for (size_t c = 0; c < Channel_Count && len < buf_size; c++) {
+            const ChannelSummary &summary = bucket.channels[c];
+            if (summary.count == 0) {
+                len += util::TSNPrintf(buf + len, buf_size - len, ",0,,,");
+                continue;
+            }
+            len += util::TSNPrintf(buf + len, buf_size - len, ",%" PRIu32 ",%" PRId64 ",%" PRId64 ",%" PRId64,
+                                   summary.count, summary.min * Scales[c], summary.sum * Scales[c] / summary.count, summary.max * Scales[c]);
+        }
+
+        if (len < buf_size) {
+            len += util::TSNPrintf(buf + len, buf_size - len, ",%" PRIu16 "\n", bucket.calibration);
+        }
+
+        return static_cast<int>(std::min(len, buf_size - 1));
+    }
+
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+
+/* Power rail time series, aggregated from the ina226 reads system clients already do */
+namespace ams::mitm::i2c::telemetry {
+
+    constexpr size_t MaxRails     = 16;
+    constexpr size_t NumBuckets   = 32;
+    constexpr u32 DefaultBucketMs = 1000;
+    constexpr u32 MinBucketMs     = 10;
+    constexpr u32 MaxBucketMs     = 3600000;
+
+    /* Raw ina226 register values, current scales with the calibration register and the shunt */
+    enum Channel {
+        Channel_BusVoltage   = 0, /* 1.25mV per lsb */
+        Channel_ShuntVoltage = 1, /* 2.5uV per lsb */
+        Channel_Current      = 2, /* Current_LSB = 0.00512 / (calibration * R_shunt) per lsb */
+        Channel_Count        = 3,
+    };
+
+    /* Which rails are sampled, part of the config snapshot. No rails disables the sampler. */
+    struct TelemetryConfig {
+        u32 device_codes[MaxRails];
+        size_t num_rails;
+        u32 bucket_ms;
+    };
+
+    /* Layout of the samples returned by the i2cmitm service */
+    struct ChannelSummary {
+        s32 min;
+        s32 max;
+        s64 sum;
+        u32 count;
+        u32 reserved;
+    };
+    static_assert(sizeof(ChannelSummary) == 0x18);
+
+    struct RailBucket {
+        u32 device_code;
+        u16 calibration; /* Last calibration register value seen on the bus, 0 if none was */
+        u16 reserved;
+        u64 start_ms;    /* System tick time the bucket starts at */
+        u32 duration_ms;
+        u32 reserved2;
+        ChannelSummary channels[Channel_Count];
+    };
+    static_assert(sizeof(RailBucket) == 0x60);
+
+    /* Handles the keys of the telemetry section */
+    Result ParseIniEntry(TelemetryConfig *config, const char *name, const char *value);
+    void LogConfig(const TelemetryConfig &config);
+
+    bool IsRailSelected(const TelemetryConfig &config, DeviceCode device_code);
+
+    class Rail;
+
+    /* Returns the time series of a rail, nullptr if the device is no ina226 or all slots are taken. The rail stays valid for the process lifetime. */
+    Rail *GetRail(DeviceCode device_code);
+
+    /* Feeds a register access that went over the bus anyway, values holds the register's bytes as sent on the bus. A bucket_ms of 0 drops it. */
+    void RecordRegister(Rail *rail, u32 bucket_ms, u8 reg, const u8 *values, size_t size);
+
+    /* Copies the buckets of every rail, oldest first, only buckets that got samples are kept */
+    size_t GetSamples(RailBucket *out, size_t max_count);
+    /* Same for the rail in slot rail_index, returns 0 once past the last rail */
+    size_t GetRailSamples(size_t rail_index, RailBucket *out, size_t max_count);
+    void Reset();
+
+    /* CSV export of the buckets, voltages converted to uV and nV */
+    constexpr const char CsvHeader[] = "device_code,rail,start_ms,duration_ms,"
+                                       "vbus_samples,vbus_min_uv,vbus_avg_uv,vbus_max_uv,"
+                                       "vshunt_samples,vshunt_min_nv,vshunt_avg_nv,vshunt_max_nv,"
+                                       "current_samples,current_min,current_avg,current_max,calibration\n";
+    constexpr size_t MaxCsvLineLength = 0x140;
+
+    int FormatCsvLine(char *buf, size_t buf_size, const RailBucket &bucket);
+
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "i2c_mitm_trace.hpp"
+#include "i2c_mitm_selection.hpp"
+#include "i2c_mitm_devices.hpp"
+#include "logging.hpp"
+
+namespace ams::mitm::i2c::trace {
+
+    namespace {
+
+        struct OpName {
+            const char *name;
+            u32 ops;
+        };
+
+        constexpr OpName OpNames[] = {
+            { "send",    Op_Send        },
+            { "recv",    Op_Receive     },
+            { "cmdlist", Op_CommandList },
+            { "retry",   Op_RetryPolicy },
+            { "all",     AllOps         },
+            { "none",    0              },
+        };
+
+        /* A device's mask lives in the same slot until a reboot, so sessions can keep a pointer to it */
+        struct MaskSlot {
+            u32 device_code;
+            Mask mask;
+            bool is_set; /* By the config or over IPC, the others follow the default */
+        };
+
+        constinit os::SdkMutex g_mask_mutex;
+        constinit MaskSlot g_mask_slots[MaxMaskSlots] = {};
+        constinit Mask g_default_mask = DefaultMask;
+
+        /* Ops separated by commas, e.g. "send,cmdlist" */
+        Result ParseOps(const char *value, u32 &out) {
+            u32 ops = 0;
+            R_TRY(selection::ForEachListItem(value, [&](const char *item, char **end) -> Result {
+                const char *cur = item;
+                while ((*cur >= 'a' && *cur <= 'z') || (*cur >= 'A' && *cur <= 'Z')) {
+                    cur++;
+                }
+
+                const std::string_view word(item, cur - item);
+                const auto it = std::find_if(std::begin(OpNames), std::end(OpNames), [&](const OpName &op) {
+                    return word.size() == std::strlen(op.name) && strncasecmp(item, op.name, word.size()) == 0;
+                });
+                R_UNLESS(it != std::end(OpNames), ::ams::settings::ResultInvalidArgument());
+
+                ops |= it->ops;
+                *end = const_cast<char *>(cur);
+                R_SUCCEED();
+            }));
+
+            out = ops;
+            R_SUCCEED();
+        }
+
+        /* Caller holds g_mask_mutex */
+        MaskSlot *FindSlot(u32 device_code) {
+            MaskSlot *free_slot = nullptr;
+            for (auto &slot : g_mask_slots) {
+                if (slot.device_code == device_code) {
+                    return std::addressof(slot);
+                }
+                if (slot.device_code == 0 && free_slot == nullptr) {
+                    free_slot = std::addressof(slot);
+                }
+            }
+
+            if (free_slot != nullptr) {
+                free_slot->device_code = device_code;
+                free_slot->is_set      = false;
+                free_slot->mask.store(g_default_mask.load());
+            }
+            return free_slot;
+        }
+
+        /* Caller holds g_mask_mutex */
+        void SetDefaultMask(u32 mask) {
+            g_default_mask.store(mask);
+            for (auto &slot : g_mask_slots) {
+                if (slot.device_code != 0 && !slot.is_set) {
+                    slot.mask.store(mask);
+                }
+            }
+        }
+
+    }
+
+    Result ParseIniEntry(TraceConfig *config, const char *name, const char *value) {
+        u32 ops;
+        R_TRY(ParseOps(value, ops));
+
+        if (strcasecmp(name, "default") == 0) {
+            config->default_mask = ops;
+            R_SUCCEED();
+        }
+
+        u32 device_code;
+        char *end;
+        R_TRY(ParseDeviceCode(name, std::addressof(end), device_code));
+        R_UNLESS(*end == '\0' && device_code != 0, ::ams::settings::ResultInvalidArgument());
+
+        for (size_t i = 0; i < config->num_devices; i++) {
+            if (config->devices[i].device_code == device_code) {
+                config->devices[i].mask = ops;
+                R_SUCCEED();
+            }
+        }
+
+        if (config->num_devices >= MaxTracedDevices) {
+            log::DebugLog("Too many traced devices, ignoring 0x%08" PRIx32 "\n", device_code);
+            R_SUCCEED();
+        }
+
+        config->devices[config->num_devices++] = { .device_code = device_code, .mask = ops };
+        R_SUCCEED();
+    }
+
+    void LogConfig(const TraceConfig &config) {
+        log::DebugLog("i2c mitm trace: default ops 0x%" PRIx32 "\n", config.default_mask);
+        for (size_t i = 0; i < config.num_devices; i++) {
+            log::DebugLog("i2c mitm trace dev 0x%08" PRIx32 " (%s): ops 0x%" PRIx32 "\n", config.devices[i].device_code, GetDeviceName(config.devices[i].device_code), config.devices[i].mask);
+        }
+    }
+
+    void Commit(const TraceConfig &config) {
+        std::scoped_lock lk(g_mask_mutex);
+
+        for (auto &slot : g_mask_slots) {
+            slot.is_set = false;
+        }
+        SetDefaultMask(config.default_mask);
+
+        for (size_t i = 0; i < config.num_devices; i++) {
+            MaskSlot *slot = FindSlot(config.devices[i].device_code);
+            if (slot == nullptr) {
+                log::DebugLog("No trace mask slot left, dev 0x%08" PRIx32 " follows the default\n", config.devices[i].device_code);
+                continue;
+            }
+
+            slot->is_set = true;
+            slot->mask.store(config.devices[i].mask);
+        }
+    }
+
+    const Mask *GetMask(DeviceCode device_code) {
+        const u32 value = device_code.GetInternalValue();
+        if (value == 0) {
+            return std::addressof(g_default_mask);
+        }
+
+        std::scoped_lock lk(g_mask_mutex);
+        const MaskSlot *slot = FindSlot(value);
+        return slot != nullptr ? std::addressof(slot->mask) : std::addressof(g_default_mask);
+    }
+
+    Result SetMask(u32 device_code, u32 mask) {
+        R_UNLESS((mask & ~AllOps) == 0, ::ams::settings::ResultInvalidArgument());
+
+        std::scoped_lock lk(g_mask_mutex);
+        if (device_code == 0) {
+            SetDefaultMask(mask);
+            R_SUCCEED();
+        }
+
+        MaskSlot *slot = FindSlot(device_code);
+        R_UNLESS(slot != nullptr, ::ams::settings::ResultInvalidArgument());
+
+        slot->is_set = true;
+        slot->mask.store(mask);
+        R_SUCCEED();
+    }
+
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+
+/* Which ops of which devices are captured, switched at runtime through the config or the i2cmitm service */
+namespace ams::mitm::i2c::trace {
+
+    enum Op : u32 {
+        Op_Send        = (1u << 0),
+        Op_Receive     = (1u << 1),
+        Op_CommandList = (1u << 2),
+        Op_RetryPolicy = (1u << 3),
+    };
+
+    constexpr u32 AllOps = Op_Send | Op_Receive | Op_CommandList | Op_RetryPolicy;
+
+    /* Debug builds trace every device unless the config says otherwise, release builds none */
+    #ifdef DEBUG
+    constexpr u32 DefaultMask = AllOps;
+    #else
+    constexpr u32 DefaultMask = 0;
+    #endif
+
+    constexpr size_t MaxTracedDevices = 16;
+    constexpr size_t MaxMaskSlots     = 32;
+
+    struct DeviceMask {
+        u32 device_code;
+        u32 mask;
+    };
+
+    /* Traced ops per device, part of the config snapshot */
+    struct TraceConfig {
+        DeviceMask devices[MaxTracedDevices];
+        size_t num_devices;
+        u32 default_mask; /* Devices that are not listed */
+    };
+
+    /* Handles the keys of the trace section, default=<ops> and <device code or name>=<ops> */
+    Result ParseIniEntry(TraceConfig *config, const char *name, const char *value);
+    void LogConfig(const TraceConfig &config);
+
+    /* Sets every mask to the one of the config, masks set over IPC included */
+    void Commit(const TraceConfig &config);
+
+    using Mask = std::atomic<u32>;
+
+    /* Mask of the device, sessions look it up once when they are opened. Devices beyond MaxMaskSlots share the default mask. */
+    const Mask *GetMask(DeviceCode device_code);
+
+    /* All a disabled trace costs is this load */
+    inline bool IsEnabled(const Mask *mask, u32 ops) {
+        return (mask->load(std::memory_order_relaxed) & ops) != 0;
+    }
+
+    /* Sets the mask of one device, device code 0 sets the default. Lasts until the next config load. */
+    Result SetMask(u32 device_code, u32 mask);
+
+}
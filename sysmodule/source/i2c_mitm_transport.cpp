@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "i2c_mitm_transport.hpp"
+#include <switch/services/i2c.h>
+
+namespace ams::mitm::i2c {
+
+    I2cSessionTransport::I2cSessionTransport(SessionHandle session) : m_session(session) { }
+
+    I2cSessionTransport::~I2cSessionTransport() {
+        serviceClose(&this->m_session.s);
+    }
+
+    Result I2cSessionTransport::Send(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+        if (use_old_command) {
+            R_RETURN(serviceDispatchIn(&this->m_session.s,
+                                       0,
+                                       option,
+                                       .buffer_attrs = {SfBufferAttr_In | SfBufferAttr_HipcMapAlias},
+                                       .buffers = {{data, size}}));
+        } else {
+            R_RETURN(serviceDispatchIn(&this->m_session.s,
+                                       10,
+                                       option,
+                                       .buffer_attrs = {SfBufferAttr_In | SfBufferAttr_HipcAutoSelect},
+                                       .buffers = {{data, size}}));
+        }
+    }
+
+    Result I2cSessionTransport::Receive(u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+        if (use_old_command) {
+            R_RETURN(serviceDispatchIn(&this->m_session.s,
+                                       1,
+                                       option,
+                                       .buffer_attrs = {SfBufferAttr_Out | SfBufferAttr_HipcMapAlias},
+                                       .buffers = {{data, size}}));
+        } else {
+            R_RETURN(serviceDispatchIn(&this->m_session.s,
+                                       11,
+                                       option,
+                                       .buffer_attrs = {SfBufferAttr_Out | SfBufferAttr_HipcAutoSelect},
+                                       .buffers = {{data, size}}));
+        }
+    }
+
+    Result I2cSessionTransport::ExecuteCommandList(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, bool use_old_command) {
+        if (use_old_command) {
+            R_RETURN(serviceDispatch(&this->m_session.s,
+                                     2,
+                                     .buffer_attrs = {SfBufferAttr_Out | SfBufferAttr_HipcMapAlias, SfBufferAttr_In | SfBufferAttr_HipcPointer},
+                                     .buffers = {{rcv_data, rcv_size}, {commands, num_commands}}));
+        } else {
+            R_RETURN(serviceDispatch(&this->m_session.s,
+                                     12,
+                                     .buffer_attrs = {SfBufferAttr_Out | SfBufferAttr_HipcAutoSelect, SfBufferAttr_In | SfBufferAttr_HipcPointer},
+                                     .buffers = {{rcv_data, rcv_size}, {commands, num_commands}}));
+        }
+    }
+
+    Result I2cSessionTransport::SetRetryPolicy(s32 max_retry_count, s32 retry_interval_us) {
+        const u32 in[] = {static_cast<u32>(max_retry_count), static_cast<u32>(retry_interval_us)};
+        R_RETURN(serviceDispatchIn(&this->m_session.s,
+                                   13,
+                                   in));
+    }
+
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <switch/services/i2c.h>
+#else
+namespace ams::host {
+    class FakeI2cDevice;
+}
+#endif
+
+namespace ams::mitm::i2c {
+
+    /*
+     * Carries the session commands to the device. On the console it forwards them to the real i2c session,
+     * the host build links a transport driving a simulated device instead, so the session logic runs unchanged.
+     */
+    class I2cSessionTransport {
+        NON_COPYABLE(I2cSessionTransport);
+        NON_MOVEABLE(I2cSessionTransport);
+        public:
+            #if defined(ATMOSPHERE_OS_HORIZON)
+            /* Held inline, every forwarded call reads the service handle straight out of the session object */
+            using SessionHandle = ::I2cSession;
+            #else
+            using SessionHandle = host::FakeI2cDevice *;
+            #endif
+        private:
+            SessionHandle m_session;
+        public:
+            explicit I2cSessionTransport(SessionHandle session);
+            ~I2cSessionTransport();
+
+            /* use_old_command selects the pre 6.0.0 commands with map alias buffers over the auto select ones */
+            Result Send(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command);
+            Result Receive(u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command);
+            Result ExecuteCommandList(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, bool use_old_command);
+            Result SetRetryPolicy(s32 max_retry_count, s32 retry_interval_us);
+    };
+
+}
@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
+#include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+#include <span>
+
+/* Register and field layouts of the chips the mitm knows about, shared between the sysmodule and the host tools */
+namespace ams::mitm::i2c::regmap {
+
+    enum FieldFormat : u8 {
+        FieldFormat_Value, /* offset + raw * num / den, in unit */
+        FieldFormat_Flag,
+        FieldFormat_Enum,
+        FieldFormat_Hex,
+    };
+
+    struct FieldInfo {
+        const char *name;
+        u8 shift;
+        u8 width;
+        FieldFormat format;
+        bool is_signed;
+        s32 offset;
+        s32 num;
+        s32 den;
+        const char *unit;
+        std::span<const char * const> enum_names;
+
+        constexpr u32 GetRaw(u32 value) const {
+            return (value >> shift) & ((u32(1) << width) - 1);
+        }
+    };
+
+    constexpr FieldInfo Flag(const char *name, u8 bit) {
+        return { name, bit, 1, FieldFormat_Flag, false, 0, 1, 1, "", {} };
+    }
+
+    constexpr FieldInfo Hex(const char *name, u8 shift, u8 width) {
+        return { name, shift, width, FieldFormat_Hex, false, 0, 1, 1, "", {} };
+    }
+
+    constexpr FieldInfo Value(const char *name, u8 shift, u8 width, s32 offset, s32 num, s32 den, const char *unit) {
+        return { name, shift, width, FieldFormat_Value, false, offset, num, den, unit, {} };
+    }
+
+    constexpr FieldInfo SignedValue(const char *name, u8 shift, u8 width, s32 num, s32 den, const char *unit) {
+        return { name, shift, width, FieldFormat_Value, true, 0, num, den, unit, {} };
+    }
+
+    constexpr FieldInfo Enum(const char *name, u8 shift, u8 width, std::span<const char * const> names) {
+        return { name, shift, width, FieldFormat_Enum, false, 0, 1, 1, "", names };
+    }
+
+    struct RegisterInfo {
+        u8 reg;
+        const char *name;
+        std::span<const FieldInfo> fields = {};
+    };
+
+    /* Registers sorted by address, registers missing from the map have no name */
+    struct RegisterMap {
+        const RegisterInfo *registers;
+        size_t num_registers;
+        size_t register_size;
+        bool big_endian; /* Byte order of multi byte registers */
+    };
+
+    /* Value of the register_size bytes at values */
+    constexpr u32 GetRegisterValue(const RegisterMap &map, const u8 *values) {
+        u32 value = 0;
+        for (size_t i = 0; i < map.register_size; i++) {
+            const size_t shift = map.big_endian ? map.register_size - 1 - i : i;
+            value |= static_cast<u32>(values[i]) << (BITSIZEOF(u8) * shift);
+        }
+        return value;
+    }
+
+    /* bq24193 charger, datasheet SLUSBA5 */
+    constexpr inline const char *Bq24193InputLimitNames[]   = { "100mA", "150mA", "500mA", "900mA", "1200mA", "1500mA", "2000mA", "3000mA" };
+    constexpr inline const char *Bq24193ChargeConfigNames[] = { "disable", "charge", "otg", "otg" };
+    constexpr inline const char *Bq24193BoostLimitNames[]   = { "500mA", "1300mA" };
+    constexpr inline const char *Bq24193WatchdogNames[]     = { "disable", "40s", "80s", "160s" };
+    constexpr inline const char *Bq24193ChargeTimerNames[]  = { "5h", "8h", "12h", "20h" };
+    constexpr inline const char *Bq24193ThermalRegNames[]   = { "60C", "80C", "100C", "120C" };
+    constexpr inline const char *Bq24193VbusStatNames[]     = { "unknown", "usb host", "adapter", "otg" };
+    constexpr inline const char *Bq24193ChargeStatNames[]   = { "not charging", "pre-charge", "fast charging", "charge done" };
+    constexpr inline const char *Bq24193ChargeFaultNames[]  = { "normal", "input fault", "thermal shutdown", "safety timer expired" };
+
+    constexpr inline FieldInfo Bq24193Reg00Fields[] = { Flag("EN_HIZ", 7), Value("VINDPM", 3, 4, 3880, 80, 1, "mV"), Enum("IINLIM", 0, 3, Bq24193InputLimitNames) };
+    constexpr inline FieldInfo Bq24193Reg01Fields[] = { Flag("REG_RESET", 7), Flag("WD_RST", 6), Enum("CHG_CONFIG", 4, 2, Bq24193ChargeConfigNames), Value("SYS_MIN", 1, 3, 3000, 100, 1, "mV"), Enum("BOOST_LIM", 0, 1, Bq24193BoostLimitNames) };
+    constexpr inline FieldInfo Bq24193Reg02Fields[] = { Value("ICHG", 2, 6, 512, 64, 1, "mA"), Flag("BCOLD", 1), Flag("FORCE_20PCT", 0) };
+    constexpr inline FieldInfo Bq24193Reg03Fields[] = { Value("IPRECHG", 4, 4, 128, 128, 1, "mA"), Value("ITERM", 0, 4, 128, 128, 1, "mA") };
+    constexpr inline FieldInfo Bq24193Reg04Fields[] = { Value("VREG", 2, 6, 3504, 16, 1, "mV"), Value("BATLOWV", 1, 1, 2800, 200, 1, "mV"), Value("VRECHG", 0, 1, 100, 200, 1, "mV") };
+    constexpr inline FieldInfo Bq24193Reg05Fields[] = { Flag("EN_TERM", 7), Flag("TERM_STAT", 6), Enum("WATCHDOG", 4, 2, Bq24193WatchdogNames), Flag("EN_TIMER", 3), Enum("CHG_TIMER", 1, 2, Bq24193ChargeTimerNames), Flag("JEITA_ISET", 0) };
+    constexpr inline FieldInfo Bq24193Reg06Fields[] = { Value("BAT_COMP", 5, 3, 0, 10, 1, "mOhm"), Value("VCLAMP", 2, 3, 0, 16, 1, "mV"), Enum("TREG", 0, 2, Bq24193ThermalRegNames) };
+    constexpr inline FieldInfo Bq24193Reg07Fields[] = { Flag("DPDM_EN", 7), Flag("TMR2X_EN", 6), Flag("BATFET_DISABLE", 5), Flag("JEITA_VSET", 4), Hex("INT_MASK", 0, 2) };
+    constexpr inline FieldInfo Bq24193Reg08Fields[] = { Enum("VBUS_STAT", 6, 2, Bq24193VbusStatNames), Enum("CHRG_STAT", 4, 2, Bq24193ChargeStatNames), Flag("DPM_STAT", 3), Flag("PG_STAT", 2), Flag("THERM_STAT", 1), Flag("VSYS_STAT", 0) };
+    constexpr inline FieldInfo Bq24193Reg09Fields[] = { Flag("WATCHDOG_FAULT", 7), Flag("BOOST_FAULT", 6), Enum("CHRG_FAULT", 4, 2, Bq24193ChargeFaultNames), Flag("BAT_FAULT", 3), Hex("NTC_FAULT", 0, 3) };
+    constexpr inline FieldInfo Bq24193Reg0AFields[] = { Hex("PN", 3, 3), Flag("TS_PROFILE", 2), Hex("DEV_REG", 0, 2) };
+
+    constexpr inline RegisterInfo Bq24193Registers[] = {
+        { 0x00, "InputSourceControl",                     Bq24193Reg00Fields },
+        { 0x01, "PowerOnConfiguration",                   Bq24193Reg01Fields },
+        { 0x02, "ChargeCurrentControl",                   Bq24193Reg02Fields },
+        { 0x03, "PreChargeTerminationCurrentControl",     Bq24193Reg03Fields },
+        { 0x04, "ChargeVoltageControl",                   Bq24193Reg04Fields },
+        { 0x05, "ChargeTerminationTimerControl",          Bq24193Reg05Fields },
+        { 0x06, "IrCompensationThermalRegulationControl", Bq24193Reg06Fields },
+        { 0x07, "MiscOperationControl",                   Bq24193Reg07Fields },
+        { 0x08, "SystemStatus",                           Bq24193Reg08Fields },
+        { 0x09, "Fault",                                  Bq24193Reg09Fields },
+        { 0x0A, "VendorPartRevisionStatus",               Bq24193Reg0AFields },
+    };
+
+    /* max17050 fuel gauge, 16 bit registers. Current and capacity assume the 5mOhm sense resistor of the console. */
+    constexpr inline FieldInfo Max17050StatusFields[]      = { Flag("POR", 1), Flag("BST", 3), Flag("VMN", 8), Flag("TMN", 9), Flag("SMN", 10), Flag("BI", 11), Flag("VMX", 12), Flag("TMX", 13), Flag("SMX", 14), Flag("BR", 15) };
+    constexpr inline FieldInfo Max17050CapacityFields[]    = { Value("CAP", 0, 16, 0, 1, 1, "mAh") };
+    constexpr inline FieldInfo Max17050PercentFields[]     = { Value("PCT", 0, 16, 0, 1, 256, "%") };
+    constexpr inline FieldInfo Max17050TemperatureFields[] = { SignedValue("TEMP", 0, 16, 1, 256, "C") };
+    constexpr inline FieldInfo Max17050VoltageFields[]     = { Value("V", 0, 16, 0, 5, 64, "mV") };
+    constexpr inline FieldInfo Max17050CurrentFields[]     = { SignedValue("I", 0, 16, 5, 16, "mA") };
+    constexpr inline FieldInfo Max17050TimeFields[]        = { Value("TTE", 0, 16, 0, 45, 8, "s") };
+    constexpr inline FieldInfo Max17050CyclesFields[]      = { Value("CYCLES", 0, 16, 0, 1, 100, "") };
+    constexpr inline FieldInfo Max17050MaxMinTempFields[]  = { SignedValue("MAX", 8, 8, 1, 1, "C"), SignedValue("MIN", 0, 8, 1, 1, "C") };
+    constexpr inline FieldInfo Max17050MaxMinVoltFields[]  = { Value("MAX", 8, 8, 0, 20, 1, "mV"), Value("MIN", 0, 8, 0, 20, 1, "mV") };
+    constexpr inline FieldInfo Max17050VEmptyFields[]      = { Value("VE", 7, 9, 0, 10, 1, "mV"), Value("VR", 0, 7, 0, 40, 1, "mV") };
+    constexpr inline FieldInfo Max17050VersionFields[]     = { Hex("VERSION", 0, 16) };
+
+    constexpr inline RegisterInfo Max17050Registers[] = {
+        { 0x00, "Status",             Max17050StatusFields },
+        { 0x01, "VAlrtThreshold"     },
+        { 0x02, "TAlrtThreshold"     },
+        { 0x03, "SAlrtThreshold"     },
+        { 0x04, "AtRate"             },
+        { 0x05, "RemCapRep",          Max17050CapacityFields },
+        { 0x06, "SOCRep",             Max17050PercentFields },
+        { 0x07, "Age",                Max17050PercentFields },
+        { 0x08, "Temperature",        Max17050TemperatureFields },
+        { 0x09, "VCell",              Max17050VoltageFields },
+        { 0x0A, "Current",            Max17050CurrentFields },
+        { 0x0B, "AverageCurrent",     Max17050CurrentFields },
+        { 0x0D, "SOCMix",             Max17050PercentFields },
+        { 0x0E, "SOCAv",              Max17050PercentFields },
+        { 0x0F, "RemCapMix",          Max17050CapacityFields },
+        { 0x10, "FullCAP",            Max17050CapacityFields },
+        { 0x11, "TTE",                Max17050TimeFields },
+        { 0x12, "QResidual00"        },
+        { 0x13, "FullSOCThr"         },
+        { 0x16, "AverageTemperature", Max17050TemperatureFields },
+        { 0x17, "Cycles",             Max17050CyclesFields },
+        { 0x18, "DesignCap",          Max17050CapacityFields },
+        { 0x19, "AverageVCell",       Max17050VoltageFields },
+        { 0x1A, "MaxMinTemperature",  Max17050MaxMinTempFields },
+        { 0x1B, "MaxMinVoltage",      Max17050MaxMinVoltFields },
+        { 0x1C, "MaxMinCurrent"      },
+        { 0x1D, "Config"             },
+        { 0x1E, "IChgTerm",           Max17050CurrentFields },
+        { 0x1F, "RemCapAv",           Max17050CapacityFields },
+        { 0x21, "Version",            Max17050VersionFields },
+        { 0x22, "QResidual10"        },
+        { 0x23, "FullCAPNom",         Max17050CapacityFields },
+        { 0x24, "TempNom"            },
+        { 0x25, "TempLim"            },
+        { 0x27, "AIN"                },
+        { 0x28, "LearnCFG"           },
+        { 0x29, "FilterCFG"          },
+        { 0x2A, "RelaxCFG"           },
+        { 0x2B, "MiscCFG"            },
+        { 0x2C, "TGAIN"              },
+        { 0x2D, "TOFF"               },
+        { 0x2E, "CGAIN"              },
+        { 0x2F, "COFF"               },
+        { 0x32, "QResidual20"        },
+        { 0x36, "IAvgEmpty"          },
+        { 0x37, "FCTC"               },
+        { 0x38, "RCOMP0"             },
+        { 0x39, "TempCo"             },
+        { 0x3A, "VEmpty",             Max17050VEmptyFields },
+        { 0x3D, "FSTAT"              },
+        { 0x3E, "TIMER"              },
+        { 0x3F, "SHDNTIMER"          },
+        { 0x42, "QResidual30"        },
+        { 0x45, "dQacc"              },
+        { 0x46, "dPacc"              },
+        { 0x4D, "QH"                 },
+        { 0xFB, "VFOCV",              Max17050VoltageFields },
+        { 0xFF, "VFSOC",              Max17050PercentFields },
+    };
+
+    /* max77620 PMIC */
+    constexpr inline const char *Max77620LdoPowerModeNames[] = { "off", "low power", "fps", "normal" };
+
+    constexpr inline FieldInfo Max77620Sd01Fields[]      = { Value("VOUT", 0, 7, 600, 25, 2, "mV") };
+    constexpr inline FieldInfo Max77620Sd23Fields[]      = { Value("VOUT", 0, 8, 600, 25, 2, "mV") };
+    constexpr inline FieldInfo Max77620Ldo01CfgFields[]  = { Enum("PWR_MODE", 6, 2, Max77620LdoPowerModeNames), Value("VOUT", 0, 6, 800, 25, 1, "mV") };
+    constexpr inline FieldInfo Max77620Ldo28CfgFields[]  = { Enum("PWR_MODE", 6, 2, Max77620LdoPowerModeNames), Value("VOUT", 0, 6, 800, 50, 1, "mV") };
+    constexpr inline FieldInfo Max77620OnOffCnfg1Fields[] = { Flag("SFT_RST", 7), Hex("MRT", 3, 3), Flag("SLPEN", 2), Flag("PWR_OFF", 1), Flag("EN0DLY", 0) };
+    constexpr inline FieldInfo Max77620CidFields[]       = { Hex("CID", 0, 8) };
+
+    constexpr inline RegisterInfo Max77620Registers[] = {
+        { 0x00, "CNFGGLBL1"     },
+        { 0x01, "CNFGGLBL2"     },
+        { 0x02, "CNFGGLBL3"     },
+        { 0x03, "CNFG1_32K"     },
+        { 0x04, "CNFGBBC"       },
+        { 0x05, "IRQTOP"        },
+        { 0x06, "INTLBT"        },
+        { 0x07, "IRQSD"         },
+        { 0x08, "IRQ_LVL2_L0_7" },
+        { 0x09, "IRQ_LVL2_L8"   },
+        { 0x0A, "IRQ_LVL2_GPIO" },
+        { 0x0B, "ONOFFIRQ"      },
+        { 0x0C, "NVERC"         },
+        { 0x0D, "IRQTOPM"       },
+        { 0x0E, "INTENLBT"      },
+        { 0x0F, "IRQMASKSD"     },
+        { 0x10, "IRQ_MSK_L0_7"  },
+        { 0x11, "IRQ_MSK_L8"    },
+        { 0x12, "ONOFFIRQM"     },
+        { 0x13, "STATLBT"       },
+        { 0x14, "STATSD"        },
+        { 0x15, "ONOFFSTAT"     },
+        { 0x16, "SD0",           Max77620Sd01Fields },
+        { 0x17, "SD1",           Max77620Sd01Fields },
+        { 0x18, "SD2",           Max77620Sd23Fields },
+        { 0x19, "SD3",           Max77620Sd23Fields },
+        { 0x1A, "SD4"           },
+        { 0x1B, "DVSSD0",        Max77620Sd01Fields },
+        { 0x1C, "DVSSD1",        Max77620Sd01Fields },
+        { 0x1D, "SD0_CFG"       },
+        { 0x1E, "SD1_CFG"       },
+        { 0x1F, "SD2_CFG"       },
+        { 0x20, "SD3_CFG"       },
+        { 0x21, "SD4_CFG"       },
+        { 0x22, "SD_CFG2"       },
+        { 0x23, "LDO0_CFG",      Max77620Ldo01CfgFields },
+        { 0x24, "LDO0_CFG2"     },
+        { 0x25, "LDO1_CFG",      Max77620Ldo01CfgFields },
+        { 0x26, "LDO1_CFG2"     },
+        { 0x27, "LDO2_CFG",      Max77620Ldo28CfgFields },
+        { 0x28, "LDO2_CFG2"     },
+        { 0x29, "LDO3_CFG",      Max77620Ldo28CfgFields },
+        { 0x2A, "LDO3_CFG2"     },
+        { 0x2B, "LDO4_CFG",      Max77620Ldo28CfgFields },
+        { 0x2C, "LDO4_CFG2"     },
+        { 0x2D, "LDO5_CFG",      Max77620Ldo28CfgFields },
+        { 0x2E, "LDO5_CFG2"     },
+        { 0x2F, "LDO6_CFG",      Max77620Ldo28CfgFields },
+        { 0x30, "LDO6_CFG2"     },
+        { 0x31, "LDO7_CFG",      Max77620Ldo28CfgFields },
+        { 0x32, "LDO7_CFG2"     },
+        { 0x33, "LDO8_CFG",      Max77620Ldo28CfgFields },
+        { 0x34, "LDO8_CFG2"     },
+        { 0x35, "LDO_CFG3"      },
+        { 0x36, "GPIO0"         },
+        { 0x37, "GPIO1"         },
+        { 0x38, "GPIO2"         },
+        { 0x39, "GPIO3"         },
+        { 0x3A, "GPIO4"         },
+        { 0x3B, "GPIO5"         },
+        { 0x3C, "GPIO6"         },
+        { 0x3D, "GPIO7"         },
+        { 0x3E, "PUE_GPIO"      },
+        { 0x3F, "PDE_GPIO"      },
+        { 0x40, "AME_GPIO"      },
+        { 0x41, "ONOFFCNFG1",    Max77620OnOffCnfg1Fields },
+        { 0x42, "ONOFFCNFG2"    },
+        { 0x43, "FPS_CFG0"      },
+        { 0x44, "FPS_CFG1"      },
+        { 0x45, "FPS_CFG2"      },
+        { 0x46, "FPS_LDO0"      },
+        { 0x47, "FPS_LDO1"      },
+        { 0x48, "FPS_LDO2"      },
+        { 0x49, "FPS_LDO3"      },
+        { 0x4A, "FPS_LDO4"      },
+        { 0x4B, "FPS_LDO5"      },
+        { 0x4C, "FPS_LDO6"      },
+        { 0x4D, "FPS_LDO7"      },
+        { 0x4E, "FPS_LDO8"      },
+        { 0x4F, "FPS_SD0"       },
+        { 0x50, "FPS_SD1"       },
+        { 0x51, "FPS_SD2"       },
+        { 0x52, "FPS_SD3"       },
+        { 0x53, "FPS_SD4"       },
+        { 0x54, "FPS_GPIO1"     },
+        { 0x55, "FPS_GPIO2"     },
+        { 0x56, "FPS_GPIO3"     },
+        { 0x57, "FPS_RSO"       },
+        { 0x58, "CID0",          Max77620CidFields },
+        { 0x59, "CID1",          Max77620CidFields },
+        { 0x5A, "CID2",          Max77620CidFields },
+        { 0x5B, "CID3",          Max77620CidFields },
+        { 0x5C, "CID4",          Max77620CidFields },
+        { 0x5D, "CID5",          Max77620CidFields },
+    };
+
+    /* ina226 power monitor, 16 bit big endian registers. Current and power scale with the calibration register and the shunt, they are left raw. */
+    constexpr inline const char *Ina226AverageNames[]        = { "1", "4", "16", "64", "128", "256", "512", "1024" };
+    constexpr inline const char *Ina226ConversionTimeNames[] = { "140us", "204us", "332us", "588us", "1.1ms", "2.116ms", "4.156ms", "8.244ms" };
+    constexpr inline const char *Ina226ModeNames[]           = { "power-down", "shunt triggered", "bus triggered", "shunt and bus triggered", "power-down", "shunt continuous", "bus continuous", "shunt and bus continuous" };
+
+    constexpr inline FieldInfo Ina226ConfigFields[]       = { Flag("RST", 15), Enum("AVG", 9, 3, Ina226AverageNames), Enum("VBUSCT", 6, 3, Ina226ConversionTimeNames), Enum("VSHCT", 3, 3, Ina226ConversionTimeNames), Enum("MODE", 0, 3, Ina226ModeNames) };
+    constexpr inline FieldInfo Ina226ShuntVoltageFields[] = { SignedValue("VSHUNT", 0, 16, 5, 2, "uV") };
+    constexpr inline FieldInfo Ina226BusVoltageFields[]   = { Value("VBUS", 0, 16, 0, 5, 4, "mV") };
+    constexpr inline FieldInfo Ina226PowerFields[]        = { Value("POWER", 0, 16, 0, 1, 1, "") };
+    constexpr inline FieldInfo Ina226CurrentFields[]      = { SignedValue("CURRENT", 0, 16, 1, 1, "") };
+    constexpr inline FieldInfo Ina226CalibrationFields[]  = { Value("CAL", 0, 15, 0, 1, 1, "") };
+    constexpr inline FieldInfo Ina226MaskEnableFields[]   = { Flag("SOL", 15), Flag("SUL", 14), Flag("BOL", 13), Flag("BUL", 12), Flag("POL", 11), Flag("CNVR", 10), Flag("AFF", 4), Flag("CVRF", 3), Flag("OVF", 2), Flag("APOL", 1), Flag("LEN", 0) };
+    constexpr inline FieldInfo Ina226DieIdFields[]        = { Hex("DID", 4, 12), Hex("RID", 0, 4) };
+
+    constexpr inline RegisterInfo Ina226Registers[] = {
+        { 0x00, "Configuration",  Ina226ConfigFields       },
+        { 0x01, "ShuntVoltage",   Ina226ShuntVoltageFields },
+        { 0x02, "BusVoltage",     Ina226BusVoltageFields   },
+        { 0x03, "Power",          Ina226PowerFields        },
+        { 0x04, "Current",        Ina226CurrentFields      },
+        { 0x05, "Calibration",    Ina226CalibrationFields  },
+        { 0x06, "MaskEnable",     Ina226MaskEnableFields   },
+        { 0x07, "AlertLimit"     },
+        { 0xFE, "ManufacturerId" },
+        { 0xFF, "DieId",          Ina226DieIdFields        },
+    };
+
+    constexpr inline RegisterMap Bq24193RegisterMap  = { Bq24193Registers,  std::size(Bq24193Registers),  1, false };
+    constexpr inline RegisterMap Max17050RegisterMap = { Max17050Registers, std::size(Max17050Registers), 2, false };
+    constexpr inline RegisterMap Max77620RegisterMap = { Max77620Registers, std::size(Max77620Registers), 1, false };
+    constexpr inline RegisterMap Ina226RegisterMap   = { Ina226Registers,   std::size(Ina226Registers),   2, true  };
+
+    constexpr bool IsSorted(const RegisterMap &map) {
+        for (size_t i = 1; i < map.num_registers; i++) {
+            if (map.registers[i - 1].reg >= map.registers[i].reg) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static_assert(IsSorted(Bq24193RegisterMap));
+    static_assert(IsSorted(Max17050RegisterMap));
+    static_assert(IsSorted(Max77620RegisterMap));
+    static_assert(IsSorted(Ina226RegisterMap));
+
+    /* Returns nullptr for registers missing from the map */
+    constexpr const RegisterInfo *GetRegisterInfo(const RegisterMap &map, u8 reg) {
+        const RegisterInfo *end = map.registers + map.num_registers;
+        const RegisterInfo *it = std::lower_bound(map.registers, end, reg, [](const RegisterInfo &info, u8 reg) { return info.reg < reg; });
+        return it != end && it->reg == reg ? it : nullptr;
+    }
+
+    constexpr const char *GetRegisterName(const RegisterMap &map, u8 reg) {
+        const RegisterInfo *info = GetRegisterInfo(map, reg);
+        return info != nullptr ? info->name : nullptr;
+    }
+
+    static_assert(GetRegisterInfo(Bq24193RegisterMap, 0x04)->fields[0].GetRaw(0xB2) == 0x2C);
+    static_assert([] { constexpr u8 Values[] = { 0x12, 0x34 }; return GetRegisterValue(Ina226RegisterMap, Values) == 0x1234 && GetRegisterValue(Max17050RegisterMap, Values) == 0x3412; }());
+
+}
@@ -1,111 +1,729 @@
 #include "logging.hpp"
+#include "i2c_log_format.hpp"
+#include "i2c_mitm_log_filter.hpp"
 
 namespace ams::log {
 
     namespace {
 
-        constexpr const char LogFilePath[] = "sdmc:/atmosphere/logs/i2c-mitm.log";
-        fs::FileHandle LogFile;
-        s64 LogOffset;
+        constexpr const char PreviousLogFilePath[] = "sdmc:/atmosphere/logs/i2c-mitm.prev.log";
+        constexpr const char OlderCaptureFilePathFormat[] = "sdmc:/atmosphere/logs/i2c-mitm.%zu.cap";
+
+        enum RecordKind : u32 {
+            RecordKind_Padding  = 0,
+            RecordKind_Text     = 1,
+            RecordKind_DataDump = 2,
+            RecordKind_Capture  = 3,
+        };
+
+        /* Every record in the ring starts with this header, followed by size + aux_size bytes of payload */
+        struct RecordHeader {
+            u32 state;
+            u32 kind;
+            s64 tick;
+            const char *thread_name;
+            s32 priority;
+            s32 current_priority;
+            u32 size;
+            u32 aux_size;
+        };
+        static_assert(sizeof(RecordHeader) % alignof(RecordHeader) == 0);
+
+        constexpr u32 RecordState_Committed = (1u << 31);
+
+        constexpr size_t RecordAlignment = alignof(RecordHeader);
+
+        /*
+         * Bounded multi-producer, single-consumer ring of variable sized records.
+         * Producers reserve space with a CAS on the write position, copy their payload and publish the record
+         * by storing its size with the committed bit set. The writer thread consumes committed records in order,
+         * clears the consumed bytes and then releases them by advancing the read position.
+         * When the ring is full, the new record is dropped and counted.
+         */
+        template<size_t Size>
+        class LogRing {
+            static_assert(util::IsAligned(Size, RecordAlignment));
+            private:
+                alignas(RecordAlignment) u8 m_buffer[Size];
+                std::atomic<u64> m_write_pos;
+                std::atomic<u64> m_read_pos;
+                std::atomic<u64> m_dropped;
+            public:
+                constexpr LogRing() : m_buffer(), m_write_pos(0), m_read_pos(0), m_dropped(0) { /* ... */ }
+
+                RecordHeader *Reserve(size_t payload_size) {
+                    const u64 total = util::AlignUp(sizeof(RecordHeader) + payload_size, RecordAlignment);
+                    if (total > Size / 2) {
+                        m_dropped.fetch_add(1);
+                        return nullptr;
+                    }
+
+                    u64 write_pos = m_write_pos.load(std::memory_order_relaxed);
+                    while (true) {
+                        const u64 offset = write_pos % Size;
+                        const u64 padding = (Size - offset < total) ? Size - offset : 0;
+
+                        if (write_pos + padding + total - m_read_pos.load(std::memory_order_acquire) > Size) {
+                            /* Our view of the write position may be stale, only drop if it is current */
+                            const u64 current_write_pos = m_write_pos.load(std::memory_order_acquire);
+                            if (current_write_pos != write_pos) {
+                                write_pos = current_write_pos;
+                                continue;
+                            }
+
+                            m_dropped.fetch_add(1);
+                            return nullptr;
+                        }
+
+                        if (m_write_pos.compare_exchange_weak(write_pos, write_pos + padding + total, std::memory_order_acq_rel)) {
+                            if (padding) {
+                                /* Record doesn't fit at the end of the ring, skip the remaining bytes */
+                                RecordHeader *pad = reinterpret_cast<RecordHeader *>(m_buffer + offset);
+                                pad->kind = RecordKind_Padding;
+                                std::atomic_ref<u32>(pad->state).store(static_cast<u32>(padding) | RecordState_Committed, std::memory_order_release);
+                            }
+
+                            RecordHeader *header = reinterpret_cast<RecordHeader *>(m_buffer + ((write_pos + padding) % Size));
+                            header->size     = payload_size;
+                            header->aux_size = 0;
+                            return header;
+                        }
+                    }
+                }
+
+                void Commit(RecordHeader *header) {
+                    const u32 total = util::AlignUp(sizeof(RecordHeader) + header->size + header->aux_size, RecordAlignment);
+                    std::atomic_ref<u32>(header->state).store(total | RecordState_Committed, std::memory_order_release);
+                }
+
+                size_t GetUsedSize() const {
+                    return m_write_pos.load(std::memory_order_relaxed) - m_read_pos.load(std::memory_order_relaxed);
+                }
+
+                u64 GetDroppedCount() const {
+                    return m_dropped.load(std::memory_order_relaxed);
+                }
+
+                template<typename F>
+                size_t Drain(F f) {
+                    const u64 start_pos = m_read_pos.load(std::memory_order_relaxed);
+                    const u64 end_pos   = m_write_pos.load(std::memory_order_acquire);
+
+                    u64 read_pos = start_pos;
+                    while (read_pos != end_pos) {
+                        const size_t offset = read_pos % Size;
+                        RecordHeader *header = reinterpret_cast<RecordHeader *>(m_buffer + offset);
+
+                        /* Stop at the first record that is reserved but not yet committed */
+                        const u32 state = std::atomic_ref<u32>(header->state).load(std::memory_order_acquire);
+                        if (!(state & RecordState_Committed)) {
+                            break;
+                        }
+
+                        const u32 total = state & ~RecordState_Committed;
+                        if (header->kind != RecordKind_Padding) {
+                            f(*header, reinterpret_cast<const char *>(header + 1));
+                        }
+
+                        /* Clear the record so stale bytes are never mistaken for a committed header */
+                        std::memset(header, 0, total);
+                        read_pos += total;
+                    }
+
+                    m_read_pos.store(read_pos, std::memory_order_release);
+
+                    return read_pos - start_pos;
+                }
+        };
+
+        constexpr size_t LogRingSize = 32_KB;
+        constinit LogRing<LogRingSize> g_log_ring;
+
+        /* Wake the writer early once the ring is half full */
+        constexpr size_t WriterWakeThreshold = LogRingSize / 2;
+        constexpr TimeSpan WriterPollInterval = TimeSpan::FromMilliSeconds(100);
+
+        constexpr s32 WriterThreadPriority = 30;
+        constexpr size_t WriterThreadStackSize = 0x2000;
+        alignas(os::ThreadStackAlignment) constinit u8 g_writer_thread_stack[WriterThreadStackSize];
+        constinit os::ThreadType g_writer_thread;
+        os::EventType g_writer_event;
+
+        constinit std::atomic<bool> g_writer_running = false;
+        constinit std::atomic<bool> g_writer_exit = false;
+
+        constinit std::atomic<u32> g_flush_interval_ms = DefaultFlushIntervalMs;
+        constinit std::atomic<u32> g_flush_threshold_kb = DefaultFlushThresholdKb;
+
+        /* Flush requests are numbered, the writer publishes the last one it completed and signals g_flush_event */
+        constinit std::atomic<u64> g_flush_requested = 0;
+        constinit std::atomic<u64> g_flush_completed = 0;
+        os::EventType g_flush_event;
+
+        /* Longer than any sync of a healthy SD card, a Flush() caller is not held up by a stuck writer beyond it */
+        constexpr TimeSpan FlushTimeout = TimeSpan::FromSeconds(5);
+
+        /* Appended files grow in extents, so appending does not extend the FAT cluster chain on every write */
+        constexpr s64 FileExtentSize = 1_MB;
+
+        /*
+         * Output file of the writer thread, kept open for the lifetime of the process.
+         * Writes are batched through a buffer and only flushed to the SD card when the writer syncs the sink.
+         * A ring sink writes its data area as a circular buffer and records the write position in the file header.
+         * Otherwise the file is appended to, preallocated in extents and truncated to the written size when the sink is closed.
+         */
+        class LogSink {
+            private:
+                const char *m_path;
+                char *m_buffer;
+                size_t m_buffer_capacity;
+                size_t m_buffer_size;
+                fs::FileHandle m_file;
+                /* Bytes written since the file was created */
+                s64 m_offset;
+                s64 m_file_size;
+                /* Size of the data area of a ring sink, 0 when the file is appended to */
+                s64 m_ring_size;
+                /* Bytes written or buffered since the last flush */
+                size_t m_unsynced_size;
+                bool m_is_open;
+            public:
+                constexpr LogSink(const char *path, char *buffer, size_t buffer_capacity, s64 ring_size) : m_path(path), m_buffer(buffer), m_buffer_capacity(buffer_capacity), m_buffer_size(0), m_file(), m_offset(0), m_file_size(0), m_ring_size(ring_size), m_unsynced_size(0), m_is_open(false) { /* ... */ }
+
+                Result Initialize() {
+                    // Check if file exists and create it if not
+                    bool has_file;
+                    R_TRY(fs::HasFile(&has_file, m_path));
+                    if (!has_file) {
+                        R_TRY(fs::CreateFile(m_path, 0));
+                    }
+
+                    R_TRY(fs::OpenFile(&m_file, m_path, fs::OpenMode_ReadWrite | fs::OpenMode_AllowAppend));
+                    m_is_open = true;
+
+                    // Get file write offset
+                    R_TRY(fs::GetFileSize(&m_file_size, m_file));
+                    m_offset = m_file_size;
+                    if (m_ring_size) {
+                        R_TRY(this->InitializeRing());
+                    }
+
+                    R_SUCCEED();
+                }
+
+                void Close() {
+                    if (m_is_open) {
+                        this->WriteBuffer();
+                        if (m_ring_size) {
+                            R_ABORT_UNLESS(this->WriteRingHeader());
+                        } else {
+                            R_ABORT_UNLESS(fs::SetFileSize(m_file, m_offset));
+                        }
+                        R_ABORT_UNLESS(fs::FlushFile(m_file));
+                        fs::CloseFile(m_file);
+                        m_unsynced_size = 0;
+                        m_is_open = false;
+                    }
+                }
+
+                void Sync() {
+                    if (m_is_open && m_unsynced_size != 0) {
+                        this->WriteBuffer();
+                        if (m_ring_size) {
+                            R_ABORT_UNLESS(this->WriteRingHeader());
+                        }
+                        R_ABORT_UNLESS(fs::FlushFile(m_file));
+                        m_unsynced_size = 0;
+                    }
+                }
+
+                size_t GetUnsyncedSize() const {
+                    return m_unsynced_size;
+                }
+
+                bool IsOpen() const {
+                    return m_is_open;
+                }
+
+                /* Size of the file once the buffer is written, appended sinks only */
+                s64 GetSize() const {
+                    return m_offset + m_buffer_size;
+                }
+
+                void WriteBuffer() {
+                    if (m_buffer_size == 0 || !m_is_open) {
+                        return;
+                    }
+
+                    if (m_ring_size) {
+                        this->WriteRing();
+                        return;
+                    }
+
+                    const s64 end = m_offset + m_buffer_size;
+                    if (end > m_file_size) {
+                        m_file_size = util::AlignUp(end, FileExtentSize);
+                        R_ABORT_UNLESS(fs::SetFileSize(m_file, m_file_size));
+                    }
+
+                    R_ABORT_UNLESS(fs::WriteFile(m_file, m_offset, m_buffer, m_buffer_size, fs::WriteOption::None));
+                    m_offset = end;
+                    m_buffer_size = 0;
+                }
+
+                char *GetBuffer(size_t size) {
+                    AMS_ASSERT(size <= m_buffer_capacity);
+                    if (m_buffer_capacity - m_buffer_size < size) {
+                        this->WriteBuffer();
+                    }
+                    return m_buffer + m_buffer_size;
+                }
+
+                void Advance(size_t size) {
+                    m_buffer_size += size;
+                    m_unsynced_size += size;
+                }
+
+                void Write(const void *data, size_t size) {
+                    std::memcpy(this->GetBuffer(size), data, size);
+                    this->Advance(size);
+                }
+
+                void Printf(size_t max_size, const char *fmt, ...) {
+                    char *buff = this->GetBuffer(max_size);
+
+                    std::va_list args;
+                    va_start(args, fmt);
+                    const int len = util::TVSNPrintf(buff, max_size, fmt, args);
+                    va_end(args);
+
+                    this->Advance(std::min<size_t>(len, max_size - 1));
+                }
+
+            private:
+                /* Continues at the position of a valid ring file, anything else is replaced by an empty one of the full size */
+                Result InitializeRing() {
+                    mitm::i2c::logfile::FileHeader header = {};
+                    if (m_file_size >= static_cast<s64>(sizeof(header))) {
+                        R_TRY(fs::ReadFile(m_file, 0, std::addressof(header), sizeof(header)));
+                    }
+
+                    if (mitm::i2c::logfile::IsValidHeader(header, m_file_size)) {
+                        m_ring_size = header.data_size;
+                        m_offset    = header.write_position;
+                    } else {
+                        m_offset    = 0;
+                        m_file_size = sizeof(header) + m_ring_size;
+                        R_TRY(fs::SetFileSize(m_file, m_file_size));
+                        R_TRY(this->WriteRingHeader());
+                    }
+
+                    AMS_ABORT_UNLESS(static_cast<s64>(m_buffer_capacity) <= m_ring_size);
+                    R_SUCCEED();
+                }
+
+                Result WriteRingHeader() {
+                    const mitm::i2c::logfile::FileHeader header = {
+                        .magic          = mitm::i2c::logfile::FileMagic,
+                        .version        = mitm::i2c::logfile::FormatVersion,
+                        .header_size    = sizeof(mitm::i2c::logfile::FileHeader),
+                        .data_size      = static_cast<u64>(m_ring_size),
+                        .write_position = static_cast<u64>(m_offset),
+                    };
+                    R_RETURN(fs::WriteFile(m_file, 0, std::addressof(header), sizeof(header), fs::WriteOption::None));
+                }
+
+                /* Splits the buffer where it wraps around the end of the data area */
+                void WriteRing() {
+                    size_t written = 0;
+                    while (written < m_buffer_size) {
+                        const s64 position = m_offset % m_ring_size;
+                        const size_t size = std::min<s64>(m_buffer_size - written, m_ring_size - position);
+                        R_ABORT_UNLESS(fs::WriteFile(m_file, sizeof(mitm::i2c::logfile::FileHeader) + position, m_buffer + written, size, fs::WriteOption::None));
+                        written  += size;
+                        m_offset += size;
+                    }
+
+                    m_buffer_size = 0;
+                }
+        };
+
+        /* Sink buffers, only touched by the writer thread. A full buffer goes out as one page aligned WriteFile. */
+        constexpr size_t LogBufferSize = 0x8000;
+        constexpr size_t CaptureBufferSize = 0x8000;
+        alignas(os::MemoryPageSize) constinit char g_log_buffer[LogBufferSize];
+        alignas(os::MemoryPageSize) constinit char g_capture_buffer[CaptureBufferSize];
+
+        constinit LogSink g_log_sink(mitm::i2c::logfile::LogFilePath, g_log_buffer, sizeof(g_log_buffer), mitm::i2c::logfile::DefaultDataSize);
+        constinit LogSink g_capture_sink(mitm::i2c::capture::CaptureFilePath, g_capture_buffer, sizeof(g_capture_buffer), 0);
+
+        constinit u64 g_reported_dropped = 0;
+
+        /* The log of older versions grew without bound, it is kept as the previous log when the ring file replaces it */
+        Result KeepUnboundedLog() {
+            bool has_file;
+            R_TRY(fs::HasFile(&has_file, mitm::i2c::logfile::LogFilePath));
+            if (!has_file) {
+                R_SUCCEED();
+            }
+
+            bool is_ring_file;
+            {
+                fs::FileHandle file;
+                R_TRY(fs::OpenFile(&file, mitm::i2c::logfile::LogFilePath, fs::OpenMode_Read));
+                ON_SCOPE_EXIT { fs::CloseFile(file); };
+
+                s64 file_size;
+                R_TRY(fs::GetFileSize(&file_size, file));
+
+                mitm::i2c::logfile::FileHeader header = {};
+                if (file_size >= static_cast<s64>(sizeof(header))) {
+                    R_TRY(fs::ReadFile(file, 0, std::addressof(header), sizeof(header)));
+                }
+                is_ring_file = mitm::i2c::logfile::IsValidHeader(header, file_size);
+            }
+
+            if (!is_ring_file) {
+                R_TRY(fs::HasFile(&has_file, PreviousLogFilePath));
+                if (has_file) {
+                    R_TRY(fs::DeleteFile(PreviousLogFilePath));
+                }
+                R_TRY(fs::RenameFile(mitm::i2c::logfile::LogFilePath, PreviousLogFilePath));
+            }
+
+            R_SUCCEED();
+        }
+
+        /* Shifts every capture file one place older, the oldest is deleted */
+        Result ShiftCaptureFiles() {
+            char older_path[fs::EntryNameLengthMax];
+            char path[fs::EntryNameLengthMax];
+
+            for (size_t i = mitm::i2c::capture::NumFiles - 1; i > 0; i--) {
+                util::TSNPrintf(older_path, sizeof(older_path), OlderCaptureFilePathFormat, i);
+                if (i > 1) {
+                    util::TSNPrintf(path, sizeof(path), OlderCaptureFilePathFormat, i - 1);
+                } else {
+                    util::TSNPrintf(path, sizeof(path), "%s", mitm::i2c::capture::CaptureFilePath);
+                }
+
+                bool has_file;
+                R_TRY(fs::HasFile(&has_file, path));
+                if (!has_file) {
+                    continue;
+                }
+
+                R_TRY(fs::HasFile(&has_file, older_path));
+                if (has_file) {
+                    R_TRY(fs::DeleteFile(older_path));
+                }
+                R_TRY(fs::RenameFile(path, older_path));
+            }
+
+            R_SUCCEED();
+        }
+
+        Result InitializeCaptureFile() {
+            /* Every boot and every full file starts a new capture file, so the captures of earlier boots are kept until they age out */
+            R_TRY(ShiftCaptureFiles());
+            R_TRY(g_capture_sink.Initialize());
+
+            const mitm::i2c::capture::FileHeader header = {
+                .magic          = mitm::i2c::capture::FileMagic,
+                .version        = mitm::i2c::capture::FormatVersion,
+                .header_size    = sizeof(mitm::i2c::capture::FileHeader),
+                .tick_frequency = static_cast<u64>(os::GetSystemTickFrequency()),
+            };
+            g_capture_sink.Write(std::addressof(header), sizeof(header));
+            g_capture_sink.Sync();
+
+            R_SUCCEED();
+        }
+
+        void FormatRecordHeader(const RecordHeader &header) {
+            const auto ts = os::Tick(header.tick).ToTimeSpan();
+            g_log_sink.Printf(0x80, "[ts: %6lums t: %-13s p: %d/%d] ",
+                ts.GetMilliSeconds(),
+                header.thread_name,
+                header.priority + 28,
+                header.current_priority + 28
+            );
+        }
+
+        void FormatDataDump(const u8 *data, size_t size) {
+            /* One line holds 16 bytes: a leading space and "xx " per byte */
+            constexpr size_t MaxLineSize = 1 + 16 * 3 + 1;
+
+            for (size_t i = 0; i < size; i += 16) {
+                char *buff = g_log_sink.GetBuffer(MaxLineSize);
+                int len = util::TSNPrintf(buff, MaxLineSize, " ");
+
+                for (size_t j = i; j < std::min(size, i + 16); ++j) {
+                    len += util::TSNPrintf(buff + len, MaxLineSize - len, "%02x%c", data[j], (j + 1) % 16 ? ' ' : '\n');
+                }
+
+                g_log_sink.Advance(len);
+            }
+
+            g_log_sink.Write("\n", 1);
+        }
+
+        void WriteCaptureRecord(const char *record, size_t size) {
+            if (!g_capture_sink.IsOpen()) {
+                return;
+            }
+
+            if (g_capture_sink.GetSize() + static_cast<s64>(size) > mitm::i2c::capture::MaxFileSize) {
+                g_capture_sink.Close();
+                if (const Result result = InitializeCaptureFile(); R_FAILED(result)) {
+                    g_capture_sink.Close();
+                    g_log_sink.Printf(0x80, "[capture file rotation failed: 0x%" PRIx32 ", capture stopped]\n", result.GetValue());
+                    return;
+                }
+            }
+
+            /* Capture records are already in their on-disk format */
+            g_capture_sink.Write(record, size);
+        }
+
+        void FormatRecord(const RecordHeader &header, const char *payload) {
+            switch (header.kind) {
+                case RecordKind_Text:
+                    FormatRecordHeader(header);
+                    g_log_sink.Write(payload, header.size);
+                    break;
+                case RecordKind_DataDump:
+                    FormatRecordHeader(header);
+                    g_log_sink.Write(payload, header.size);
+                    FormatDataDump(reinterpret_cast<const u8 *>(payload + header.size), header.aux_size);
+                    break;
+                case RecordKind_Capture:
+                    WriteCaptureRecord(payload, header.size);
+                    break;
+                AMS_UNREACHABLE_DEFAULT_CASE();
+            }
+        }
+
+        void FormatDroppedCount() {
+            const u64 dropped = g_log_ring.GetDroppedCount();
+            if (dropped == g_reported_dropped) {
+                return;
+            }
+
+            g_log_sink.Printf(0x80, "[log ring full, dropped %" PRIu64 " records]\n", dropped - g_reported_dropped);
+            g_reported_dropped = dropped;
+        }
+
+        void WriteLogBatch() {
+            if (g_log_ring.GetUsedSize() == 0 && g_log_ring.GetDroppedCount() == g_reported_dropped) {
+                return;
+            }
+
+            /* Keep draining until the producers are idle, so a burst ends up in the buffers as a whole */
+            while (g_log_ring.Drain(FormatRecord) != 0) { /* ... */ }
+
+            FormatDroppedCount();
+        }
+
+        void SyncSinks() {
+            g_log_sink.Sync();
+            g_capture_sink.Sync();
+        }
+
+        void LogWriterThreadFunction(void *) {
+            os::Tick last_sync = os::GetSystemTick();
+
+            while (!g_writer_exit.load()) {
+                os::TimedWaitEvent(&g_writer_event, WriterPollInterval);
+
+                /* Counts of pollers that stopped are only written from here */
+                mitm::i2c::logfilter::SettleExpired(os::GetSystemTick().GetInt64Value());
+
+                /* Loaded before draining, so every record pushed before a Flush() call is in the batch that completes it */
+                const u64 requested = g_flush_requested.load();
+                WriteLogBatch();
+
+                const size_t threshold = static_cast<size_t>(g_flush_threshold_kb.load(std::memory_order_relaxed)) * 1_KB;
+                const auto now = os::GetSystemTick();
+                if (requested != g_flush_completed.load(std::memory_order_relaxed) ||
+                    (now - last_sync).ToTimeSpan() >= TimeSpan::FromMilliSeconds(g_flush_interval_ms.load(std::memory_order_relaxed)) ||
+                    g_log_sink.GetUnsyncedSize() >= threshold || g_capture_sink.GetUnsyncedSize() >= threshold) {
+                    SyncSinks();
+                    last_sync = now;
+                    g_flush_completed.store(requested);
+                    os::SignalEvent(&g_flush_event);
+                }
+            }
+
+            WriteLogBatch();
+            g_log_sink.Close();
+            g_capture_sink.Close();
+
+            /* Nothing is written past this point, so requests that came in while closing are released too */
+            g_flush_completed.store(g_flush_requested.load());
+            os::SignalEvent(&g_flush_event);
+        }
+
+        RecordHeader *ReserveRecord(RecordKind kind, size_t size, size_t aux_size) {
+            RecordHeader *header = g_log_ring.Reserve(size + aux_size);
+            if (header == nullptr) {
+                return nullptr;
+            }
+
+            auto thread = os::GetCurrentThread();
+            header->kind             = kind;
+            header->tick             = os::GetSystemTick().GetInt64Value();
+            header->thread_name      = os::GetThreadNamePointer(thread);
+            header->priority         = os::GetThreadPriority(thread);
+            header->current_priority = os::GetThreadCurrentPriority(thread);
+            header->size             = size;
+            header->aux_size         = aux_size;
+
+            return header;
+        }
+
+        void CommitRecord(RecordHeader *header) {
+            g_log_ring.Commit(header);
+
+            if (g_log_ring.GetUsedSize() >= WriterWakeThreshold && g_writer_running.load(std::memory_order_relaxed)) {
+                os::SignalEvent(&g_writer_event);
+            }
+        }
+
+        void PushRecord(RecordKind kind, const char *fmt, std::va_list args, const void *data, size_t data_size) {
+            char buff[0x400];
+            const int len = std::min<int>(util::TVSNPrintf(buff, sizeof(buff), fmt, args), sizeof(buff) - 1);
+
+            RecordHeader *header = ReserveRecord(kind, len, data_size);
+            if (header == nullptr) {
+                return;
+            }
+
+            char *payload = reinterpret_cast<char *>(header + 1);
+            std::memcpy(payload, buff, len);
+            if (data_size) {
+                std::memcpy(payload + len, data, data_size);
+            }
+
+            CommitRecord(header);
+        }
+
+    }
+
+    namespace impl {
+
+        constinit std::atomic<u32> g_level = DefaultLevel;
 
-        constinit os::SdkMutex g_log_lock;
-        
     }
 
     Result Initialize() {
-        // Check if log file exists and create it if not
-        bool has_file;
-        R_TRY(fs::HasFile(&has_file, LogFilePath));
-        if (!has_file) {
-            R_TRY(fs::CreateFile(LogFilePath, 0));
-        }
+        R_TRY(KeepUnboundedLog());
+        R_TRY(g_log_sink.Initialize());
+        g_log_sink.Printf(0x100, "\n======================== LOG STARTED ========================\n");
+        g_log_sink.Sync();
 
-        // Get file write offset
-        R_TRY(fs::OpenFile(&LogFile, LogFilePath, fs::OpenMode_Write | fs::OpenMode_AllowAppend));
-        R_TRY(GetFileSize(&LogOffset, LogFile));
-        
-        char buff[0x100];
-        int len = util::TSNPrintf(buff, sizeof(buff), "\n======================== LOG STARTED ========================\n");
-        R_ABORT_UNLESS(fs::WriteFile(LogFile, LogOffset, buff, len, fs::WriteOption::Flush));
-        LogOffset += len;
+        R_TRY(InitializeCaptureFile());
 
-        fs::CloseFile(LogFile);
+        // Start the background writer, log lines are only queued by the callers
+        os::InitializeEvent(&g_writer_event, false, os::EventClearMode_AutoClear);
+        os::InitializeEvent(&g_flush_event, false, os::EventClearMode_AutoClear);
+        R_ABORT_UNLESS(os::CreateThread(&g_writer_thread,
+            LogWriterThreadFunction,
+            nullptr,
+            g_writer_thread_stack,
+            WriterThreadStackSize,
+            WriterThreadPriority
+        ));
+
+        os::SetThreadNamePointer(&g_writer_thread, "LogWriter");
+        os::StartThread(&g_writer_thread);
+        g_writer_running.store(true);
 
         R_SUCCEED();
     }
 
     void Finalize() {
-        fs::FlushFile(LogFile);
-        fs::CloseFile(LogFile);
+        if (!g_writer_running.exchange(false)) {
+            return;
+        }
+
+        g_writer_exit.store(true);
+        os::SignalEvent(&g_writer_event);
+        os::WaitThread(&g_writer_thread);
+        os::DestroyThread(&g_writer_thread);
+        os::FinalizeEvent(&g_writer_event);
+        os::FinalizeEvent(&g_flush_event);
     }
 
-    void DebugLogImpl(const char *fmt, std::va_list args) {
-        R_ABORT_UNLESS(fs::OpenFile(&LogFile, LogFilePath, fs::OpenMode_Write | fs::OpenMode_AllowAppend));
-
-        char buff[0x400];
-        int len;
-
-        auto thread = os::GetCurrentThread();
-        auto ts = os::GetSystemTick().ToTimeSpan();
-        len = util::TSNPrintf(buff, sizeof(buff), "[ts: %6lums t: %-13s p: %d/%d] ",
-            ts.GetMilliSeconds(),
-            os::GetThreadNamePointer(thread),
-            os::GetThreadPriority(thread) + 28,
-            os::GetThreadCurrentPriority(thread)+ 28
-        );
-        R_ABORT_UNLESS(fs::WriteFile(LogFile, LogOffset, buff, len, fs::WriteOption::None));
-        LogOffset += len;
-
-        //len = std::vsnprintf(buff, sizeof(buff), fmt, args);
-        len = util::TVSNPrintf(buff, sizeof(buff), fmt, args);
-        R_ABORT_UNLESS(fs::WriteFile(LogFile, LogOffset, buff, len, fs::WriteOption::Flush));
-        LogOffset += len;
-
-        fs::CloseFile(LogFile);
+    u64 GetDroppedCount() {
+        return g_log_ring.GetDroppedCount();
     }
 
-    void DebugLog(const char *fmt, ...) {
-        std::scoped_lock lk(g_log_lock);
+    void SetLevel(Level level) {
+        impl::g_level.store(level, std::memory_order_relaxed);
+    }
 
-        std::va_list args;
-        va_start(args, fmt);
-        DebugLogImpl(fmt, args);
-        va_end(args);
+    void SetFlushPolicy(u32 interval_ms, u32 threshold_kb) {
+        g_flush_interval_ms.store(interval_ms);
+        g_flush_threshold_kb.store(threshold_kb);
     }
 
-    void DebugDataDumpImpl(const void *data, size_t size) {
-        size_t buff_size = 4*size + 5;
-        std::unique_ptr<char[]> buff(new char[buff_size]);
+    bool Flush() {
+        if (!g_writer_running.load()) {
+            return true;
+        }
 
-        R_ABORT_UNLESS(fs::OpenFile(&LogFile, LogFilePath, fs::OpenMode_Write | fs::OpenMode_AllowAppend));
+        const u64 request = g_flush_requested.fetch_add(1) + 1;
+        os::SignalEvent(&g_writer_event);
 
-        int len = 0;
-        for (size_t i = 0; i < size; ++i) {
-            if ((i % 16) == 0) {
-                len += util::TSNPrintf(buff.get() + len, buff_size - len, " ");
+        /* Woken by every completed sync, one for an earlier request just waits again */
+        const os::Tick start = os::GetSystemTick();
+        while (g_flush_completed.load() < request) {
+            const TimeSpan elapsed = (os::GetSystemTick() - start).ToTimeSpan();
+            if (elapsed >= FlushTimeout) {
+                DebugLog("Log flush timed out after %" PRIi64 "ms\n", elapsed.GetMilliSeconds());
+                return false;
             }
+            os::TimedWaitEvent(&g_flush_event, FlushTimeout - elapsed);
+        }
 
-            len += util::TSNPrintf(buff.get() + len, buff_size - len, "%02x%c",
-                reinterpret_cast<const u8 *>(data)[i],
-                (i+1) % 16 ? ' ' : '\n'
-            );
+        /* Callers flushing at the same time share the auto clear event, pass the wakeup on */
+        os::SignalEvent(&g_flush_event);
+        return true;
+    }
+
+    void DebugLog(const char *fmt, ...) {
+        std::va_list args;
+        va_start(args, fmt);
+        PushRecord(RecordKind_Text, fmt, args, nullptr, 0);
+        va_end(args);
+    }
+
+    void WriteCapture(const mitm::i2c::capture::RecordHeader &capture_header, const void *data, const void *aux) {
+        RecordHeader *header = ReserveRecord(RecordKind_Capture, mitm::i2c::capture::GetRecordSize(capture_header), 0);
+        if (header == nullptr) {
+            return;
         }
-        len += util::TSNPrintf(buff.get() + len, buff_size - len, "\n");
 
-        R_ABORT_UNLESS(fs::WriteFile(LogFile, LogOffset, buff.get(), len, fs::WriteOption::Flush));
-        LogOffset += len;
+        u8 *payload = reinterpret_cast<u8 *>(header + 1);
+        std::memcpy(payload, std::addressof(capture_header), sizeof(capture_header));
+        payload += sizeof(capture_header);
+        if (capture_header.size) {
+            std::memcpy(payload, data, capture_header.size);
+            payload += capture_header.size;
+        }
+        if (capture_header.aux_size) {
+            std::memcpy(payload, aux, capture_header.aux_size);
+        }
 
-        fs::CloseFile(LogFile);
+        CommitRecord(header);
     }
 
     void DebugDataDump(const void *data, size_t size, const char *fmt, ...) {
-        std::scoped_lock lk(g_log_lock);
-
         std::va_list args;
         va_start(args, fmt);
-        DebugLogImpl(fmt, args);
+        PushRecord(RecordKind_DataDump, fmt, args, data, size);
         va_end(args);
-        DebugDataDumpImpl(data, size);
     }
 
 }
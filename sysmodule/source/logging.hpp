@@ -1,5 +1,10 @@
 #pragma once
+#if defined(ATMOSPHERE_OS_HORIZON)
 #include <stratosphere.hpp>
+#else
+#include "ams_host.hpp"
+#endif
+#include "i2c_capture_format.hpp"
 
 namespace ams::log {
 
@@ -9,12 +14,46 @@ namespace ams::log {
     void DebugLog(const char *fmt, ...);
     void DebugDataDump(const void *data, size_t size, const char *fmt, ...);
 
+    /* Queue a binary i2c capture record, data and aux must hold header.size and header.aux_size bytes */
+    void WriteCapture(const mitm::i2c::capture::RecordHeader &header, const void *data, const void *aux);
+
+    /* Number of log records dropped because the log ring was full */
+    u64 GetDroppedCount();
+
+    constexpr inline u32 DefaultFlushIntervalMs  = 1000;
+    constexpr inline u32 DefaultFlushThresholdKb = 64;
+
+    /* Buffered log and capture data reaches the SD card after at most interval_ms (0 after every batch), or once threshold_kb are pending */
+    void SetFlushPolicy(u32 interval_ms, u32 threshold_kb);
+
+    /* Writes everything queued so far to the SD card and waits for it, false if the writer did not get it done within a few seconds */
+    bool Flush();
+
+    enum Level : u32 {
+        Level_Info  = 0,
+        Level_Debug = 1,
+    };
+
     #ifdef DEBUG
-    #define DEBUG_LOG(fmt, ...) ::ams::log::DebugLog(fmt "\n", ##__VA_ARGS__)
-    #define DEBUG_DATA_DUMP(data, size, fmt, ...) ::ams::log::DebugDataDump(data, size, fmt "\n", ##__VA_ARGS__)
+    constexpr inline Level DefaultLevel = Level_Debug;
     #else
-    #define DEBUG_LOG(fmt, ...)
-    #define DEBUG_DATA_DUMP(data, size, fmt, ...)
+    constexpr inline Level DefaultLevel = Level_Info;
     #endif
 
+    /* DEBUG_LOG and DEBUG_DATA_DUMP messages are only written at Level_Debug, set from the config or over IPC */
+    void SetLevel(Level level);
+
+    namespace impl {
+
+        extern std::atomic<u32> g_level;
+
+    }
+
+    inline bool IsDebugEnabled() {
+        return impl::g_level.load(std::memory_order_relaxed) >= Level_Debug;
+    }
+
+    #define DEBUG_LOG(fmt, ...) do { if (::ams::log::IsDebugEnabled()) { ::ams::log::DebugLog(fmt "\n", ##__VA_ARGS__); } } while (false)
+    #define DEBUG_DATA_DUMP(data, size, fmt, ...) do { if (::ams::log::IsDebugEnabled()) { ::ams::log::DebugDataDump(data, size, fmt "\n", ##__VA_ARGS__); } } while (false)
+
 }
@@ -90,6 +90,9 @@ namespace ams {
         // Launch mitm modules
         ams::mitm::i2c::Launch();
 
+        // Pick up config changes without a reboot
+        ams::mitm::i2c::StartConfigMonitor();
+
         // Wait for mitm modules to terminate
         ams::mitm::i2c::WaitFinished();
     }
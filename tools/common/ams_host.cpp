@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ams_host.hpp"
+#include <chrono>
+#include <string_view>
+#include <sys/stat.h>
+
+namespace ams {
+
+    namespace os {
+
+        Tick GetSystemTick() {
+            return Tick(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        s64 GetSystemTickFrequency() {
+            return INT64_C(1000000000);
+        }
+
+        void SleepThread(TimeSpan ts) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(ts.GetNanoSeconds()));
+        }
+
+        Result CreateThread(ThreadType *thread, ThreadFunction function, void *argument, void *stack, size_t stack_size, s32 priority) {
+            AMS_UNUSED(stack, stack_size, priority);
+
+            *thread = {
+                .function = function,
+                .argument = argument,
+                .name     = nullptr,
+                .thread   = nullptr,
+            };
+            R_SUCCEED();
+        }
+
+        void StartThread(ThreadType *thread) {
+            thread->thread = new std::thread(thread->function, thread->argument);
+        }
+
+        void WaitThread(ThreadType *thread) {
+            if (thread->thread != nullptr && thread->thread->joinable()) {
+                thread->thread->join();
+            }
+        }
+
+        void DestroyThread(ThreadType *thread) {
+            WaitThread(thread);
+            delete thread->thread;
+            thread->thread = nullptr;
+        }
+
+        void SetThreadNamePointer(ThreadType *thread, const char *name) {
+            thread->name = name;
+        }
+
+    }
+
+    namespace fs {
+
+        namespace {
+
+            constexpr std::string_view SdCardMountName = "sdmc:/";
+
+            std::string g_sd_card_root = ".";
+
+            std::string ResolvePath(const char *path) {
+                const std::string_view view(path);
+                if (view.starts_with(SdCardMountName)) {
+                    return g_sd_card_root + "/" + std::string(view.substr(SdCardMountName.size()));
+                }
+                return std::string(view);
+            }
+
+            std::FILE *GetFile(FileHandle handle) {
+                return static_cast<std::FILE *>(handle.handle);
+            }
+
+        }
+
+        namespace {
+
+            constexpr u32 ResultModuleId = 2;
+
+            R_DEFINE_ERROR_RESULT(PathNotFound,     1);
+            R_DEFINE_ERROR_RESULT(UnexpectedInFile, 5);
+
+        }
+
+        void SetSdCardRoot(const char *path) {
+            g_sd_card_root = path;
+        }
+
+        Result OpenFile(FileHandle *out, const char *path, int mode) {
+            const char *file_mode = (mode & OpenMode_Write) ? ((mode & OpenMode_AllowAppend) ? "a+b" : "r+b") : "rb";
+
+            std::FILE *file = std::fopen(ResolvePath(path).c_str(), file_mode);
+            R_UNLESS(file != nullptr, ResultPathNotFound());
+
+            out->handle = file;
+            R_SUCCEED();
+        }
+
+        void CloseFile(FileHandle handle) {
+            std::fclose(GetFile(handle));
+        }
+
+        Result ReadFile(size_t *out, FileHandle handle, s64 offset, void *buffer, size_t size) {
+            std::FILE *file = GetFile(handle);
+            R_UNLESS(std::fseek(file, offset, SEEK_SET) == 0, ResultUnexpectedInFile());
+
+            *out = std::fread(buffer, 1, size, file);
+            R_UNLESS(!std::ferror(file), ResultUnexpectedInFile());
+            R_SUCCEED();
+        }
+
+        Result GetFileSize(s64 *out, FileHandle handle) {
+            std::FILE *file = GetFile(handle);
+            R_UNLESS(std::fseek(file, 0, SEEK_END) == 0, ResultUnexpectedInFile());
+
+            *out = std::ftell(file);
+            R_SUCCEED();
+        }
+
+        Result GetFileTimeStampRawForDebug(FileTimeStampRaw *out, const char *path) {
+            struct stat st;
+            R_UNLESS(::stat(ResolvePath(path).c_str(), std::addressof(st)) == 0, ResultPathNotFound());
+
+            *out = {
+                .create        = st.st_ctime,
+                .modify        = st.st_mtime,
+                .access        = st.st_atime,
+                .is_local_time = false,
+                .pad           = {},
+            };
+            R_SUCCEED();
+        }
+
+    }
+
+    namespace util::ini {
+
+        namespace {
+
+            char *Trim(char *str) {
+                while (*str == ' ' || *str == '\t') {
+                    str++;
+                }
+
+                char *end = str + std::strlen(str);
+                while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n')) {
+                    *--end = '\0';
+                }
+                return str;
+            }
+
+        }
+
+        /* Same rules as the inih based parser on the console: [section], name=value, ';' and '#' comments */
+        int ParseFile(fs::FileHandle file, void *user, Handler handler) {
+            s64 file_size;
+            if (R_FAILED(fs::GetFileSize(std::addressof(file_size), file))) {
+                return -1;
+            }
+
+            std::string contents(file_size, '\0');
+            size_t read_size;
+            if (R_FAILED(fs::ReadFile(std::addressof(read_size), file, 0, contents.data(), contents.size()))) {
+                return -1;
+            }
+            contents.resize(read_size);
+
+            char section[0x40] = {};
+            int error = 0;
+            int line_no = 0;
+
+            size_t pos = 0;
+            while (pos < contents.size()) {
+                size_t end = contents.find('\n', pos);
+                if (end == std::string::npos) {
+                    end = contents.size();
+                }
+
+                std::string line_buf(contents, pos, end - pos);
+                pos = end + 1;
+                line_no++;
+
+                char *line = Trim(line_buf.data());
+                if (*line == '\0' || *line == ';' || *line == '#') {
+                    continue;
+                }
+
+                if (*line == '[') {
+                    char *close = std::strchr(line, ']');
+                    if (close == nullptr) {
+                        error = error ? error : line_no;
+                        continue;
+                    }
+                    *close = '\0';
+                    Strlcpy(section, Trim(line + 1), sizeof(section));
+                    continue;
+                }
+
+                char *separator = std::strchr(line, '=');
+                if (separator == nullptr) {
+                    error = error ? error : line_no;
+                    continue;
+                }
+                *separator = '\0';
+
+                char *value = separator + 1;
+                if (char *comment = std::strstr(value, " ;"); comment != nullptr) {
+                    *comment = '\0';
+                }
+
+                if (!handler(user, section, Trim(line), Trim(value)) && !error) {
+                    error = line_no;
+                }
+            }
+
+            return error;
+        }
+
+    }
+
+}
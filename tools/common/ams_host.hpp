@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include <cinttypes>
+#include <climits>
+#include <strings.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Minimal subset of the Atmosphere vapours and stratosphere APIs, so sources shared with the sysmodule build on the host.
+ * Only what the shared sources use is provided, the os and fs parts are implemented in ams_host.cpp.
+ */
+
+#define NON_COPYABLE(cls) \
+    cls(const cls &) = delete; \
+    cls &operator=(const cls &) = delete
+
+#define NON_MOVEABLE(cls) \
+    cls(cls &&) = delete; \
+    cls &operator=(cls &&) = delete
+
+#define BITSIZEOF(x) (sizeof(x) * CHAR_BIT)
+
+#define AMS_UNUSED(...) ::ams::impl::UnusedImpl(__VA_ARGS__)
+#define AMS_ABORT_UNLESS(expr) do { if (!(expr)) { std::abort(); } } while (0)
+#define AMS_ASSERT(expr) AMS_ABORT_UNLESS(expr)
+
+#define AMS_CONCATENATE_IMPL(s1, s2) s1##s2
+#define AMS_CONCATENATE(s1, s2) AMS_CONCATENATE_IMPL(s1, s2)
+#define ON_SCOPE_EXIT auto AMS_CONCATENATE(scope_exit_guard_, __LINE__) = ::ams::impl::ScopeGuardOnExit() + [&]() ALWAYS_INLINE_LAMBDA
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#define ALWAYS_INLINE_LAMBDA __attribute__((always_inline))
+
+namespace ams {
+
+    using u8  = std::uint8_t;
+    using u16 = std::uint16_t;
+    using u32 = std::uint32_t;
+    using u64 = std::uint64_t;
+    using s8  = std::int8_t;
+    using s16 = std::int16_t;
+    using s32 = std::int32_t;
+    using s64 = std::int64_t;
+
+    using std::size_t;
+
+    namespace impl {
+
+        template<typename... ArgTypes>
+        constexpr void UnusedImpl(ArgTypes &&...) { /* ... */ }
+
+        template<typename F>
+        class ScopeGuard {
+            NON_COPYABLE(ScopeGuard);
+            private:
+                F m_f;
+            public:
+                constexpr explicit ScopeGuard(F f) : m_f(std::move(f)) { /* ... */ }
+                ~ScopeGuard() { m_f(); }
+        };
+
+        struct ScopeGuardOnExit { };
+
+        template<typename F>
+        constexpr ScopeGuard<F> operator+(ScopeGuardOnExit, F &&f) {
+            return ScopeGuard<F>(std::forward<F>(f));
+        }
+
+    }
+
+    /* Results are module | description << 9, as on the console */
+    class Result {
+        private:
+            u32 m_value;
+        public:
+            constexpr Result() : m_value(0) { /* ... */ }
+            constexpr explicit Result(u32 value) : m_value(value) { /* ... */ }
+
+            constexpr u32 GetValue() const { return m_value; }
+            constexpr u32 GetModule() const { return m_value & 0x1FF; }
+            constexpr u32 GetDescription() const { return (m_value >> 9) & 0x1FFF; }
+            constexpr bool IsSuccess() const { return m_value == 0; }
+            constexpr bool IsFailure() const { return m_value != 0; }
+    };
+
+    constexpr Result ResultSuccess() { return Result(); }
+
+    #define R_SUCCEEDED(res) (static_cast<::ams::Result>(res).IsSuccess())
+    #define R_FAILED(res)    (static_cast<::ams::Result>(res).IsFailure())
+
+    #define R_SUCCEED()   return ::ams::ResultSuccess()
+    #define R_THROW(res)  return static_cast<::ams::Result>(res)
+    #define R_RETURN(res) return static_cast<::ams::Result>(res)
+
+    #define R_TRY(res) \
+        do { \
+            if (const ::ams::Result _tmp_r_try_rc = (res); R_FAILED(_tmp_r_try_rc)) { \
+                return _tmp_r_try_rc; \
+            } \
+        } while (0)
+
+    #define R_UNLESS(expr, res) \
+        do { \
+            if (!(expr)) { \
+                R_THROW(res); \
+            } \
+        } while (0)
+
+    #define R_SUCCEED_IF(expr) R_UNLESS(!(expr), ::ams::ResultSuccess())
+
+    #define R_ABORT_UNLESS(res) AMS_ABORT_UNLESS(R_SUCCEEDED(res))
+
+    #define R_DEFINE_NAMESPACE_RESULT_MODULE(nmspc, value) \
+        namespace nmspc { \
+            [[maybe_unused]] constexpr inline ::ams::u32 ResultModuleId = value; \
+        }
+
+    #define R_DEFINE_ERROR_RESULT(name, desc) \
+        struct Result##name { \
+            static constexpr ::ams::u32 Value = ResultModuleId | (static_cast<::ams::u32>(desc) << 9); \
+            constexpr operator ::ams::Result() const { return ::ams::Result(Value); } \
+            static constexpr bool Includes(::ams::Result result) { return result.GetValue() == Value; } \
+        }
+
+    class TimeSpan {
+        private:
+            s64 m_ns;
+        public:
+            constexpr TimeSpan() : m_ns(0) { /* ... */ }
+
+            static constexpr TimeSpan FromNanoSeconds(s64 ns)  { TimeSpan ts; ts.m_ns = ns; return ts; }
+            static constexpr TimeSpan FromMicroSeconds(s64 us) { return FromNanoSeconds(us * INT64_C(1000)); }
+            static constexpr TimeSpan FromMilliSeconds(s64 ms) { return FromNanoSeconds(ms * INT64_C(1000000)); }
+            static constexpr TimeSpan FromSeconds(s64 s)       { return FromNanoSeconds(s * INT64_C(1000000000)); }
+
+            constexpr s64 GetNanoSeconds() const  { return m_ns; }
+            constexpr s64 GetMicroSeconds() const { return m_ns / INT64_C(1000); }
+            constexpr s64 GetMilliSeconds() const { return m_ns / INT64_C(1000000); }
+            constexpr s64 GetSeconds() const      { return m_ns / INT64_C(1000000000); }
+
+            constexpr auto operator<=>(const TimeSpan &) const = default;
+    };
+
+    namespace os {
+
+        /* Ticks are nanoseconds of the host's monotonic clock */
+        class Tick {
+            private:
+                s64 m_tick;
+            public:
+                constexpr Tick() : m_tick(0) { /* ... */ }
+                constexpr explicit Tick(s64 tick) : m_tick(tick) { /* ... */ }
+
+                constexpr s64 GetInt64Value() const { return m_tick; }
+                constexpr TimeSpan ToTimeSpan() const { return TimeSpan::FromNanoSeconds(m_tick); }
+
+                constexpr Tick operator+(const Tick &rhs) const { return Tick(m_tick + rhs.m_tick); }
+                constexpr Tick operator-(const Tick &rhs) const { return Tick(m_tick - rhs.m_tick); }
+                constexpr auto operator<=>(const Tick &) const = default;
+        };
+
+        Tick GetSystemTick();
+        s64 GetSystemTickFrequency();
+
+        constexpr Tick ConvertToTick(TimeSpan ts) { return Tick(ts.GetNanoSeconds()); }
+
+        void SleepThread(TimeSpan ts);
+
+        constexpr size_t ThreadStackAlignment = 0x1000;
+
+        using ThreadFunction = void (*)(void *);
+
+        struct ThreadType {
+            ThreadFunction function;
+            void *argument;
+            const char *name;
+            std::thread *thread;
+        };
+
+        /* stack and priority are ignored, the thread runs on a host thread */
+        Result CreateThread(ThreadType *thread, ThreadFunction function, void *argument, void *stack, size_t stack_size, s32 priority);
+        void StartThread(ThreadType *thread);
+        void WaitThread(ThreadType *thread);
+        void DestroyThread(ThreadType *thread);
+        void SetThreadNamePointer(ThreadType *thread, const char *name);
+
+        class SdkMutex {
+            private:
+                std::mutex m_mutex;
+            public:
+                constexpr SdkMutex() = default;
+
+                void Lock() { m_mutex.lock(); }
+                void Unlock() { m_mutex.unlock(); }
+                bool TryLock() { return m_mutex.try_lock(); }
+
+                void lock() { this->Lock(); }
+                void unlock() { this->Unlock(); }
+                bool try_lock() { return this->TryLock(); }
+        };
+
+    }
+
+    namespace util {
+
+        template<typename T>
+        constexpr int Strlcpy(T *dst, const T *src, int count) {
+            int i = 0;
+            while (src[i] != 0) {
+                if (i < count - 1) {
+                    dst[i] = src[i];
+                }
+                i++;
+            }
+            if (count > 0) {
+                dst[std::min(i, count - 1)] = 0;
+            }
+            return i;
+        }
+
+        __attribute__((format(printf, 3, 4)))
+        inline int TSNPrintf(char *dst, size_t dst_size, const char *fmt, ...) {
+            std::va_list vl;
+            va_start(vl, fmt);
+            const int ret = std::vsnprintf(dst, dst_size, fmt, vl);
+            va_end(vl);
+            return ret;
+        }
+
+        inline int TVSNPrintf(char *dst, size_t dst_size, const char *fmt, std::va_list vl) {
+            return std::vsnprintf(dst, dst_size, fmt, vl);
+        }
+
+        struct BitPack8 {
+            u8 value;
+
+            template<size_t Index, size_t Count, typename T = u8>
+            struct Field {
+                using Type = T;
+                static constexpr size_t Shift = Index;
+                static constexpr u8 Mask = static_cast<u8>(((1u << Count) - 1) << Index);
+            };
+
+            template<typename FieldType>
+            constexpr typename FieldType::Type Get() const {
+                return static_cast<typename FieldType::Type>((this->value & FieldType::Mask) >> FieldType::Shift);
+            }
+
+            template<typename FieldType>
+            constexpr void Set(typename FieldType::Type field) {
+                this->value = static_cast<u8>((this->value & ~FieldType::Mask) | ((static_cast<u8>(field) << FieldType::Shift) & FieldType::Mask));
+            }
+        };
+
+    }
+
+    class DeviceCode {
+        private:
+            u32 m_inner_value;
+        public:
+            constexpr DeviceCode(u32 v) : m_inner_value(v) { /* ... */ }
+
+            constexpr u32 GetInternalValue() const { return m_inner_value; }
+
+            constexpr bool operator==(const DeviceCode &) const = default;
+    };
+
+    namespace ncm {
+
+        struct ProgramId {
+            u64 value;
+
+            constexpr bool operator==(const ProgramId &) const = default;
+        };
+
+        constexpr inline ProgramId InvalidProgramId = {};
+
+    }
+
+    namespace hos {
+
+        enum Version : u32 {
+            Version_Min     = 0,
+            Version_5_1_0   = 0x050100,
+            Version_6_0_0   = 0x060000,
+            Version_Current = 0x120000,
+        };
+
+        /* The host acts as the latest firmware, old commands are only used when a caller asks for them */
+        constexpr Version GetVersion() { return Version_Current; }
+
+    }
+
+    namespace sf {
+
+        class InBuffer {
+            private:
+                const u8 *m_ptr;
+                size_t m_size;
+            public:
+                constexpr InBuffer(const void *ptr, size_t size) : m_ptr(static_cast<const u8 *>(ptr)), m_size(size) { /* ... */ }
+
+                constexpr const u8 *GetPointer() const { return m_ptr; }
+                constexpr size_t GetSize() const { return m_size; }
+        };
+
+        class OutBuffer {
+            private:
+                u8 *m_ptr;
+                size_t m_size;
+            public:
+                constexpr OutBuffer(void *ptr, size_t size) : m_ptr(static_cast<u8 *>(ptr)), m_size(size) { /* ... */ }
+
+                constexpr u8 *GetPointer() const { return m_ptr; }
+                constexpr size_t GetSize() const { return m_size; }
+        };
+
+        class InAutoSelectBuffer : public InBuffer {
+            public:
+                using InBuffer::InBuffer;
+        };
+
+        class OutAutoSelectBuffer : public OutBuffer {
+            public:
+                using OutBuffer::OutBuffer;
+        };
+
+        template<typename T>
+        class InPointerArray {
+            private:
+                const T *m_ptr;
+                size_t m_count;
+            public:
+                constexpr InPointerArray(const T *ptr, size_t count) : m_ptr(ptr), m_count(count) { /* ... */ }
+
+                constexpr const T *GetPointer() const { return m_ptr; }
+                constexpr size_t GetSize() const { return m_count; }
+        };
+
+    }
+
+    namespace i2c {
+
+        using I2cCommand = u8;
+
+        enum TransactionOption : u32 {
+            TransactionOption_StartCondition = (1u << 0),
+            TransactionOption_StopCondition  = (1u << 1),
+            TransactionOption_MaxBits        = (1u << 30),
+        };
+
+    }
+
+}
+
+R_DEFINE_NAMESPACE_RESULT_MODULE(ams::i2c, 101);
+R_DEFINE_NAMESPACE_RESULT_MODULE(ams::settings, 105);
+
+namespace ams {
+
+    namespace i2c {
+
+        R_DEFINE_ERROR_RESULT(NoAck,           1);
+        R_DEFINE_ERROR_RESULT(BusBusy,         2);
+        R_DEFINE_ERROR_RESULT(CommandListFull, 3);
+        R_DEFINE_ERROR_RESULT(UnknownDevice,   5);
+
+    }
+
+    namespace settings {
+
+        R_DEFINE_ERROR_RESULT(InvalidArgument, 1);
+
+    }
+
+    /* Paths starting with "sdmc:/" are redirected to the directory set with SetSdCardRoot */
+    namespace fs {
+
+        struct FileHandle {
+            void *handle;
+        };
+
+        enum OpenMode {
+            OpenMode_Read        = (1 << 0),
+            OpenMode_Write       = (1 << 1),
+            OpenMode_AllowAppend = (1 << 2),
+        };
+
+        struct FileTimeStampRaw {
+            s64 create;
+            s64 modify;
+            s64 access;
+            bool is_local_time;
+            u8 pad[7];
+        };
+
+        void SetSdCardRoot(const char *path);
+
+        Result OpenFile(FileHandle *out, const char *path, int mode);
+        void CloseFile(FileHandle handle);
+        Result ReadFile(size_t *out, FileHandle handle, s64 offset, void *buffer, size_t size);
+        Result GetFileSize(s64 *out, FileHandle handle);
+        Result GetFileTimeStampRawForDebug(FileTimeStampRaw *out, const char *path);
+
+    }
+
+    namespace util::ini {
+
+        using Handler = int (*)(void *user, const char *section, const char *name, const char *value);
+
+        /* Returns 0 on success, otherwise the line of the first error */
+        int ParseFile(fs::FileHandle file, void *user, Handler handler);
+
+    }
+
+}
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fake_i2c_device.hpp"
+#include "i2c_mitm_transport.hpp"
+#include "i2c_command_list.hpp"
+
+namespace ams::host {
+
+    namespace {
+
+        constexpr ::ams::i2c::TransactionOption GetTransactionOption(const mitm::i2c::cmdlist::Command &command) {
+            u32 option = 0;
+            if (command.start_condition) {
+                option |= ::ams::i2c::TransactionOption_StartCondition;
+            }
+            if (command.stop_condition) {
+                option |= ::ams::i2c::TransactionOption_StopCondition;
+            }
+            return static_cast<::ams::i2c::TransactionOption>(option);
+        }
+
+    }
+
+    FakeI2cDevice::FakeI2cDevice() : m_registers(), m_present(), m_writable(), m_pointer(0), m_max_retry_count(0), m_retry_interval_us(0), m_counters() { /* ... */ }
+
+    bool FakeI2cDevice::IsPresent(u8 reg) const {
+        return m_present[reg / BITSIZEOF(u64)] & (u64(1) << (reg % BITSIZEOF(u64)));
+    }
+
+    bool FakeI2cDevice::IsWritable(u8 reg) const {
+        return m_writable[reg / BITSIZEOF(u64)] & (u64(1) << (reg % BITSIZEOF(u64)));
+    }
+
+    void FakeI2cDevice::AddRegister(u8 reg, u8 reset_value, bool writable) {
+        std::scoped_lock lk(m_mutex);
+
+        m_registers[reg] = reset_value;
+        m_present[reg / BITSIZEOF(u64)] |= u64(1) << (reg % BITSIZEOF(u64));
+        if (writable) {
+            m_writable[reg / BITSIZEOF(u64)] |= u64(1) << (reg % BITSIZEOF(u64));
+        }
+    }
+
+    u8 FakeI2cDevice::GetRegister(u8 reg) {
+        std::scoped_lock lk(m_mutex);
+        return m_registers[reg];
+    }
+
+    void FakeI2cDevice::SetRegister(u8 reg, u8 value) {
+        std::scoped_lock lk(m_mutex);
+        m_registers[reg] = value;
+    }
+
+    FakeI2cDevice::BusCounters FakeI2cDevice::GetBusCounters() {
+        std::scoped_lock lk(m_mutex);
+        return m_counters;
+    }
+
+    void FakeI2cDevice::ResetBusCounters() {
+        std::scoped_lock lk(m_mutex);
+        m_counters = {};
+    }
+
+    Result FakeI2cDevice::SendImpl(const u8 *data, size_t size, ::ams::i2c::TransactionOption option) {
+        m_counters.sends++;
+        R_SUCCEED_IF(size == 0);
+
+        /* A transfer with a start condition addresses the register pointer first, without one it continues the last write */
+        size_t idx = 0;
+        if (option & ::ams::i2c::TransactionOption_StartCondition) {
+            if (!this->IsPresent(data[0])) {
+                m_counters.nacks++;
+                R_THROW(::ams::i2c::ResultNoAck());
+            }
+            m_pointer = data[idx++];
+        }
+
+        for (; idx < size; idx++) {
+            if (!this->IsPresent(m_pointer)) {
+                m_counters.nacks++;
+                R_THROW(::ams::i2c::ResultNoAck());
+            }
+            if (this->IsWritable(m_pointer)) {
+                m_registers[m_pointer] = data[idx];
+            }
+            m_pointer++;
+            m_counters.bytes_written++;
+        }
+
+        R_SUCCEED();
+    }
+
+    Result FakeI2cDevice::ReceiveImpl(u8 *data, size_t size) {
+        m_counters.receives++;
+
+        for (size_t i = 0; i < size; i++) {
+            if (!this->IsPresent(m_pointer)) {
+                m_counters.nacks++;
+                R_THROW(::ams::i2c::ResultNoAck());
+            }
+            data[i] = m_registers[m_pointer++];
+            m_counters.bytes_read++;
+        }
+
+        R_SUCCEED();
+    }
+
+    Result FakeI2cDevice::Send(const u8 *data, size_t size, ::ams::i2c::TransactionOption option) {
+        std::scoped_lock lk(m_mutex);
+        R_RETURN(this->SendImpl(data, size, option));
+    }
+
+    Result FakeI2cDevice::Receive(u8 *data, size_t size, ::ams::i2c::TransactionOption option) {
+        AMS_UNUSED(option);
+
+        std::scoped_lock lk(m_mutex);
+        R_RETURN(this->ReceiveImpl(data, size));
+    }
+
+    Result FakeI2cDevice::ExecuteCommandList(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands) {
+        std::scoped_lock lk(m_mutex);
+        m_counters.command_lists++;
+
+        /* Malformed lists fail before anything reaches the bus */
+        R_UNLESS(mitm::i2c::cmdlist::IsValid(commands, num_commands, rcv_size), ::ams::i2c::ResultCommandListFull());
+
+        mitm::i2c::cmdlist::CommandListReader reader(commands, num_commands, rcv_size);
+        mitm::i2c::cmdlist::Command command;
+        while (reader.Next(std::addressof(command))) {
+            switch (command.kind) {
+            case mitm::i2c::cmdlist::CommandKind_Send:
+                R_TRY(this->SendImpl(command.data, command.size, GetTransactionOption(command)));
+                break;
+            case mitm::i2c::cmdlist::CommandKind_Receive:
+                R_TRY(this->ReceiveImpl(rcv_data + command.receive_offset, command.size));
+                break;
+            case mitm::i2c::cmdlist::CommandKind_Sleep:
+                /* Sleeps take no simulated time */
+                break;
+            }
+        }
+
+        R_SUCCEED();
+    }
+
+    Result FakeI2cDevice::SetRetryPolicy(s32 max_retry_count, s32 retry_interval_us) {
+        std::scoped_lock lk(m_mutex);
+        m_max_retry_count   = max_retry_count;
+        m_retry_interval_us = retry_interval_us;
+        R_SUCCEED();
+    }
+
+    void InitializeBq24193(FakeI2cDevice *device) {
+        constexpr struct {
+            u8 reg;
+            u8 reset_value;
+            bool writable;
+        } Registers[] = {
+            { 0x00, 0x30, true  }, /* Input source control */
+            { 0x01, 0x1B, true  }, /* Power-on configuration */
+            { 0x02, 0x60, true  }, /* Charge current control */
+            { 0x03, 0x11, true  }, /* Pre-charge/termination current control */
+            { 0x04, 0xB2, true  }, /* Charge voltage control, 4208mV */
+            { 0x05, 0x9A, true  }, /* Charge termination/timer control */
+            { 0x06, 0x03, true  }, /* IR compensation/thermal regulation control */
+            { 0x07, 0x4B, true  }, /* Misc operation control */
+            { 0x08, 0x00, false }, /* System status */
+            { 0x09, 0x00, false }, /* Fault */
+            { 0x0A, 0x2F, false }, /* Vendor/part/revision status */
+        };
+
+        for (const auto &reg : Registers) {
+            device->AddRegister(reg.reg, reg.reset_value, reg.writable);
+        }
+    }
+
+    void InitializeRegisterFile(FakeI2cDevice *device) {
+        for (size_t reg = 0; reg < FakeI2cDevice::NumRegisters; reg++) {
+            device->AddRegister(static_cast<u8>(reg), 0, true);
+        }
+    }
+
+}
+
+namespace ams::mitm::i2c {
+
+    /* Host transport, drives a FakeI2cDevice. The old and new commands only differ in their buffer mapping, so both land in the same calls. */
+    I2cSessionTransport::I2cSessionTransport(SessionHandle session) : m_session(session) { /* ... */ }
+
+    I2cSessionTransport::~I2cSessionTransport() { /* ... */ }
+
+    Result I2cSessionTransport::Send(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+        AMS_UNUSED(use_old_command);
+        R_RETURN(this->m_session->Send(data, size, option));
+    }
+
+    Result I2cSessionTransport::Receive(u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+        AMS_UNUSED(use_old_command);
+        R_RETURN(this->m_session->Receive(data, size, option));
+    }
+
+    Result I2cSessionTransport::ExecuteCommandList(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands, bool use_old_command) {
+        AMS_UNUSED(use_old_command);
+        R_RETURN(this->m_session->ExecuteCommandList(rcv_data, rcv_size, commands, num_commands));
+    }
+
+    Result I2cSessionTransport::SetRetryPolicy(s32 max_retry_count, s32 retry_interval_us) {
+        R_RETURN(this->m_session->SetRetryPolicy(max_retry_count, retry_interval_us));
+    }
+
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "ams_host.hpp"
+
+namespace ams::host {
+
+    /*
+     * In-memory i2c device with an 8 bit register file. A Send sets the register pointer from its first byte and writes
+     * the rest with auto increment, a Receive reads from the pointer on. Accesses to registers the device does not have are NACKed.
+     */
+    class FakeI2cDevice {
+        NON_COPYABLE(FakeI2cDevice);
+        NON_MOVEABLE(FakeI2cDevice);
+        public:
+            static constexpr size_t NumRegisters = 0x100;
+
+            /* Transactions as seen on the bus, i.e. what the mitm let through */
+            struct BusCounters {
+                u64 sends;
+                u64 receives;
+                u64 command_lists;
+                u64 bytes_written;
+                u64 bytes_read;
+                u64 nacks;
+            };
+        private:
+            std::mutex m_mutex;
+            u8 m_registers[NumRegisters];
+            u64 m_present[NumRegisters / BITSIZEOF(u64)];
+            u64 m_writable[NumRegisters / BITSIZEOF(u64)];
+            u8 m_pointer;
+            s32 m_max_retry_count;
+            s32 m_retry_interval_us;
+            BusCounters m_counters;
+        public:
+            FakeI2cDevice();
+
+            void AddRegister(u8 reg, u8 reset_value, bool writable);
+
+            /* Backdoor access, bypasses the bus and the counters, writes to read-only registers too */
+            u8 GetRegister(u8 reg);
+            void SetRegister(u8 reg, u8 value);
+
+            BusCounters GetBusCounters();
+            void ResetBusCounters();
+
+            Result Send(const u8 *data, size_t size, ::ams::i2c::TransactionOption option);
+            Result Receive(u8 *data, size_t size, ::ams::i2c::TransactionOption option);
+            Result ExecuteCommandList(u8 *rcv_data, size_t rcv_size, const ::ams::i2c::I2cCommand *commands, size_t num_commands);
+            Result SetRetryPolicy(s32 max_retry_count, s32 retry_interval_us);
+        private:
+            bool IsPresent(u8 reg) const;
+            bool IsWritable(u8 reg) const;
+            Result SendImpl(const u8 *data, size_t size, ::ams::i2c::TransactionOption option);
+            Result ReceiveImpl(u8 *data, size_t size);
+    };
+
+    /* bq24193 charger: REG00-REG07 control, REG08-REG0A status, fault and part info, at their power on defaults */
+    void InitializeBq24193(FakeI2cDevice *device);
+
+    /* Generic device with all 256 registers present and writable, reset to zero */
+    void InitializeRegisterFile(FakeI2cDevice *device);
+
+}
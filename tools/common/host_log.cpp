@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "host_log.hpp"
+#include "logging.hpp"
+
+namespace ams::host {
+
+    namespace {
+
+        constinit std::mutex g_log_mutex;
+        constinit std::FILE *g_debug_log_output = nullptr;
+        constinit std::FILE *g_capture_file = nullptr;
+        constinit u64 g_capture_size = 0;
+
+    }
+
+    void SetDebugLogOutput(std::FILE *out) {
+        std::scoped_lock lk(g_log_mutex);
+        g_debug_log_output = out;
+    }
+
+    bool OpenCaptureFile(const char *path) {
+        CloseCaptureFile();
+
+        std::scoped_lock lk(g_log_mutex);
+        g_capture_file = std::fopen(path, "wb");
+        if (g_capture_file == nullptr) {
+            return false;
+        }
+
+        const mitm::i2c::capture::FileHeader header = {
+            .magic          = mitm::i2c::capture::FileMagic,
+            .version        = mitm::i2c::capture::FormatVersion,
+            .header_size    = sizeof(mitm::i2c::capture::FileHeader),
+            .tick_frequency = static_cast<u64>(os::GetSystemTickFrequency()),
+        };
+        std::fwrite(std::addressof(header), sizeof(header), 1, g_capture_file);
+        return true;
+    }
+
+    u64 GetCaptureSize() {
+        std::scoped_lock lk(g_log_mutex);
+        return g_capture_size;
+    }
+
+    void ResetCaptureSize() {
+        std::scoped_lock lk(g_log_mutex);
+        g_capture_size = 0;
+    }
+
+    void CloseCaptureFile() {
+        std::scoped_lock lk(g_log_mutex);
+        if (g_capture_file != nullptr) {
+            std::fclose(g_capture_file);
+            g_capture_file = nullptr;
+        }
+    }
+
+}
+
+namespace ams::log {
+
+    namespace impl {
+
+        constinit std::atomic<u32> g_level = DefaultLevel;
+
+    }
+
+    Result Initialize() {
+        R_SUCCEED();
+    }
+
+    void Finalize() {
+        host::CloseCaptureFile();
+    }
+
+    void DebugLog(const char *fmt, ...) {
+        std::scoped_lock lk(host::g_log_mutex);
+        if (host::g_debug_log_output == nullptr) {
+            return;
+        }
+
+        std::va_list vl;
+        va_start(vl, fmt);
+        std::vfprintf(host::g_debug_log_output, fmt, vl);
+        va_end(vl);
+    }
+
+    void DebugDataDump(const void *data, size_t size, const char *fmt, ...) {
+        std::scoped_lock lk(host::g_log_mutex);
+        if (host::g_debug_log_output == nullptr) {
+            return;
+        }
+
+        std::va_list vl;
+        va_start(vl, fmt);
+        std::vfprintf(host::g_debug_log_output, fmt, vl);
+        va_end(vl);
+
+        const u8 *bytes = static_cast<const u8 *>(data);
+        for (size_t i = 0; i < size; i++) {
+            std::fprintf(host::g_debug_log_output, "%02" PRIx8 "%c", bytes[i], (i % 16 == 15 || i + 1 == size) ? '\n' : ' ');
+        }
+    }
+
+    void WriteCapture(const mitm::i2c::capture::RecordHeader &header, const void *data, const void *aux) {
+        std::scoped_lock lk(host::g_log_mutex);
+        if (host::g_capture_file == nullptr) {
+            return;
+        }
+
+        std::fwrite(std::addressof(header), sizeof(header), 1, host::g_capture_file);
+        if (header.size != 0) {
+            std::fwrite(data, 1, header.size, host::g_capture_file);
+        }
+        if (header.aux_size != 0) {
+            std::fwrite(aux, 1, header.aux_size, host::g_capture_file);
+        }
+        host::g_capture_size += sizeof(header) + header.size + header.aux_size;
+    }
+
+    u64 GetDroppedCount() {
+        return 0;
+    }
+
+    void SetLevel(Level level) {
+        impl::g_level.store(level, std::memory_order_relaxed);
+    }
+
+    void SetFlushPolicy(u32 interval_ms, u32 threshold_kb) {
+        AMS_UNUSED(interval_ms, threshold_kb);
+    }
+
+    bool Flush() {
+        std::scoped_lock lk(host::g_log_mutex);
+        if (host::g_capture_file != nullptr) {
+            std::fflush(host::g_capture_file);
+        }
+        return true;
+    }
+
+}
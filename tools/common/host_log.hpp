@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "ams_host.hpp"
+
+/* Host backend of the sysmodule's log API, see logging.hpp */
+namespace ams::host {
+
+    /* Debug messages go to out, nullptr silences them */
+    void SetDebugLogOutput(std::FILE *out);
+
+    /* Writes capture records to path in the i2c-mitm.cap format, until CloseCaptureFile */
+    bool OpenCaptureFile(const char *path);
+    void CloseCaptureFile();
+
+    /* Bytes of capture records written since the last reset, headers included */
+    u64 GetCaptureSize();
+    void ResetCaptureSize();
+
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "register_decoder.hpp"
+#include "i2c_command_list.hpp"
+#include "i2c_mitm_devices.hpp"
+
+namespace ams::host {
+
+    namespace {
+
+        using namespace ::ams::mitm::i2c;
+
+        void Append(std::string *out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+        void Append(std::string *out, const char *format, ...) {
+            char buf[0x80];
+            std::va_list args;
+            va_start(args, format);
+            std::vsnprintf(buf, sizeof(buf), format, args);
+            va_end(args);
+            out->append(buf);
+        }
+
+        void FormatField(std::string *out, const regmap::FieldInfo &field, u32 value) {
+            const u32 raw = field.GetRaw(value);
+            switch (field.format) {
+                case regmap::FieldFormat_Value:
+                    {
+                        s64 v = raw;
+                        if (field.is_signed && (raw & (u32(1) << (field.width - 1)))) {
+                            v -= s64(1) << field.width;
+                        }
+                        Append(out, "%s=%g%s", field.name, static_cast<double>(field.offset) + static_cast<double>(v) * field.num / field.den, field.unit);
+                    }
+                    break;
+                case regmap::FieldFormat_Flag:
+                    Append(out, "%s=%u", field.name, raw);
+                    break;
+                case regmap::FieldFormat_Enum:
+                    if (raw < field.enum_names.size()) {
+                        Append(out, "%s=%s", field.name, field.enum_names[raw]);
+                    } else {
+                        Append(out, "%s=%u", field.name, raw);
+                    }
+                    break;
+                case regmap::FieldFormat_Hex:
+                    Append(out, "%s=0x%x", field.name, raw);
+                    break;
+            }
+        }
+
+        const regmap::RegisterMap *GetRegisterMap(u32 device_code) {
+            const DeviceInfo *info = GetDeviceInfo(device_code);
+            return info != nullptr ? info->register_map : nullptr;
+        }
+
+    }
+
+    void FormatRegisters(std::string *out, const mitm::i2c::regmap::RegisterMap &map, u8 reg, const u8 *values, size_t size) {
+        for (size_t offset = 0; offset + map.register_size <= size; offset += map.register_size, reg++) {
+            const u32 value = regmap::GetRegisterValue(map, values + offset);
+
+            if (offset != 0) {
+                out->append(", ");
+            }
+
+            const regmap::RegisterInfo *info = regmap::GetRegisterInfo(map, reg);
+            if (info == nullptr) {
+                Append(out, "0x%02x=0x%0*x", reg, static_cast<int>(map.register_size * 2), value);
+                continue;
+            }
+
+            Append(out, "%s=0x%0*x", info->name, static_cast<int>(map.register_size * 2), value);
+            if (!info->fields.empty()) {
+                out->append(" {");
+                for (size_t i = 0; i < info->fields.size(); i++) {
+                    if (i != 0) {
+                        out->append(", ");
+                    }
+                    FormatField(out, info->fields[i], value);
+                }
+                out->push_back('}');
+            }
+        }
+    }
+
+    bool RegisterDecoder::Decode(std::string *out, const mitm::i2c::capture::RecordHeader &header, const u8 *data, const u8 *aux) {
+        /* Failed transactions carry no register values */
+        const regmap::RegisterMap *map = GetRegisterMap(header.device_code);
+        if (map == nullptr || header.result != 0) {
+            return false;
+        }
+
+        const size_t start = out->size();
+        const auto decode_write = [&](const u8 *bytes, size_t size) {
+            this->Select(header, bytes[0]);
+            if (size >= 2) {
+                out->append(out->size() != start ? "; write " : "write ");
+                FormatRegisters(out, *map, bytes[0], bytes + 1, size - 1);
+            }
+        };
+        const auto decode_read = [&](const u8 *bytes, size_t size) {
+            if (const u8 *reg = this->GetSelected(header); reg != nullptr && size != 0) {
+                out->append(out->size() != start ? "; read " : "read ");
+                FormatRegisters(out, *map, *reg, bytes, size);
+            }
+        };
+
+        switch (header.op) {
+            case capture::Op_Send:
+                if (header.size != 0) {
+                    decode_write(data, header.size);
+                }
+                break;
+            case capture::Op_Receive:
+                decode_read(data, header.size);
+                break;
+            case capture::Op_ExecuteCommandList:
+                cmdlist::ForEachCommand(data, header.size, header.aux_size, [&](const cmdlist::Command &command) {
+                    if (command.kind == cmdlist::CommandKind_Send && command.size != 0) {
+                        decode_write(command.data, command.size);
+                    } else if (command.kind == cmdlist::CommandKind_Receive) {
+                        decode_read(aux + command.receive_offset, command.size);
+                    }
+                });
+                break;
+            default:
+                break;
+        }
+
+        return out->size() != start;
+    }
+
+    void RegisterDecoder::Select(const mitm::i2c::capture::RecordHeader &header, u8 reg) {
+        for (auto &selected : m_selected) {
+            if (selected.program_id == header.program_id && selected.device_code == header.device_code) {
+                selected.reg = reg;
+                return;
+            }
+        }
+        m_selected.push_back({ header.program_id, header.device_code, reg });
+    }
+
+    const u8 *RegisterDecoder::GetSelected(const mitm::i2c::capture::RecordHeader &header) const {
+        for (const auto &selected : m_selected) {
+            if (selected.program_id == header.program_id && selected.device_code == header.device_code) {
+                return std::addressof(selected.reg);
+            }
+        }
+        return nullptr;
+    }
+
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "ams_host.hpp"
+#include "i2c_capture_format.hpp"
+#include "i2c_register_maps.hpp"
+#include <string>
+#include <vector>
+
+/* Turns the register traffic in capture records into named fields, for the devices with a register map */
+namespace ams::host {
+
+    /* Appends "name=value {field=..., ...}" for every register in values, values holds consecutive registers from reg on */
+    void FormatRegisters(std::string *out, const mitm::i2c::regmap::RegisterMap &map, u8 reg, const u8 *values, size_t size);
+
+    /*
+     * A Receive only carries data, the register it reads was selected by an earlier Send of the same client.
+     * The decoder remembers the last register each program selected on each device to decode them.
+     */
+    class RegisterDecoder {
+        private:
+            struct SelectedRegister {
+                u64 program_id;
+                u32 device_code;
+                u8 reg;
+            };
+        private:
+            std::vector<SelectedRegister> m_selected;
+        public:
+            /* Returns false if the record has nothing to decode */
+            bool Decode(std::string *out, const mitm::i2c::capture::RecordHeader &header, const u8 *data, const u8 *aux);
+        private:
+            void Select(const mitm::i2c::capture::RecordHeader &header, u8 reg);
+            const u8 *GetSelected(const mitm::i2c::capture::RecordHeader &header) const;
+    };
+
+}
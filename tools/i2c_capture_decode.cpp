@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "i2c_capture_format.hpp"
+#include "i2c_command_list.hpp"
+#include "i2c_mitm_devices.hpp"
+#include "register_decoder.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+/* Host side decoder for i2c-mitm.cap captures, prints them as text or converts them to pcap */
+namespace ams::mitm::i2c::capture {
+
+    namespace {
+
+        /* pcap link type for captures that are not a standard protocol, each packet is a raw capture record */
+        constexpr u32 PcapLinkTypeUser0 = 147;
+
+        struct PcapFileHeader {
+            u32 magic;
+            u16 version_major;
+            u16 version_minor;
+            s32 thiszone;
+            u32 sigfigs;
+            u32 snaplen;
+            u32 network;
+        };
+
+        struct PcapRecordHeader {
+            u32 ts_sec;
+            u32 ts_usec;
+            u32 incl_len;
+            u32 orig_len;
+        };
+
+        const char *GetOpName(u8 op) {
+            switch (op) {
+                case Op_Send:               return "send";
+                case Op_Receive:            return "recv";
+                case Op_ExecuteCommandList: return "cmdlist";
+                case Op_SetRetryPolicy:     return "retry";
+                case Op_Repeated:           return "repeated";
+                case Op_RateLimited:        return "ratelimited";
+                case Op_OpenSession:        return "open";
+                case Op_CloseSession:       return "close";
+                default:                    return "unknown";
+            }
+        }
+
+        void PrintBytes(FILE *out, const u8 *data, size_t size) {
+            std::fputc('[', out);
+            for (size_t i = 0; i < size; i++) {
+                std::fprintf(out, "0x%02" PRIx8 "%s", data[i], i + 1 < size ? ", " : "");
+            }
+            std::fputc(']', out);
+        }
+
+        const char *GetParseErrorName(cmdlist::ParseError error) {
+            switch (error) {
+                case cmdlist::ParseError_Truncated:       return "truncated";
+                case cmdlist::ParseError_ReceiveOverflow: return "receive buffer overflow";
+                case cmdlist::ParseError_InvalidCommand:  return "invalid command";
+                default:                                  return "none";
+            }
+        }
+
+        void PrintCommandList(FILE *out, const u8 *commands, size_t size) {
+            std::fputc('[', out);
+
+            /* The receive buffer size is not part of the record, receives are printed whatever their size */
+            cmdlist::CommandListReader reader(commands, size, std::numeric_limits<size_t>::max());
+            cmdlist::Command command;
+            for (bool first = true; reader.Next(std::addressof(command)); first = false) {
+                if (!first) {
+                    std::fprintf(out, ", ");
+                }
+
+                switch (command.kind) {
+                    case cmdlist::CommandKind_Send:
+                        std::fprintf(out, "[send, len: 0x%02zx, data: ", command.size);
+                        PrintBytes(out, command.data, command.size);
+                        std::fputc(']', out);
+                        break;
+                    case cmdlist::CommandKind_Receive:
+                        std::fprintf(out, "[recv, len: 0x%02zx, offset: 0x%02zx]", command.size, command.receive_offset);
+                        break;
+                    case cmdlist::CommandKind_Sleep:
+                        std::fprintf(out, "[sleep, us: %" PRIu32 "]", command.sleep_us);
+                        break;
+                }
+            }
+
+            if (reader.GetError() != cmdlist::ParseError_None) {
+                std::fprintf(out, "%s[%s at 0x%zx]", reader.GetOffset() != 0 ? ", " : "", GetParseErrorName(reader.GetError()), reader.GetOffset());
+            }
+
+            std::fputc(']', out);
+        }
+
+        void PrintRecord(FILE *out, const FileHeader &file_header, const RecordHeader &header, const u8 *data, const u8 *aux, host::RegisterDecoder *decoder) {
+            const double ms = static_cast<double>(header.tick) * 1000.0 / static_cast<double>(file_header.tick_frequency);
+
+            std::fprintf(out, "[ts: %12.3fms] ProgID: 0x%016" PRIx64 ", I2C dev: 0x%08" PRIx32 " (%s): ", ms, header.program_id, header.device_code, GetDeviceName(header.device_code));
+            if (header.session_id != 0) {
+                std::fprintf(out, "session: %" PRIu16 ", ", header.session_id);
+            }
+            if (header.op == Op_OpenSession || header.op == Op_CloseSession) {
+                std::fprintf(out, "%s\n", GetOpName(header.op));
+                return;
+            }
+            std::fprintf(out, "result: 0x%08" PRIx32 ", %-4s, ", header.result, GetOpName(header.op));
+            if (header.op == Op_Send && (header.option & OptionFlag_Injected)) {
+                std::fprintf(out, "injected, ");
+            }
+
+            switch (header.op) {
+                case Op_Send:
+                case Op_Receive:
+                    std::fprintf(out, "data: ");
+                    PrintBytes(out, data, header.size);
+                    break;
+                case Op_ExecuteCommandList:
+                    std::fprintf(out, "commands: ");
+                    PrintCommandList(out, data, header.size);
+                    if (header.aux_size) {
+                        std::fprintf(out, ", recv data: ");
+                        PrintBytes(out, aux, header.aux_size);
+                    }
+                    break;
+                case Op_SetRetryPolicy:
+                    if (header.size >= 2 * sizeof(s32)) {
+                        s32 policy[2];
+                        std::memcpy(policy, data, sizeof(policy));
+                        std::fprintf(out, "max retry count: %" PRIi32 ", retry interval us: %" PRIi32, policy[0], policy[1]);
+                    }
+                    break;
+                case Op_Repeated:
+                    if (header.size >= sizeof(RepeatedData)) {
+                        RepeatedData repeated;
+                        std::memcpy(std::addressof(repeated), data, sizeof(repeated));
+                        std::fprintf(out, "%s repeated %" PRIu32 " times, payload hash: 0x%08" PRIx32, GetOpName(header.option), repeated.count, repeated.payload_hash);
+                    }
+                    break;
+                case Op_RateLimited:
+                    if (header.size >= sizeof(RateLimitedData)) {
+                        RateLimitedData limited;
+                        std::memcpy(std::addressof(limited), data, sizeof(limited));
+                        std::fprintf(out, "%" PRIu32 " records left out by the rate limit", limited.count);
+                    }
+                    break;
+                default:
+                    PrintBytes(out, data, header.size);
+                    break;
+            }
+
+            std::fputc('\n', out);
+
+            if (std::string decoded; decoder != nullptr && decoder->Decode(std::addressof(decoded), header, data, aux)) {
+                std::fprintf(out, "    %s\n", decoded.c_str());
+            }
+        }
+
+        void WritePcapRecord(FILE *out, const FileHeader &file_header, const u8 *record, size_t record_size) {
+            RecordHeader header;
+            std::memcpy(std::addressof(header), record, sizeof(header));
+
+            const u64 us = static_cast<u64>(static_cast<double>(header.tick) * 1000000.0 / static_cast<double>(file_header.tick_frequency));
+            const PcapRecordHeader pcap_header = {
+                .ts_sec   = static_cast<u32>(us / 1000000),
+                .ts_usec  = static_cast<u32>(us % 1000000),
+                .incl_len = static_cast<u32>(record_size),
+                .orig_len = static_cast<u32>(record_size),
+            };
+
+            std::fwrite(std::addressof(pcap_header), sizeof(pcap_header), 1, out);
+            std::fwrite(record, record_size, 1, out);
+        }
+
+        /* Prints or converts the records of one capture file, returns false if it is not a capture */
+        bool DecodeFile(const char *in_path, FILE *out, bool write_pcap, host::RegisterDecoder *decoder, size_t *num_records) {
+            FILE *in = std::fopen(in_path, "rb");
+            if (in == nullptr) {
+                std::perror(in_path);
+                return false;
+            }
+            ON_SCOPE_EXIT { std::fclose(in); };
+
+            FileHeader file_header;
+            if (std::fread(std::addressof(file_header), sizeof(file_header), 1, in) != 1 || file_header.magic != FileMagic) {
+                std::fprintf(stderr, "%s: not an i2c-mitm capture\n", in_path);
+                return false;
+            }
+            if (file_header.version == 0 || file_header.version > FormatVersion || file_header.tick_frequency == 0) {
+                std::fprintf(stderr, "%s: unsupported capture version %u\n", in_path, file_header.version);
+                return false;
+            }
+            std::fseek(in, file_header.header_size, SEEK_SET);
+
+            std::vector<u8> record;
+            RecordHeader header;
+            while (std::fread(std::addressof(header), sizeof(header), 1, in) == 1 && !IsPreallocatedTail(header)) {
+                record.resize(GetRecordSize(header));
+                std::memcpy(record.data(), std::addressof(header), sizeof(header));
+
+                if (std::fread(record.data() + sizeof(header), record.size() - sizeof(header), 1, in) != 1 && record.size() != sizeof(header)) {
+                    std::fprintf(stderr, "%s: truncated record at end of capture\n", in_path);
+                    break;
+                }
+
+                if (write_pcap) {
+                    WritePcapRecord(out, file_header, record.data(), record.size());
+                } else {
+                    const u8 *data = record.data() + sizeof(header);
+                    PrintRecord(out, file_header, header, data, data + header.size, decoder);
+                }
+
+                (*num_records)++;
+            }
+
+            return true;
+        }
+
+        int Usage(const char *name) {
+            std::fprintf(stderr, "usage: %s <capture.cap>... [-p <out.pcap>] [-n]\n", name);
+            std::fprintf(stderr, "  Prints the capture as text, or writes it as pcap (link type USER0) with -p.\n");
+            std::fprintf(stderr, "  Several files are read as one capture in the given order, oldest first, e.g. i2c-mitm.3.cap i2c-mitm.2.cap i2c-mitm.1.cap i2c-mitm.cap.\n");
+            std::fprintf(stderr, "  Register accesses of known chips are decoded into fields, -n leaves them raw.\n");
+            return EXIT_FAILURE;
+        }
+
+        int Main(int argc, char **argv) {
+            std::vector<const char *> in_paths;
+            const char *pcap_path = nullptr;
+            bool decode_registers = true;
+
+            for (int i = 1; i < argc; i++) {
+                if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+                    pcap_path = argv[++i];
+                } else if (std::strcmp(argv[i], "-n") == 0) {
+                    decode_registers = false;
+                } else if (argv[i][0] != '-') {
+                    in_paths.push_back(argv[i]);
+                } else {
+                    return Usage(argv[0]);
+                }
+            }
+
+            if (in_paths.empty()) {
+                return Usage(argv[0]);
+            }
+
+            FILE *out = stdout;
+            if (pcap_path != nullptr) {
+                out = std::fopen(pcap_path, "wb");
+                if (out == nullptr) {
+                    std::perror(pcap_path);
+                    return EXIT_FAILURE;
+                }
+
+                const PcapFileHeader pcap_header = {
+                    .magic         = 0xa1b2c3d4,
+                    .version_major = 2,
+                    .version_minor = 4,
+                    .thiszone      = 0,
+                    .sigfigs       = 0,
+                    .snaplen       = 0x10000 + sizeof(RecordHeader),
+                    .network       = PcapLinkTypeUser0,
+                };
+                std::fwrite(std::addressof(pcap_header), sizeof(pcap_header), 1, out);
+            }
+
+            /* The decoder state carries over, so a read in one file is decoded with the register selected in the one before */
+            size_t num_records = 0;
+            host::RegisterDecoder decoder;
+            bool decoded = true;
+            for (const char *in_path : in_paths) {
+                if (!DecodeFile(in_path, out, pcap_path != nullptr, decode_registers ? std::addressof(decoder) : nullptr, std::addressof(num_records))) {
+                    decoded = false;
+                    break;
+                }
+            }
+
+            if (pcap_path != nullptr) {
+                std::fclose(out);
+                std::fprintf(stderr, "wrote %zu records to %s\n", num_records, pcap_path);
+            }
+
+            return decoded ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+    }
+
+}
+
+int main(int argc, char **argv) {
+    return ams::mitm::i2c::capture::Main(argc, argv);
+}
@@ -0,0 +1,721 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fake_i2c_device.hpp"
+#include "host_log.hpp"
+#include "i2c_capture_format.hpp"
+#include "i2c_command_list.hpp"
+#include "i2c_mitm_session.hpp"
+#include "i2c_mitm_settings.hpp"
+#include "i2c_mitm_devices.hpp"
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Replays an i2c-mitm.cap capture against the session services on the host, for regression checks and benchmarks of recorded traffic */
+namespace ams::mitm::i2c {
+
+    namespace {
+
+        enum SessionType {
+            SessionType_Monitor,
+            SessionType_Rule,
+            SessionType_Caching,
+            SessionType_Telemetry,
+            SessionType_Auto,
+        };
+
+        struct Options {
+            SessionType session_type;
+            bool real_time;
+            bool use_old_command;
+        };
+
+        struct Record {
+            capture::RecordHeader header;
+            std::vector<u8> data;
+            std::vector<u8> aux;
+        };
+
+        constexpr u32 HashBytes(u32 hash, const u8 *data, size_t size) {
+            /* FNV-1a, as the log filter hashes the payload of repeated records */
+            for (size_t i = 0; i < size; i++) {
+                hash = (hash ^ data[i]) * 0x01000193;
+            }
+            return hash;
+        }
+
+        u32 HashPayload(const Record &record) {
+            return HashBytes(HashBytes(0x811C9DC5, record.data.data(), record.data.size()), record.aux.data(), record.aux.size());
+        }
+
+        /* The session types are templates, the replay picks one per recorded session at run time */
+        class ReplaySession {
+            public:
+                virtual ~ReplaySession() = default;
+
+                virtual Result Send(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) = 0;
+                virtual Result Receive(u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) = 0;
+                virtual Result ExecuteCommandList(u8 *rcv_data, size_t rcv_size, const u8 *commands, size_t num_commands, bool use_old_command) = 0;
+                virtual Result SetRetryPolicy(s32 max_retry_count, s32 retry_interval_us) = 0;
+        };
+
+        template<typename Session>
+        class ReplaySessionImpl : public ReplaySession {
+            private:
+                Session m_session;
+            public:
+                ReplaySessionImpl(host::FakeI2cDevice *device, DeviceCode device_code, ncm::ProgramId program_id) : m_session(device, device_code, program_id) { /* ... */ }
+
+                virtual Result Send(const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) override {
+                    if (use_old_command) {
+                        R_RETURN(m_session.SendOld(sf::InBuffer(data, size), option));
+                    } else {
+                        R_RETURN(m_session.Send(sf::InAutoSelectBuffer(data, size), option));
+                    }
+                }
+
+                virtual Result Receive(u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) override {
+                    if (use_old_command) {
+                        R_RETURN(m_session.ReceiveOld(sf::OutBuffer(data, size), option));
+                    } else {
+                        R_RETURN(m_session.Receive(sf::OutAutoSelectBuffer(data, size), option));
+                    }
+                }
+
+                virtual Result ExecuteCommandList(u8 *rcv_data, size_t rcv_size, const u8 *commands, size_t num_commands, bool use_old_command) override {
+                    const sf::InPointerArray<::ams::i2c::I2cCommand> command_list(commands, num_commands);
+                    if (use_old_command) {
+                        R_RETURN(m_session.ExecuteCommandListOld(sf::OutBuffer(rcv_data, rcv_size), command_list));
+                    } else {
+                        R_RETURN(m_session.ExecuteCommandList(sf::OutAutoSelectBuffer(rcv_data, rcv_size), command_list));
+                    }
+                }
+
+                virtual Result SetRetryPolicy(s32 max_retry_count, s32 retry_interval_us) override {
+                    R_RETURN(m_session.SetRetryPolicy(max_retry_count, retry_interval_us));
+                }
+        };
+
+        /* Captures before version 3 have no session ids, their records are grouped into one session per program and device */
+        struct SessionKey {
+            u64 program_id;
+            u32 device_code;
+            u16 session_id;
+
+            constexpr auto operator<=>(const SessionKey &) const = default;
+        };
+
+        struct SessionState {
+            std::unique_ptr<ReplaySession> session;
+            host::FakeI2cDevice *device;
+            /* Register the recorded client last selected, where the recorded reads are planted on the device */
+            s32 pointer;
+            /* Last record of each payload, a Repeated record is replayed as that many copies of it */
+            std::map<u32, const Record *> by_hash;
+        };
+
+        struct LatencyStats {
+            std::vector<s64> samples_ns;
+        };
+
+        class Replayer {
+            private:
+                const Options &m_options;
+                s64 m_tick_frequency;
+                std::map<u32, std::unique_ptr<host::FakeI2cDevice>> m_devices;
+                std::map<SessionKey, SessionState> m_sessions;
+                std::string m_transcript;
+                LatencyStats m_latency[capture::Op_SetRetryPolicy + 1];
+                u64 m_start_tick;
+                os::Tick m_start;
+                s64 m_elapsed_ns;
+                s64 m_max_late_ns;
+                s64 m_total_late_ns;
+                size_t m_num_calls;
+                size_t m_num_sessions;
+                size_t m_num_injected;
+                size_t m_num_repeats;
+                size_t m_num_unmatched_repeats;
+                u64 m_num_rate_limited;
+            public:
+                Replayer(const Options &options, s64 tick_frequency)
+                    : m_options(options), m_tick_frequency(tick_frequency), m_start_tick(0), m_start(), m_elapsed_ns(0), m_max_late_ns(0), m_total_late_ns(0),
+                      m_num_calls(0), m_num_sessions(0), m_num_injected(0), m_num_repeats(0), m_num_unmatched_repeats(0), m_num_rate_limited(0) { /* ... */ }
+
+                void Run(const std::vector<Record> &records) {
+                    if (records.empty()) {
+                        return;
+                    }
+
+                    m_start_tick = records.front().header.tick;
+                    m_start = os::GetSystemTick();
+
+                    for (const Record &record : records) {
+                        this->Replay(record);
+                    }
+
+                    m_elapsed_ns = (os::GetSystemTick() - m_start).ToTimeSpan().GetNanoSeconds();
+                }
+
+                const std::string &GetTranscript() const { return m_transcript; }
+
+                void PrintSummary(std::FILE *out) {
+                    const s64 elapsed_ns = m_elapsed_ns;
+                    std::fprintf(out, "replayed %zu calls of %zu sessions in %.3fms, %.0f calls/s\n",
+                                 m_num_calls, m_num_sessions, elapsed_ns / 1e6, elapsed_ns > 0 ? m_num_calls * 1e9 / elapsed_ns : 0.0);
+                    std::fprintf(out, "%-8s %8s %10s %10s %10s\n", "call", "count", "p50 ns", "p99 ns", "max ns");
+
+                    constexpr const char *Names[] = { "send", "recv", "cmdlist", "retry" };
+                    for (size_t op = 0; op < std::size(m_latency); op++) {
+                        std::vector<s64> &samples = m_latency[op].samples_ns;
+                        if (samples.empty()) {
+                            continue;
+                        }
+                        std::sort(samples.begin(), samples.end());
+                        std::fprintf(out, "%-8s %8zu %10" PRId64 " %10" PRId64 " %10" PRId64 "\n", Names[op], samples.size(),
+                                     samples[samples.size() / 2], samples[std::min(samples.size() - 1, samples.size() * 99 / 100)], samples.back());
+                    }
+
+                    if (m_options.real_time && m_num_calls != 0) {
+                        std::fprintf(out, "schedule: %.1fus late on average, %.1fus at most\n", m_total_late_ns / 1e3 / m_num_calls, m_max_late_ns / 1e3);
+                    }
+                    if (m_num_injected != 0) {
+                        std::fprintf(out, "skipped %zu writes the mitm issued itself, the sessions issue them again\n", m_num_injected);
+                    }
+                    if (m_num_repeats != 0) {
+                        std::fprintf(out, "warning: %zu calls were restored from repeated records, their order is a guess. Record with dedup_window_ms=0.\n", m_num_repeats);
+                    }
+                    if (m_num_unmatched_repeats != 0) {
+                        std::fprintf(out, "warning: %zu repeated records without the record they repeat\n", m_num_unmatched_repeats);
+                    }
+                    if (m_num_rate_limited != 0) {
+                        std::fprintf(out, "warning: %" PRIu64 " records were left out by the rate limit, the trace is incomplete\n", m_num_rate_limited);
+                    }
+                }
+            private:
+                host::FakeI2cDevice *GetDevice(u32 device_code) {
+                    auto &device = m_devices[device_code];
+                    if (device == nullptr) {
+                        /* Every register is present, the recorded reads decide what they hold */
+                        device = std::make_unique<host::FakeI2cDevice>();
+                        host::InitializeRegisterFile(device.get());
+                    }
+                    return device.get();
+                }
+
+                SessionType GetSessionType(DeviceCode device_code) {
+                    if (m_options.session_type != SessionType_Auto) {
+                        return m_options.session_type;
+                    }
+
+                    const ScopedConfig config;
+                    if (cache::GetDeviceCacheConfig(config.GetCache(), device_code) != nullptr) {
+                        return SessionType_Caching;
+                    } else if (telemetry::IsRailSelected(config.GetTelemetry(), device_code) || charge::IsObservedDevice(config.GetChargePolicy(), device_code)) {
+                        return SessionType_Telemetry;
+                    } else if (rules::GetDeviceRules(config.GetRules(), device_code) != nullptr ||
+                               (charge::IsEnabled(config.GetChargePolicy()) && charge::IsChargerDevice(device_code)) ||
+                               config.GetConfig().coalesce_reads) {
+                        return SessionType_Rule;
+                    } else {
+                        return SessionType_Monitor;
+                    }
+                }
+
+                std::unique_ptr<ReplaySession> CreateSession(host::FakeI2cDevice *device, DeviceCode device_code, ncm::ProgramId program_id) {
+                    switch (this->GetSessionType(device_code)) {
+                        case SessionType_Monitor:     return std::make_unique<ReplaySessionImpl<MonitorI2cSessionService>>(device, device_code, program_id);
+                        case SessionType_Rule:        return std::make_unique<ReplaySessionImpl<RuleI2cSessionService>>(device, device_code, program_id);
+                        case SessionType_Telemetry:   return std::make_unique<ReplaySessionImpl<TelemetryI2cSessionService>>(device, device_code, program_id);
+                        case SessionType_Caching:
+                        default:                      return std::make_unique<ReplaySessionImpl<CachingI2cSessionService>>(device, device_code, program_id);
+                    }
+                }
+
+                void AppendLine(const capture::RecordHeader &header, const char *fmt, ...) __attribute__((format(printf, 3, 4))) {
+                    char buf[0x80];
+                    util::TSNPrintf(buf, sizeof(buf), "s%-5" PRIu16 " 0x%08" PRIx32 " %-8s ", header.session_id, header.device_code, GetDeviceName(header.device_code));
+                    m_transcript += buf;
+
+                    std::va_list args;
+                    va_start(args, fmt);
+                    std::vsnprintf(buf, sizeof(buf), fmt, args);
+                    va_end(args);
+                    m_transcript += buf;
+                }
+
+                void AppendBytes(const u8 *data, size_t size) {
+                    char buf[4];
+                    for (size_t i = 0; i < size; i++) {
+                        util::TSNPrintf(buf, sizeof(buf), " %02" PRIx8, data[i]);
+                        m_transcript += buf;
+                    }
+                }
+
+                void AppendResult(Result result, const u8 *data, size_t size) {
+                    char buf[0x20];
+                    if (R_FAILED(result)) {
+                        util::TSNPrintf(buf, sizeof(buf), " -> error 0x%" PRIx32, result.GetValue());
+                        m_transcript += buf;
+                        return;
+                    }
+                    m_transcript += " -> ok";
+                    this->AppendBytes(data, size);
+                }
+
+                /* What the call did to the device, shows the writes the overrides changed, dropped or added */
+                void AppendRegisterChanges(host::FakeI2cDevice *device, const u8 *before) {
+                    char buf[0x10];
+                    bool first = true;
+                    for (size_t reg = 0; reg < host::FakeI2cDevice::NumRegisters; reg++) {
+                        const u8 value = device->GetRegister(static_cast<u8>(reg));
+                        if (value == before[reg]) {
+                            continue;
+                        }
+                        util::TSNPrintf(buf, sizeof(buf), "%s%02zx=%02" PRIx8 ">%02" PRIx8, first ? " | " : " ", reg, before[reg], value);
+                        m_transcript += buf;
+                        first = false;
+                    }
+                    m_transcript += '\n';
+                }
+
+                void SaveRegisters(host::FakeI2cDevice *device, u8 *out) {
+                    for (size_t reg = 0; reg < host::FakeI2cDevice::NumRegisters; reg++) {
+                        out[reg] = device->GetRegister(static_cast<u8>(reg));
+                    }
+                }
+
+                /* Plants the bytes the recorded client read at the register it read them from, so the session reads what the console did */
+                void PlantRead(host::FakeI2cDevice *device, s32 pointer, const u8 *data, size_t size) {
+                    if (pointer < 0) {
+                        return;
+                    }
+                    for (size_t i = 0; i < size; i++) {
+                        device->SetRegister(static_cast<u8>(pointer + i), data[i]);
+                    }
+                }
+
+                void WaitFor(u64 tick) {
+                    if (!m_options.real_time || tick < m_start_tick) {
+                        return;
+                    }
+
+                    const s64 target_ns = static_cast<s64>(static_cast<double>(tick - m_start_tick) * 1e9 / m_tick_frequency);
+                    const s64 now_ns = (os::GetSystemTick() - m_start).ToTimeSpan().GetNanoSeconds();
+                    if (now_ns < target_ns) {
+                        os::SleepThread(TimeSpan::FromNanoSeconds(target_ns - now_ns));
+                    }
+
+                    const s64 late_ns = std::max<s64>((os::GetSystemTick() - m_start).ToTimeSpan().GetNanoSeconds() - target_ns, 0);
+                    m_max_late_ns = std::max(m_max_late_ns, late_ns);
+                    m_total_late_ns += late_ns;
+                }
+
+                SessionState &GetSession(const capture::RecordHeader &header) {
+                    const SessionKey key = { header.program_id, header.device_code, header.session_id };
+                    auto it = m_sessions.find(key);
+                    if (it != m_sessions.end()) {
+                        return it->second;
+                    }
+
+                    /* Opened before the capture started, or a capture without session records */
+                    return this->OpenSession(header);
+                }
+
+                SessionState &OpenSession(const capture::RecordHeader &header) {
+                    const SessionKey key = { header.program_id, header.device_code, header.session_id };
+                    host::FakeI2cDevice *device = this->GetDevice(header.device_code);
+
+                    u8 before[host::FakeI2cDevice::NumRegisters];
+                    this->SaveRegisters(device, before);
+
+                    SessionState &state = m_sessions[key];
+                    state = {
+                        .session = this->CreateSession(device, header.device_code, { header.program_id }),
+                        .device  = device,
+                        .pointer = -1,
+                        .by_hash = {},
+                    };
+                    m_num_sessions++;
+
+                    this->AppendLine(header, "open");
+                    this->AppendRegisterChanges(device, before);
+                    return state;
+                }
+
+                void Replay(const Record &record) {
+                    const capture::RecordHeader &header = record.header;
+
+                    switch (header.op) {
+                        case capture::Op_OpenSession:
+                            {
+                                /* A reused session id replaces the old session */
+                                m_sessions.erase({ header.program_id, header.device_code, header.session_id });
+                                this->WaitFor(header.tick);
+                                this->OpenSession(header);
+                            }
+                            return;
+                        case capture::Op_CloseSession:
+                            m_sessions.erase({ header.program_id, header.device_code, header.session_id });
+                            return;
+                        case capture::Op_RateLimited:
+                            if (record.data.size() >= sizeof(capture::RateLimitedData)) {
+                                capture::RateLimitedData limited;
+                                std::memcpy(std::addressof(limited), record.data.data(), sizeof(limited));
+                                m_num_rate_limited += limited.count;
+                            }
+                            return;
+                        case capture::Op_Repeated:
+                            this->ReplayRepeated(record);
+                            return;
+                        case capture::Op_Send:
+                            if (header.option & capture::OptionFlag_Injected) {
+                                m_num_injected++;
+                                return;
+                            }
+                            [[fallthrough]];
+                        case capture::Op_Receive:
+                        case capture::Op_ExecuteCommandList:
+                        case capture::Op_SetRetryPolicy:
+                            {
+                                SessionState &state = this->GetSession(header);
+                                state.by_hash[HashPayload(record)] = std::addressof(record);
+                                this->WaitFor(header.tick);
+                                this->ReplayCall(state, record);
+                            }
+                            return;
+                        default:
+                            return;
+                    }
+                }
+
+                void ReplayRepeated(const Record &record) {
+                    capture::RepeatedData repeated;
+                    if (record.data.size() < sizeof(repeated)) {
+                        return;
+                    }
+                    std::memcpy(std::addressof(repeated), record.data.data(), sizeof(repeated));
+
+                    SessionState &state = this->GetSession(record.header);
+                    const auto it = state.by_hash.find(repeated.payload_hash);
+                    if (it == state.by_hash.end() || it->second->header.op != record.header.option) {
+                        m_num_unmatched_repeats++;
+                        return;
+                    }
+
+                    /* Only the count is known, the repeats are spread evenly up to the summary */
+                    const Record &original = *it->second;
+                    for (u32 i = 1; i <= repeated.count; i++) {
+                        this->WaitFor(original.header.tick + (record.header.tick - original.header.tick) * i / (repeated.count + 1));
+                        this->ReplayCall(state, original);
+                    }
+                    m_num_repeats += repeated.count;
+                }
+
+                void ReplayCall(SessionState &state, const Record &record) {
+                    const capture::RecordHeader &header = record.header;
+                    const auto option = static_cast<::ams::i2c::TransactionOption>(header.option & (::ams::i2c::TransactionOption_StartCondition | ::ams::i2c::TransactionOption_StopCondition));
+                    const bool old = m_options.use_old_command;
+
+                    u8 before[host::FakeI2cDevice::NumRegisters];
+                    std::vector<u8> received;
+                    Result result = ResultSuccess();
+                    os::Tick start;
+
+                    switch (header.op) {
+                        case capture::Op_Send:
+                            if (!record.data.empty()) {
+                                state.pointer = record.data[0];
+                            }
+                            this->SaveRegisters(state.device, before);
+                            this->AppendLine(header, "send   ");
+                            this->AppendBytes(record.data.data(), record.data.size());
+
+                            start = os::GetSystemTick();
+                            result = state.session->Send(record.data.data(), record.data.size(), option, old);
+                            break;
+                        case capture::Op_Receive:
+                            this->PlantRead(state.device, state.pointer, record.data.data(), record.data.size());
+                            this->SaveRegisters(state.device, before);
+                            this->AppendLine(header, "recv    %zu", record.data.size());
+                            received.resize(record.data.size());
+
+                            start = os::GetSystemTick();
+                            result = state.session->Receive(received.data(), received.size(), option, old);
+                            break;
+                        case capture::Op_ExecuteCommandList:
+                            cmdlist::ForEachCommand(record.data.data(), record.data.size(), record.aux.size(), [&](const cmdlist::Command &command) {
+                                if (command.kind == cmdlist::CommandKind_Send && command.size >= 1) {
+                                    state.pointer = command.data[0];
+                                } else if (command.kind == cmdlist::CommandKind_Receive) {
+                                    this->PlantRead(state.device, state.pointer, record.aux.data() + command.receive_offset, command.size);
+                                }
+                            });
+                            this->SaveRegisters(state.device, before);
+                            this->AppendLine(header, "cmdlist");
+                            this->AppendBytes(record.data.data(), record.data.size());
+                            received.resize(record.aux.size());
+
+                            start = os::GetSystemTick();
+                            result = state.session->ExecuteCommandList(received.data(), received.size(), record.data.data(), record.data.size(), old);
+                            break;
+                        case capture::Op_SetRetryPolicy:
+                            {
+                                s32 policy[2] = {};
+                                std::memcpy(policy, record.data.data(), std::min(record.data.size(), sizeof(policy)));
+                                this->SaveRegisters(state.device, before);
+                                this->AppendLine(header, "retry   %" PRIi32 " %" PRIi32, policy[0], policy[1]);
+
+                                start = os::GetSystemTick();
+                                result = state.session->SetRetryPolicy(policy[0], policy[1]);
+                            }
+                            break;
+                        default:
+                            return;
+                    }
+
+                    m_latency[header.op].samples_ns.push_back((os::GetSystemTick() - start).ToTimeSpan().GetNanoSeconds());
+                    m_num_calls++;
+
+                    this->AppendResult(result, received.data(), received.size());
+                    this->AppendRegisterChanges(state.device, before);
+                }
+        };
+
+        bool ReadCapture(const char *path, std::vector<Record> &out, s64 *out_tick_frequency) {
+            FILE *in = std::fopen(path, "rb");
+            if (in == nullptr) {
+                std::perror(path);
+                return false;
+            }
+            ON_SCOPE_EXIT { std::fclose(in); };
+
+            capture::FileHeader file_header;
+            if (std::fread(std::addressof(file_header), sizeof(file_header), 1, in) != 1 || file_header.magic != capture::FileMagic) {
+                std::fprintf(stderr, "%s: not an i2c-mitm capture\n", path);
+                return false;
+            }
+            if (file_header.version == 0 || file_header.version > capture::FormatVersion || file_header.tick_frequency == 0) {
+                std::fprintf(stderr, "%s: unsupported capture version %u\n", path, file_header.version);
+                return false;
+            }
+            std::fseek(in, file_header.header_size, SEEK_SET);
+            *out_tick_frequency = file_header.tick_frequency;
+
+            Record record;
+            while (std::fread(std::addressof(record.header), sizeof(record.header), 1, in) == 1 && !capture::IsPreallocatedTail(record.header)) {
+                record.data.resize(record.header.size);
+                record.aux.resize(record.header.aux_size);
+                if ((record.header.size != 0 && std::fread(record.data.data(), record.data.size(), 1, in) != 1) ||
+                    (record.header.aux_size != 0 && std::fread(record.aux.data(), record.aux.size(), 1, in) != 1)) {
+                    std::fprintf(stderr, "%s: truncated record at end of capture\n", path);
+                    break;
+                }
+                out.push_back(record);
+            }
+
+            return true;
+        }
+
+        bool ReadFile(const char *path, std::string &out) {
+            FILE *in = std::fopen(path, "rb");
+            if (in == nullptr) {
+                std::perror(path);
+                return false;
+            }
+
+            char buf[0x1000];
+            size_t read;
+            while ((read = std::fread(buf, 1, sizeof(buf), in)) != 0) {
+                out.append(buf, read);
+            }
+            std::fclose(in);
+            return true;
+        }
+
+        bool WriteFile(const char *path, const std::string &data) {
+            FILE *out = std::fopen(path, "wb");
+            if (out == nullptr) {
+                std::perror(path);
+                return false;
+            }
+
+            const bool written = std::fwrite(data.data(), 1, data.size(), out) == data.size();
+            std::fclose(out);
+            return written;
+        }
+
+        /* Prints the first lines that differ, returns whether the transcripts match */
+        bool CompareTranscript(const std::string &golden, const std::string &transcript) {
+            constexpr int MaxReportedLines = 10;
+
+            size_t golden_pos = 0, pos = 0;
+            int mismatches = 0;
+            for (size_t line = 1; golden_pos < golden.size() || pos < transcript.size(); line++) {
+                const size_t golden_end = std::min(golden.find('\n', golden_pos), golden.size());
+                const size_t end = std::min(transcript.find('\n', pos), transcript.size());
+
+                const std::string_view expected(golden.data() + golden_pos, golden_end - golden_pos);
+                const std::string_view actual(transcript.data() + pos, end - pos);
+                if (expected != actual) {
+                    if (mismatches++ < MaxReportedLines) {
+                        std::printf("line %zu:\n  expected: %.*s\n  actual:   %.*s\n", line, static_cast<int>(expected.size()), expected.data(), static_cast<int>(actual.size()), actual.data());
+                    }
+                }
+
+                golden_pos = std::min(golden_end + 1, golden.size());
+                pos = std::min(end + 1, transcript.size());
+            }
+
+            if (mismatches != 0) {
+                std::printf("%d lines differ from the golden transcript\n", mismatches);
+            }
+            return mismatches == 0;
+        }
+
+        bool ParseSessionType(const char *name, SessionType &out) {
+            constexpr struct {
+                const char *name;
+                SessionType type;
+            } SessionTypes[] = {
+                { "monitor",     SessionType_Monitor     },
+                { "rule",        SessionType_Rule        },
+                { "caching",     SessionType_Caching     },
+                { "telemetry",   SessionType_Telemetry   },
+                { "auto",        SessionType_Auto        },
+            };
+
+            for (const auto &type : SessionTypes) {
+                if (std::strcmp(name, type.name) == 0) {
+                    out = type.type;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        int Usage(const char *name) {
+            std::fprintf(stderr, "usage: %s [-s <sdroot>] [-t <type>] [-r] [-o] [-g <golden> | -w <golden>] [-p] [-c <capture>] [-v] <trace.cap>...\n", name);
+            std::fprintf(stderr, "  Replays the sessions and calls of a capture against fake devices that answer the recorded reads.\n");
+            std::fprintf(stderr, "  Several files are replayed as one capture in the given order, oldest first.\n");
+            std::fprintf(stderr, "  -s  root directory holding config/i2c_mitm/i2c_mitm.ini\n");
+            std::fprintf(stderr, "  -t  monitor, rule, caching, telemetry or auto (default, picks the type the mitm would)\n");
+            std::fprintf(stderr, "  -r  real time, keeps the recorded timing (default as fast as possible)\n");
+            std::fprintf(stderr, "  -o  use the pre 6.0.0 commands\n");
+            std::fprintf(stderr, "  -g  compare the transcript of the replay against a golden one, fails on any difference\n");
+            std::fprintf(stderr, "  -w  write the transcript of the replay as the golden one\n");
+            std::fprintf(stderr, "  -p  print the transcript\n");
+            std::fprintf(stderr, "  -c  capture the replayed sessions' bus traffic to a file\n");
+            std::fprintf(stderr, "  -v  print the debug log to stderr\n");
+            return EXIT_FAILURE;
+        }
+
+        int Main(int argc, char **argv) {
+            Options options = { SessionType_Auto, false, false };
+            std::vector<const char *> trace_paths;
+            const char *golden_path = nullptr;
+            const char *write_golden_path = nullptr;
+            const char *capture_path = nullptr;
+            bool print_transcript = false;
+
+            for (int i = 1; i < argc; i++) {
+                if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+                    fs::SetSdCardRoot(argv[++i]);
+                } else if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+                    if (!ParseSessionType(argv[++i], options.session_type)) {
+                        return Usage(argv[0]);
+                    }
+                } else if (std::strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+                    golden_path = argv[++i];
+                } else if (std::strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+                    write_golden_path = argv[++i];
+                } else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+                    capture_path = argv[++i];
+                } else if (std::strcmp(argv[i], "-r") == 0) {
+                    options.real_time = true;
+                } else if (std::strcmp(argv[i], "-o") == 0) {
+                    options.use_old_command = true;
+                } else if (std::strcmp(argv[i], "-p") == 0) {
+                    print_transcript = true;
+                } else if (std::strcmp(argv[i], "-v") == 0) {
+                    host::SetDebugLogOutput(stderr);
+                } else if (argv[i][0] != '-') {
+                    trace_paths.push_back(argv[i]);
+                } else {
+                    return Usage(argv[0]);
+                }
+            }
+
+            if (trace_paths.empty() || (golden_path != nullptr && write_golden_path != nullptr)) {
+                return Usage(argv[0]);
+            }
+
+            std::vector<Record> records;
+            s64 tick_frequency;
+            for (const char *trace_path : trace_paths) {
+                if (!ReadCapture(trace_path, records, std::addressof(tick_frequency))) {
+                    return EXIT_FAILURE;
+                }
+            }
+
+            if (capture_path != nullptr && !host::OpenCaptureFile(capture_path)) {
+                std::perror(capture_path);
+                return EXIT_FAILURE;
+            }
+            ON_SCOPE_EXIT { host::CloseCaptureFile(); };
+
+            if (R_FAILED(InitializeConfig())) {
+                std::fprintf(stderr, "failed to parse config, continuing with what was parsed\n");
+            }
+            LogConfig();
+
+            Replayer replayer(options, tick_frequency);
+            replayer.Run(records);
+            replayer.PrintSummary(stdout);
+
+            if (print_transcript) {
+                std::fputs(replayer.GetTranscript().c_str(), stdout);
+            }
+
+            if (write_golden_path != nullptr) {
+                return WriteFile(write_golden_path, replayer.GetTranscript()) ? EXIT_SUCCESS : EXIT_FAILURE;
+            }
+
+            if (golden_path != nullptr) {
+                std::string golden;
+                if (!ReadFile(golden_path, golden)) {
+                    return EXIT_FAILURE;
+                }
+                return CompareTranscript(golden, replayer.GetTranscript()) ? EXIT_SUCCESS : EXIT_FAILURE;
+            }
+
+            return EXIT_SUCCESS;
+        }
+
+    }
+
+}
+
+int main(int argc, char **argv) {
+    return ams::mitm::i2c::Main(argc, argv);
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "i2c_log_format.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+
+/* Host side reader for i2c-mitm.log ring files, prints the log text oldest first */
+namespace ams::mitm::i2c::logfile {
+
+    namespace {
+
+        int Usage(const char *name) {
+            std::fprintf(stderr, "usage: %s <i2c-mitm.log> [-o <out.txt>]\n", name);
+            std::fprintf(stderr, "  Prints the text of the log ring file in the order it was written, or writes it to a file with -o.\n");
+            return EXIT_FAILURE;
+        }
+
+        int Main(int argc, char **argv) {
+            const char *in_path = nullptr;
+            const char *out_path = nullptr;
+
+            for (int i = 1; i < argc; i++) {
+                if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+                    out_path = argv[++i];
+                } else if (in_path == nullptr && argv[i][0] != '-') {
+                    in_path = argv[i];
+                } else {
+                    return Usage(argv[0]);
+                }
+            }
+
+            if (in_path == nullptr) {
+                return Usage(argv[0]);
+            }
+
+            FILE *in = std::fopen(in_path, "rb");
+            if (in == nullptr) {
+                std::perror(in_path);
+                return EXIT_FAILURE;
+            }
+
+            std::fseek(in, 0, SEEK_END);
+            const s64 file_size = std::ftell(in);
+            std::fseek(in, 0, SEEK_SET);
+
+            FileHeader header;
+            if (std::fread(std::addressof(header), sizeof(header), 1, in) != 1 || header.magic != FileMagic) {
+                std::fprintf(stderr, "%s: not an i2c-mitm log ring file\n", in_path);
+                std::fclose(in);
+                return EXIT_FAILURE;
+            }
+            if (!IsValidHeader(header, file_size)) {
+                std::fprintf(stderr, "%s: unsupported log version %u or truncated file\n", in_path, header.version);
+                std::fclose(in);
+                return EXIT_FAILURE;
+            }
+
+            std::vector<char> data(header.data_size);
+            std::fseek(in, header.header_size, SEEK_SET);
+            const bool read_ok = std::fread(data.data(), data.size(), 1, in) == 1;
+            std::fclose(in);
+            if (!read_ok) {
+                std::fprintf(stderr, "%s: truncated log data\n", in_path);
+                return EXIT_FAILURE;
+            }
+
+            FILE *out = stdout;
+            if (out_path != nullptr) {
+                out = std::fopen(out_path, "w");
+                if (out == nullptr) {
+                    std::perror(out_path);
+                    return EXIT_FAILURE;
+                }
+            }
+
+            if (header.write_position <= header.data_size) {
+                std::fwrite(data.data(), 1, header.write_position, out);
+            } else {
+                /* Wrapped, the oldest byte follows the newest one. Its line was partly overwritten, start after it. */
+                const size_t split = header.write_position % header.data_size;
+                std::vector<char> text(data.begin() + split, data.end());
+                text.insert(text.end(), data.begin(), data.begin() + split);
+
+                const auto line_end = std::find(text.begin(), text.end(), '\n');
+                const size_t start = line_end != text.end() ? (line_end - text.begin()) + 1 : 0;
+                std::fwrite(text.data() + start, 1, text.size() - start, out);
+            }
+
+            if (out_path != nullptr) {
+                std::fclose(out);
+            }
+
+            return EXIT_SUCCESS;
+        }
+
+    }
+
+}
+
+int main(int argc, char **argv) {
+    return ams::mitm::i2c::logfile::Main(argc, argv);
+}
@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fake_i2c_device.hpp"
+#include "host_log.hpp"
+#include "i2c_mitm_session.hpp"
+#include "i2c_mitm_settings.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/* Measures the per-call cost of the session services on the host, over command lists recorded from psm, the fuel gauge driver and pcv */
+namespace ams::mitm::i2c {
+
+    namespace {
+
+        constexpr ncm::ProgramId BenchProgramId = { 0x010000000000001A }; /* psm */
+
+        constexpr DeviceCode Bq24193DeviceCode      = 0x39000001;
+        constexpr DeviceCode Max17050DeviceCode     = 0x39000033;
+        constexpr DeviceCode Max77620PmicDeviceCode = 0x3A000001;
+
+        constexpr auto SendOption = static_cast<::ams::i2c::TransactionOption>(::ams::i2c::TransactionOption_StartCondition);
+        constexpr auto StopOption = static_cast<::ams::i2c::TransactionOption>(::ams::i2c::TransactionOption_StartCondition | ::ams::i2c::TransactionOption_StopCondition);
+
+        /* Regressions of more than this many percent in ns/op fail the comparison against the baseline */
+        constexpr double DefaultTolerance = 25.0;
+        constexpr s64 DefaultMinTimeMs = 100;
+        constexpr int Repetitions = 5;
+
+        enum Call {
+            Call_SendReceive,
+            Call_Send,
+            Call_CommandList,
+        };
+
+        struct Workload {
+            const char *name;
+            DeviceCode device_code;
+            bool register_file;
+            Call call;
+            std::vector<u8> data;
+            size_t receive_size;
+        };
+
+        /* Appends a Send of reg followed by values */
+        void AddWrite(std::vector<u8> &commands, u8 reg, std::initializer_list<u8> values, bool stop = true) {
+            commands.push_back(stop ? 0xC0 : 0x40);
+            commands.push_back(static_cast<u8>(values.size() + 1));
+            commands.push_back(reg);
+            commands.insert(commands.end(), values.begin(), values.end());
+        }
+
+        /* Appends a Send of reg followed by a Receive of count bytes */
+        void AddRead(std::vector<u8> &commands, u8 reg, u8 count) {
+            commands.insert(commands.end(), { 0x40, 0x01, reg, 0xC1, count });
+        }
+
+        void AddSleep(std::vector<u8> &commands, u8 us) {
+            commands.insert(commands.end(), { 0x02, us });
+        }
+
+        std::vector<Workload> MakeWorkloads() {
+            std::vector<Workload> workloads;
+
+            /* psm polls the charger status and fault registers */
+            workloads.push_back({ "bq24193_status_sr", Bq24193DeviceCode, false, Call_SendReceive, { 0x08 }, 1 });
+            workloads.push_back({ "bq24193_status_cmd", Bq24193DeviceCode, false, Call_CommandList, { 0x40, 0x01, 0x08, 0xC1, 0x01 }, 1 });
+
+            /* psm reprograms the charge voltage, hits the chrg_voltage rule */
+            workloads.push_back({ "bq24193_vreg_send", Bq24193DeviceCode, false, Call_Send, { 0x04, 0xB2 }, 0 });
+            workloads.push_back({ "bq24193_vreg_cmd", Bq24193DeviceCode, false, Call_CommandList, { 0xC0, 0x02, 0x04, 0xB2 }, 0 });
+
+            /* Fuel gauge word read (RepSOC) and a block read of the status registers */
+            workloads.push_back({ "max17050_soc_cmd", Max17050DeviceCode, true, Call_CommandList, { 0x40, 0x01, 0x06, 0xC1, 0x02 }, 2 });
+            workloads.push_back({ "max17050_block_cmd", Max17050DeviceCode, true, Call_CommandList, { 0x40, 0x01, 0x00, 0xC1, 0x20 }, 0x20 });
+
+            /* pcv ramping a PMIC regulator: write the voltage, wait, check the status */
+            {
+                std::vector<u8> commands;
+                AddWrite(commands, 0x23, { 0x40 });
+                AddSleep(commands, 0x64);
+                AddRead(commands, 0x05, 1);
+                workloads.push_back({ "max77620_ramp_cmd", Max77620PmicDeviceCode, true, Call_CommandList, std::move(commands), 1 });
+            }
+
+            /* pcv's largest lists configure a whole set of regulators at once */
+            {
+                std::vector<u8> commands;
+                size_t receive_size = 0;
+                for (u8 reg = 0x16; commands.size() < 0xE0; reg += 2) {
+                    AddWrite(commands, reg, { 0x00, 0x40, 0x7F });
+                    AddSleep(commands, 0x20);
+                    AddRead(commands, reg, 2);
+                    receive_size += 2;
+                }
+                workloads.push_back({ "max77620_config_cmd", Max77620PmicDeviceCode, true, Call_CommandList, std::move(commands), receive_size });
+            }
+
+            return workloads;
+        }
+
+        struct BenchResult {
+            std::string name;
+            double ns_per_op;
+            double bytes_per_op;
+        };
+
+        template<typename Session>
+        Result RunOnce(Session &session, const Workload &workload, u8 *rcv_data) {
+            switch (workload.call) {
+            case Call_SendReceive:
+                R_TRY(session.Send(sf::InAutoSelectBuffer(workload.data.data(), workload.data.size()), SendOption));
+                R_RETURN(session.Receive(sf::OutAutoSelectBuffer(rcv_data, workload.receive_size), StopOption));
+            case Call_Send:
+                R_RETURN(session.Send(sf::InAutoSelectBuffer(workload.data.data(), workload.data.size()), StopOption));
+            case Call_CommandList:
+            default:
+                R_RETURN(session.ExecuteCommandList(sf::OutAutoSelectBuffer(rcv_data, workload.receive_size),
+                                                    sf::InPointerArray<::ams::i2c::I2cCommand>(workload.data.data(), workload.data.size())));
+            }
+        }
+
+        template<typename Session>
+        TimeSpan TimeIterations(Session &session, const Workload &workload, u8 *rcv_data, u64 iterations) {
+            const os::Tick start = os::GetSystemTick();
+            for (u64 i = 0; i < iterations; i++) {
+                RunOnce(session, workload, rcv_data);
+            }
+            return (os::GetSystemTick() - start).ToTimeSpan();
+        }
+
+        /* Doubles the iteration count until a run takes at least min_time, then keeps the fastest of a few runs to filter out scheduler noise */
+        template<typename Session>
+        bool RunBench(const char *session_name, const Workload &workload, TimeSpan min_time, BenchResult *out) {
+            host::FakeI2cDevice device;
+            if (workload.register_file) {
+                host::InitializeRegisterFile(std::addressof(device));
+            } else {
+                host::InitializeBq24193(std::addressof(device));
+            }
+
+            Session session(std::addressof(device), workload.device_code, BenchProgramId);
+            std::vector<u8> rcv_data(workload.receive_size);
+
+            /* Warm up and make sure the workload is valid for the device */
+            const Result result = RunOnce(session, workload, rcv_data.data());
+            if (R_FAILED(result)) {
+                std::fprintf(stderr, "%s/%s failed: 0x%" PRIx32 "\n", workload.name, session_name, result.GetValue());
+                return false;
+            }
+
+            u64 iterations = 1;
+            TimeSpan best = TimeIterations(session, workload, rcv_data.data(), iterations);
+            while (best < min_time) {
+                iterations *= 2;
+                best = TimeIterations(session, workload, rcv_data.data(), iterations);
+            }
+
+            host::ResetCaptureSize();
+            for (int i = 0; i < Repetitions; i++) {
+                best = std::min(best, TimeIterations(session, workload, rcv_data.data(), iterations));
+            }
+
+            out->name         = std::string(workload.name) + "/" + session_name;
+            out->ns_per_op    = static_cast<double>(best.GetNanoSeconds()) / iterations;
+            out->bytes_per_op = static_cast<double>(host::GetCaptureSize()) / (iterations * Repetitions);
+            return true;
+        }
+
+        /* Baseline files hold one "<name> <ns/op> <bytes/op>" line per benchmark, # starts a comment */
+        bool ReadBaseline(const char *path, std::vector<BenchResult> &out) {
+            std::FILE *file = std::fopen(path, "r");
+            if (file == nullptr) {
+                return false;
+            }
+            ON_SCOPE_EXIT { std::fclose(file); };
+
+            char line[0x100];
+            while (std::fgets(line, sizeof(line), file) != nullptr) {
+                char name[0x80];
+                double ns_per_op, bytes_per_op;
+                if (line[0] == '#' || std::sscanf(line, "%127s %lf %lf", name, std::addressof(ns_per_op), std::addressof(bytes_per_op)) != 3) {
+                    continue;
+                }
+                out.push_back({ name, ns_per_op, bytes_per_op });
+            }
+
+            return true;
+        }
+
+        bool WriteBaseline(const char *path, const std::vector<BenchResult> &results) {
+            std::FILE *file = std::fopen(path, "w");
+            if (file == nullptr) {
+                return false;
+            }
+            ON_SCOPE_EXIT { std::fclose(file); };
+
+            std::fprintf(file, "# i2c_session_bench baseline: <workload>/<session type> <ns/op> <capture bytes/op>\n");
+            for (const auto &result : results) {
+                std::fprintf(file, "%s %.1f %.1f\n", result.name.c_str(), result.ns_per_op, result.bytes_per_op);
+            }
+            return true;
+        }
+
+        const BenchResult *FindResult(const std::vector<BenchResult> &results, const std::string &name) {
+            for (const auto &result : results) {
+                if (result.name == name) {
+                    return std::addressof(result);
+                }
+            }
+            return nullptr;
+        }
+
+        /* Slower by more than tolerance percent, or more bytes logged per call, counts as a regression */
+        bool PrintResults(const std::vector<BenchResult> &results, const std::vector<BenchResult> *baseline, double tolerance) {
+            bool regressed = false;
+
+            std::printf("%-36s %12s %12s", "benchmark", "ns/op", "bytes/op");
+            if (baseline != nullptr) {
+                std::printf(" %12s", "vs baseline");
+            }
+            std::printf("\n");
+
+            for (const auto &result : results) {
+                std::printf("%-36s %12.1f %12.1f", result.name.c_str(), result.ns_per_op, result.bytes_per_op);
+
+                if (baseline != nullptr) {
+                    const BenchResult *base = FindResult(*baseline, result.name);
+                    if (base == nullptr) {
+                        std::printf(" %12s", "new");
+                    } else {
+                        const double delta = (result.ns_per_op / base->ns_per_op - 1.0) * 100.0;
+                        const bool slower = delta > tolerance;
+                        const bool bigger = result.bytes_per_op > base->bytes_per_op;
+                        std::printf(" %+11.1f%%%s%s", delta, slower ? " SLOWER" : "", bigger ? " BIGGER" : "");
+                        regressed |= slower || bigger;
+                    }
+                }
+
+                std::printf("\n");
+            }
+
+            return !regressed;
+        }
+
+        int Usage(const char *name) {
+            std::fprintf(stderr, "usage: %s [-s <sd root>] [-f <filter>] [-t <ms>] [-b <baseline>] [-r <percent>] [-w <baseline>]\n", name);
+            std::fprintf(stderr, "  Runs the session services over recorded command lists against simulated devices, with capture logging enabled.\n");
+            std::fprintf(stderr, "  -s  directory standing in for the SD card root, the config is read from config/i2c_mitm/i2c_mitm.ini\n");
+            std::fprintf(stderr, "  -f  only run benchmarks whose name contains the filter\n");
+            std::fprintf(stderr, "  -t  minimum run time per benchmark in ms (default %" PRId64 ")\n", DefaultMinTimeMs);
+            std::fprintf(stderr, "  -b  compare against a baseline file, exits with an error on regressions\n");
+            std::fprintf(stderr, "  -r  allowed ns/op regression in percent (default %.0f)\n", DefaultTolerance);
+            std::fprintf(stderr, "  -w  write the results as a new baseline file\n");
+            return EXIT_FAILURE;
+        }
+
+        int Main(int argc, char **argv) {
+            const char *filter = "";
+            const char *baseline_path = nullptr;
+            const char *output_path = nullptr;
+            s64 min_time_ms = DefaultMinTimeMs;
+            double tolerance = DefaultTolerance;
+
+            for (int i = 1; i < argc; i++) {
+                if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+                    fs::SetSdCardRoot(argv[++i]);
+                } else if (std::strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+                    filter = argv[++i];
+                } else if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+                    min_time_ms = std::strtoll(argv[++i], nullptr, 0);
+                } else if (std::strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+                    baseline_path = argv[++i];
+                } else if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+                    tolerance = std::strtod(argv[++i], nullptr);
+                } else if (std::strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+                    output_path = argv[++i];
+                } else {
+                    return Usage(argv[0]);
+                }
+            }
+
+            std::vector<BenchResult> baseline;
+            if (baseline_path != nullptr && !ReadBaseline(baseline_path, baseline)) {
+                std::perror(baseline_path);
+                return EXIT_FAILURE;
+            }
+
+            if (R_FAILED(InitializeConfig())) {
+                std::fprintf(stderr, "failed to parse config, continuing with what was parsed\n");
+            }
+
+            /* Records are formatted and written like on the console, only the output is thrown away */
+            if (!host::OpenCaptureFile("/dev/null")) {
+                std::perror("/dev/null");
+                return EXIT_FAILURE;
+            }
+            ON_SCOPE_EXIT { host::CloseCaptureFile(); };
+
+            const TimeSpan min_time = TimeSpan::FromMilliSeconds(min_time_ms);
+            std::vector<BenchResult> results;
+            for (const auto &workload : MakeWorkloads()) {
+                const auto run = [&]<typename Session>(const char *session_name) {
+                    if ((std::string(workload.name) + "/" + session_name).find(filter) == std::string::npos) {
+                        return true;
+                    }
+
+                    BenchResult result;
+                    if (!RunBench<Session>(session_name, workload, min_time, std::addressof(result))) {
+                        return false;
+                    }
+                    results.push_back(std::move(result));
+                    return true;
+                };
+
+                if (!run.template operator()<MonitorI2cSessionService>("monitor") ||
+                    !run.template operator()<RuleI2cSessionService>("rule") ||
+                    !run.template operator()<CachingI2cSessionService>("caching")) {
+                    return EXIT_FAILURE;
+                }
+            }
+
+            const bool ok = PrintResults(results, baseline_path != nullptr ? std::addressof(baseline) : nullptr, tolerance);
+
+            if (output_path != nullptr && !WriteBaseline(output_path, results)) {
+                std::perror(output_path);
+                return EXIT_FAILURE;
+            }
+
+            return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+    }
+
+}
+
+int main(int argc, char **argv) {
+    return ams::mitm::i2c::Main(argc, argv);
+}
@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fake_i2c_device.hpp"
+#include "host_log.hpp"
+#include "i2c_mitm_session.hpp"
+#include "i2c_command_list.hpp"
+#include "i2c_mitm_settings.hpp"
+#include "i2c_mitm_stats.hpp"
+#include "i2c_mitm_telemetry.hpp"
+#include "i2c_mitm_devices.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+/* Runs the mitm session services on the host against a simulated device, for regression testing without a console */
+namespace ams::mitm::i2c {
+
+    namespace {
+
+        constexpr DeviceCode Bq24193DeviceCode = 0x39000001;
+        constexpr ncm::ProgramId SimProgramId  = { 0x010000000000001A }; /* psm */
+
+        constexpr auto SendOption = static_cast<::ams::i2c::TransactionOption>(::ams::i2c::TransactionOption_StartCondition);
+        constexpr auto StopOption = static_cast<::ams::i2c::TransactionOption>(::ams::i2c::TransactionOption_StartCondition | ::ams::i2c::TransactionOption_StopCondition);
+
+        enum SessionType {
+            SessionType_Monitor,
+            SessionType_Rule,
+            SessionType_Caching,
+            SessionType_Telemetry,
+            SessionType_Auto,
+        };
+
+        struct Options {
+            SessionType session_type;
+            DeviceCode device_code;
+            bool use_old_command;
+        };
+
+        /* Splits "op:a:b:..." into its numeric arguments, returns false on malformed numbers */
+        bool ParseArguments(const char *str, std::vector<u32> &out) {
+            out.clear();
+
+            const char *cur = std::strchr(str, ':');
+            while (cur != nullptr) {
+                char *end;
+                const unsigned long value = std::strtoul(cur + 1, std::addressof(end), 0);
+                if (end == cur + 1 || (*end != ':' && *end != '\0')) {
+                    return false;
+                }
+                out.push_back(static_cast<u32>(value));
+                cur = *end == ':' ? end : nullptr;
+            }
+
+            return true;
+        }
+
+        void PrintResult(const char *command, Result result, const u8 *data, size_t size) {
+            std::printf("%-24s -> ", command);
+            if (R_FAILED(result)) {
+                std::printf("error 0x%" PRIx32 " (%" PRIu32 "-%04" PRIu32 ")\n", result.GetValue(), 2000 + result.GetModule(), result.GetDescription());
+                return;
+            }
+
+            std::printf("ok");
+            for (size_t i = 0; i < size; i++) {
+                std::printf(" %02" PRIx8, data[i]);
+            }
+            std::printf("\n");
+        }
+
+        void PrintRegisters(host::FakeI2cDevice &device) {
+            std::printf("registers:");
+            for (size_t reg = 0; reg <= 0x0A; reg++) {
+                std::printf(" %02zx=%02" PRIx8, reg, device.GetRegister(static_cast<u8>(reg)));
+            }
+            std::printf("\n");
+        }
+
+        void PrintCounters(host::FakeI2cDevice &device) {
+            const auto counters = device.GetBusCounters();
+            std::printf("bus: %" PRIu64 " sends, %" PRIu64 " receives, %" PRIu64 " command lists, %" PRIu64 " bytes written, %" PRIu64 " bytes read, %" PRIu64 " nacks\n",
+                        counters.sends, counters.receives, counters.command_lists, counters.bytes_written, counters.bytes_read, counters.nacks);
+
+            stats::DeviceLatencyStats latency[stats::MaxDevices];
+            const size_t count = stats::GetLatencyStats(latency, std::size(latency));
+            for (size_t i = 0; i < count; i++) {
+                std::printf("forwarded by dev 0x%08" PRIx32 ": %" PRIu64 " sends, %" PRIu64 " receives, %" PRIu64 " command lists, %" PRIu64 " retry policies\n",
+                            latency[i].device_code,
+                            latency[i].commands[stats::Command_Send].count,
+                            latency[i].commands[stats::Command_Receive].count,
+                            latency[i].commands[stats::Command_ExecuteCommandList].count,
+                            latency[i].commands[stats::Command_SetRetryPolicy].count);
+            }
+        }
+
+        void PrintTelemetry() {
+            std::printf("%s", telemetry::CsvHeader);
+
+            telemetry::RailBucket buckets[telemetry::NumBuckets];
+            for (size_t rail = 0; rail < telemetry::MaxRails; rail++) {
+                const size_t count = telemetry::GetRailSamples(rail, buckets, std::size(buckets));
+                for (size_t i = 0; i < count; i++) {
+                    char line[telemetry::MaxCsvLineLength];
+                    telemetry::FormatCsvLine(line, sizeof(line), buckets[i]);
+                    std::printf("%s", line);
+                }
+            }
+        }
+
+        template<typename Session>
+        Result DoSend(Session &session, const u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+            if (use_old_command) {
+                R_RETURN(session.SendOld(sf::InBuffer(data, size), option));
+            } else {
+                R_RETURN(session.Send(sf::InAutoSelectBuffer(data, size), option));
+            }
+        }
+
+        template<typename Session>
+        Result DoReceive(Session &session, u8 *data, size_t size, ::ams::i2c::TransactionOption option, bool use_old_command) {
+            if (use_old_command) {
+                R_RETURN(session.ReceiveOld(sf::OutBuffer(data, size), option));
+            } else {
+                R_RETURN(session.Receive(sf::OutAutoSelectBuffer(data, size), option));
+            }
+        }
+
+        template<typename Session>
+        Result DoCommandList(Session &session, u8 *rcv_data, size_t rcv_size, const std::vector<u8> &commands, bool use_old_command) {
+            const sf::InPointerArray<::ams::i2c::I2cCommand> command_list(commands.data(), commands.size());
+            if (use_old_command) {
+                R_RETURN(session.ExecuteCommandListOld(sf::OutBuffer(rcv_data, rcv_size), command_list));
+            } else {
+                R_RETURN(session.ExecuteCommandList(sf::OutAutoSelectBuffer(rcv_data, rcv_size), command_list));
+            }
+        }
+
+        template<typename Session>
+        bool RunCommand(Session &session, host::FakeI2cDevice &device, const Options &options, const char *command) {
+            std::vector<u32> args;
+            if (!ParseArguments(command, args)) {
+                return false;
+            }
+
+            const std::string_view op(command, std::strcspn(command, ":"));
+            const bool old = options.use_old_command;
+
+            std::vector<u8> data;
+            for (const u32 arg : args) {
+                data.push_back(static_cast<u8>(arg));
+            }
+
+            if (op == "write" && args.size() >= 2) {
+                PrintResult(command, DoSend(session, data.data(), data.size(), StopOption, old), nullptr, 0);
+            } else if (op == "read" && args.size() == 2) {
+                std::vector<u8> values(args[1]);
+                Result result = DoSend(session, data.data(), 1, SendOption, old);
+                if (R_SUCCEEDED(result)) {
+                    result = DoReceive(session, values.data(), values.size(), StopOption, old);
+                }
+                PrintResult(command, result, values.data(), values.size());
+            } else if (op == "cmdwrite" && args.size() >= 2) {
+                std::vector<u8> commands = { 0xC0, static_cast<u8>(data.size()) };
+                commands.insert(commands.end(), data.begin(), data.end());
+                PrintResult(command, DoCommandList(session, nullptr, 0, commands, old), nullptr, 0);
+            } else if (op == "cmdread" && args.size() == 2) {
+                std::vector<u8> values(args[1]);
+                const std::vector<u8> commands = { 0x40, 0x01, data[0], 0xC1, static_cast<u8>(values.size()) };
+                PrintResult(command, DoCommandList(session, values.data(), values.size(), commands, old), values.data(), values.size());
+            } else if (op == "cmdlist" && !args.empty()) {
+                /* Size the receive buffer for the list's receives, malformed lists get none and are left to the session to reject */
+                size_t rcv_size = 0;
+                cmdlist::ForEachCommand(data.data(), data.size(), std::numeric_limits<size_t>::max(), [&](const cmdlist::Command &cmd) {
+                    if (cmd.kind == cmdlist::CommandKind_Receive) {
+                        rcv_size += cmd.size;
+                    }
+                });
+                std::vector<u8> values(rcv_size);
+                PrintResult(command, DoCommandList(session, values.data(), values.size(), data, old), values.data(), values.size());
+            } else if (op == "retry" && args.size() == 2) {
+                PrintResult(command, session.SetRetryPolicy(static_cast<s32>(args[0]), static_cast<s32>(args[1])), nullptr, 0);
+            } else if (op == "poke" && args.size() == 2) {
+                device.SetRegister(data[0], data[1]);
+            } else if (op == "reload" && args.empty()) {
+                PrintResult(command, ReloadConfig(), nullptr, 0);
+            } else if (op == "regs" && args.empty()) {
+                PrintRegisters(device);
+            } else if (op == "telemetry" && args.empty()) {
+                PrintTelemetry();
+            } else if (op == "sleep" && args.size() == 1) {
+                os::SleepThread(TimeSpan::FromMilliSeconds(args[0]));
+            } else {
+                return false;
+            }
+
+            return true;
+        }
+
+        template<typename Session>
+        int RunSession(host::FakeI2cDevice &device, const Options &options, char **commands, int num_commands) {
+            Session session(std::addressof(device), options.device_code, SimProgramId);
+
+            for (int i = 0; i < num_commands; i++) {
+                if (!RunCommand(session, device, options, commands[i])) {
+                    std::fprintf(stderr, "invalid command: %s\n", commands[i]);
+                    return EXIT_FAILURE;
+                }
+            }
+
+            return EXIT_SUCCESS;
+        }
+
+        bool ParseSessionType(const char *name, SessionType &out) {
+            constexpr struct {
+                const char *name;
+                SessionType type;
+            } SessionTypes[] = {
+                { "monitor",     SessionType_Monitor     },
+                { "rule",        SessionType_Rule        },
+                { "caching",     SessionType_Caching     },
+                { "telemetry",   SessionType_Telemetry   },
+                { "auto",        SessionType_Auto        },
+            };
+
+            for (const auto &type : SessionTypes) {
+                if (std::strcmp(name, type.name) == 0) {
+                    out = type.type;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        int Usage(const char *name) {
+            std::fprintf(stderr, "usage: %s [-s <sd root>] [-d <device>] [-t <session type>] [-c <out.cap>] [-o] [-v] <command>...\n", name);
+            std::fprintf(stderr, "  Opens one mitm session for a simulated device and runs the commands on it.\n");
+            std::fprintf(stderr, "  -s  directory standing in for the SD card root, the config is read from config/i2c_mitm/i2c_mitm.ini\n");
+            std::fprintf(stderr, "  -d  device code or name, default Bq24193. Devices other than the bq24193 are a plain register file.\n");
+            std::fprintf(stderr, "  -t  monitor, rule, caching, telemetry or auto (default, picks the type the mitm would)\n");
+            std::fprintf(stderr, "  -c  write the session's transactions to a capture file\n");
+            std::fprintf(stderr, "  -o  use the pre 6.0.0 commands\n");
+            std::fprintf(stderr, "  -v  print debug log messages to stderr\n");
+            std::fprintf(stderr, "commands:\n");
+            std::fprintf(stderr, "  write:<reg>:<value>[:<value>...]  register write as a Send\n");
+            std::fprintf(stderr, "  read:<reg>:<count>                register read as Send + Receive\n");
+            std::fprintf(stderr, "  cmdwrite:<reg>:<value>[...]       register write as a command list\n");
+            std::fprintf(stderr, "  cmdread:<reg>:<count>             register read as a command list\n");
+            std::fprintf(stderr, "  cmdlist:<byte>[:<byte>...]        raw command list\n");
+            std::fprintf(stderr, "  retry:<count>:<interval us>       SetRetryPolicy\n");
+            std::fprintf(stderr, "  poke:<reg>:<value>                change a register behind the mitm's back\n");
+            std::fprintf(stderr, "  sleep:<ms>, reload, regs\n");
+            std::fprintf(stderr, "  telemetry                         print the power rail telemetry as CSV\n");
+            return EXIT_FAILURE;
+        }
+
+        int Main(int argc, char **argv) {
+            Options options = { SessionType_Auto, Bq24193DeviceCode, false };
+            const char *capture_path = nullptr;
+
+            int i = 1;
+            for (; i < argc && argv[i][0] == '-'; i++) {
+                if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+                    fs::SetSdCardRoot(argv[++i]);
+                } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+                    char *end;
+                    u32 device_code;
+                    if (R_FAILED(ParseDeviceCode(argv[++i], std::addressof(end), device_code)) || *end != '\0') {
+                        return Usage(argv[0]);
+                    }
+                    options.device_code = device_code;
+                } else if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+                    if (!ParseSessionType(argv[++i], options.session_type)) {
+                        return Usage(argv[0]);
+                    }
+                } else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+                    capture_path = argv[++i];
+                } else if (std::strcmp(argv[i], "-o") == 0) {
+                    options.use_old_command = true;
+                } else if (std::strcmp(argv[i], "-v") == 0) {
+                    host::SetDebugLogOutput(stderr);
+                } else {
+                    return Usage(argv[0]);
+                }
+            }
+
+            if (capture_path != nullptr && !host::OpenCaptureFile(capture_path)) {
+                std::perror(capture_path);
+                return EXIT_FAILURE;
+            }
+            ON_SCOPE_EXIT { host::CloseCaptureFile(); };
+
+            if (R_FAILED(InitializeConfig())) {
+                std::fprintf(stderr, "failed to parse config, continuing with what was parsed\n");
+            }
+            LogConfig();
+
+            if (options.session_type == SessionType_Auto) {
+                const ScopedConfig config;
+                if (cache::GetDeviceCacheConfig(config.GetCache(), options.device_code) != nullptr) {
+                    options.session_type = SessionType_Caching;
+                } else if (telemetry::IsRailSelected(config.GetTelemetry(), options.device_code) || charge::IsObservedDevice(config.GetChargePolicy(), options.device_code)) {
+                    options.session_type = SessionType_Telemetry;
+                } else if (rules::GetDeviceRules(config.GetRules(), options.device_code) != nullptr ||
+                           (charge::IsEnabled(config.GetChargePolicy()) && charge::IsChargerDevice(options.device_code)) ||
+                           config.GetConfig().coalesce_reads) {
+                    options.session_type = SessionType_Rule;
+                } else {
+                    options.session_type = SessionType_Monitor;
+                }
+            }
+
+            host::FakeI2cDevice device;
+            if (options.device_code == Bq24193DeviceCode) {
+                host::InitializeBq24193(std::addressof(device));
+            } else {
+                host::InitializeRegisterFile(std::addressof(device));
+            }
+
+            int rc;
+            switch (options.session_type) {
+            case SessionType_Monitor:
+                rc = RunSession<MonitorI2cSessionService>(device, options, argv + i, argc - i);
+                break;
+            case SessionType_Rule:
+                rc = RunSession<RuleI2cSessionService>(device, options, argv + i, argc - i);
+                break;
+            case SessionType_Telemetry:
+                rc = RunSession<TelemetryI2cSessionService>(device, options, argv + i, argc - i);
+                break;
+            case SessionType_Caching:
+            default:
+                rc = RunSession<CachingI2cSessionService>(device, options, argv + i, argc - i);
+                break;
+            }
+
+            PrintRegisters(device);
+            PrintCounters(device);
+            return rc;
+        }
+
+    }
+
+}
+
+int main(int argc, char **argv) {
+    return ams::mitm::i2c::Main(argc, argv);
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2024 ndeadly
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fake_i2c_device.hpp"
+#include "host_log.hpp"
+#include "i2c_mitm_session.hpp"
+#include "i2c_mitm_settings.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+/* Checks the session services against the simulated devices, with the config in test/sdroot */
+namespace ams::mitm::i2c {
+
+    namespace {
+
+        constexpr ncm::ProgramId TestProgramId = { 0x010000000000001A }; /* psm */
+
+        constexpr DeviceCode Bq24193DeviceCode      = 0x39000001;
+        constexpr DeviceCode Max17050DeviceCode     = 0x39000033;
+        constexpr DeviceCode Max77620PmicDeviceCode = 0x3A000001;
+        constexpr DeviceCode Ina226DeviceCode       = 0x3F000001;
+
+        constexpr auto SendOption = static_cast<::ams::i2c::TransactionOption>(::ams::i2c::TransactionOption_StartCondition);
+        constexpr auto StopOption = static_cast<::ams::i2c::TransactionOption>(::ams::i2c::TransactionOption_StartCondition | ::ams::i2c::TransactionOption_StopCondition);
+
+        /* REG04 for chrg_voltage=4112 in the test config */
+        constexpr u8 TestVoltageConfig = 0x9A;
+
+        int g_num_failures;
+
+        bool Check(bool passed, const char *expression, int line) {
+            if (!passed) {
+                std::printf("  line %d: %s\n", line, expression);
+                g_num_failures++;
+            }
+            return passed;
+        }
+
+        #define TEST_CHECK(expr) Check((expr), #expr, __LINE__)
+
+        template<typename Session>
+        Result Write(Session &session, std::initializer_list<u8> data) {
+            const std::vector<u8> buf(data);
+            R_RETURN(session.Send(sf::InAutoSelectBuffer(buf.data(), buf.size()), StopOption));
+        }
+
+        template<typename Session>
+        Result Read(Session &session, u8 reg, u8 *out, size_t count) {
+            R_TRY(session.Send(sf::InAutoSelectBuffer(std::addressof(reg), sizeof(reg)), SendOption));
+            R_RETURN(session.Receive(sf::OutAutoSelectBuffer(out, count), StopOption));
+        }
+
+        template<typename Session>
+        Result ExecuteCommandList(Session &session, u8 *rcv_data, size_t rcv_size, std::initializer_list<u8> commands) {
+            const std::vector<u8> list(commands);
+            R_RETURN(session.ExecuteCommandList(sf::OutAutoSelectBuffer(rcv_data, rcv_size), sf::InPointerArray<::ams::i2c::I2cCommand>(list.data(), list.size())));
+        }
+
+        /* Zero when nothing reached the device, the sends and receives of a command list count too */
+        u64 GetBusTransactions(host::FakeI2cDevice &device) {
+            const auto counters = device.GetBusCounters();
+            return counters.sends + counters.receives + counters.command_lists;
+        }
+
+        /* chrg_voltage turns into an on_open write of REG04 and rewrites charge voltages above it */
+        void TestChargeVoltageOverride() {
+            host::FakeI2cDevice device;
+            host::InitializeBq24193(std::addressof(device));
+            const u8 default_config = device.GetRegister(0x04);
+
+            RuleI2cSessionService session(std::addressof(device), Bq24193DeviceCode, TestProgramId);
+            TEST_CHECK(device.GetRegister(0x04) == TestVoltageConfig);
+
+            /* psm restoring the default is rewritten */
+            TEST_CHECK(R_SUCCEEDED(Write(session, {0x04, default_config})));
+            TEST_CHECK(device.GetRegister(0x04) == TestVoltageConfig);
+
+            /* Voltages below the override and the other bits of the register go through */
+            TEST_CHECK(R_SUCCEEDED(Write(session, {0x04, 0x12})));
+            TEST_CHECK(device.GetRegister(0x04) == 0x12);
+            TEST_CHECK(R_SUCCEEDED(Write(session, {0x03, 0x21})));
+            TEST_CHECK(device.GetRegister(0x03) == 0x21);
+
+            /* Only the first session of the device does the on_open write */
+            device.SetRegister(0x04, default_config);
+            RuleI2cSessionService second(std::addressof(device), Bq24193DeviceCode, TestProgramId);
+            TEST_CHECK(device.GetRegister(0x04) == default_config);
+        }
+
+        void TestRuleRewriteAndDrop() {
+            host::FakeI2cDevice device;
+            host::InitializeRegisterFile(std::addressof(device));
+            RuleI2cSessionService session(std::addressof(device), Max77620PmicDeviceCode, TestProgramId);
+
+            TEST_CHECK(R_SUCCEEDED(Write(session, {0x20, 0x90})));
+            TEST_CHECK(device.GetRegister(0x20) == 0x40);
+            TEST_CHECK(R_SUCCEEDED(Write(session, {0x20, 0x10})));
+            TEST_CHECK(device.GetRegister(0x20) == 0x10);
+
+            /* The rule applies to the register's byte of a burst */
+            TEST_CHECK(R_SUCCEEDED(Write(session, {0x1F, 0x07, 0xA0})));
+            TEST_CHECK(device.GetRegister(0x1F) == 0x07);
+            TEST_CHECK(device.GetRegister(0x20) == 0x40);
+
+            /* A long burst still has the rule applied to the register's byte */
+            std::vector<u8> burst(0x41, 0x90);
+            burst[0] = 0x00;
+            TEST_CHECK(R_SUCCEEDED(session.Send(sf::InAutoSelectBuffer(burst.data(), burst.size()), StopOption)));
+            TEST_CHECK(device.GetRegister(0x1F) == 0x90);
+            TEST_CHECK(device.GetRegister(0x20) == 0x40);
+
+            /* One that wraps around the register space fails without reaching the device */
+            burst.resize(0x102, 0x90);
+            device.ResetBusCounters();
+            TEST_CHECK(R_FAILED(session.Send(sf::InAutoSelectBuffer(burst.data(), burst.size()), StopOption)));
+            TEST_CHECK(GetBusTransactions(device) == 0);
+
+            /* A rule on a field, without a max */
+            TEST_CHECK(R_SUCCEEDED(Write(session, {0x22, 0xF5})));
+            TEST_CHECK(device.GetRegister(0x22) == 0x05);
+            TEST_CHECK(R_SUCCEEDED(Write(session, {0x22, 0x75})));
+            TEST_CHECK(device.GetRegister(0x22) == 0x75);
+
+            /* A dropped write succeeds for the client without reaching the device */
+            device.SetRegister(0x21, 0x55);
+            device.ResetBusCounters();
+            TEST_CHECK(R_SUCCEEDED(Write(session, {0x21, 0x00})));
+            TEST_CHECK(device.GetRegister(0x21) == 0x55);
+            TEST_CHECK(GetBusTransactions(device) == 0);
+            TEST_CHECK(R_SUCCEEDED(Write(session, {0x21, 0x01})));
+            TEST_CHECK(device.GetRegister(0x21) == 0x01);
+        }
+
+        void TestCommandListRules() {
+            host::FakeI2cDevice device;
+            host::InitializeRegisterFile(std::addressof(device));
+            RuleI2cSessionService session(std::addressof(device), Max77620PmicDeviceCode, TestProgramId);
+
+            TEST_CHECK(R_SUCCEEDED(ExecuteCommandList(session, nullptr, 0, {0xC0, 0x02, 0x20, 0x90})));
+            TEST_CHECK(device.GetRegister(0x20) == 0x40);
+
+            /* The dropped write is cut out of the list, the read after it still happens */
+            u8 value = 0;
+            device.SetRegister(0x21, 0x55);
+            device.ResetBusCounters();
+            TEST_CHECK(R_SUCCEEDED(ExecuteCommandList(session, std::addressof(value), sizeof(value), {0xC0, 0x02, 0x21, 0x00, 0x40, 0x01, 0x20, 0xC1, 0x01})));
+            TEST_CHECK(value == 0x40);
+            TEST_CHECK(device.GetRegister(0x21) == 0x55);
+            TEST_CHECK(device.GetBusCounters().command_lists == 1);
+
+            /* A list of nothing but a dropped write is not sent at all */
+            device.ResetBusCounters();
+            TEST_CHECK(R_SUCCEEDED(ExecuteCommandList(session, nullptr, 0, {0xC0, 0x02, 0x21, 0x00})));
+            TEST_CHECK(GetBusTransactions(device) == 0);
+        }
+
+        void TestCacheHitAndInvalidate() {
+            host::FakeI2cDevice device;
+            host::InitializeRegisterFile(std::addressof(device));
+            device.SetRegister(0x05, 0x11);
+            CachingI2cSessionService session(std::addressof(device), Max17050DeviceCode, TestProgramId);
+
+            u8 value = 0;
+            TEST_CHECK(R_SUCCEEDED(Read(session, 0x05, std::addressof(value), sizeof(value))));
+            TEST_CHECK(value == 0x11);
+
+            /* Served from the cache, a change behind the mitm's back is not seen */
+            device.SetRegister(0x05, 0x22);
+            device.ResetBusCounters();
+            TEST_CHECK(R_SUCCEEDED(Read(session, 0x05, std::addressof(value), sizeof(value))));
+            TEST_CHECK(value == 0x11);
+            TEST_CHECK(R_SUCCEEDED(ExecuteCommandList(session, std::addressof(value), sizeof(value), {0x40, 0x01, 0x05, 0xC1, 0x01})));
+            TEST_CHECK(value == 0x11);
+            TEST_CHECK(GetBusTransactions(device) == 0);
+
+            /* A write through the session invalidates the register */
+            TEST_CHECK(R_SUCCEEDED(Write(session, {0x05, 0x33})));
+            device.ResetBusCounters();
+            TEST_CHECK(R_SUCCEEDED(Read(session, 0x05, std::addressof(value), sizeof(value))));
+            TEST_CHECK(value == 0x33);
+            TEST_CHECK(device.GetBusCounters().command_lists == 1);
+
+            /* So does one in a command list */
+            TEST_CHECK(R_SUCCEEDED(ExecuteCommandList(session, nullptr, 0, {0xC0, 0x02, 0x05, 0x44})));
+            TEST_CHECK(R_SUCCEEDED(Read(session, 0x05, std::addressof(value), sizeof(value))));
+            TEST_CHECK(value == 0x44);
+        }
+
+        void TestCoalescedSendReceive() {
+            host::FakeI2cDevice device;
+            host::InitializeRegisterFile(std::addressof(device));
+            device.SetRegister(0x02, 0x12);
+            device.SetRegister(0x03, 0x34);
+            RuleI2cSessionService session(std::addressof(device), Ina226DeviceCode, TestProgramId);
+
+            /* The register select and the read go out as one command list, and only in it */
+            u8 values[2] = {};
+            TEST_CHECK(R_SUCCEEDED(Read(session, 0x02, values, sizeof(values))));
+            TEST_CHECK(values[0] == 0x12 && values[1] == 0x34);
+            const auto counters = device.GetBusCounters();
+            TEST_CHECK(counters.command_lists == 1 && counters.sends == 1 && counters.receives == 1);
+
+            /* A select followed by a write is sent on its own */
+            device.ResetBusCounters();
+            const u8 reg = 0x02;
+            TEST_CHECK(R_SUCCEEDED(session.Send(sf::InAutoSelectBuffer(std::addressof(reg), sizeof(reg)), SendOption)));
+            TEST_CHECK(R_SUCCEEDED(Write(session, {0x03, 0x56})));
+            TEST_CHECK(device.GetRegister(0x03) == 0x56);
+            TEST_CHECK(device.GetBusCounters().sends == 2);
+        }
+
+        int Usage(const char *name) {
+            std::fprintf(stderr, "usage: %s [-s <sd root>] [-v]\n", name);
+            std::fprintf(stderr, "  Runs the session tests, the config is read from <sd root>/config/i2c_mitm/i2c_mitm.ini\n");
+            return EXIT_FAILURE;
+        }
+
+        int Main(int argc, char **argv) {
+            for (int i = 1; i < argc; i++) {
+                if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+                    fs::SetSdCardRoot(argv[++i]);
+                } else if (std::strcmp(argv[i], "-v") == 0) {
+                    host::SetDebugLogOutput(stderr);
+                } else {
+                    return Usage(argv[0]);
+                }
+            }
+
+            if (R_FAILED(InitializeConfig())) {
+                std::fprintf(stderr, "failed to parse config\n");
+                return EXIT_FAILURE;
+            }
+
+            constexpr struct {
+                const char *name;
+                void (*func)();
+            } Tests[] = {
+                { "charge_voltage_override",  TestChargeVoltageOverride },
+                { "rule_rewrite_and_drop",    TestRuleRewriteAndDrop    },
+                { "command_list_rules",       TestCommandListRules      },
+                { "cache_hit_and_invalidate", TestCacheHitAndInvalidate },
+                { "coalesced_send_receive",   TestCoalescedSendReceive  },
+            };
+
+            int num_failed = 0;
+            for (const auto &test : Tests) {
+                const int failures = g_num_failures;
+                test.func();
+                const bool passed = g_num_failures == failures;
+                std::printf("%-4s %s\n", passed ? "ok" : "FAIL", test.name);
+                num_failed += passed ? 0 : 1;
+            }
+
+            std::printf("%zu tests, %d failed\n", std::size(Tests), num_failed);
+            return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+    }
+
+}
+
+int main(int argc, char **argv) {
+    return ams::mitm::i2c::Main(argc, argv);
+}